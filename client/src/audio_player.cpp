@@ -1,10 +1,12 @@
 #include "audio_player.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <iostream>
 
 AudioPlayer::AudioPlayer()
-    : playing(false), shouldStop(false), currentPosition(0), syncTimestamp(0) {}
+    : header(), baseOffset(0), playing(false), shouldStop(false),
+      currentPosition(0), syncTimestamp(0) {}
 
 AudioPlayer::~AudioPlayer() {
   stop();
@@ -186,8 +188,13 @@ bool AudioPlayer::setupAudioUnit() {
   return true;
 }
 
-bool AudioPlayer::initialize(const WavHeader &wavHeader) {
+unsigned int AudioPlayer::bytesPerFrame() const {
+  return header.numChannels * (header.bitsPerSample / 8);
+}
+
+bool AudioPlayer::initialize(const WavHeader &wavHeader, uint64_t startFrame) {
   header = wavHeader;
+  baseOffset = startFrame * bytesPerFrame();
   currentPosition.store(0);
 
   // Print audio details
@@ -199,14 +206,15 @@ bool AudioPlayer::initialize(const WavHeader &wavHeader) {
   return setupAudioUnit();
 }
 
-void AudioPlayer::addAudioData(const std::vector<char> &data) {
+void AudioPlayer::addAudioData(const char *data, size_t size) {
   // Append the new data to our audio buffer
-  audioData.insert(audioData.end(), data.begin(), data.end());
+  audioData.insert(audioData.end(), data, data + size);
 }
 
-void AudioPlayer::clearAudioData() {
+void AudioPlayer::clearAudioData(uint64_t startFrame) {
   stop();
   audioData.clear();
+  baseOffset = startFrame * bytesPerFrame();
   currentPosition.store(0);
 }
 
@@ -255,44 +263,70 @@ bool AudioPlayer::seekToPosition(double seconds) {
     return false;
   }
 
-  // Calculate position in bytes
-  int bytesPerSecond =
-      header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-  unsigned int position = static_cast<unsigned int>(seconds * bytesPerSecond);
-
-  // Align to frame boundary
-  int bytesPerFrame = header.numChannels * (header.bitsPerSample / 8);
-  position = (position / bytesPerFrame) * bytesPerFrame;
-
-  if (position >= audioData.size()) {
+  // Frame-aligned position in bytes
+  uint64_t frame = frameAt(seconds);
+  if (frame >= getFrameCount()) {
     std::cerr << "Error: Position is beyond the end of the file" << std::endl;
     return false;
   }
+  if (!hasFrame(frame)) {
+    std::cerr << "Error: Position has not been received yet" << std::endl;
+    return false;
+  }
 
-  currentPosition.store(position);
+  currentPosition.store(frame * bytesPerFrame() - baseOffset);
 
   std::cout << "Seeked to position: " << seconds << " seconds" << std::endl;
   return true;
 }
 
 double AudioPlayer::getPositionInSeconds() const {
-  if (audioData.empty()) {
+  int bytesPerSecond = header.sampleRate * bytesPerFrame();
+  if (bytesPerSecond == 0) {
     return 0.0;
   }
 
-  int bytesPerSecond =
-      header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-  return static_cast<double>(currentPosition.load()) / bytesPerSecond;
+  return static_cast<double>(baseOffset + currentPosition.load()) /
+         bytesPerSecond;
 }
 
 double AudioPlayer::getDurationInSeconds() const {
-  if (audioData.empty()) {
+  if (header.sampleRate == 0) {
     return 0.0;
   }
 
-  int bytesPerSecond =
-      header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-  return static_cast<double>(audioData.size()) / bytesPerSecond;
+  return static_cast<double>(getFrameCount()) / header.sampleRate;
+}
+
+uint64_t AudioPlayer::frameAt(double seconds) const {
+  if (seconds <= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(seconds * header.sampleRate);
+}
+
+uint64_t AudioPlayer::getFrameCount() const {
+  if (bytesPerFrame() == 0) {
+    return 0;
+  }
+
+  // The header gives the whole song's length; the data may be a part of it
+  size_t songSize = std::max<size_t>(header.dataSize, baseOffset + audioData.size());
+  return songSize / bytesPerFrame();
+}
+
+uint64_t AudioPlayer::getEndFrame() const {
+  if (bytesPerFrame() == 0) {
+    return 0;
+  }
+  return getEndOffset() / bytesPerFrame();
+}
+
+size_t AudioPlayer::getEndOffset() const { return baseOffset + audioData.size(); }
+
+bool AudioPlayer::hasFrame(uint64_t frame) const {
+  uint64_t offset = frame * bytesPerFrame();
+  return offset >= baseOffset && offset + bytesPerFrame() <= baseOffset + audioData.size();
 }
 
 bool AudioPlayer::isPlaying() const { return playing.load(); }
@@ -17,6 +17,7 @@ class AudioPlayer {
 private:
     WavHeader header;
     std::vector<char> audioData;
+    size_t baseOffset;  // Byte of the song at audioData[0]; nonzero after a seek
     
     // Playback state
     std::atomic<bool> playing;
@@ -41,19 +42,20 @@ private:
                                   AudioBufferList *ioData);
     
     bool setupAudioUnit();
+    unsigned int bytesPerFrame() const;
 
 public:
     AudioPlayer();
     ~AudioPlayer();
     
-    // Initialize with header and audio data
-    bool initialize(const WavHeader& wavHeader);
+    // Initialize with header; the audio added next starts at 'startFrame'
+    bool initialize(const WavHeader& wavHeader, uint64_t startFrame = 0);
     
     // Add audio data (for streaming)
-    void addAudioData(const std::vector<char>& data);
+    void addAudioData(const char* data, size_t size);
     
-    // Clear audio data
-    void clearAudioData();
+    // Clear audio data; the audio added next starts at 'startFrame'
+    void clearAudioData(uint64_t startFrame = 0);
     
     // Control functions
     bool play();
@@ -66,6 +68,16 @@ public:
     double getDurationInSeconds() const;
     bool isPlaying() const;
     
+    // Sample frames: the one at 'seconds', the song's length, the one after
+    // the audio added, and whether the audio of 'frame' has been added
+    uint64_t frameAt(double seconds) const;
+    uint64_t getFrameCount() const;
+    uint64_t getEndFrame() const;
+    bool hasFrame(uint64_t frame) const;
+    
+    // Byte of the song's audio after the audio added
+    size_t getEndOffset() const;
+    
     // Network synchronization functions
     bool setSyncTimestamp(uint64_t timestamp);
     uint64_t getSyncTimestamp() const;
@@ -1,10 +1,15 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "music_client.h"
 
 void displayHelp() {
     std::cout << "\nCommands:" << std::endl;
     std::cout << "  list              - Show available songs" << std::endl;
+    std::cout << "  search <words>    - Find songs whose path has these words" << std::endl;
+    std::cout << "  browse [dir]      - Show a directory of the library" << std::endl;
+    std::cout << "  more              - Show the next page of results" << std::endl;
     std::cout << "  play <song_number>- Request and play a song by number" << std::endl;
     std::cout << "  resume            - Resume playback" << std::endl;
     std::cout << "  pause             - Pause playback" << std::endl;
@@ -19,18 +24,29 @@ void displayHelp() {
 int main(int argc, char* argv[]) {
     std::string serverHost = "localhost";
     int serverPort = 8080;
+    bool lowBitrate = false;
     
-    // Parse command line arguments
-    if (argc >= 2) {
-        serverHost = argv[1];
+    // Parse command line arguments: [host] [port], and --low-bitrate anywhere
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--low-bitrate") {
+            lowBitrate = true;
+        } else {
+            positional.push_back(arg);
+        }
     }
     
-    if (argc >= 3) {
+    if (positional.size() >= 1) {
+        serverHost = positional[0];
+    }
+    
+    if (positional.size() >= 2) {
         try {
-            serverPort = std::stoi(argv[2]);
+            serverPort = std::stoi(positional[1]);
         } catch (const std::exception& e) {
-            std::cerr << "Invalid port number: " << argv[2] << std::endl;
-            std::cerr << "Usage: " << argv[0] << " [host] [port]" << std::endl;
+            std::cerr << "Invalid port number: " << positional[1] << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [host] [port] [--low-bitrate]" << std::endl;
             return 1;
         }
     }
@@ -39,6 +55,12 @@ int main(int argc, char* argv[]) {
     std::cout << "Connecting to " << serverHost << ":" << serverPort << "..." << std::endl;
     
     MusicClient client;
+    client.setLowBitrate(lowBitrate);
+    
+    // The song list is kept per server so reconnects only fetch changes
+    const char* home = getenv("HOME");
+    client.setSongListCache(std::string(home ? home : ".") + "/.music_client_" + serverHost + "_" +
+                            std::to_string(serverPort) + ".songs");
     
     // Connect to server
     if (!client.connect(serverHost, serverPort)) {
@@ -58,13 +80,25 @@ int main(int argc, char* argv[]) {
         if (command == "list") {
             client.requestSongList();
             
+        } else if (command.substr(0, 7) == "search ") {
+            client.search(command.substr(7));
+            
+        } else if (command == "browse" || command.substr(0, 7) == "browse ") {
+            client.browse(command.size() > 7 ? command.substr(7) : "");
+            
+        } else if (command == "more") {
+            if (!client.requestNextPage()) {
+                std::cout << "No more results." << std::endl;
+            }
+            
         } else if (command.substr(0, 5) == "play ") {
             try {
-                int songIndex = std::stoi(command.substr(5)) - 1;
-                const auto& songs = client.getAvailableSongs();
+                // Numbers refer to the last list, search or browse page shown
+                int songNumber = std::stoi(command.substr(5));
+                std::string songName;
                 
-                if (songIndex >= 0 && songIndex < static_cast<int>(songs.size())) {
-                    client.requestSong(songs[songIndex]);
+                if (songNumber > 0 && client.getListedSong(songNumber, songName)) {
+                    client.requestSong(songName);
                 } else {
                     std::cout << "Invalid song number. Use 'list' to see available songs." << std::endl;
                 }
@@ -1,12 +1,55 @@
 #include "music_client.h"
 #include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include "../../common/include/catalog_query.h"
+#include "../../common/include/catalog_sync.h"
+#include "../../common/include/adpcm_codec.h"
+#include "../../common/include/crc32c.h"
+#include "../../common/include/lossless_codec.h"
+
+// Audio buffered before a new song starts playing (1MB), unless the server
+// negotiates another amount
+const size_t SONG_BUFFER_BYTES = 1024 * 1024;
+
+// Largest SONG_DATA payload this client accepts (1MB)
+const uint32_t MAX_CHUNK_BYTES = 1024 * 1024;
+
+// Seconds of audio the client wants sent ahead of its playhead
+const double PACING_WINDOW_SECONDS = 10.0;
+
+// seekFrame while no seek is waiting for its audio
+const uint64_t NO_SEEK = UINT64_MAX;
+
+// Reconnect attempts after the connection drops, the n-th one waiting n
+// times the delay
+const int RECONNECT_ATTEMPTS = 5;
+const std::chrono::milliseconds RECONNECT_DELAY(500);
 
 MusicClient::MusicClient() 
     : socket(new Socket()), 
+      serverPort(0),
+      sessionToken(NO_SESSION),
+      startBytes(SONG_BUFFER_BYTES),
+      audioCodec(Codec::PCM),
+      lowBitrate(false),
       player(new AudioPlayer()), 
       isRunning(false),
-      isBuffering(false) {
+      songInfoReceived(false),
+      currentStream(NO_STREAM),
+      lastStreamId(NO_STREAM),
+      refetchStream(NO_STREAM),
+      seekFrame(NO_SEEK),
+      songListVersion(NO_LIST_VERSION),
+      queryType(MessageType::SEARCH_REQUEST),
+      nextQueryOffset(0),
+      moreResults(false),
+      isBuffering(false),
+      bufferedBytes(0),
+      bufferTarget(SONG_BUFFER_BYTES),
+      playWhenBuffered(true) {
 }
 
 MusicClient::~MusicClient() {
@@ -17,11 +60,15 @@ bool MusicClient::connect(const std::string& host, int port) {
     if (!socket->connectToServer(host, port)) {
         return false;
     }
+    serverHost = host;
+    serverPort = port;
     
     // Start receive thread
     isRunning.store(true);
     receiveThread = std::thread(&MusicClient::receiveThreadFunc, this);
     
+    sendHello();
+    
     // Request song list
     requestSongList();
     
@@ -36,7 +83,10 @@ void MusicClient::disconnect() {
             receiveThread.join();
         }
         
-        socket->close();
+        {
+            std::lock_guard<std::recursive_mutex> lock(sendMutex);
+            socket->close();
+        }
         
         // Stop any playing audio
         if (player) {
@@ -45,29 +95,166 @@ void MusicClient::disconnect() {
     }
 }
 
+void MusicClient::setSongListCache(const std::string& path) {
+    songListCachePath = path;
+    loadSongListCache();
+}
+
+void MusicClient::setLowBitrate(bool enabled) {
+    lowBitrate = enabled;
+}
+
 bool MusicClient::requestSongList() {
-    // Create empty message to request song list
-    std::vector<char> message = serializeMessage(MessageType::LIST_REQUEST, std::string());
-    return socket->send(message);
+    // The server replies with whatever brings our copy up to date
+    return sendListSyncRequest(songListVersion);
+}
+
+bool MusicClient::sendListSyncRequest(uint64_t version) {
+    char payload[ListSyncRequestMessage::MIN_SIZE];
+    ListSyncRequestMessage::encodePayload(payload, version);
+    return sendMessage(MessageType::LIST_REQUEST, payload, sizeof(payload));
+}
+
+bool MusicClient::search(const std::string& text) {
+    return sendQuery(MessageType::SEARCH_REQUEST, text, 0);
+}
+
+bool MusicClient::browse(const std::string& directory) {
+    return sendQuery(MessageType::BROWSE_REQUEST, directory, 0);
+}
+
+bool MusicClient::requestNextPage() {
+    MessageType type;
+    std::string text;
+    uint32_t offset;
+    {
+        std::lock_guard<std::mutex> lock(listedMutex);
+        if (!moreResults) {
+            return false;
+        }
+        type = queryType;
+        text = queryText;
+        offset = nextQueryOffset;
+    }
+    return sendQuery(type, text, offset);
+}
+
+bool MusicClient::sendQuery(MessageType type, const std::string& text, uint32_t offset) {
+    {
+        std::lock_guard<std::mutex> lock(listedMutex);
+        queryType = type;
+        queryText = text;
+        moreResults = false;
+    }
+    std::vector<char> payload = encodeQueryRequest(offset, QUERY_PAGE_SIZE, text);
+    return sendMessage(type, payload.data(), payload.size());
+}
+
+bool MusicClient::getListedSong(size_t number, std::string& songName) const {
+    std::lock_guard<std::mutex> lock(listedMutex);
+    if (number == 0 || number > listedSongs.size()) {
+        return false;
+    }
+    songName = listedSongs[number - 1];
+    return true;
 }
 
 bool MusicClient::requestSong(const std::string& songName) {
+    std::lock_guard<std::mutex> lock(playbackMutex);
     currentSong = songName;
     // Clear any existing audio data
     player->clearAudioData();
+    songInfoReceived = false;
     isBuffering = true;
+    bufferedBytes = 0;
+    bufferTarget = startBytes;
+    playWhenBuffered = true;
     
-    // Send song request
-    std::vector<char> message = serializeMessage(MessageType::SONG_REQUEST, songName);
-    return socket->send(message);
+    return requestStream(0, false);
+}
+
+bool MusicClient::requestStream(uint64_t firstFrame, bool refetching) {
+    // Each request gets a new stream; from here on frames of the previous
+    // one are ignored, and cancelling it keeps its unsent audio off the wire
+    StreamId stream = ++lastStreamId;
+    if (stream == NO_STREAM) {
+        stream = ++lastStreamId;
+    }
+    refetchStream.store(refetching ? stream : NO_STREAM);
+    seekFrame.store(NO_SEEK);
+    StreamId previous = currentStream.exchange(stream);
+    if (previous != NO_STREAM) {
+        char cancel[StreamCancelMessage::FRAME_SIZE];
+        sendFrame(cancel, StreamCancelMessage::encode(cancel, sizeof(cancel), previous));
+    }
+    
+    // Request it by track ID; the name is only for display
+    char frame[TrackRequestMessage::FRAME_SIZE];
+    size_t size = TrackRequestMessage::encode(frame, sizeof(frame), stream, trackIdOf(currentSong),
+                                              firstFrame, uint64_t(0));
+    return sendFrame(frame, size);
+}
+
+bool MusicClient::sendPlayControl(StreamId stream, PlayControl command, double position) {
+    if (stream == NO_STREAM) {
+        return true;
+    }
+    char frame[PlayControlMessage::FRAME_SIZE];
+    return sendFrame(frame, PlayControlMessage::encode(frame, sizeof(frame), stream, command, position));
+}
+
+bool MusicClient::sendHello() {
+    // The socket's receive buffer lets the server keep chunks small enough
+    // to land in one piece
+    std::lock_guard<std::recursive_mutex> lock(sendMutex);
+    int receiveBuffer = 0;
+    socklen_t length = sizeof(receiveBuffer);
+    if (getsockopt(socket->getSocketFd(), SOL_SOCKET, SO_RCVBUF, &receiveBuffer, &length) < 0) {
+        receiveBuffer = 0;
+    }
+    
+    // The server sends the most compact codec offered, so ADPCM is only
+    // listed in the low-bitrate mode
+    CodecSet codecs = codecBit(Codec::PCM) | codecBit(lowBitrate ? Codec::ADPCM : Codec::LOSSLESS);
+    
+    char frame[HelloMessage::FRAME_SIZE];
+    return sendFrame(frame, HelloMessage::encode(frame, sizeof(frame), PROTOCOL_VERSION, MAX_CHUNK_BYTES, codecs,
+                                                 PACING_WINDOW_SECONDS,
+                                                 static_cast<uint32_t>(receiveBuffer)));
+}
+
+bool MusicClient::sendMessage(MessageType type, const void* payload, size_t size) {
+    EncodedHeader header = makeMessageHeader(type, size);
+    
+    struct iovec iov[2];
+    iov[0].iov_base = header.data();
+    iov[0].iov_len = header.size();
+    iov[1].iov_base = const_cast<void*>(payload);
+    iov[1].iov_len = size;
+    
+    std::lock_guard<std::recursive_mutex> lock(sendMutex);
+    return socket->sendv(iov, size > 0 ? 2 : 1);
+}
+
+bool MusicClient::sendFrame(const char* frame, size_t size) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(frame);
+    iov.iov_len = size;
+    
+    std::lock_guard<std::recursive_mutex> lock(sendMutex);
+    return size > 0 && socket->sendv(&iov, 1);
 }
 
 void MusicClient::receiveThreadFunc() {
+    char headerData[MESSAGE_HEADER_SIZE];
+    // Reused for every message, so it only allocates when a larger one arrives
+    std::vector<char> payload;
+    
     while (isRunning.load()) {
         // First, receive the message header
-        std::vector<char> headerData = socket->receive(sizeof(MessageHeader));
+        size_t headerSize = socket->receiveInto(headerData, MESSAGE_HEADER_SIZE);
         
-        if (headerData.empty()) {
+        if (headerSize == 0) {
             if (socket->connected()) {
                 // Just no data yet, continue
                 std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -75,23 +262,25 @@ void MusicClient::receiveThreadFunc() {
             } else {
                 // Connection closed
                 std::cerr << "Connection closed by server" << std::endl;
-                break;
+                if (!reconnect()) {
+                    break;
+                }
+                continue;
             }
         }
         
-        if (headerData.size() < sizeof(MessageHeader)) {
+        if (headerSize < MESSAGE_HEADER_SIZE) {
             std::cerr << "Received incomplete header" << std::endl;
             continue;
         }
         
         // Parse the header
-        MessageHeader header;
-        memcpy(&header, headerData.data(), sizeof(MessageHeader));
+        MessageHeader header = decodeMessageHeader(headerData);
         
         // Receive the message payload
-        std::vector<char> payload = socket->receive(header.size);
+        payload.resize(header.size);
         
-        if (payload.size() < header.size) {
+        if (socket->receiveInto(payload.data(), header.size) < header.size) {
             std::cerr << "Received incomplete payload" << std::endl;
             continue;
         }
@@ -101,65 +290,249 @@ void MusicClient::receiveThreadFunc() {
     }
 }
 
+bool MusicClient::reconnect() {
+    {
+        // Sends from the UI fail while the connection is down
+        std::lock_guard<std::recursive_mutex> lock(sendMutex);
+        socket->close();
+    }
+    for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS && isRunning.load(); ++attempt) {
+        std::this_thread::sleep_for(RECONNECT_DELAY * attempt);
+        std::cout << "Reconnecting to " << serverHost << ":" << serverPort << "..." << std::endl;
+        // Connected without the locks, which the UI would otherwise wait on
+        std::unique_ptr<Socket> connection(new Socket());
+        if (!connection->connectToServer(serverHost, serverPort)) {
+            continue;
+        }
+        std::cout << "Reconnected to server" << std::endl;
+        
+        // The new socket takes over with its HELLO and resume already
+        // queued, so no UI request can reach the server ahead of them
+        std::lock_guard<std::mutex> playbackLock(playbackMutex);
+        std::lock_guard<std::recursive_mutex> sendLock(sendMutex);
+        socket = std::move(connection);
+        
+        // Audio is PCM again until the new connection acknowledges a codec
+        audioCodec = Codec::PCM;
+        sendHello();
+        
+        StreamId stream = currentStream.load();
+        if (stream == NO_STREAM) {
+            return true;
+        }
+        if (!songInfoReceived) {
+            // Nothing of the song arrived: ask for it again
+            requestStream(0, false);
+            return true;
+        }
+        
+        // Everything the player holds was verified; the server sends the
+        // rest on the same stream, so it counts as a refetch. A seek still
+        // waiting for its audio left the player starting at the seek point.
+        refetchStream.store(stream);
+        seekFrame.store(NO_SEEK);
+        bufferedBytes = 0;
+        char frame[SessionResumeMessage::FRAME_SIZE];
+        sendFrame(frame, SessionResumeMessage::encode(frame, sizeof(frame), sessionToken, stream,
+                                                      trackIdOf(currentSong), player->getEndFrame()));
+        return true;
+    }
+    std::cerr << "Could not reconnect to server" << std::endl;
+    return false;
+}
+
 void MusicClient::handleMessage(const MessageHeader& header, const std::vector<char>& data) {
+    std::string_view payload(data.data(), data.size());
+    
     switch (header.type) {
         case MessageType::LIST_RESPONSE:
-            availableSongs = parseStringList(data);
-            std::cout << "Received song list with " << availableSongs.size() << " songs:" << std::endl;
-            for (size_t i = 0; i < availableSongs.size(); ++i) {
-                std::cout << (i + 1) << ". " << availableSongs[i] << std::endl;
+            {
+                // The names are views of the payload until copied into the list
+                wire::StringListView songs;
+                if (!SongListMessage::decode(payload, songs)) {
+                    std::cerr << "Received corrupt song list" << std::endl;
+                    break;
+                }
+                availableSongs.assign(songs.begin(), songs.end());
+                songListVersion = NO_LIST_VERSION;
+                std::cout << "Received song list with " << availableSongs.size() << " songs:" << std::endl;
+                printSongList();
+                break;
             }
+            
+        case MessageType::LIST_NOT_MODIFIED:
+            std::cout << "Song list unchanged (" << availableSongs.size() << " songs):" << std::endl;
+            printSongList();
+            break;
+            
+        case MessageType::LIST_SNAPSHOT:
+        case MessageType::LIST_DELTA:
+            if (!applySongListUpdate(header.type, data)) {
+                // Our copy is not the one the delta starts from
+                sendListSyncRequest(NO_LIST_VERSION);
+                break;
+            }
+            saveSongListCache();
+            std::cout << (header.type == MessageType::LIST_DELTA ? "Updated" : "Received")
+                      << " song list with " << availableSongs.size() << " songs:" << std::endl;
+            printSongList();
+            break;
+            
+        case MessageType::SEARCH_RESPONSE:
+        case MessageType::BROWSE_RESPONSE:
+            showQueryPage(header.type, data);
             break;
             
         case MessageType::SONG_INFO:
-            if (data.size() >= sizeof(WavHeader)) {
+            {
+                StreamId stream;
+                uint64_t firstFrame;
+                std::string_view wavHeader;
+                std::lock_guard<std::mutex> lock(playbackMutex);
+                if (!SongInfoMessage::decode(payload, stream, firstFrame, wavHeader) ||
+                    stream != currentStream.load() || wavHeader.size() < sizeof(WavHeader)) {
+                    break;
+                }
+                uint64_t seekedTo = seekFrame.load();
+                if (seekedTo != NO_SEEK) {
+                    // Until the stream starts over at the seek point, its
+                    // audio is from before the seek
+                    if (firstFrame == seekedTo) {
+                        seekFrame.store(NO_SEEK);
+                    }
+                    break;
+                }
+                if (stream == refetchStream.load()) {
+                    // The player already holds the song up to here
+                    break;
+                }
                 WavHeader header;
-                memcpy(&header, data.data(), sizeof(WavHeader));
+                memcpy(&header, wavHeader.data(), sizeof(WavHeader));
                 
                 // Initialize the audio player with this header
-                player->initialize(header);
-                audioBuffer.clear();
+                player->initialize(header, firstFrame);
+                songInfoReceived = true;
                 std::cout << "Received song info, waiting for data..." << std::endl;
+                break;
             }
-            break;
             
         case MessageType::SONG_DATA:
-            // Add the audio data to our buffer
-            audioBuffer.insert(audioBuffer.end(), data.begin(), data.end());
-            
-            // If we're still buffering and have enough data, start playback
-            if (isBuffering && audioBuffer.size() > 1024 * 1024) { // 1MB buffer
-                player->addAudioData(audioBuffer);
-                audioBuffer.clear();
-                isBuffering = false;
+            {
+                // Audio of a song we skipped is still arriving; drop it
+                StreamId stream;
+                uint64_t offset;
+                uint32_t crc;
+                std::string_view audio;
+                // Held until the audio is in the player, so that a song
+                // requested meanwhile cannot receive it
+                std::lock_guard<std::mutex> lock(playbackMutex);
+                if (!SongDataMessage::decode(payload, stream, offset, crc, audio) ||
+                    stream != currentStream.load() || seekFrame.load() != NO_SEEK) {
+                    break;
+                }
+                
+                // The player holds the song's audio up to 'expected'; after a
+                // resume the stream starts at the frame holding that byte
+                size_t expected = player->getEndOffset();
+                bool intact = crc32c::compute(audio.data(), audio.size()) == crc && offset <= expected;
+                Codec codec = audioCodec.load();
+                if (intact && codec != Codec::PCM) {
+                    // The checksum covers the compressed bytes; the offset
+                    // counts the PCM they decode to
+                    decodedAudio.clear();
+                    intact = codec == Codec::ADPCM
+                                 ? adpcm::decode(audio.data(), audio.size(), decodedAudio)
+                                 : lossless::decode(audio.data(), audio.size(), decodedAudio);
+                    audio = std::string_view(decodedAudio.data(), decodedAudio.size());
+                }
+                if (!intact) {
+                    // Damaged or missing audio: fetch again from what was verified
+                    std::cerr << "Audio at byte " << offset << " failed its check, fetching it again" << std::endl;
+                    requestStream(player->getEndFrame(), true);
+                    break;
+                }
+                if (offset + audio.size() <= expected) {
+                    break;
+                }
+                audio.remove_prefix(expected - offset);
+                player->addAudioData(audio.data(), audio.size());
                 
-                std::cout << "Starting playback of " << currentSong << std::endl;
-                player->play();
-            } else if (!isBuffering) {
-                // If we're already playing, add this data to the player
-                player->addAudioData(data);
+                // Play once enough has been buffered
+                if (isBuffering && (bufferedBytes += audio.size()) > bufferTarget) {
+                    isBuffering = false;
+                    
+                    if (playWhenBuffered) {
+                        std::cout << "Starting playback of " << currentSong << std::endl;
+                        player->play();
+                    }
+                }
+                break;
             }
-            break;
             
         case MessageType::SONG_DATA_END:
-            // Add any remaining buffered data
-            if (!audioBuffer.empty()) {
-                player->addAudioData(audioBuffer);
-                audioBuffer.clear();
+            {
+                StreamId stream;
+                std::lock_guard<std::mutex> lock(playbackMutex);
+                if (!SongDataEndMessage::decode(payload, stream) || stream != currentStream.load()) {
+                    break;
+                }
+                // Nothing left to cancel when the next song is requested
+                currentStream.compare_exchange_strong(stream, NO_STREAM);
+                
+                uint64_t seekedTo = seekFrame.exchange(NO_SEEK);
+                if (seekedTo != NO_SEEK) {
+                    // The song was sent in full before the server got the
+                    // seek; ask for it again from there
+                    requestStream(seekedTo, true);
+                    break;
+                }
+                
+                if (isBuffering) {
+                    isBuffering = false;
+                    if (playWhenBuffered) {
+                        player->play();
+                    }
+                }
+                
+                std::cout << "Received complete song data for " << currentSong << std::endl;
+                break;
             }
             
-            if (isBuffering) {
-                isBuffering = false;
-                player->play();
+        case MessageType::HELLO_ACK:
+            {
+                uint32_t version;
+                uint32_t chunkSize;
+                uint32_t firstChunkSize;
+                Codec codec;
+                double windowSeconds;
+                uint32_t bufferBytes;
+                if (!HelloAckMessage::decode(payload, version, chunkSize, firstChunkSize, codec, windowSeconds,
+                                             bufferBytes) ||
+                    (codec != Codec::PCM && codec != Codec::LOSSLESS && codec != Codec::ADPCM)) {
+                    std::cerr << "Received unusable connection parameters" << std::endl;
+                    break;
+                }
+                startBytes = bufferBytes;
+                audioCodec = codec;
+                const char* codecNote = codec == Codec::LOSSLESS ? ", lossless compression"
+                                        : codec == Codec::ADPCM  ? ", low-bitrate ADPCM"
+                                                                 : "";
+                std::cout << "Connected with protocol version " << version << ", chunks of " << firstChunkSize
+                          << "-" << chunkSize << " bytes" << codecNote << std::endl;
+                break;
             }
             
-            std::cout << "Received complete song data for " << currentSong << std::endl;
-            break;
+        case MessageType::SESSION_TOKEN:
+            {
+                // Kept to resume the stream in flight if the connection drops
+                SessionTokenMessage::decode(payload, sessionToken);
+                break;
+            }
             
         case MessageType::ERROR:
             {
-                // Convert data to string for error message
-                std::string errorMsg(data.begin(), data.end());
+                std::string_view errorMsg;
+                ErrorMessage::decode(payload, errorMsg);
                 std::cerr << "Error from server: " << errorMsg << std::endl;
                 break;
             }
@@ -170,62 +543,206 @@ void MusicClient::handleMessage(const MessageHeader& header, const std::vector<c
     }
 }
 
-std::vector<std::string> MusicClient::parseStringList(const std::vector<char>& data) {
-    std::vector<std::string> result;
+bool MusicClient::applySongListUpdate(MessageType type, const std::vector<char>& data) {
+    if (type == MessageType::LIST_SNAPSHOT) {
+        std::vector<std::string> songs;
+        uint64_t version;
+        if (!decodeListSnapshot(data.data(), data.size(), version, songs)) {
+            std::cerr << "Received corrupt song list" << std::endl;
+            return false;
+        }
+        availableSongs = std::move(songs);
+        songListVersion = version;
+        return true;
+    }
     
-    if (data.size() < 4) {
-        return result; // Not enough data for count
+    ListDeltaHeader delta;
+    std::vector<std::string> removed;
+    std::vector<std::string> added;
+    if (!decodeListDelta(data.data(), data.size(), delta, removed, added) ||
+        delta.fromVersion != songListVersion) {
+        return false;
     }
+    std::vector<std::string> updated = applyListDelta(availableSongs, removed, added);
     
-    // Extract count
-    uint32_t count;
-    memcpy(&count, data.data(), 4);
+    // The version is a hash of the list, so a bad merge cannot go unnoticed
+    std::vector<char> serialized = serializeStringList(updated);
+    if (listVersion(std::string_view(serialized.data(), serialized.size())) != delta.toVersion) {
+        std::cerr << "Song list update did not match the server's version" << std::endl;
+        return false;
+    }
+    availableSongs = std::move(updated);
+    songListVersion = delta.toVersion;
+    return true;
+}
+
+void MusicClient::printSongList() {
+    for (size_t i = 0; i < availableSongs.size(); ++i) {
+        std::cout << (i + 1) << ". " << availableSongs[i] << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(listedMutex);
+    listedSongs = availableSongs;
+}
+
+void MusicClient::showQueryPage(MessageType type, const std::vector<char>& data) {
+    QueryPageHeader page;
+    std::vector<QueryEntry> entries;
+    if (!decodeQueryPage(data.data(), data.size(), page, entries)) {
+        std::cerr << "Received corrupt result page" << std::endl;
+        return;
+    }
     
-    size_t offset = 4;
-    for (uint32_t i = 0; i < count; ++i) {
-        // Check if we have enough data for the length
-        if (offset + 4 > data.size()) {
-            break;
+    std::lock_guard<std::mutex> lock(listedMutex);
+    // Browse names are relative to the directory browsed
+    std::string directory;
+    if (type == MessageType::BROWSE_RESPONSE && !queryText.empty()) {
+        directory = queryText;
+        if (directory.back() != '/') {
+            directory += '/';
         }
-        
-        // Extract string length
-        uint32_t length;
-        memcpy(&length, data.data() + offset, 4);
-        offset += 4;
-        
-        // Check if we have enough data for the string
-        if (offset + length > data.size()) {
-            break;
+    }
+    
+    if (entries.empty()) {
+        std::cout << (page.offset == 0 ? "Nothing found" : "No more entries") << std::endl;
+    }
+    listedSongs.clear();
+    for (const QueryEntry& entry : entries) {
+        if (entry.kind == QueryEntryKind::DIRECTORY) {
+            std::cout << "   " << directory << entry.name << "/  (" << entry.value << " songs)" << std::endl;
+            continue;
         }
-        
-        // Extract string
-        std::string str(data.data() + offset, data.data() + offset + length);
-        result.push_back(str);
-        offset += length;
+        listedSongs.push_back(directory + entry.name);
+        uint32_t seconds = (entry.value + 500) / 1000;
+        char duration[16];
+        snprintf(duration, sizeof(duration), "%u:%02u", seconds / 60, seconds % 60);
+        std::cout << listedSongs.size() << ". " << listedSongs.back() << "  [" << duration << "]" << std::endl;
     }
     
-    return result;
+    nextQueryOffset = page.offset + page.count;
+    moreResults = (page.flags & QUERY_MORE) != 0;
+    if (moreResults) {
+        std::cout << "Type 'more' for the next page" << std::endl;
+    }
+    if (page.flags & QUERY_TRUNCATED) {
+        std::cout << "Search stopped early; add words to narrow it down" << std::endl;
+    }
+}
+
+void MusicClient::loadSongListCache() {
+    std::ifstream file(songListCachePath, std::ios::binary);
+    if (!file) {
+        return;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    std::vector<std::string> songs;
+    uint64_t version;
+    if (!decodeListSnapshot(data.data(), data.size(), version, songs)) {
+        std::cerr << "Ignoring corrupt song list cache " << songListCachePath << std::endl;
+        return;
+    }
+    // Caches written in an older layout decode to a list that no longer
+    // matches its version
+    std::vector<char> serialized = serializeStringList(songs);
+    if (listVersion(std::string_view(serialized.data(), serialized.size())) != version) {
+        std::cerr << "Ignoring stale song list cache " << songListCachePath << std::endl;
+        return;
+    }
+    availableSongs = std::move(songs);
+    songListVersion = version;
+}
+
+void MusicClient::saveSongListCache() const {
+    if (songListCachePath.empty()) {
+        return;
+    }
+    
+    // Same encoding as LIST_SNAPSHOT; replaced atomically so a crash
+    // mid-write leaves the old copy
+    std::vector<char> data = encodeListSnapshot(songListVersion, availableSongs);
+    std::string tempPath = songListCachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.write(data.data(), data.size())) {
+            std::cerr << "Cannot write song list cache " << tempPath << std::endl;
+            return;
+        }
+    }
+    std::rename(tempPath.c_str(), songListCachePath.c_str());
 }
 
 bool MusicClient::play() {
+    std::lock_guard<std::mutex> lock(playbackMutex);
     if (isBuffering) {
+        // Starts once enough audio has arrived
+        playWhenBuffered = true;
         std::cout << "Still buffering, please wait..." << std::endl;
-        return false;
+        return sendPlayControl(currentStream.load(), PlayControl::PLAY, player->getPositionInSeconds());
+    }
+    
+    StreamId stream = currentStream.load();
+    if (stream != NO_STREAM) {
+        // Let the server send again
+        sendPlayControl(stream, PlayControl::PLAY, player->getPositionInSeconds());
+    } else if (!currentSong.empty() && player->getEndFrame() < player->getFrameCount()) {
+        // Stopped before the song had arrived: fetch the rest again
+        if (!player->hasFrame(player->frameAt(player->getPositionInSeconds()))) {
+            // Nothing to play until it arrives
+            isBuffering = true;
+            bufferedBytes = 0;
+            bufferTarget = 0;
+            playWhenBuffered = true;
+            return requestStream(player->getEndFrame(), true);
+        }
+        requestStream(player->getEndFrame(), true);
     }
     
     return player->play();
 }
 
 bool MusicClient::pause() {
+    std::lock_guard<std::mutex> lock(playbackMutex);
+    if (isBuffering) {
+        playWhenBuffered = false;
+    }
+    sendPlayControl(currentStream.load(), PlayControl::PAUSE, player->getPositionInSeconds());
     return player->pause();
 }
 
 bool MusicClient::stop() {
+    // Frames still on the way are ignored from here on
+    std::lock_guard<std::mutex> lock(playbackMutex);
+    StreamId stream = currentStream.exchange(NO_STREAM);
+    sendPlayControl(stream, PlayControl::STOP, 0.0);
+    seekFrame.store(NO_SEEK);
+    isBuffering = false;
     return player->stop();
 }
 
 bool MusicClient::seek(double position) {
-    return player->seekToPosition(position);
+    std::lock_guard<std::mutex> lock(playbackMutex);
+    uint64_t frame = player->frameAt(position);
+    if (currentSong.empty() || frame >= player->getFrameCount() || player->hasFrame(frame)) {
+        return player->seekToPosition(position);
+    }
+    
+    // Not received yet: rather than wait for the audio before it, have the
+    // server send from the seek point and play as soon as the first chunk lands
+    playWhenBuffered = player->isPlaying() || (isBuffering && playWhenBuffered);
+    player->clearAudioData(frame);
+    isBuffering = true;
+    bufferedBytes = 0;
+    bufferTarget = 0;
+    std::cout << "Fetching from " << position << " seconds..." << std::endl;
+    
+    StreamId stream = currentStream.load();
+    if (stream != NO_STREAM) {
+        // Reposition the stream in flight; its audio is ignored until the
+        // SONG_INFO announcing the new position
+        seekFrame.store(frame);
+        return sendPlayControl(stream, PlayControl::SEEK, position);
+    }
+    return requestStream(frame, true);
 }
 
 double MusicClient::getCurrentPosition() const {
@@ -241,6 +758,7 @@ bool MusicClient::isPlaying() const {
 }
 
 std::string MusicClient::getCurrentSong() const {
+    std::lock_guard<std::mutex> lock(playbackMutex);
     return currentSong;
 }
 
@@ -249,5 +767,6 @@ const std::vector<std::string>& MusicClient::getAvailableSongs() const {
 }
 
 bool MusicClient::isConnected() const {
+    std::lock_guard<std::recursive_mutex> lock(sendMutex);
     return socket->connected();
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -27,19 +28,57 @@
  */
 class MusicClient {
 private:
-    std::unique_ptr<Socket> socket;         ///< Network socket for server communication
+    std::unique_ptr<Socket> socket;         ///< Network socket for server communication, replaced on reconnect
+    std::string serverHost;                 ///< Server connected to, for reconnecting
+    int serverPort;                         ///< Port connected to, for reconnecting
+    SessionToken sessionToken;              ///< Session of the connection, NO_SESSION until the server names it
+    std::atomic<size_t> startBytes;         ///< Audio to buffer before a new song plays, as negotiated
+    std::atomic<Codec> audioCodec;          ///< Encoding of SONG_DATA audio, as negotiated
+    bool lowBitrate;                        ///< Ask for ADPCM audio, for thin links
+    std::vector<char> decodedAudio;         ///< Reused buffer for decoding compressed audio
     std::unique_ptr<AudioPlayer> player;    ///< Audio playback component
     std::atomic<bool> isRunning;            ///< Flag indicating if client is running
     std::thread receiveThread;              ///< Thread for handling incoming messages
     std::string currentSong;                ///< Name of the currently loaded song
-    std::vector<std::string> availableSongs; ///< List of songs available on the server
+    bool songInfoReceived;                  ///< The player has the current song's header
+    std::atomic<StreamId> currentStream;    ///< Stream of the song being received, NO_STREAM once complete
+    std::atomic<StreamId> lastStreamId;     ///< Last stream ID used in a song request
+    std::atomic<StreamId> refetchStream;    ///< Stream refetching part of the loaded song
+    std::atomic<uint64_t> seekFrame;        ///< Frame the current stream was seeked to, until it arrives
+    std::vector<std::string> availableSongs; ///< List of songs available on the server, sorted
+    uint64_t songListVersion;               ///< Version of availableSongs, NO_LIST_VERSION if none
+    std::string songListCachePath;          ///< Where the song list is kept between runs, empty for nowhere
     
-    /// Buffer for receiving audio data from the server
-    std::vector<char> audioBuffer;
+    /// Songs last printed with numbers (list, search or browse), full paths
+    std::vector<std::string> listedSongs;
+    MessageType queryType;                  ///< SEARCH_REQUEST or BROWSE_REQUEST of the last query
+    std::string queryText;                  ///< Search text or directory of the last query
+    uint32_t nextQueryOffset;               ///< Offset of the page after the last one shown
+    bool moreResults;                       ///< The last page said more entries follow
+    mutable std::mutex listedMutex;         ///< Guards the listed songs and query state
+    
+    /// Serializes writes to the socket and replacing it on reconnect.
+    /// Recursive so that a reconnect can send its HELLO and resume under it.
+    mutable std::recursive_mutex sendMutex;
+    
+    /// Guards the current song and the buffering state below, which the
+    /// receive thread and the UI both change. Taken before sendMutex.
+    mutable std::mutex playbackMutex;
     
     /// Flag indicating if client is currently buffering audio data
     bool isBuffering;
     
+    /// Audio received since buffering started; it goes into the player
+    /// straight away, which does not play it until buffering ends
+    size_t bufferedBytes;
+    
+    /// Bytes to buffer before playback starts: startBytes for a new song, to
+    /// ride out jitter, none after a seek so it plays as soon as audio arrives
+    size_t bufferTarget;
+    
+    /// Whether to play once buffered (false after pausing, or seeking while paused)
+    bool playWhenBuffered;
+    
     /**
      * @brief Processes received messages from the server
      * @param header The message header containing type and size information
@@ -56,13 +95,114 @@ private:
     void receiveThreadFunc();
     
     /**
-     * @brief Parses a byte array into a list of strings
-     * @param data The raw data containing the string list
-     * @return A vector of strings parsed from the data
+     * @brief Connects again after the connection dropped and resumes the stream in flight
+     *
+     * Retries with a growing delay. The server is asked to resume the
+     * current stream of the old session from the end of the audio the
+     * player holds, all of which passed its checksum.
+     * @return true once connected again, false if every attempt failed
+     */
+    bool reconnect();
+    
+    /**
+     * @brief Sends HELLO, advertising what this client supports
+     *
+     * The server answers with HELLO_ACK, which sets how much audio to
+     * buffer before playing.
+     * @return true if the message was sent successfully, false otherwise
+     */
+    bool sendHello();
+    
+    /**
+     * @brief Sends a message as a header plus payload in one vectored write
+     * @param type The message type
+     * @param payload Pointer to the payload bytes (may be null if size is 0)
+     * @param size Number of payload bytes
+     * @return true if the message was sent successfully, false otherwise
+     */
+    bool sendMessage(MessageType type, const void* payload, size_t size);
+    
+    /**
+     * @brief Sends a frame already encoded with its header (see Message::encode)
+     * @param frame The frame bytes
+     * @param size Number of frame bytes, 0 if encoding failed
+     * @return true if the frame was sent successfully, false otherwise
+     */
+    bool sendFrame(const char* frame, size_t size);
+    
+    /**
+     * @brief Requests the current song from a sample frame on, on a new stream
+     *
+     * The stream being received, if any, is cancelled first. Called from
+     * the receive thread and the UI, with playbackMutex held.
+     * @param firstFrame The first frame to send
+     * @param refetching Whether this refetches part of the loaded song
+     * @return true if the request was sent successfully, false otherwise
+     */
+    bool requestStream(uint64_t firstFrame, bool refetching);
+    
+    /**
+     * @brief Tells the server how the listener plays the current stream
+     *
+     * The server holds a paused stream's audio back, ends a stopped one
+     * and sends a seeked one from the new position.
+     * @param stream The stream, NO_STREAM if none is in flight (nothing is sent)
+     * @param command The command
+     * @param position The playhead, or for SEEK the position, in seconds
+     * @return true if the message was sent or none was needed, false otherwise
+     */
+    bool sendPlayControl(StreamId stream, PlayControl command, double position);
+    
+    /**
+     * @brief Applies a LIST_SNAPSHOT or LIST_DELTA to the local song list
+     * @param type The message type
+     * @param data The message payload
+     * @return true if the list is now current, false if a full list is needed
+     */
+    bool applySongListUpdate(MessageType type, const std::vector<char>& data);
+    
+    /**
+     * @brief Sends LIST_REQUEST carrying the version of the local copy
+     * @param version The version to report, NO_LIST_VERSION for a full list
+     * @return true if the request was sent successfully, false otherwise
+     */
+    bool sendListSyncRequest(uint64_t version);
+    
+    /**
+     * @brief Prints the numbered song list and makes it what song numbers refer to
+     */
+    void printSongList();
+    
+    /**
+     * @brief Sends a SEARCH_REQUEST or BROWSE_REQUEST for one page
+     * @param type The request type
+     * @param text The search text or directory
+     * @param offset Entries to skip
+     * @return true if the request was sent successfully, false otherwise
      */
-    std::vector<std::string> parseStringList(const std::vector<char>& data);
+    bool sendQuery(MessageType type, const std::string& text, uint32_t offset);
+    
+    /**
+     * @brief Prints a SEARCH_RESPONSE or BROWSE_RESPONSE page, numbering its songs
+     * @param type The message type
+     * @param data The message payload
+     */
+    void showQueryPage(MessageType type, const std::vector<char>& data);
+    
+    /**
+     * @brief Loads the song list saved by an earlier run, if any
+     */
+    void loadSongListCache();
+    
+    /**
+     * @brief Saves the song list so the next run only fetches changes
+     */
+    void saveSongListCache() const;
 
 public:
+    /// Entries asked for per search or browse page
+    static constexpr uint16_t QUERY_PAGE_SIZE = 20;
+    
     /**
      * @brief Constructs a new Music Client object
      */
@@ -76,6 +216,25 @@ public:
      */
     ~MusicClient();
     
+    /**
+     * @brief Keep the song list in a local file between runs
+     *
+     * Call before connect(). The saved copy is loaded right away and its
+     * version is sent with each list request, so the server answers with
+     * "not modified" or only the songs added and removed since.
+     * @param path The cache file, one per server
+     */
+    void setSongListCache(const std::string& path);
+    
+    /**
+     * @brief Ask for 4:1 ADPCM audio instead of lossless audio
+     *
+     * Call before connect(). For links too slow for full-quality audio: the
+     * server sends about a quarter of the PCM bytes, at some loss of quality.
+     * @param enabled Whether to ask for the low-bitrate mode
+     */
+    void setLowBitrate(bool enabled);
+    
     /**
      * @brief Connect to a music server
      * @param host The hostname or IP address of the server
@@ -97,6 +256,37 @@ public:
      */
     bool requestSongList();
     
+    /**
+     * @brief Search song paths on the server; results arrive a page at a time
+     *
+     * Large libraries need not be listed whole: the server matches words
+     * of the path, the last one as a prefix, and ranks the results.
+     * @param text The words to look for
+     * @return true if request was sent successfully, false otherwise
+     */
+    bool search(const std::string& text);
+    
+    /**
+     * @brief List one directory of the server's library, a page at a time
+     * @param directory The directory, relative to the library ("" for the top)
+     * @return true if request was sent successfully, false otherwise
+     */
+    bool browse(const std::string& directory);
+    
+    /**
+     * @brief Request the next page of the last search or browse
+     * @return true if request was sent, false if there is nothing more
+     */
+    bool requestNextPage();
+    
+    /**
+     * @brief Look up a song by the number it was last printed with
+     * @param number The 1-based number from the last list, search or browse page
+     * @param songName Receives the song's full name
+     * @return true if the number is valid, false otherwise
+     */
+    bool getListedSong(size_t number, std::string& songName) const;
+    
     /**
      * @brief Request a specific song from the server
      * @param songName The name of the song to request
@@ -106,26 +296,32 @@ public:
     
     /**
      * @brief Start or resume playback of the current song
+     *
+     * After a stop, the part of the song not received yet is fetched again.
      * @return true if successful, false otherwise
      */
     bool play();
     
     /**
-     * @brief Pause playback of the current song
+     * @brief Pause playback of the current song; the server stops sending it
      * @return true if successful, false otherwise
      */
     bool pause();
     
     /**
-     * @brief Stop playback of the current song
+     * @brief Stop playback of the current song and end its transfer
      * @return true if successful, false otherwise
      */
     bool stop();
     
     /**
      * @brief Seek to a specific position in the current song
+     *
+     * A position not received yet is fetched from the server starting
+     * there: the stream in flight is repositioned, or the song requested
+     * again, so the seek takes one round trip and one chunk wherever it lands.
      * @param position The position in seconds to seek to
-     * @return true if successful, false otherwise
+     * @return true if successful (or the refetch was requested), false otherwise
      */
     bool seek(double position);
     
@@ -0,0 +1,392 @@
+#ifndef ADPCM_CODEC_H
+#define ADPCM_CODEC_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "codec_block.h"
+#include "wire_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 4:1 lossy compression of PCM audio for SONG_DATA frames (Codec::ADPCM),
+// for listeners whose link cannot carry the full rate, in the blocks of
+// codec_block.h.
+//
+// A 16-bit mono or stereo block is coded as IMA ADPCM, four bits per
+// sample: each sample's difference from a prediction is quantized against
+// an adaptive step size. The block is split into LANES independent
+// sequences (each channel cut into equal segments), every one starting from
+// an exact sample and its own step size, so the four run side by side in
+// one SSE2 register. Other formats are stored verbatim.
+//
+// An ADPCM block's body is U16 frames, U8 channels, then for each lane its
+// first sample (I16) and step index (U8), then one code per lane for each
+// later sample: two bytes a step, lane 0 in the low nibble of the first.
+//
+// A lane's segment is frames / (LANES / channels) frames, rounded up; the
+// last segment of a block may be shorter, and its lane is padded with its
+// last sample.
+namespace adpcm {
+
+using codec_block::BLOCK_FRAMES;
+using codec_block::MAX_BLOCK_OVERHEAD;
+
+// Block methods
+using codec_block::VERBATIM;
+const uint8_t ADPCM = 1;
+
+// Sequences coded side by side in a block
+const size_t LANES = 4;
+
+namespace detail {
+
+const size_t BLOCK_HEADER_SIZE = codec_block::PREFIX_SIZE + 2 + 1 + LANES * 3;
+const int32_t MAX_INDEX = 88;
+
+// IMA ADPCM quantizer step sizes
+const int32_t STEPS[MAX_INDEX + 1] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+// Lane states, one element per lane
+struct Lanes {
+  int32_t predictor[LANES];
+  int32_t index[LANES];
+};
+
+// Step index to start a lane at: the first step at least as large as its
+// opening sample-to-sample changes, so the quantizer need not ramp up
+inline int32_t startIndex(const int32_t* samples, size_t count) {
+  size_t span = std::min<size_t>(count, 17);
+  int64_t total = 0;
+  for (size_t t = 1; t < span; ++t) {
+    total += std::abs(samples[t * LANES] - samples[(t - 1) * LANES]);
+  }
+  int32_t average = span > 1 ? static_cast<int32_t>(total / static_cast<int64_t>(span - 1)) : 0;
+  int32_t index = 0;
+  while (index < MAX_INDEX && STEPS[index] < average) {
+    ++index;
+  }
+  return index;
+}
+
+// Code samples[t * LANES + lane] for t in [1, steps], updating 'state'
+// and writing LANES codes per step to 'codes'. Both versions produce the
+// same codes.
+inline void encodeLanesPortable(const int32_t* samples, size_t steps, Lanes& state, uint8_t* codes) {
+  for (size_t t = 1; t <= steps; ++t) {
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      int32_t step = STEPS[state.index[lane]];
+      int32_t diff = samples[t * LANES + lane] - state.predictor[lane];
+      uint8_t code = 0;
+      if (diff < 0) {
+        code = 8;
+        diff = -diff;
+      }
+      int32_t delta = step >> 3;
+      if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+      }
+      step >>= 1;
+      if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+      }
+      step >>= 1;
+      if (diff >= step) {
+        code |= 1;
+        delta += step;
+      }
+      int32_t predictor = state.predictor[lane] + ((code & 8) ? -delta : delta);
+      state.predictor[lane] = std::min(std::max(predictor, -32768), 32767);
+      int32_t index = state.index[lane] + ((code & 4) ? 2 * (code & 3) + 2 : -1);
+      state.index[lane] = std::min(std::max(index, 0), MAX_INDEX);
+      *codes++ = code;
+    }
+  }
+}
+
+// Rebuild samples[t * LANES + lane] for t in [1, steps] from 'codes'
+inline void decodeLanesPortable(const uint8_t* codes, size_t steps, Lanes& state, int32_t* samples) {
+  for (size_t t = 1; t <= steps; ++t) {
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      uint8_t code = *codes++;
+      int32_t step = STEPS[state.index[lane]];
+      int32_t delta = step >> 3;
+      if (code & 4) {
+        delta += step;
+      }
+      if (code & 2) {
+        delta += step >> 1;
+      }
+      if (code & 1) {
+        delta += step >> 2;
+      }
+      int32_t predictor = state.predictor[lane] + ((code & 8) ? -delta : delta);
+      state.predictor[lane] = std::min(std::max(predictor, -32768), 32767);
+      int32_t index = state.index[lane] + ((code & 4) ? 2 * (code & 3) + 2 : -1);
+      state.index[lane] = std::min(std::max(index, 0), MAX_INDEX);
+      samples[t * LANES + lane] = state.predictor[lane];
+    }
+  }
+}
+
+#if defined(__SSE2__)
+// The lanes' step sizes; SSE2 has no gather, so they are looked up one by one
+inline __m128i stepsOf(__m128i index) {
+  alignas(16) int32_t indices[LANES];
+  _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+  return _mm_setr_epi32(STEPS[indices[0]], STEPS[indices[1]], STEPS[indices[2]], STEPS[indices[3]]);
+}
+
+// Clamp to the 16-bit range: saturate to 16 bits and sign-extend back
+inline __m128i clampSample(__m128i value) {
+  __m128i packed = _mm_packs_epi32(value, value);
+  return _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+}
+
+// Move the step indices by the codes' magnitudes, within [0, MAX_INDEX]
+inline __m128i adaptIndex(__m128i index, __m128i code) {
+  const __m128i four = _mm_set1_epi32(4);
+  __m128i large = _mm_cmpeq_epi32(_mm_and_si128(code, four), four);
+  __m128i up = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(code, _mm_set1_epi32(3)), 1), _mm_set1_epi32(2));
+  index = _mm_add_epi32(index, _mm_or_si128(_mm_and_si128(large, up), _mm_andnot_si128(large, _mm_set1_epi32(-1))));
+  index = _mm_andnot_si128(_mm_srai_epi32(index, 31), index);
+  __m128i over = _mm_cmpgt_epi32(index, _mm_set1_epi32(MAX_INDEX));
+  return _mm_or_si128(_mm_and_si128(over, _mm_set1_epi32(MAX_INDEX)), _mm_andnot_si128(over, index));
+}
+
+inline void encodeLanesVector(const int32_t* samples, size_t steps, Lanes& state, uint8_t* codes) {
+  __m128i predictor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.predictor));
+  __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.index));
+  const __m128i one = _mm_set1_epi32(1);
+  for (size_t t = 1; t <= steps; ++t) {
+    __m128i step = stepsOf(index);
+    __m128i diff = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + t * LANES)), predictor);
+    __m128i negative = _mm_srai_epi32(diff, 31);
+    diff = _mm_sub_epi32(_mm_xor_si128(diff, negative), negative);
+    __m128i delta = _mm_srai_epi32(step, 3);
+    __m128i code = _mm_and_si128(negative, _mm_set1_epi32(8));
+
+    // Three comparisons against the halving step give the magnitude bits
+    for (int bit = 4; bit >= 1; bit >>= 1) {
+      __m128i fits = _mm_cmpgt_epi32(diff, _mm_sub_epi32(step, one));
+      __m128i taken = _mm_and_si128(fits, step);
+      diff = _mm_sub_epi32(diff, taken);
+      delta = _mm_add_epi32(delta, taken);
+      code = _mm_or_si128(code, _mm_and_si128(fits, _mm_set1_epi32(bit)));
+      step = _mm_srai_epi32(step, 1);
+    }
+
+    predictor = clampSample(_mm_add_epi32(predictor, _mm_sub_epi32(_mm_xor_si128(delta, negative), negative)));
+    index = adaptIndex(index, code);
+
+    // Four codes, one per byte
+    __m128i words = _mm_packs_epi32(code, code);
+    __m128i packed = _mm_packus_epi16(words, words);
+    int32_t bytes = _mm_cvtsi128_si32(packed);
+    memcpy(codes, &bytes, LANES);
+    codes += LANES;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state.predictor), predictor);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state.index), index);
+}
+
+inline void decodeLanesVector(const uint8_t* codes, size_t steps, Lanes& state, int32_t* samples) {
+  __m128i predictor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.predictor));
+  __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.index));
+  const __m128i zero = _mm_setzero_si128();
+  for (size_t t = 1; t <= steps; ++t) {
+    int32_t bytes;
+    memcpy(&bytes, codes, LANES);
+    codes += LANES;
+    __m128i code = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+
+    __m128i step = stepsOf(index);
+    __m128i delta = _mm_srai_epi32(step, 3);
+    for (int bit = 4; bit >= 1; bit >>= 1) {
+      __m128i set = _mm_cmpeq_epi32(_mm_and_si128(code, _mm_set1_epi32(bit)), _mm_set1_epi32(bit));
+      delta = _mm_add_epi32(delta, _mm_and_si128(set, step));
+      step = _mm_srai_epi32(step, 1);
+    }
+    __m128i negative = _mm_cmpeq_epi32(_mm_and_si128(code, _mm_set1_epi32(8)), _mm_set1_epi32(8));
+
+    predictor = clampSample(_mm_add_epi32(predictor, _mm_sub_epi32(_mm_xor_si128(delta, negative), negative)));
+    index = adaptIndex(index, code);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + t * LANES), predictor);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state.predictor), predictor);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state.index), index);
+}
+#else
+inline void encodeLanesVector(const int32_t* samples, size_t steps, Lanes& state, uint8_t* codes) {
+  encodeLanesPortable(samples, steps, state, codes);
+}
+
+inline void decodeLanesVector(const uint8_t* codes, size_t steps, Lanes& state, int32_t* samples) {
+  decodeLanesPortable(codes, steps, state, samples);
+}
+#endif
+
+// Frames per lane for a block of 'frames' frames of 'channels' channels
+inline size_t segmentFrames(size_t frames, size_t channels) {
+  size_t segments = LANES / channels;
+  return (frames + segments - 1) / segments;
+}
+
+// Lane of sample frame 'frame', channel 'channel': channels alternate,
+// then segments follow each other
+inline size_t laneOf(size_t frame, size_t channel, size_t channels, size_t segment) {
+  return (frame / segment) * channels + channel;
+}
+
+} // namespace detail
+
+// Append the encoding of 'size' bytes of PCM (at most BLOCK_FRAMES frames)
+// in the given format to 'out'
+inline void encodeBlock(const char* pcm, size_t size, uint16_t channels, uint16_t bitsPerSample,
+                        std::vector<char>& out) {
+  using namespace detail;
+  using codec_block::appendVerbatim;
+  size_t frameSize = size_t(channels) * (bitsPerSample / 8);
+  if (bitsPerSample != 16 || (channels != 1 && channels != 2) || size == 0 || size % frameSize != 0 ||
+      size / frameSize > BLOCK_FRAMES) {
+    appendVerbatim(pcm, size, out);
+    return;
+  }
+  size_t frames = size / frameSize;
+  size_t segment = segmentFrames(frames, channels);
+  size_t steps = segment - 1;
+
+  // Short blocks cost more as ADPCM than as they are
+  size_t bodySize = BLOCK_HEADER_SIZE - 4 + steps * LANES / 2;
+  if (bodySize >= size + 1) {
+    appendVerbatim(pcm, size, out);
+    return;
+  }
+
+  // Lay the samples out lane by lane, padding short lanes with their last sample
+  std::vector<int32_t> samples(segment * LANES, 0);
+  for (size_t frame = 0; frame < frames; ++frame) {
+    for (size_t channel = 0; channel < channels; ++channel) {
+      size_t lane = laneOf(frame, channel, channels, segment);
+      int16_t sample = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm + (frame * channels + channel) * 2));
+      samples[(frame % segment) * LANES + lane] = sample;
+    }
+  }
+  for (size_t lane = 0; lane < LANES; ++lane) {
+    size_t first = (lane / channels) * segment;
+    size_t length = first < frames ? std::min(segment, frames - first) : 0;
+    int32_t last = length > 0 ? samples[(length - 1) * LANES + lane] : 0;
+    for (size_t t = length; t < segment; ++t) {
+      samples[t * LANES + lane] = last;
+    }
+  }
+
+  size_t start = out.size();
+  out.resize(start + 4 + bodySize);
+  char* header = out.data() + start;
+  codec_block::writePrefix(header, bodySize, ADPCM);
+  wire::storeLE(header + 5, static_cast<uint16_t>(frames));
+  header[7] = static_cast<char>(channels);
+
+  Lanes state;
+  for (size_t lane = 0; lane < LANES; ++lane) {
+    state.predictor[lane] = samples[lane];
+    state.index[lane] = startIndex(samples.data() + lane, segment);
+    char* laneHeader = header + 8 + lane * 3;
+    wire::storeLE(laneHeader, static_cast<uint16_t>(state.predictor[lane]));
+    laneHeader[2] = static_cast<char>(state.index[lane]);
+  }
+
+  // Code the lanes, then pack two codes a byte
+  std::vector<uint8_t> codes(steps * LANES);
+  encodeLanesVector(samples.data(), steps, state, codes.data());
+  char* packed = header + BLOCK_HEADER_SIZE;
+  for (size_t i = 0; i < codes.size(); i += 2) {
+    *packed++ = static_cast<char>(codes[i] | (codes[i + 1] << 4));
+  }
+}
+
+// Decode the blocks in [data, data + size), appending their PCM to 'pcm';
+// false if they are malformed
+inline bool decode(const char* data, size_t size, std::vector<char>& pcm) {
+  using namespace detail;
+  std::vector<int32_t> samples;
+  std::vector<uint8_t> codes;
+  while (size > 0) {
+    uint8_t method;
+    const char* body;
+    size_t bodyBytes;
+    if (!codec_block::nextBlock(data, size, method, body, bodyBytes)) {
+      return false;
+    }
+    if (method == VERBATIM) {
+      pcm.insert(pcm.end(), body, body + bodyBytes);
+      continue;
+    }
+    if (method != ADPCM || bodyBytes < BLOCK_HEADER_SIZE - codec_block::PREFIX_SIZE) {
+      return false;
+    }
+    size_t frames = wire::loadLE<uint16_t>(body);
+    size_t channels = static_cast<uint8_t>(body[2]);
+    if (frames == 0 || frames > BLOCK_FRAMES || (channels != 1 && channels != 2)) {
+      return false;
+    }
+    size_t segment = segmentFrames(frames, channels);
+    size_t steps = segment - 1;
+    if (bodyBytes != BLOCK_HEADER_SIZE - codec_block::PREFIX_SIZE + steps * LANES / 2) {
+      return false;
+    }
+
+    samples.resize(segment * LANES);
+    Lanes state;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      const char* laneHeader = body + 3 + lane * 3;
+      state.predictor[lane] = static_cast<int16_t>(wire::loadLE<uint16_t>(laneHeader));
+      state.index[lane] = static_cast<uint8_t>(laneHeader[2]);
+      if (state.index[lane] > MAX_INDEX) {
+        return false;
+      }
+      samples[lane] = state.predictor[lane];
+    }
+
+    codes.resize(steps * LANES);
+    const char* packed = body + BLOCK_HEADER_SIZE - codec_block::PREFIX_SIZE;
+    for (size_t i = 0; i < codes.size(); i += 2) {
+      uint8_t byte = static_cast<uint8_t>(*packed++);
+      codes[i] = byte & 0x0F;
+      codes[i + 1] = byte >> 4;
+    }
+    decodeLanesVector(codes.data(), steps, state, samples.data());
+
+    size_t offset = pcm.size();
+    pcm.resize(offset + frames * channels * 2);
+    char* out = pcm.data() + offset;
+    for (size_t frame = 0; frame < frames; ++frame) {
+      for (size_t channel = 0; channel < channels; ++channel) {
+        size_t lane = laneOf(frame, channel, channels, segment);
+        wire::storeLE(out, static_cast<uint16_t>(samples[(frame % segment) * LANES + lane]));
+        out += 2;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace adpcm
+
+#endif // ADPCM_CODEC_H
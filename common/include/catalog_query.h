@@ -0,0 +1,131 @@
+#ifndef CATALOG_QUERY_H
+#define CATALOG_QUERY_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "protocol.h"
+
+// Paged search and browsing of the song catalog, for libraries too large
+// to send as one list.
+//
+//   SEARCH_REQUEST   SearchRequestMessage: paging, then the search text
+//   BROWSE_REQUEST   BrowseRequestMessage: paging, then a directory ("" for
+//                    the top level)
+//   SEARCH_RESPONSE / BROWSE_RESPONSE
+//                    QueryPageMessage: the page, then 'count' entries,
+//                    each a QueryEntrySchema followed by the name
+//
+// Search matches whole words of the song path, the last word of the query
+// as a prefix, and returns the best matches first. Browse lists a
+// directory's subdirectories and songs in name order; song names in a
+// BROWSE_RESPONSE are relative to the directory, in a SEARCH_RESPONSE
+// they are full paths.
+
+// Entries per page the server returns at most
+const uint16_t MAX_QUERY_PAGE = 100;
+
+// Entries to skip, entries wanted (capped at MAX_QUERY_PAGE), then the text
+template<MessageType TYPE>
+using QueryRequestMessage = Message<TYPE, wire::U32, wire::U16, wire::Tail>;
+using SearchRequestMessage = QueryRequestMessage<MessageType::SEARCH_REQUEST>;
+using BrowseRequestMessage = QueryRequestMessage<MessageType::BROWSE_REQUEST>;
+
+enum QueryPageFlags : uint8_t {
+  QUERY_MORE = 1,       // Entries follow this page
+  QUERY_TRUNCATED = 2   // Search stopped at its work limit; refine the query
+};
+
+// The catalog version the page was taken from, the offset of its first
+// entry, the entry count and QueryPageFlags, then the entries
+template<MessageType TYPE>
+using QueryPageMessage = Message<TYPE, wire::U64, wire::U32, wire::U16, wire::U8, wire::Tail>;
+using SearchResponseMessage = QueryPageMessage<MessageType::SEARCH_RESPONSE>;
+using BrowseResponseMessage = QueryPageMessage<MessageType::BROWSE_RESPONSE>;
+
+enum class QueryEntryKind : uint8_t {
+  SONG,
+  DIRECTORY
+};
+
+// An entry's kind, its value (SONG: duration in milliseconds; DIRECTORY:
+// songs below it) and the length of the name that follows
+using QueryEntrySchema = wire::Schema<wire::Enum<QueryEntryKind>, wire::U32, wire::U32>;
+
+// A decoded page's fields before its entries
+struct QueryPageHeader {
+  uint64_t version = 0;
+  uint32_t offset = 0;
+  uint16_t count = 0;
+  uint8_t flags = 0;
+};
+
+// One decoded entry of a page
+struct QueryEntry {
+  QueryEntryKind kind;
+  uint32_t value;
+  std::string name;
+};
+
+// SEARCH_REQUEST or BROWSE_REQUEST payload (both have the same layout)
+inline std::vector<char> encodeQueryRequest(uint32_t offset, uint16_t limit, std::string_view text) {
+  std::vector<char> payload(SearchRequestMessage::payloadSize(offset, limit, text));
+  SearchRequestMessage::encodePayload(payload.data(), offset, limit, text);
+  return payload;
+}
+
+// Start a response page; fill in the count and flags with finishQueryPage()
+inline void beginQueryPage(std::vector<char>& payload, uint64_t version, uint32_t offset) {
+  payload.resize(SearchResponseMessage::MIN_SIZE);
+  SearchResponseMessage::encodePayload(payload.data(), version, offset, uint16_t(0), uint8_t(0), std::string_view());
+}
+
+inline void appendQueryEntry(std::vector<char>& payload, QueryEntryKind kind, uint32_t value,
+                             std::string_view name) {
+  size_t offset = payload.size();
+  payload.resize(offset + QueryEntrySchema::MIN_SIZE + name.size());
+  char* out = QueryEntrySchema::encodePayload(payload.data() + offset, kind, value,
+                                              static_cast<uint32_t>(name.size()));
+  memcpy(out, name.data(), name.size());
+}
+
+inline void finishQueryPage(std::vector<char>& payload, uint16_t count, uint8_t flags) {
+  uint64_t version = 0;
+  uint32_t offset = 0;
+  uint16_t unusedCount;
+  uint8_t unusedFlags;
+  std::string_view entries;
+  SearchResponseMessage::decode(std::string_view(payload.data(), payload.size()), version, offset, unusedCount,
+                                unusedFlags, entries);
+  SearchResponseMessage::encodePayload(payload.data(), version, offset, count, flags, std::string_view());
+}
+
+// Decode a SEARCH_RESPONSE or BROWSE_RESPONSE; false if it is malformed
+inline bool decodeQueryPage(const char* data, size_t size, QueryPageHeader& header,
+                            std::vector<QueryEntry>& entries) {
+  std::string_view rest;
+  if (!SearchResponseMessage::decode(std::string_view(data, size), header.version, header.offset, header.count,
+                                     header.flags, rest)) {
+    return false;
+  }
+  entries.clear();
+  for (uint16_t i = 0; i < header.count; ++i) {
+    QueryEntry entry;
+    uint32_t nameLength;
+    if (!QueryEntrySchema::decode(rest, entry.kind, entry.value, nameLength)) {
+      return false;
+    }
+    rest.remove_prefix(QueryEntrySchema::MIN_SIZE);
+    if (rest.size() < nameLength) {
+      return false;
+    }
+    entry.name.assign(rest.data(), nameLength);
+    rest.remove_prefix(nameLength);
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+#endif // CATALOG_QUERY_H
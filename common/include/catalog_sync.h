@@ -0,0 +1,202 @@
+#ifndef CATALOG_SYNC_H
+#define CATALOG_SYNC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "protocol.h"
+
+// Incremental song list sync. A client that kept the list from an earlier
+// connection sends its version in LIST_REQUEST and gets back one of:
+//
+//   LIST_NOT_MODIFIED  the copy is current
+//   LIST_DELTA         the names removed and added since its version
+//   LIST_SNAPSHOT      every name
+//
+// A LIST_REQUEST without a payload still gets the plain LIST_RESPONSE.
+//
+// Versions identify the list contents (a hash of the names), so a copy
+// stays valid across server restarts as long as the songs are the same.
+// Name lists are sorted and front-coded: each name is stored as the length
+// of the prefix it shares with the previous name, then the length and
+// bytes of the rest, both lengths as LEB128 varints. Deep album paths
+// share most of their bytes with their neighbours.
+
+// Version 0 means "no copy"
+const uint64_t NO_LIST_VERSION = 0;
+
+// The version of the client's copy of the list
+using ListSyncRequestMessage = Message<MessageType::LIST_REQUEST, wire::U64>;
+
+// The version the client's copy already has
+using ListNotModifiedMessage = Message<MessageType::LIST_NOT_MODIFIED, wire::U64>;
+
+// The list's version and name count, then the names, front-coded
+using ListSnapshotMessage = Message<MessageType::LIST_SNAPSHOT, wire::U64, wire::U32, wire::Tail>;
+
+// The version the delta starts from and the one it brings the list to, the
+// counts of removed and added names, then both name lists, front-coded
+using ListDeltaMessage = Message<MessageType::LIST_DELTA, wire::U64, wire::U64, wire::U32, wire::U32, wire::Tail>;
+
+// A decoded LIST_DELTA's versions
+struct ListDeltaHeader {
+  uint64_t fromVersion = NO_LIST_VERSION;
+  uint64_t toVersion = NO_LIST_VERSION;
+};
+
+// Version of a list from its LIST_RESPONSE payload (FNV-1a, never 0)
+inline uint64_t listVersion(std::string_view listPayload) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : listPayload) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash == NO_LIST_VERSION ? 1 : hash;
+}
+
+inline void appendVarint(std::vector<char>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline bool readVarint(const char*& position, const char* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && position < end; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*position++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Front-codes names in the order given (sorted input compresses best).
+// Call append() once per name; 'previous' is the last name appended.
+class FrontCoder {
+public:
+  explicit FrontCoder(std::vector<char>& output) : out(output) {}
+
+  void append(std::string_view name) {
+    size_t shared = 0;
+    size_t limit = std::min(previous.size(), name.size());
+    while (shared < limit && previous[shared] == name[shared]) {
+      ++shared;
+    }
+    appendVarint(out, shared);
+    appendVarint(out, name.size() - shared);
+    out.insert(out.end(), name.begin() + shared, name.end());
+    previous = name;
+  }
+
+private:
+  std::vector<char>& out;
+  std::string_view previous;  // Views the caller's names, which outlive the coder
+};
+
+// Decode 'count' front-coded names; false if the data is truncated or corrupt
+inline bool readFrontCoded(const char*& position, const char* end, uint32_t count,
+                           std::vector<std::string>& names) {
+  std::string previous;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint64_t shared, length;
+    if (!readVarint(position, end, shared) || !readVarint(position, end, length) ||
+        shared > previous.size() || length > static_cast<uint64_t>(end - position)) {
+      return false;
+    }
+    previous.resize(shared);
+    previous.append(position, length);
+    position += length;
+    names.push_back(previous);
+  }
+  return true;
+}
+
+// LIST_SNAPSHOT payload for sorted names
+template<typename String>
+inline std::vector<char> encodeListSnapshot(uint64_t version, const std::vector<String>& names) {
+  // The names follow the fixed fields, which are written around them
+  std::vector<char> payload(ListSnapshotMessage::MIN_SIZE);
+  FrontCoder coder(payload);
+  for (const auto& name : names) {
+    coder.append(name);
+  }
+  ListSnapshotMessage::encodePayload(payload.data(), version, static_cast<uint32_t>(names.size()),
+                                     std::string_view());
+  return payload;
+}
+
+inline bool decodeListSnapshot(const char* data, size_t size, uint64_t& version,
+                               std::vector<std::string>& names) {
+  uint64_t listVersion;
+  uint32_t count;
+  std::string_view coded;
+  if (!ListSnapshotMessage::decode(std::string_view(data, size), listVersion, count, coded)) {
+    return false;
+  }
+  const char* position = coded.data();
+  names.clear();
+  names.reserve(std::min<size_t>(count, size));
+  if (!readFrontCoded(position, coded.data() + coded.size(), count, names)) {
+    return false;
+  }
+  version = listVersion;
+  return true;
+}
+
+// LIST_DELTA payload; both name lists sorted
+template<typename String>
+inline std::vector<char> encodeListDelta(uint64_t fromVersion, uint64_t toVersion,
+                                         const std::vector<String>& removed,
+                                         const std::vector<String>& added) {
+  std::vector<char> payload(ListDeltaMessage::MIN_SIZE);
+  FrontCoder removedCoder(payload);
+  for (const auto& name : removed) {
+    removedCoder.append(name);
+  }
+  FrontCoder addedCoder(payload);
+  for (const auto& name : added) {
+    addedCoder.append(name);
+  }
+  ListDeltaMessage::encodePayload(payload.data(), fromVersion, toVersion, static_cast<uint32_t>(removed.size()),
+                                  static_cast<uint32_t>(added.size()), std::string_view());
+  return payload;
+}
+
+inline bool decodeListDelta(const char* data, size_t size, ListDeltaHeader& delta,
+                            std::vector<std::string>& removed, std::vector<std::string>& added) {
+  uint32_t removedCount;
+  uint32_t addedCount;
+  std::string_view coded;
+  if (!ListDeltaMessage::decode(std::string_view(data, size), delta.fromVersion, delta.toVersion, removedCount,
+                                addedCount, coded)) {
+    return false;
+  }
+  const char* position = coded.data();
+  const char* end = coded.data() + coded.size();
+  return readFrontCoded(position, end, removedCount, removed) &&
+         readFrontCoded(position, end, addedCount, added);
+}
+
+// Apply a delta to a sorted list, keeping it sorted
+inline std::vector<std::string> applyListDelta(const std::vector<std::string>& names,
+                                               const std::vector<std::string>& removed,
+                                               const std::vector<std::string>& added) {
+  std::vector<std::string> kept;
+  kept.reserve(names.size());
+  std::set_difference(names.begin(), names.end(), removed.begin(), removed.end(),
+                      std::back_inserter(kept));
+  std::vector<std::string> result;
+  result.reserve(kept.size() + added.size());
+  std::set_union(kept.begin(), kept.end(), added.begin(), added.end(), std::back_inserter(result));
+  return result;
+}
+
+#endif // CATALOG_SYNC_H
@@ -0,0 +1,68 @@
+#ifndef CODEC_BLOCK_H
+#define CODEC_BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "wire_codec.h"
+
+// Block framing shared by the SONG_DATA codecs (lossless_codec.h and
+// adpcm_codec.h).
+//
+// Audio is cut into blocks of up to BLOCK_FRAMES sample frames, each
+// encoded on its own, so a song's blocks can be encoded once and sent to
+// every listener. A block is its size, then a method byte:
+//   U32 size     bytes of the block after this field
+//   U8 method    VERBATIM: the PCM bytes follow as they are; other methods
+//                are the codec's own
+namespace codec_block {
+
+// Sample frames per block
+const size_t BLOCK_FRAMES = 4096;
+
+// Bytes of a block before its body: the size and the method
+const size_t PREFIX_SIZE = 4 + 1;
+
+// Most bytes encoding adds to a block: one its codec cannot shrink is
+// stored verbatim behind its size and method
+const size_t MAX_BLOCK_OVERHEAD = PREFIX_SIZE;
+
+// Method of a block stored as it is
+const uint8_t VERBATIM = 0;
+
+// Write the size (the bytes after the size field) and method of a block
+inline void writePrefix(char* block, size_t size, uint8_t method) {
+  wire::storeLE(block, static_cast<uint32_t>(size));
+  block[4] = static_cast<char>(method);
+}
+
+// Append 'size' bytes of PCM to 'out' as a VERBATIM block
+inline void appendVerbatim(const char* pcm, size_t size, std::vector<char>& out) {
+  char prefix[PREFIX_SIZE];
+  writePrefix(prefix, size + 1, VERBATIM);
+  out.insert(out.end(), prefix, prefix + sizeof(prefix));
+  out.insert(out.end(), pcm, pcm + size);
+}
+
+// Take the first block off [data, data + size), advancing past it, and
+// find its method and body (the bytes after the method); false if the
+// block is cut short
+inline bool nextBlock(const char*& data, size_t& size, uint8_t& method, const char*& body, size_t& bodyBytes) {
+  if (size < PREFIX_SIZE) {
+    return false;
+  }
+  size_t blockSize = wire::loadLE<uint32_t>(data);
+  if (blockSize < 1 || blockSize > size - 4) {
+    return false;
+  }
+  method = static_cast<uint8_t>(data[4]);
+  body = data + PREFIX_SIZE;
+  bodyBytes = blockSize - 1;
+  data += 4 + blockSize;
+  size -= 4 + blockSize;
+  return true;
+}
+
+} // namespace codec_block
+
+#endif // CODEC_BLOCK_H
@@ -0,0 +1,174 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+// CRC-32C (Castagnoli), the checksum of each SONG_DATA frame's audio. It
+// runs on the CPU's CRC instruction where there is one: SSE4.2 on x86-64,
+// detected at run time, or the ARMv8 CRC extension when compiled for it.
+// Elsewhere a slicing-by-8 table computes the same value.
+namespace crc32c {
+
+namespace detail {
+
+// The polynomial, bit-reflected
+constexpr uint32_t POLYNOMIAL = 0x82F63B78;
+
+// TABLES[k][b] is the CRC of byte b followed by k zero bytes
+constexpr std::array<std::array<uint32_t, 256>, 8> makeTables() {
+  std::array<std::array<uint32_t, 256>, 8> tables{};
+  for (uint32_t b = 0; b < 256; ++b) {
+    uint32_t crc = b;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (POLYNOMIAL & (0u - (crc & 1)));
+    }
+    tables[0][b] = crc;
+  }
+  for (size_t k = 1; k < 8; ++k) {
+    for (uint32_t b = 0; b < 256; ++b) {
+      tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+    }
+  }
+  return tables;
+}
+
+inline constexpr std::array<std::array<uint32_t, 256>, 8> TABLES = makeTables();
+
+// The update steps work on the CRC register, i.e. without the final
+// inversion
+
+inline uint32_t updateTable(uint32_t crc, const char* data, size_t size) {
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+  while (size >= 8) {
+    uint32_t low = (in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24)) ^ crc;
+    crc = TABLES[7][low & 0xFF] ^ TABLES[6][(low >> 8) & 0xFF] ^ TABLES[5][(low >> 16) & 0xFF] ^
+          TABLES[4][low >> 24] ^ TABLES[3][in[4]] ^ TABLES[2][in[5]] ^ TABLES[1][in[6]] ^ TABLES[0][in[7]];
+    in += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *in++) & 0xFF];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t updateHardware(uint32_t crc, const char* data, size_t size) {
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (size-- > 0) {
+    crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data++));
+  }
+  return crc;
+}
+
+inline bool hasHardware() {
+  static const bool supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+}
+#elif defined(CRC32C_ARM)
+inline uint32_t updateHardware(uint32_t crc, const char* data, size_t size) {
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+    data += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = __crc32cb(crc, static_cast<uint8_t>(*data++));
+  }
+  return crc;
+}
+
+inline bool hasHardware() { return true; }
+#else
+inline uint32_t updateHardware(uint32_t crc, const char* data, size_t size) {
+  return updateTable(crc, data, size);
+}
+
+inline bool hasHardware() { return false; }
+#endif
+
+// a * b modulo the polynomial, both bit-reflected (a must not be 0)
+constexpr uint32_t multiplyModulo(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31;
+  uint32_t product = 0;
+  while (true) {
+    if (a & m) {
+      product ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+  }
+  return product;
+}
+
+// POWERS[k] is x^(2^k) modulo the polynomial
+constexpr std::array<uint32_t, 32> makePowers() {
+  std::array<uint32_t, 32> powers{};
+  uint32_t power = 1u << 30;  // x^1
+  for (size_t k = 0; k < 32; ++k) {
+    powers[k] = power;
+    power = multiplyModulo(power, power);
+  }
+  return powers;
+}
+
+inline constexpr std::array<uint32_t, 32> POWERS = makePowers();
+
+// x^(8 * size) modulo the polynomial: appending 'size' zero bytes
+inline uint32_t shiftOperator(size_t size) {
+  uint32_t result = 1u << 31;  // x^0
+  for (size_t k = 3; size > 0; size >>= 1, ++k) {
+    if (size & 1) {
+      result = multiplyModulo(POWERS[k & 31], result);
+    }
+  }
+  return result;
+}
+
+} // namespace detail
+
+// Continue 'crc', the checksum of earlier bytes (0 before any), over
+// [data, data + size)
+inline uint32_t extend(uint32_t crc, const char* data, size_t size) {
+  crc = ~crc;
+  crc = detail::hasHardware() ? detail::updateHardware(crc, data, size) : detail::updateTable(crc, data, size);
+  return ~crc;
+}
+
+// Checksum of [data, data + size)
+inline uint32_t compute(const char* data, size_t size) {
+  return extend(0, data, size);
+}
+
+// Checksum of A followed by B, from the checksums of both and B's size,
+// without the bytes
+inline uint32_t combine(uint32_t crcA, uint32_t crcB, size_t sizeB) {
+  return detail::multiplyModulo(detail::shiftOperator(sizeB), crcA) ^ crcB;
+}
+
+} // namespace crc32c
+
+#endif // CRC32C_H
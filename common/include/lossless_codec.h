@@ -0,0 +1,645 @@
+#ifndef LOSSLESS_CODEC_H
+#define LOSSLESS_CODEC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "codec_block.h"
+#include "wire_codec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Lossless compression of PCM audio for SONG_DATA frames (Codec::LOSSLESS),
+// in the blocks of codec_block.h.
+//
+// A 16-bit mono or stereo block is compressed the way FLAC does it: the two
+// channels are decorrelated (left/right, left/side, right/side or mid/side,
+// whichever is cheapest), each channel is predicted from its previous
+// samples by a fixed polynomial or a quantized LPC filter, and the
+// prediction errors are Rice-coded in partitions that each pick their own
+// parameter. Other formats, and trailing bytes that do not
+// make up a whole frame, are stored verbatim.
+//
+// A COMPRESSED block's body is U16 frames, U8 channels, U8 stereo mode,
+// then a bitstream (most significant bit first) with one subframe per
+// channel.
+//
+// Deinterleaving, channel decorrelation, fixed prediction and the final
+// interleaving run four samples at a time with SSE2 where the compiler
+// targets it; elsewhere the same plain loops are left to the compiler.
+namespace lossless {
+
+using codec_block::BLOCK_FRAMES;
+using codec_block::MAX_BLOCK_OVERHEAD;
+
+// Block methods
+using codec_block::VERBATIM;
+const uint8_t COMPRESSED = 1;
+
+// Stereo modes: which two channels a stereo block stores
+const uint8_t LEFT_RIGHT = 0;
+const uint8_t LEFT_SIDE = 1;
+const uint8_t RIGHT_SIDE = 2;
+const uint8_t MID_SIDE = 3;
+
+namespace detail {
+
+// Subframe types; 0-4 are fixed predictors of that order
+const uint8_t CONSTANT = 0xFE;
+const uint8_t LPC = 0x20;  // | order
+
+const size_t MAX_FIXED_ORDER = 4;
+const size_t LPC_ORDER = 8;
+const unsigned LPC_PRECISION = 12;  // Bits per quantized coefficient, sign included
+const size_t PARTITION_SIZE = 256;  // Residuals per Rice parameter
+const unsigned RICE_ESCAPE = 32;    // Quotients this large are stored raw
+const size_t BLOCK_HEADER_SIZE = codec_block::PREFIX_SIZE + 2 + 1 + 1;
+
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<char>& output) : out(output), accumulator(0), pending(0) {}
+
+  // Append the low 'count' bits of 'value' (count <= 32)
+  void write(uint32_t value, unsigned count) {
+    accumulator = (accumulator << count) | (value & ((uint64_t(1) << count) - 1));
+    pending += count;
+    while (pending >= 8) {
+      pending -= 8;
+      out.push_back(static_cast<char>(accumulator >> pending));
+    }
+  }
+
+  // Pad the last byte with zeros
+  void flush() {
+    if (pending > 0) {
+      out.push_back(static_cast<char>(accumulator << (8 - pending)));
+      pending = 0;
+    }
+  }
+
+private:
+  std::vector<char>& out;
+  uint64_t accumulator;
+  unsigned pending;
+};
+
+class BitReader {
+public:
+  BitReader(const char* data, size_t size)
+      : in(reinterpret_cast<const unsigned char*>(data)),
+        end(in + size),
+        accumulator(0),
+        available(0),
+        padding(0) {}
+
+  uint32_t read(unsigned count) {
+    refill();
+    available -= count;
+    return static_cast<uint32_t>((accumulator >> available) & ((uint64_t(1) << count) - 1));
+  }
+
+  // Count zero bits up to 'limit', consuming the one that ends them unless
+  // 'limit' was reached first
+  unsigned readZeros(unsigned limit) {
+    refill();
+    uint64_t window = accumulator << (64 - available);
+    unsigned zeros = window == 0 ? 64 : static_cast<unsigned>(__builtin_clzll(window));
+    if (zeros >= limit) {
+      available -= limit;
+      return limit;
+    }
+    available -= zeros + 1;
+    return zeros;
+  }
+
+  // Whether more bits were read than the data holds
+  bool overrun() const { return available < padding; }
+
+private:
+  const unsigned char* in;
+  const unsigned char* end;
+  uint64_t accumulator;
+  unsigned available;  // Unread bits at the bottom of the accumulator
+  unsigned padding;    // Zero bits added past the end of the data
+
+  void refill() {
+    while (available <= 56) {
+      unsigned char byte = 0;
+      if (in < end) {
+        byte = *in++;
+      } else if (padding < 64) {
+        padding += 8;
+      }
+      accumulator = (accumulator << 8) | byte;
+      available += 8;
+    }
+  }
+};
+
+inline uint32_t zigzag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+// Split interleaved 16-bit stereo into left and right
+inline void deinterleaveStereo(const char* pcm, size_t frames, int32_t* left, int32_t* right) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= frames; i += 4) {
+    __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + i * 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(left + i), _mm_srai_epi32(_mm_slli_epi32(samples, 16), 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(right + i), _mm_srai_epi32(samples, 16));
+  }
+#endif
+  for (; i < frames; ++i) {
+    left[i] = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm + i * 4));
+    right[i] = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm + i * 4 + 2));
+  }
+}
+
+inline void readMono(const char* pcm, size_t frames, int32_t* samples) {
+  for (size_t i = 0; i < frames; ++i) {
+    samples[i] = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm + i * 2));
+  }
+}
+
+// mid = (left + right) >> 1, side = left - right
+inline void midSide(const int32_t* left, const int32_t* right, size_t count, int32_t* mid, int32_t* side) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mid + i), _mm_srai_epi32(_mm_add_epi32(l, r), 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(side + i), _mm_sub_epi32(l, r));
+  }
+#endif
+  for (; i < count; ++i) {
+    mid[i] = (left[i] + right[i]) >> 1;
+    side[i] = left[i] - right[i];
+  }
+}
+
+// out[i] = in[i] - in[i - 1] for i in [from, count)
+inline void difference(const int32_t* in, int32_t* out, size_t from, size_t count) {
+  size_t i = from;
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i - 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi32(current, previous));
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = in[i] - in[i - 1];
+  }
+}
+
+// Sum of |values[i]| for i in [from, count)
+inline uint64_t sumAbs(const int32_t* values, size_t from, size_t count) {
+  uint64_t total = 0;
+  size_t i = from;
+#if defined(__SSE2__)
+  // Each lane adds up at most 256 values of under 2^22 before they are totalled
+  while (i + 4 <= count) {
+    size_t stop = std::min(count - (count - i) % 4, i + 1024);
+    __m128i lanes = _mm_setzero_si128();
+    for (; i < stop; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+      __m128i sign = _mm_srai_epi32(v, 31);
+      lanes = _mm_add_epi32(lanes, _mm_sub_epi32(_mm_xor_si128(v, sign), sign));
+    }
+    uint32_t parts[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(parts), lanes);
+    total += uint64_t(parts[0]) + parts[1] + parts[2] + parts[3];
+  }
+#endif
+  for (; i < count; ++i) {
+    total += static_cast<uint64_t>(values[i] < 0 ? -int64_t(values[i]) : values[i]);
+  }
+  return total;
+}
+
+// How one channel of a block is predicted
+struct Predictor {
+  uint8_t type = 0;
+  size_t order = 0;
+  unsigned shift = 0;
+  int32_t coefficients[LPC_ORDER] = {};
+  uint64_t cost = UINT64_MAX;  // Sum of |residual|, an estimate of its coded size
+};
+
+// Quantized LPC of 'order' for 'x', or a predictor with cost UINT64_MAX if
+// the signal does not suit one
+inline Predictor fitLpc(const int32_t* x, size_t count, size_t order, int32_t* residual) {
+  Predictor best;
+  if (count <= order * 4) {
+    return best;
+  }
+
+  // Autocorrelation; a touch of extra energy at lag 0 keeps the recursion
+  // stable on near-silent blocks
+  double autocorrelation[LPC_ORDER + 1];
+  for (size_t lag = 0; lag <= order; ++lag) {
+    double sum = 0;
+    for (size_t i = lag; i < count; ++i) {
+      sum += static_cast<double>(x[i]) * x[i - lag];
+    }
+    autocorrelation[lag] = sum;
+  }
+  if (autocorrelation[0] <= 0) {
+    return best;
+  }
+  autocorrelation[0] *= 1.0 + 1e-9;
+
+  // Levinson-Durbin recursion
+  double lpc[LPC_ORDER] = {};
+  double error = autocorrelation[0];
+  for (size_t i = 0; i < order; ++i) {
+    double reflection = autocorrelation[i + 1];
+    for (size_t j = 0; j < i; ++j) {
+      reflection -= lpc[j] * autocorrelation[i - j];
+    }
+    reflection /= error;
+    double previous[LPC_ORDER];
+    std::copy(lpc, lpc + i, previous);
+    for (size_t j = 0; j < i; ++j) {
+      lpc[j] = previous[j] - reflection * previous[i - 1 - j];
+    }
+    lpc[i] = reflection;
+    error *= 1.0 - reflection * reflection;
+    if (error <= 0) {
+      return best;
+    }
+  }
+
+  // Quantize with the largest shift that keeps every coefficient in range,
+  // carrying each rounding error into the next coefficient
+  double largest = 0;
+  for (size_t i = 0; i < order; ++i) {
+    largest = std::max(largest, std::fabs(lpc[i]));
+  }
+  if (largest == 0) {
+    return best;
+  }
+  const int32_t limit = (1 << (LPC_PRECISION - 1)) - 1;
+  int shift = static_cast<int>(LPC_PRECISION) - 1 - static_cast<int>(std::floor(std::log2(largest))) - 1;
+  shift = std::clamp(shift, 0, 15);
+  double carry = 0;
+  for (size_t i = 0; i < order; ++i) {
+    double scaled = lpc[i] * static_cast<double>(1 << shift) + carry;
+    int32_t q = std::clamp(static_cast<int32_t>(std::lround(scaled)), -limit, limit);
+    carry = scaled - q;
+    best.coefficients[i] = q;
+  }
+  best.type = static_cast<uint8_t>(LPC | order);
+  best.order = order;
+  best.shift = static_cast<unsigned>(shift);
+
+  uint64_t cost = 0;
+  for (size_t i = order; i < count; ++i) {
+    int64_t prediction = 0;
+    for (size_t j = 0; j < order; ++j) {
+      prediction += int64_t(best.coefficients[j]) * x[i - 1 - j];
+    }
+    int64_t e = x[i] - (prediction >> shift);
+    if (e > (1 << 28) || e < -(1 << 28)) {
+      best.cost = UINT64_MAX;
+      return best;
+    }
+    residual[i] = static_cast<int32_t>(e);
+    cost += static_cast<uint64_t>(e < 0 ? -e : e);
+  }
+  best.cost = cost;
+  return best;
+}
+
+// Rice-code residual[order, count) in partitions
+inline void writeResidual(BitWriter& bits, const int32_t* residual, size_t order, size_t count) {
+  for (size_t start = order; start < count; start += PARTITION_SIZE) {
+    size_t stop = std::min(start + PARTITION_SIZE, count);
+    uint64_t sum = 0;
+    for (size_t i = start; i < stop; ++i) {
+      sum += zigzag(residual[i]);
+    }
+    // The parameter near log2 of the mean codes a geometric source best
+    uint64_t n = stop - start;
+    unsigned k = 0;
+    while (k < 30 && (n << (k + 1)) <= sum) {
+      ++k;
+    }
+    bits.write(k, 5);
+    for (size_t i = start; i < stop; ++i) {
+      uint32_t u = zigzag(residual[i]);
+      uint32_t quotient = u >> k;
+      if (quotient < RICE_ESCAPE) {
+        bits.write(1, quotient + 1);
+        if (k > 0) {
+          bits.write(u, k);
+        }
+      } else {
+        bits.write(0, RICE_ESCAPE);
+        bits.write(u, 32);
+      }
+    }
+  }
+}
+
+// Pick and write the subframe of one channel; 'work' holds 3 * count values
+inline void writeSubframe(BitWriter& bits, const int32_t* x, size_t count, int32_t* work) {
+  bool constant = true;
+  for (size_t i = 1; i < count && constant; ++i) {
+    constant = x[i] == x[0];
+  }
+  if (constant) {
+    bits.write(CONSTANT, 8);
+    bits.write(static_cast<uint32_t>(x[0]), 32);
+    return;
+  }
+
+  // Fixed predictors: order k's residual is the k-th difference
+  int32_t* orders[2] = {work, work + count};
+  int32_t* lpcResidual = work + 2 * count;
+  Predictor best;
+  best.type = 0;
+  best.cost = sumAbs(x, 0, count);
+  const int32_t* previous = x;
+  for (size_t order = 1; order <= MAX_FIXED_ORDER && order < count; ++order) {
+    int32_t* current = orders[order % 2];
+    difference(previous, current, order, count);
+    uint64_t cost = sumAbs(current, order, count);
+    if (cost < best.cost) {
+      best.type = static_cast<uint8_t>(order);
+      best.order = order;
+      best.cost = cost;
+    }
+    previous = current;
+  }
+  Predictor lpc = fitLpc(x, count, LPC_ORDER, lpcResidual);
+  if (lpc.cost < best.cost) {
+    best = lpc;
+  }
+
+  bits.write(best.type, 8);
+  for (size_t i = 0; i < best.order; ++i) {
+    bits.write(static_cast<uint32_t>(x[i]), 32);
+  }
+  const int32_t* residual = x;
+  if (best.type & LPC) {
+    bits.write(best.shift, 5);
+    for (size_t i = 0; i < best.order; ++i) {
+      bits.write(static_cast<uint32_t>(best.coefficients[i]), LPC_PRECISION);
+    }
+    residual = lpcResidual;
+  } else if (best.order > 0) {
+    // Recompute the chosen order's differences, which later orders overwrote
+    previous = x;
+    for (size_t order = 1; order <= best.order; ++order) {
+      difference(previous, orders[order % 2], order, count);
+      previous = orders[order % 2];
+    }
+    residual = previous;
+  }
+  writeResidual(bits, residual, best.order, count);
+}
+
+// Read one channel's subframe into x[0, count)
+inline bool readSubframe(BitReader& bits, int32_t* x, size_t count) {
+  uint8_t type = static_cast<uint8_t>(bits.read(8));
+  if (type == CONSTANT) {
+    std::fill(x, x + count, static_cast<int32_t>(bits.read(32)));
+    return !bits.overrun();
+  }
+
+  size_t order = type & LPC ? type & ~LPC : type;
+  if (type & LPC ? order == 0 || order > LPC_ORDER : order > MAX_FIXED_ORDER) {
+    return false;
+  }
+  order = std::min(order, count);
+  for (size_t i = 0; i < order; ++i) {
+    x[i] = static_cast<int32_t>(bits.read(32));
+  }
+  unsigned shift = 0;
+  int32_t coefficients[LPC_ORDER] = {};
+  if (type & LPC) {
+    shift = bits.read(5);
+    for (size_t i = 0; i < order; ++i) {
+      // Sign-extend from LPC_PRECISION bits
+      uint32_t raw = bits.read(LPC_PRECISION);
+      coefficients[i] = static_cast<int32_t>(raw << (32 - LPC_PRECISION)) >> (32 - LPC_PRECISION);
+    }
+  }
+
+  for (size_t start = order; start < count; start += PARTITION_SIZE) {
+    size_t stop = std::min(start + PARTITION_SIZE, count);
+    unsigned k = bits.read(5);
+    for (size_t i = start; i < stop; ++i) {
+      unsigned quotient = bits.readZeros(RICE_ESCAPE);
+      uint32_t u = quotient == RICE_ESCAPE ? bits.read(32)
+                                           : (quotient << k) | (k > 0 ? bits.read(k) : 0);
+      int64_t e = unzigzag(u);
+      int64_t prediction = 0;
+      if (type & LPC) {
+        for (size_t j = 0; j < order; ++j) {
+          prediction += int64_t(coefficients[j]) * x[i - 1 - j];
+        }
+        prediction >>= shift;
+      } else {
+        switch (order) {
+          case 1: prediction = x[i - 1]; break;
+          case 2: prediction = 2 * int64_t(x[i - 1]) - x[i - 2]; break;
+          case 3: prediction = 3 * (int64_t(x[i - 1]) - x[i - 2]) + x[i - 3]; break;
+          case 4: prediction = 4 * (int64_t(x[i - 1]) + x[i - 3]) - 6 * int64_t(x[i - 2]) - x[i - 4]; break;
+        }
+      }
+      x[i] = static_cast<int32_t>(e + prediction);
+    }
+    if (bits.overrun()) {
+      return false;
+    }
+  }
+  return !bits.overrun();
+}
+
+// Write 16-bit samples back, interleaving a stereo pair
+inline void interleaveStereo(const int32_t* left, const int32_t* right, size_t frames, char* out) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= frames; i += 4) {
+    __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+    __m128i packed = _mm_packs_epi32(l, r);  // l0..l3 r0..r3
+    __m128i pairs = _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), pairs);
+  }
+#endif
+  for (; i < frames; ++i) {
+    wire::storeLE(out + i * 4, static_cast<uint16_t>(left[i]));
+    wire::storeLE(out + i * 4 + 2, static_cast<uint16_t>(right[i]));
+  }
+}
+
+// Undo mid/side: left = mid + side rounded up, right = left - side
+inline void undoMidSide(int32_t* mid, int32_t* side, size_t count) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i one = _mm_set1_epi32(1);
+  for (; i + 4 <= count; i += 4) {
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + i));
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(side + i));
+    __m128i sum = _mm_or_si128(_mm_slli_epi32(m, 1), _mm_and_si128(s, one));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mid + i), _mm_srai_epi32(_mm_add_epi32(sum, s), 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(side + i), _mm_srai_epi32(_mm_sub_epi32(sum, s), 1));
+  }
+#endif
+  for (; i < count; ++i) {
+    int32_t sum = (mid[i] * 2) | (side[i] & 1);
+    int32_t left = (sum + side[i]) >> 1;
+    side[i] = (sum - side[i]) >> 1;
+    mid[i] = left;
+  }
+}
+
+} // namespace detail
+
+// Append the encoding of 'size' bytes of PCM (at most BLOCK_FRAMES frames)
+// in the given format to 'out'
+inline void encodeBlock(const char* pcm, size_t size, uint16_t channels, uint16_t bitsPerSample,
+                        std::vector<char>& out) {
+  using namespace detail;
+  using codec_block::appendVerbatim;
+  size_t frameSize = size_t(channels) * (bitsPerSample / 8);
+  if (bitsPerSample != 16 || (channels != 1 && channels != 2) || size == 0 || size % frameSize != 0 ||
+      size / frameSize > BLOCK_FRAMES) {
+    appendVerbatim(pcm, size, out);
+    return;
+  }
+  size_t frames = size / frameSize;
+
+  // Left, right, mid, side, and room for the predictors' residuals
+  std::vector<int32_t> samples(7 * frames);
+  int32_t* left = samples.data();
+  int32_t* right = left + frames;
+  int32_t* mid = right + frames;
+  int32_t* side = mid + frames;
+  int32_t* work = side + frames;
+
+  size_t start = out.size();
+  out.resize(start + BLOCK_HEADER_SIZE);
+  BitWriter bits(out);
+  uint8_t mode = LEFT_RIGHT;
+  if (channels == 1) {
+    readMono(pcm, frames, left);
+    writeSubframe(bits, left, frames, work);
+  } else {
+    deinterleaveStereo(pcm, frames, left, right);
+    midSide(left, right, frames, mid, side);
+
+    // Pick the pair by a cheap estimate: the sum of second differences
+    uint64_t costs[4];
+    const int32_t* channelsOf[4] = {left, right, mid, side};
+    for (size_t c = 0; c < 4; ++c) {
+      difference(channelsOf[c], work, 1, frames);
+      difference(work, work + frames, 2, frames);
+      costs[c] = sumAbs(work + frames, std::min<size_t>(2, frames), frames);
+    }
+    const uint64_t pairs[4] = {costs[0] + costs[1], costs[0] + costs[3], costs[1] + costs[3], costs[2] + costs[3]};
+    mode = static_cast<uint8_t>(std::min_element(pairs, pairs + 4) - pairs);
+    const int32_t* first[4] = {left, left, right, mid};
+    const int32_t* second[4] = {right, side, side, side};
+    writeSubframe(bits, first[mode], frames, work);
+    writeSubframe(bits, second[mode], frames, work);
+  }
+  bits.flush();
+
+  // Incompressible audio is better sent as it is
+  size_t bodySize = out.size() - start - 4;
+  if (bodySize >= size + 1) {
+    out.resize(start);
+    appendVerbatim(pcm, size, out);
+    return;
+  }
+  char* header = out.data() + start;
+  codec_block::writePrefix(header, bodySize, COMPRESSED);
+  wire::storeLE(header + 5, static_cast<uint16_t>(frames));
+  header[7] = static_cast<char>(channels);
+  header[8] = static_cast<char>(mode);
+}
+
+// Decode the blocks in [data, data + size), appending their PCM to 'pcm';
+// false if they are malformed
+inline bool decode(const char* data, size_t size, std::vector<char>& pcm) {
+  using namespace detail;
+  std::vector<int32_t> samples;
+  while (size > 0) {
+    uint8_t method;
+    const char* body;
+    size_t bodyBytes;
+    if (!codec_block::nextBlock(data, size, method, body, bodyBytes)) {
+      return false;
+    }
+    if (method == VERBATIM) {
+      pcm.insert(pcm.end(), body, body + bodyBytes);
+      continue;
+    }
+    if (method != COMPRESSED || bodyBytes < 4) {
+      return false;
+    }
+    size_t frames = wire::loadLE<uint16_t>(body);
+    size_t channels = static_cast<uint8_t>(body[2]);
+    uint8_t mode = static_cast<uint8_t>(body[3]);
+    if (frames == 0 || frames > BLOCK_FRAMES || (channels != 1 && channels != 2) || mode > MID_SIDE) {
+      return false;
+    }
+
+    samples.resize(2 * frames);
+    int32_t* first = samples.data();
+    int32_t* second = first + frames;
+    BitReader bits(body + 4, bodyBytes - 4);
+    if (!readSubframe(bits, first, frames) || (channels == 2 && !readSubframe(bits, second, frames))) {
+      return false;
+    }
+
+    size_t offset = pcm.size();
+    pcm.resize(offset + frames * channels * 2);
+    if (channels == 1) {
+      for (size_t i = 0; i < frames; ++i) {
+        wire::storeLE(pcm.data() + offset + i * 2, static_cast<uint16_t>(first[i]));
+      }
+      continue;
+    }
+    switch (mode) {
+      case LEFT_SIDE:
+        // right = left - side
+        for (size_t i = 0; i < frames; ++i) {
+          second[i] = first[i] - second[i];
+        }
+        break;
+      case RIGHT_SIDE:
+        // left = right + side, then put left first
+        for (size_t i = 0; i < frames; ++i) {
+          int32_t right = first[i];
+          first[i] = right + second[i];
+          second[i] = right;
+        }
+        break;
+      case MID_SIDE:
+        undoMidSide(first, second, frames);
+        break;
+    }
+    interleaveStereo(first, second, frames, pcm.data() + offset);
+  }
+  return true;
+}
+
+} // namespace lossless
+
+#endif // LOSSLESS_CODEC_H
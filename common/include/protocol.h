@@ -1,10 +1,15 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <string>
+#include <string_view>
 #include <vector>
+#include "track_id.h"
 #include "wav_header.h"
+#include "wire_codec.h"
 
 // Message types for client-server communication
 enum class MessageType : uint8_t {
@@ -15,7 +20,20 @@ enum class MessageType : uint8_t {
   SONG_DATA,            // Server sends song data chunks
   SONG_DATA_END,        // Server indicates end of song data
   PLAY_CONTROL,         // Client sends play control commands (play, pause, etc.)
-  ERROR                 // Error message
+  ERROR,                // Error message
+  LIST_NOT_MODIFIED,    // Client's copy of the song list is current (see catalog_sync.h)
+  LIST_SNAPSHOT,        // Whole song list, versioned and front-coded
+  LIST_DELTA,           // Songs added and removed since the client's version
+  SEARCH_REQUEST,       // Client searches song paths (see catalog_query.h)
+  SEARCH_RESPONSE,      // Server sends a page of matching songs
+  BROWSE_REQUEST,       // Client lists one directory
+  BROWSE_RESPONSE,      // Server sends a page of the directory's entries
+  TRACK_REQUEST,        // Client requests a song by track ID
+  STREAM_CANCEL,        // Client no longer wants a stream's song
+  SESSION_TOKEN,        // Server names the connection's session, for resuming it
+  SESSION_RESUME,       // Client reconnected and resumes a stream of its old session
+  HELLO,                // Client advertises what it supports, first on a connection
+  HELLO_ACK             // Server answers with the parameters of the connection
 };
 
 // Play control commands
@@ -26,130 +44,217 @@ enum class PlayControl : uint8_t {
   SEEK
 };
 
-// Message header structure
+// Encodings of the audio in SONG_DATA frames
+enum class Codec : uint8_t {
+  PCM,      // The song's samples as stored in the file
+  LOSSLESS, // The samples compressed without loss, in blocks (lossless_codec.h)
+  ADPCM     // The samples at 4 bits each, lossy, in blocks (adpcm_codec.h)
+};
+
+// A set of codecs, one bit per Codec
+using CodecSet = uint32_t;
+
+inline constexpr CodecSet codecBit(Codec codec) {
+  return CodecSet(1) << static_cast<uint8_t>(codec);
+}
+
+// Version of the protocol spoken by this build; HELLO_ACK carries the
+// lower of the two sides' versions
+const uint32_t PROTOCOL_VERSION = 1;
+
+// Every message is a header, then 'size' payload bytes. The header is
+// packed and little-endian: the type in byte 0, the size in bytes 1-4.
+const size_t MESSAGE_HEADER_SIZE = 5;
+
+// A decoded message header
 struct MessageHeader {
   MessageType type;
   uint32_t size;  // Size of the message payload in bytes
 };
 
-// Control message structure for play/pause/seek commands
-struct ControlMessage {
-  PlayControl command;
-  union {
-    double seekPosition;  // In seconds, used for SEEK command
-    uint8_t padding[8];   // Ensure consistent size
-  };
-};
+using HeaderSchema = wire::Schema<wire::Enum<MessageType>, wire::U32>;
+static_assert(HeaderSchema::FIXED && HeaderSchema::MIN_SIZE == MESSAGE_HEADER_SIZE, "header layout changed");
 
-// Function to serialize messages for network transmission
-template<typename T>
-std::vector<char> serializeMessage(MessageType type, const T& data) {
-  std::vector<char> buffer;
-  MessageHeader header{type, sizeof(T)};
-  
-  // Add header
-  buffer.resize(sizeof(MessageHeader));
-  memcpy(buffer.data(), &header, sizeof(MessageHeader));
-  
-  // Add data
-  size_t offset = sizeof(MessageHeader);
-  buffer.resize(offset + sizeof(T));
-  memcpy(buffer.data() + offset, &data, sizeof(T));
-  
-  return buffer;
+// A header as sent
+using EncodedHeader = std::array<char, MESSAGE_HEADER_SIZE>;
+
+// Build the header for a frame carrying 'size' payload bytes
+inline EncodedHeader makeMessageHeader(MessageType type, size_t size) {
+  EncodedHeader header;
+  HeaderSchema::encodePayload(header.data(), type, static_cast<uint32_t>(size));
+  return header;
 }
 
-// Specialization for string data (e.g., song names)
-template<>
-inline std::vector<char> serializeMessage<std::string>(MessageType type, const std::string& data) {
-  std::vector<char> buffer;
-  MessageHeader header{type, static_cast<uint32_t>(data.size())};
-  
-  // Add header
-  buffer.resize(sizeof(MessageHeader));
-  memcpy(buffer.data(), &header, sizeof(MessageHeader));
-  
-  // Add string data
-  size_t offset = sizeof(MessageHeader);
-  buffer.resize(offset + data.size());
-  memcpy(buffer.data() + offset, data.c_str(), data.size());
-  
-  return buffer;
+// Decode the MESSAGE_HEADER_SIZE bytes at 'data'
+inline MessageHeader decodeMessageHeader(const char* data) {
+  MessageHeader header;
+  HeaderSchema::decode(std::string_view(data, MESSAGE_HEADER_SIZE), header.type, header.size);
+  return header;
 }
 
-// Specialization for vector<string> (e.g., song list)
-template<>
-inline std::vector<char> serializeMessage<std::vector<std::string>>(MessageType type, const std::vector<std::string>& data) {
-  std::vector<char> buffer;
-  
-  // Calculate total size
-  uint32_t totalSize = 4;  // 4 bytes for the count
-  for (const auto& str : data) {
-    totalSize += 4 + static_cast<uint32_t>(str.size());  // 4 bytes for string length + string data
+// A message type and the schema of its payload (see wire_codec.h). Encodes
+// whole frames into the caller's buffer; decode() reads a received payload
+// in place.
+template<MessageType TYPE, typename... Fields>
+struct Message : wire::Schema<Fields...> {
+  using Payload = wire::Schema<Fields...>;
+  static constexpr MessageType type = TYPE;
+
+  // Frame size of a fixed-size message, for a buffer on the stack
+  static constexpr size_t FRAME_SIZE = MESSAGE_HEADER_SIZE + Payload::MIN_SIZE;
+
+  // Frame bytes, header included, for these field values
+  template<typename... Args>
+  static size_t frameSize(const Args&... values) {
+    return MESSAGE_HEADER_SIZE + Payload::payloadSize(values...);
   }
-  
-  MessageHeader header{type, totalSize};
-  
-  // Add header
-  buffer.resize(sizeof(MessageHeader));
-  memcpy(buffer.data(), &header, sizeof(MessageHeader));
-  
-  // Add vector size
-  size_t offset = sizeof(MessageHeader);
-  buffer.resize(offset + 4);
-  uint32_t count = static_cast<uint32_t>(data.size());
-  memcpy(buffer.data() + offset, &count, 4);
-  offset += 4;
-  
-  // Add strings
-  for (const auto& str : data) {
-    // Add string length
-    buffer.resize(offset + 4);
-    uint32_t length = static_cast<uint32_t>(str.size());
-    memcpy(buffer.data() + offset, &length, 4);
-    offset += 4;
-    
-    // Add string data
-    buffer.resize(offset + str.size());
-    memcpy(buffer.data() + offset, str.c_str(), str.size());
-    offset += str.size();
+
+  // Write the frame for these field values at 'out'; returns its size, or
+  // 0 if it needs more than 'capacity' bytes
+  template<typename... Args>
+  static size_t encode(char* out, size_t capacity, const Args&... values) {
+    size_t payloadSize = Payload::payloadSize(values...);
+    if (capacity < MESSAGE_HEADER_SIZE || capacity - MESSAGE_HEADER_SIZE < payloadSize) {
+      return 0;
+    }
+    HeaderSchema::encodePayload(out, TYPE, static_cast<uint32_t>(payloadSize));
+    Payload::encodePayload(out + MESSAGE_HEADER_SIZE, values...);
+    return MESSAGE_HEADER_SIZE + payloadSize;
   }
-  
-  return buffer;
+};
+
+// Songs are sent on streams. The client names a stream in each song
+// request and every frame of that song carries its ID, so several songs can
+// be in flight on one connection, interleaved frame by frame, and frames of
+// a stream the client cancelled are told apart from the next song's. Other
+// frames (list, query and error replies) go ahead of queued song data.
+using StreamId = uint32_t;
+
+// Never the ID of a stream
+const StreamId NO_STREAM = 0;
+
+// A stream frame's header and stream ID, which come before the rest of its
+// payload
+const size_t STREAM_PREFIX_SIZE = MESSAGE_HEADER_SIZE + 4;
+using StreamPrefix = std::array<char, STREAM_PREFIX_SIZE>;
+
+// Build the prefix of a frame of 'stream' whose payload continues with
+// 'bodySize' more bytes, sent separately (e.g. straight from a file)
+inline StreamPrefix makeStreamPrefix(MessageType type, StreamId stream, size_t bodySize) {
+  StreamPrefix prefix;
+  HeaderSchema::encodePayload(prefix.data(), type, static_cast<uint32_t>(4 + bodySize));
+  wire::U32::write(prefix.data() + MESSAGE_HEADER_SIZE, stream);
+  return prefix;
 }
 
-// Specialization for WavHeader
-template<>
-inline std::vector<char> serializeMessage<WavHeader>(MessageType type, const WavHeader& data) {
-  std::vector<char> buffer;
-  MessageHeader header{type, sizeof(WavHeader)};
-  
-  // Add header
-  buffer.resize(sizeof(MessageHeader));
-  memcpy(buffer.data(), &header, sizeof(MessageHeader));
-  
-  // Add WavHeader data
-  size_t offset = sizeof(MessageHeader);
-  buffer.resize(offset + sizeof(WavHeader));
-  memcpy(buffer.data() + offset, &data, sizeof(WavHeader));
-  
-  return buffer;
+// A SONG_DATA frame's stream prefix, the audio's offset and its checksum,
+// which come before the audio itself
+const size_t SONG_DATA_PREFIX_SIZE = STREAM_PREFIX_SIZE + 8 + 4;
+using SongDataPrefix = std::array<char, SONG_DATA_PREFIX_SIZE>;
+
+// Build the prefix of a SONG_DATA frame of 'stream' carrying 'audioSize'
+// bytes from byte 'offset' of the song's audio, with their CRC32C
+// (crc32c.h), the audio being sent separately
+inline SongDataPrefix makeSongDataPrefix(StreamId stream, uint64_t offset, uint32_t crc, size_t audioSize) {
+  SongDataPrefix prefix;
+  StreamPrefix streamPrefix = makeStreamPrefix(MessageType::SONG_DATA, stream, 8 + 4 + audioSize);
+  char* out = std::copy(streamPrefix.begin(), streamPrefix.end(), prefix.begin());
+  wire::U32::write(wire::U64::write(out, offset), crc);
+  return prefix;
 }
 
-// Specialization for raw audio data chunks
-inline std::vector<char> serializeAudioData(const std::vector<char>& data, size_t offset, size_t chunkSize) {
-  std::vector<char> buffer;
-  size_t actualSize = std::min(chunkSize, data.size() - offset);
-  MessageHeader header{MessageType::SONG_DATA, static_cast<uint32_t>(actualSize)};
-  
-  // Add header
-  buffer.resize(sizeof(MessageHeader));
-  memcpy(buffer.data(), &header, sizeof(MessageHeader));
-  
-  // Add audio data
-  buffer.resize(sizeof(MessageHeader) + actualSize);
-  memcpy(buffer.data() + sizeof(MessageHeader), data.data() + offset, actualSize);
-  
+// Identifies a connection's session to the server, so a client whose
+// connection dropped can resume its stream on a new one
+using SessionToken = uint64_t;
+
+// Never the token of a session
+const SessionToken NO_SESSION = 0;
+
+// Payload schemas. Song list sync and query schemas are in catalog_sync.h
+// and catalog_query.h with their codecs.
+
+// The stream to send the song on, then the song's name. Replaced by
+// TRACK_REQUEST, and still accepted from older clients.
+using SongRequestMessage = Message<MessageType::SONG_REQUEST, wire::U32, wire::Tail>;
+
+// The stream to send the song on, the song's track ID, then the range of
+// sample frames to send: the first, and how many (0 for the rest of the
+// song). A request on a stream that is still sending replaces its song, so
+// a client seeks past what it has received by asking for the song again
+// from the seek point.
+using TrackRequestMessage = Message<MessageType::TRACK_REQUEST, wire::U32, wire::U64, wire::U64, wire::U64>;
+
+// The stream to stop. Its frames not yet started are dropped; frames
+// already on the way still arrive and are ignored by the client.
+using StreamCancelMessage = Message<MessageType::STREAM_CANCEL, wire::U32>;
+
+// The stream the listener plays, the command, and the playhead in seconds
+// (for SEEK, the position to go to). The server holds a paused stream's
+// audio back until PLAY, ends the stream on STOP, and on SEEK drops the
+// stream's unsent audio and sends it on from the new position, announced
+// by a fresh SONG_INFO; audio of the stream received before that SONG_INFO
+// is from the old position.
+using PlayControlMessage = Message<MessageType::PLAY_CONTROL, wire::U32, wire::Enum<PlayControl>, wire::F64>;
+
+// Every song name
+using SongListMessage = Message<MessageType::LIST_RESPONSE, wire::StringList>;
+
+// The stream, the sample frame its audio starts at (the one requested,
+// unless that was past the end), then the song's WAV header as it is
+// stored in the file
+using SongInfoMessage = Message<MessageType::SONG_INFO, wire::U32, wire::U64, wire::Tail>;
+
+// The stream, the byte of the song's audio the chunk starts at, the
+// chunk's CRC32C, then the audio bytes. A client checks each chunk, and
+// after a reconnect resumes from the end of what it verified. With the
+// LOSSLESS or ADPCM codec the audio is a run of encoded blocks, each
+// decoding to whole sample frames; the offset still counts bytes of the
+// song's PCM audio, while the CRC covers the bytes as sent.
+using SongDataMessage = Message<MessageType::SONG_DATA, wire::U32, wire::U64, wire::U32, wire::Tail>;
+
+// The stream, whose song (or requested range) has been sent in full
+using SongDataEndMessage = Message<MessageType::SONG_DATA_END, wire::U32>;
+
+// A description of what went wrong
+using ErrorMessage = Message<MessageType::ERROR, wire::Tail>;
+
+// The connection's session token, sent first on every connection
+using SessionTokenMessage = Message<MessageType::SESSION_TOKEN, wire::U64>;
+
+// The token of the session whose connection dropped, the stream to resume,
+// its track, and the sample frame to resume from (where the audio the
+// client verified ends). The server sends the stream on from there,
+// announced by a SONG_INFO, keeping its range and paused state; if the
+// session has expired the track is sent from there as if newly requested.
+using SessionResumeMessage = Message<MessageType::SESSION_RESUME, wire::U64, wire::U32, wire::U64, wire::U64>;
+
+// The client's protocol version, the largest SONG_DATA payload it accepts, the
+// codecs it decodes (CodecSet), the seconds of audio it wants sent ahead of
+// its playhead (0 for the server's choice) and its socket receive buffer in
+// bytes (0 if unknown). A connection without HELLO gets the server's
+// defaults and PCM. The server picks the most compact codec both sides
+// allow, so a client lists ADPCM only when it wants the low-bitrate mode.
+using HelloMessage = Message<MessageType::HELLO, wire::U32, wire::U32, wire::U32, wire::F64, wire::U32>;
+
+// The parameters the server picked for the connection: the protocol
+// version, the largest audio chunk per SONG_DATA, the chunk a stream starts
+// with (chunks then double up to the largest, so the first audio lands
+// quickly), the codec of SONG_DATA audio, the seconds of audio sent ahead
+// of the playhead, and the audio the client should buffer before it starts
+// playing, in bytes.
+using HelloAckMessage = Message<MessageType::HELLO_ACK, wire::U32, wire::U32, wire::U32, wire::Enum<Codec>,
+                                wire::F64, wire::U32>;
+
+static_assert(TrackRequestMessage::FIXED && TrackRequestMessage::FRAME_SIZE == 33, "track request layout changed");
+static_assert(SongDataMessage::FRAME_SIZE == SONG_DATA_PREFIX_SIZE, "song data prefix layout changed");
+static_assert(PlayControlMessage::FIXED && PlayControlMessage::FRAME_SIZE == 18, "play control layout changed");
+
+// A LIST_RESPONSE payload without its header, so it can be built once and
+// sent many times. Accepts std::string or std::string_view elements.
+template<typename String>
+inline std::vector<char> serializeStringList(const std::vector<String>& data) {
+  std::vector<char> buffer(SongListMessage::payloadSize(data));
+  SongListMessage::encodePayload(buffer.data(), data);
   return buffer;
 }
 
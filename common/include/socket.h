@@ -12,6 +12,14 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#include <sys/uio.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 // Socket wrapper class for TCP communication
 class Socket {
@@ -65,7 +73,7 @@ public:
         }
         
         // Start listening
-        if (listen(sockfd, 5) < 0) {
+        if (listen(sockfd, SOMAXCONN) < 0) {
             std::cerr << "Error listening on socket: " << strerror(errno) << std::endl;
             close();
             return false;
@@ -97,6 +105,51 @@ public:
         return clientSocket;
     }
     
+    // Accept a pending connection on a non-blocking listening socket.
+    // Returns nullptr without logging when no connection is waiting. If
+    // 'error' is given it receives the failed accept's errno, and running
+    // out of descriptors is left to the caller to report.
+    Socket* acceptPending(int* error = nullptr) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrLen = sizeof(clientAddr);
+        
+        int clientSock = accept(sockfd, (struct sockaddr*)&clientAddr, &clientAddrLen);
+        if (clientSock < 0) {
+            int acceptError = errno;
+            if (error) {
+                *error = acceptError;
+            }
+            bool outOfDescriptors = acceptError == EMFILE || acceptError == ENFILE ||
+                                    acceptError == ENOBUFS || acceptError == ENOMEM;
+            if (acceptError != EAGAIN && acceptError != EWOULDBLOCK && acceptError != ECONNABORTED &&
+                !(error && outOfDescriptors)) {
+                std::cerr << "Error accepting connection: " << strerror(acceptError) << std::endl;
+            }
+            return nullptr;
+        }
+        
+        Socket* clientSocket = new Socket();
+        clientSocket->sockfd = clientSock;
+        clientSocket->isConnected = true;
+        
+        if (!clientSocket->setNonBlocking()) {
+            delete clientSocket;
+            return nullptr;
+        }
+        
+        return clientSocket;
+    }
+    
+    // Switch the socket to non-blocking mode
+    bool setNonBlocking() {
+        int flags = fcntl(sockfd, F_GETFL, 0);
+        if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            std::cerr << "Error setting non-blocking mode: " << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
     // Connect to a server
     bool connectToServer(const std::string& host, int port) {
         // Create socket
@@ -159,21 +212,111 @@ public:
         return true;
     }
     
+    // Maximum number of buffers accepted by sendv()/sendvSome()
+    static const int MAX_IOV = 64;
+    
+    // Send several buffers as one write (e.g. a frame header and its payload)
+    // without first copying them into a contiguous buffer
+    bool sendv(const struct iovec* iov, int count) {
+        if (!isConnected) {
+            std::cerr << "Error: Socket not connected" << std::endl;
+            return false;
+        }
+        if (count > MAX_IOV) {
+            std::cerr << "Error: Too many buffers for one send" << std::endl;
+            return false;
+        }
+        
+        // Local copy so partially sent buffers can be advanced in place
+        struct iovec pending[MAX_IOV];
+        memcpy(pending, iov, sizeof(struct iovec) * count);
+        int index = 0;
+        
+        while (index < count) {
+            ssize_t bytesSent = ::writev(sockfd, pending + index, count - index);
+            
+            if (bytesSent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Error sending data: " << strerror(errno) << std::endl;
+                return false;
+            }
+            
+            index += advanceIov(pending + index, count - index, static_cast<size_t>(bytesSent));
+        }
+        
+        return true;
+    }
+    
+    // Non-blocking scatter-gather send with the same return convention as
+    // sendSome(); 'more' hints that further data follows immediately
+    ssize_t sendvSome(const struct iovec* iov, int count, bool more = false) {
+        if (!isConnected) {
+            return -1;
+        }
+        
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = const_cast<struct iovec*>(iov);
+        message.msg_iovlen = count;
+        
+        int flags = 0;
+#ifdef MSG_MORE
+        if (more) {
+            flags |= MSG_MORE;
+        }
+#else
+        (void)more;
+#endif
+        
+        ssize_t bytesSent = ::sendmsg(sockfd, &message, flags);
+        if (bytesSent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            isConnected = false;
+            return -1;
+        }
+        
+        return bytesSent;
+    }
+    
+    // Consume 'bytes' from the front of an iovec array. Returns the number of
+    // buffers fully consumed; a partially sent buffer is advanced in place.
+    static int advanceIov(struct iovec* iov, int count, size_t bytes) {
+        int consumed = 0;
+        while (consumed < count && bytes >= iov[consumed].iov_len) {
+            bytes -= iov[consumed].iov_len;
+            consumed++;
+        }
+        if (consumed < count && bytes > 0) {
+            iov[consumed].iov_base = static_cast<char*>(iov[consumed].iov_base) + bytes;
+            iov[consumed].iov_len -= bytes;
+        }
+        return consumed;
+    }
+    
     // Receive data from the socket
     std::vector<char> receive(size_t length) {
+        std::vector<char> buffer(length);
+        buffer.resize(receiveInto(buffer.data(), length));
+        return buffer;
+    }
+    
+    // Receive exactly 'length' bytes into 'buffer'. Returns the number of
+    // bytes read, which is less only if the connection closed or failed.
+    size_t receiveInto(char* buffer, size_t length) {
         if (!isConnected) {
             std::cerr << "Error: Socket not connected" << std::endl;
-            return std::vector<char>();
+            return 0;
         }
         
-        std::vector<char> buffer(length);
-        ssize_t bytesRead = 0;
-        ssize_t totalBytesRead = 0;
-        ssize_t bytesRemaining = length;
+        size_t totalBytesRead = 0;
         
         // Read all the requested data
-        while (totalBytesRead < static_cast<ssize_t>(length)) {
-            bytesRead = recv(sockfd, buffer.data() + totalBytesRead, bytesRemaining, 0);
+        while (totalBytesRead < length) {
+            ssize_t bytesRead = recv(sockfd, buffer + totalBytesRead, length - totalBytesRead, 0);
             
             if (bytesRead <= 0) {
                 // Connection closed or error
@@ -184,16 +327,106 @@ public:
                     std::cerr << "Error receiving data: " << strerror(errno) << std::endl;
                 }
                 
-                // Return what we've read so far
-                buffer.resize(totalBytesRead);
-                return buffer;
+                // Report what we've read so far
+                return totalBytesRead;
             }
             
             totalBytesRead += bytesRead;
-            bytesRemaining -= bytesRead;
         }
         
-        return buffer;
+        return totalBytesRead;
+    }
+    
+    // Send as much as the kernel accepts without blocking.
+    // Returns the number of bytes sent, 0 if the socket buffer is full,
+    // or -1 if the connection failed.
+    // Set 'more' when further data follows immediately (e.g. a frame header
+    // before its sendfile body) so the kernel can coalesce them into one segment.
+    ssize_t sendSome(const char* data, size_t length, bool more = false) {
+        if (!isConnected) {
+            return -1;
+        }
+        
+        int flags = 0;
+#ifdef MSG_MORE
+        if (more) {
+            flags |= MSG_MORE;
+        }
+#else
+        (void)more;
+#endif
+        
+        ssize_t bytesSent = ::send(sockfd, data, length, flags);
+        if (bytesSent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            isConnected = false;
+            return -1;
+        }
+        
+        return bytesSent;
+    }
+    
+    // Send part of a file straight from the page cache without copying it
+    // through userspace. Same return convention as sendSome().
+    ssize_t sendFileSome(int fileFd, off_t offset, size_t length) {
+        if (!isConnected) {
+            return -1;
+        }
+        
+#if defined(__linux__)
+        ssize_t bytesSent = ::sendfile(sockfd, fileFd, &offset, length);
+        if (bytesSent == 0 && length > 0) {
+            // The file ended early (truncated on disk)
+            return -1;
+        }
+        if (bytesSent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            isConnected = false;
+            return -1;
+        }
+        return bytesSent;
+#else
+        off_t bytesSent = static_cast<off_t>(length);
+        if (::sendfile(fileFd, sockfd, offset, &bytesSent, nullptr, 0) < 0) {
+            // A partial send on a non-blocking socket still reports progress
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return static_cast<ssize_t>(bytesSent);
+            }
+            isConnected = false;
+            return -1;
+        }
+        return static_cast<ssize_t>(bytesSent);
+#endif
+    }
+    
+    // Receive whatever is available without blocking.
+    // Returns the number of bytes read, 0 if nothing is pending,
+    // or -1 if the peer closed the connection or an error occurred.
+    ssize_t receiveSome(char* buffer, size_t length) {
+        if (!isConnected) {
+            return -1;
+        }
+        
+        ssize_t bytesRead = recv(sockfd, buffer, length, 0);
+        if (bytesRead < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            isConnected = false;
+            return -1;
+        }
+        
+        if (bytesRead == 0) {
+            // Connection closed gracefully
+            isConnected = false;
+            return -1;
+        }
+        
+        return bytesRead;
     }
     
     // Check if the socket is connected
@@ -0,0 +1,30 @@
+#ifndef TRACK_ID_H
+#define TRACK_ID_H
+
+#include <cstdint>
+#include <string_view>
+
+// Stable numeric identity of a song. A track's ID is the 64-bit FNV-1a hash
+// of its path relative to the music directory, so it survives restarts and
+// rescans, and a client can derive it from any name the server listed
+// without the lists carrying IDs. Requests, the server's catalog lookups and
+// its song cache are keyed by ID; names are for display.
+//
+// Two paths hashing alike is vanishingly unlikely (about 1 in 10^8 for a
+// million songs); the server reports it when building the catalog, and the
+// later path cannot be played until one of the two is renamed.
+using TrackId = uint64_t;
+
+// Never the ID of a track
+const TrackId NO_TRACK = 0;
+
+inline TrackId trackIdOf(std::string_view path) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : path) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash == NO_TRACK ? 1 : hash;
+}
+
+#endif // TRACK_ID_H
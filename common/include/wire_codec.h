@@ -0,0 +1,279 @@
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+
+// Compile-time message schemas for the wire protocol (see protocol.h).
+//
+// A schema lists a payload's fields in order. Encoding writes them straight
+// into a buffer the caller provides; decoding reads them in place, and
+// variable-length fields decode to views of the received bytes, so neither
+// direction allocates. Integers are little-endian on the wire whatever the
+// host's byte order, and fields are packed with no padding.
+//
+// A field type describes one field:
+//   Value           what it decodes to
+//   FIXED           whether every value has the same encoded size
+//   MIN_SIZE        bytes of the smallest value
+//   size(value)     bytes 'value' takes
+//   write(out, v)   encode at 'out', returning the end
+//   read(in, end, v)  decode from [in, end), returning the end of the
+//                   field, or nullptr if the bytes are short or malformed
+namespace wire {
+
+template<typename T>
+constexpr void storeLE(char* out, T value) {
+  static_assert(std::is_unsigned_v<T>, "wire integers are unsigned");
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out[i] = static_cast<char>(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+template<typename T>
+constexpr T loadLE(const char* in) {
+  static_assert(std::is_unsigned_v<T>, "wire integers are unsigned");
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<T>(static_cast<T>(static_cast<uint8_t>(in[i])) << (8 * i));
+  }
+  return value;
+}
+
+// Unsigned integer
+template<typename T>
+struct Int {
+  using Value = T;
+  static constexpr bool FIXED = true;
+  static constexpr size_t MIN_SIZE = sizeof(T);
+
+  static constexpr size_t size(T) { return sizeof(T); }
+
+  static char* write(char* out, T value) {
+    storeLE(out, value);
+    return out + sizeof(T);
+  }
+
+  static const char* read(const char* in, const char* end, T& value) {
+    if (static_cast<size_t>(end - in) < sizeof(T)) {
+      return nullptr;
+    }
+    value = loadLE<T>(in);
+    return in + sizeof(T);
+  }
+};
+
+using U8 = Int<uint8_t>;
+using U16 = Int<uint16_t>;
+using U32 = Int<uint32_t>;
+using U64 = Int<uint64_t>;
+
+// Enumeration, as its underlying integer
+template<typename E>
+struct Enum {
+  using Value = E;
+  using Underlying = Int<std::make_unsigned_t<std::underlying_type_t<E>>>;
+  static constexpr bool FIXED = true;
+  static constexpr size_t MIN_SIZE = Underlying::MIN_SIZE;
+
+  static constexpr size_t size(E) { return MIN_SIZE; }
+
+  static char* write(char* out, E value) {
+    return Underlying::write(out, static_cast<typename Underlying::Value>(value));
+  }
+
+  static const char* read(const char* in, const char* end, E& value) {
+    typename Underlying::Value raw = 0;
+    in = Underlying::read(in, end, raw);
+    value = static_cast<E>(raw);
+    return in;
+  }
+};
+
+// IEEE 754 double, as its little-endian bit pattern
+struct F64 {
+  using Value = double;
+  static constexpr bool FIXED = true;
+  static constexpr size_t MIN_SIZE = 8;
+
+  static constexpr size_t size(double) { return 8; }
+
+  static char* write(char* out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return U64::write(out, bits);
+  }
+
+  static const char* read(const char* in, const char* end, double& value) {
+    uint64_t bits = 0;
+    in = U64::read(in, end, bits);
+    memcpy(&value, &bits, sizeof(value));
+    return in;
+  }
+};
+
+// The rest of the payload, uninterpreted (a name, audio bytes). Must be the
+// last field.
+struct Tail {
+  using Value = std::string_view;
+  static constexpr bool FIXED = false;
+  static constexpr size_t MIN_SIZE = 0;
+
+  static constexpr size_t size(std::string_view value) { return value.size(); }
+
+  static char* write(char* out, std::string_view value) {
+    memcpy(out, value.data(), value.size());
+    return out + value.size();
+  }
+
+  static const char* read(const char* in, const char* end, std::string_view& value) {
+    value = std::string_view(in, end - in);
+    return end;
+  }
+};
+
+// The strings of a decoded StringList, viewed where they were received. The
+// bytes were checked when decoding, so walking them cannot overrun.
+class StringListView {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view*;
+    using reference = std::string_view;
+
+    iterator() : position(nullptr) {}
+    explicit iterator(const char* at) : position(at) {}
+
+    std::string_view operator*() const {
+      return std::string_view(position + 4, loadLE<uint32_t>(position));
+    }
+
+    iterator& operator++() {
+      position += 4 + loadLE<uint32_t>(position);
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    bool operator==(const iterator& other) const { return position == other.position; }
+    bool operator!=(const iterator& other) const { return position != other.position; }
+
+  private:
+    const char* position;  // At the length of the current string
+  };
+
+  StringListView() : first(nullptr), last(nullptr), count(0) {}
+  StringListView(const char* begin, const char* end, uint32_t size) : first(begin), last(end), count(size) {}
+
+  iterator begin() const { return iterator(first); }
+  iterator end() const { return iterator(last); }
+  uint32_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+private:
+  const char* first;
+  const char* last;
+  uint32_t count;
+};
+
+// A count, then that many strings, each a length and its bytes. Encodes any
+// range of std::string or std::string_view.
+struct StringList {
+  using Value = StringListView;
+  static constexpr bool FIXED = false;
+  static constexpr size_t MIN_SIZE = 4;
+
+  template<typename Range>
+  static size_t size(const Range& strings) {
+    size_t total = 4;
+    for (const auto& str : strings) {
+      total += 4 + std::string_view(str).size();
+    }
+    return total;
+  }
+
+  template<typename Range>
+  static char* write(char* out, const Range& strings) {
+    char* countAt = out;
+    uint32_t count = 0;
+    out += 4;
+    for (const auto& str : strings) {
+      std::string_view view(str);
+      storeLE(out, static_cast<uint32_t>(view.size()));
+      memcpy(out + 4, view.data(), view.size());
+      out += 4 + view.size();
+      ++count;
+    }
+    storeLE(countAt, count);
+    return out;
+  }
+
+  static const char* read(const char* in, const char* end, StringListView& value) {
+    uint32_t count = 0;
+    const char* first = U32::read(in, end, count);
+    if (first == nullptr) {
+      return nullptr;
+    }
+    const char* position = first;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t length = 0;
+      position = U32::read(position, end, length);
+      if (position == nullptr || static_cast<size_t>(end - position) < length) {
+        return nullptr;
+      }
+      position += length;
+    }
+    value = StringListView(first, position, count);
+    return position;
+  }
+};
+
+// A payload made of 'Fields' in order. Decoding ignores bytes after the
+// last field, so a message can later grow fields without breaking older
+// readers.
+template<typename... Fields>
+struct Schema {
+  static constexpr bool FIXED = (true && ... && Fields::FIXED);
+  static constexpr size_t MIN_SIZE = (size_t(0) + ... + Fields::MIN_SIZE);
+
+  // Payload bytes for these field values
+  template<typename... Args>
+  static constexpr size_t payloadSize(const Args&... values) {
+    static_assert(sizeof...(Args) == sizeof...(Fields), "one value per field");
+    return (size_t(0) + ... + Fields::size(values));
+  }
+
+  // Write the payload at 'out', which must have room for
+  // payloadSize(values...) bytes; returns the end
+  template<typename... Args>
+  static char* encodePayload(char* out, const Args&... values) {
+    static_assert(sizeof...(Args) == sizeof...(Fields), "one value per field");
+    ((out = Fields::write(out, values)), ...);
+    return out;
+  }
+
+  // Decode a payload into 'values'; false if it is short or malformed.
+  // Views among them point into 'payload'.
+  static bool decode(std::string_view payload, typename Fields::Value&... values) {
+    const char* in = payload.data();
+    const char* end = in + payload.size();
+    bool ok = true;
+    ((ok = ok && (in = Fields::read(in, end, values)) != nullptr), ...);
+    return ok;
+  }
+};
+
+} // namespace wire
+
+#endif // WIRE_CODEC_H
@@ -0,0 +1,90 @@
+#include "catalog_history.h"
+#include <algorithm>
+#include <iterator>
+#include "../../common/include/catalog_sync.h"
+
+// Names in 'a' that are not in 'b' (both sorted)
+static std::vector<std::string> without(const std::vector<std::string>& a, const std::vector<std::string>& b) {
+    std::vector<std::string> result;
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+static std::vector<std::string> combined(const std::vector<std::string>& a, const std::vector<std::string>& b) {
+    std::vector<std::string> result;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+std::shared_ptr<const CatalogHistory> CatalogHistory::advance(const CatalogHistory* earlier,
+                                                              const SongCatalog& previous,
+                                                              const SongCatalog& next) {
+    auto history = std::make_shared<CatalogHistory>();
+    if (previous.getVersion() == next.getVersion()) {
+        // Only file stamps or formats changed; the list did not
+        if (earlier) {
+            *history = *earlier;
+        }
+        return history;
+    }
+
+    // One merge pass over both sorted catalogs gives the latest change
+    Delta latest;
+    latest.fromVersion = previous.getVersion();
+    size_t i = 0;
+    size_t j = 0;
+    while (i < previous.size() || j < next.size()) {
+        if (j >= next.size() || (i < previous.size() && previous.getName(i) < next.getName(j))) {
+            latest.removed.emplace_back(previous.getName(i++));
+        } else if (i >= previous.size() || next.getName(j) < previous.getName(i)) {
+            latest.added.emplace_back(next.getName(j++));
+        } else {
+            ++i;
+            ++j;
+        }
+    }
+
+    // Older deltas end at 'previous'; compose each with the latest change.
+    // A name ends up removed if either step removed it and the other did
+    // not add it back, and added likewise.
+    std::vector<Delta> candidates;
+    candidates.push_back(std::move(latest));
+    const Delta& step = candidates.front();
+    if (earlier) {
+        for (const auto& older : earlier->deltas) {
+            if (candidates.size() == MAX_VERSIONS) {
+                break;
+            }
+            if (older.fromVersion == next.getVersion()) {
+                continue;  // That copy is current again
+            }
+            Delta delta;
+            delta.fromVersion = older.fromVersion;
+            delta.removed = combined(without(older.removed, step.added), without(step.removed, older.added));
+            delta.added = combined(without(older.added, step.removed), without(step.added, older.removed));
+            candidates.push_back(std::move(delta));
+        }
+    }
+
+    size_t snapshotSize = next.getSnapshotPayload().size();
+    for (auto& delta : candidates) {
+        delta.payload = encodeListDelta(delta.fromVersion, next.getVersion(), delta.removed, delta.added);
+        if (delta.payload.size() < snapshotSize / 2) {
+            history->deltas.push_back(std::move(delta));
+        }
+    }
+    return history;
+}
+
+std::string_view CatalogHistory::findDelta(uint64_t fromVersion) const {
+    for (const auto& delta : deltas) {
+        if (delta.fromVersion == fromVersion) {
+            return std::string_view(delta.payload.data(), delta.payload.size());
+        }
+    }
+    return std::string_view();
+}
+
+size_t CatalogHistory::size() const {
+    return deltas.size();
+}
@@ -0,0 +1,45 @@
+#ifndef CATALOG_HISTORY_H
+#define CATALOG_HISTORY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "song_catalog.h"
+
+// LIST_DELTA payloads that bring recent versions of the song list up to one
+// catalog. Each time a catalog replaces another, the publisher extends the
+// previous history with the latest change, so a reconnecting client with a
+// recent copy is sent only the difference, already encoded, whatever the
+// number of clients asking.
+class CatalogHistory {
+public:
+    // Versions kept; older copies get a full snapshot
+    static constexpr size_t MAX_VERSIONS = 16;
+
+    // History for 'next', which replaces 'previous'. 'earlier' is the
+    // history of 'previous', or nullptr.
+    static std::shared_ptr<const CatalogHistory> advance(const CatalogHistory* earlier,
+                                                         const SongCatalog& previous,
+                                                         const SongCatalog& next);
+
+    // LIST_DELTA payload from 'fromVersion', or empty if that version is
+    // unknown, too old, or changed so much that a snapshot is smaller
+    std::string_view findDelta(uint64_t fromVersion) const;
+
+    // Number of versions a delta is kept for
+    size_t size() const;
+
+private:
+    struct Delta {
+        uint64_t fromVersion;
+        std::vector<std::string> removed;   // Sorted
+        std::vector<std::string> added;     // Sorted
+        std::vector<char> payload;
+    };
+
+    std::vector<Delta> deltas;   // Newest first
+};
+
+#endif // CATALOG_HISTORY_H
@@ -0,0 +1,179 @@
+#include "catalog_index.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../common/include/crc32c.h"
+
+// Identifies an index file; bump the version whenever the layout of the
+// file or of the catalog image changes
+const char INDEX_MAGIC[8] = {'M', 'P', 'C', 'A', 'T', 'I', 'D', 'X'};
+const uint32_t INDEX_VERSION = 4;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rootLength;
+};
+
+static_assert(sizeof(IndexHeader) == 16, "index header layout changed");
+
+// The image starts on an 8-byte boundary after the root path
+static uint64_t imageOffsetFor(uint64_t rootLength) {
+    return (sizeof(IndexHeader) + rootLength + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Write all of 'data', retrying short and interrupted writes
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Flush a directory's entries, so a rename inside it survives a crash
+static bool syncDirectory(const std::string& directory) {
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+std::string CatalogIndex::defaultPath(const std::string& rootDirectory) {
+    std::string stateDir;
+    const char* stateHome = getenv("XDG_STATE_HOME");
+    const char* home = getenv("HOME");
+    if (stateHome && stateHome[0] == '/') {
+        stateDir = stateHome;
+    } else {
+        stateDir = std::string(home ? home : ".") + "/.local/state";
+    }
+
+    // One index per library, named after its directory
+    std::string absolute = std::filesystem::absolute(rootDirectory).lexically_normal().string();
+    char name[32];
+    snprintf(name, sizeof(name), "catalog-%08x.idx", crc32c::compute(absolute.data(), absolute.size()));
+    return stateDir + "/music_server/" + name;
+}
+
+std::shared_ptr<const SongCatalog> CatalogIndex::load(const std::string& path, const std::string& rootDirectory) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            std::cerr << "Cannot open catalog index " << path << ": " << strerror(errno) << std::endl;
+        }
+        return nullptr;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) < 0 || static_cast<size_t>(fileInfo.st_size) < sizeof(IndexHeader)) {
+        std::cerr << "Ignoring truncated catalog index " << path << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    size_t fileSize = static_cast<size_t>(fileInfo.st_size);
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Cannot map catalog index " << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    // The catalog reads its image straight from the mapping, so the mapping
+    // lives as long as the catalog does
+    std::shared_ptr<const char> storage(static_cast<const char*>(mapping),
+                                        [fileSize](const char* base) {
+                                            munmap(const_cast<char*>(base), fileSize);
+                                        });
+
+    IndexHeader header;
+    memcpy(&header, storage.get(), sizeof(header));
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.version != INDEX_VERSION) {
+        std::cerr << "Ignoring catalog index " << path << " from another version" << std::endl;
+        return nullptr;
+    }
+
+    uint64_t imageOffset = imageOffsetFor(header.rootLength);
+    if (imageOffset > fileSize) {
+        std::cerr << "Ignoring corrupt catalog index " << path << std::endl;
+        return nullptr;
+    }
+    if (std::string_view(storage.get() + sizeof(IndexHeader), header.rootLength) != rootDirectory) {
+        // Written for another music directory
+        return nullptr;
+    }
+
+    std::shared_ptr<const char> image(storage, storage.get() + imageOffset);
+    auto catalog = SongCatalog::fromImage(image, fileSize - imageOffset);
+    if (!catalog) {
+        std::cerr << "Ignoring corrupt catalog index " << path << std::endl;
+    }
+    return catalog;
+}
+
+bool CatalogIndex::save(const std::string& path, const std::string& rootDirectory, const SongCatalog& catalog) {
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.rootLength = static_cast<uint32_t>(rootDirectory.size());
+
+    std::filesystem::path target(path);
+    std::string directory = target.has_parent_path() ? target.parent_path().string() : ".";
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    // Write a temporary file and rename it over the old index, so a reader
+    // or a crash never sees a half-written index. The data is synced before
+    // the rename and the directory after it; otherwise a crash can leave the
+    // new name pointing at an empty file.
+    std::string tempPath = path + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot write catalog index " << tempPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    const char padding[8] = {0};
+    std::string_view image = catalog.getImage();
+    bool written = writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+                   writeAll(fd, rootDirectory.data(), rootDirectory.size()) &&
+                   writeAll(fd, padding, imageOffsetFor(rootDirectory.size()) - sizeof(header) - rootDirectory.size()) &&
+                   writeAll(fd, image.data(), image.size()) &&
+                   fsync(fd) == 0;
+    if (!written) {
+        std::cerr << "Cannot write catalog index " << tempPath << ": " << strerror(errno) << std::endl;
+    }
+    close(fd);
+    if (!written) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot replace catalog index " << path << ": " << strerror(errno) << std::endl;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    if (!syncDirectory(directory)) {
+        std::cerr << "Cannot sync catalog index directory " << directory << ": " << strerror(errno) << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef CATALOG_INDEX_H
+#define CATALOG_INDEX_H
+
+#include <memory>
+#include <string>
+#include "song_catalog.h"
+
+// On-disk copy of the song catalog, so a restarted server can serve the
+// song list without rescanning the library first. The file is a short
+// header naming the library it was written for, followed by the catalog's
+// image exactly as it sits in memory. Loading maps the file read-only and
+// serves the catalog from the mapping; nothing is parsed or rebuilt, so
+// startup time does not grow with the number of songs.
+//
+// Layout (native byte order):
+//   header   magic "MPCATIDX", version, root length
+//   root     library directory the index was written for, padded to 8 bytes
+//   image    SongCatalog image
+class CatalogIndex {
+public:
+    // Index file for a library when none is configured: in the server's
+    // state directory ($XDG_STATE_HOME, else ~/.local/state), so the music
+    // directory can stay read-only
+    static std::string defaultPath(const std::string& rootDirectory);
+
+    // Map the index at 'path' written for 'rootDirectory'. Returns nullptr
+    // if the file is missing, from another library or version, or corrupt.
+    static std::shared_ptr<const SongCatalog> load(const std::string& path, const std::string& rootDirectory);
+
+    // Write the catalog to 'path', replacing any previous index atomically
+    // and durably. Creates the directory if it is missing.
+    static bool save(const std::string& path, const std::string& rootDirectory, const SongCatalog& catalog);
+};
+
+#endif // CATALOG_INDEX_H
@@ -0,0 +1,450 @@
+#include "catalog_search.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <unordered_map>
+#include "../../common/include/catalog_query.h"
+
+namespace {
+
+// Letters and digits make up words; bytes of multi-byte UTF-8 characters
+// are kept in them rather than splitting names in non-Latin scripts apart
+bool isWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+char toLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+struct Word {
+    std::string_view text;      // Views the lowered copy of the text
+    bool inBaseName;            // Part of the file name rather than a directory
+};
+
+// Lowercase 'text' into 'lowered' and split it into words. With 'songPath',
+// the .wav extension is dropped and words after the last '/' are marked as
+// the base name.
+void splitWords(std::string_view text, bool songPath, std::string& lowered, std::vector<Word>& words) {
+    lowered.assign(text);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), toLower);
+    size_t baseStart = 0;
+    if (songPath) {
+        if (lowered.size() >= 4 && lowered.compare(lowered.size() - 4, 4, ".wav") == 0) {
+            lowered.resize(lowered.size() - 4);
+        }
+        size_t slash = lowered.rfind('/');
+        baseStart = slash == std::string::npos ? 0 : slash + 1;
+    }
+
+    words.clear();
+    std::string_view view(lowered);
+    size_t i = 0;
+    while (i < view.size()) {
+        if (!isWordByte(static_cast<unsigned char>(view[i]))) {
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < view.size() && isWordByte(static_cast<unsigned char>(view[i]))) {
+            ++i;
+        }
+        words.push_back(Word{view.substr(start, i - start), start >= baseStart});
+    }
+}
+
+bool startsWith(std::string_view text, std::string_view prefix) {
+    return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+
+// How well one query word matches a song's words: whole words beat
+// prefixes, and the file name beats its directories. 0 if it does not match.
+int scoreWord(std::string_view queryWord, bool prefix, const std::vector<Word>& words) {
+    int best = 0;
+    for (const Word& word : words) {
+        int score = 0;
+        if (word.text == queryWord) {
+            score = word.inBaseName ? 4 : 2;
+        } else if (prefix && startsWith(word.text, queryWord)) {
+            score = word.inBaseName ? 3 : 1;
+        }
+        best = std::max(best, score);
+    }
+    return best;
+}
+
+// True if the file name begins with the query, word for word
+bool baseNameStartsWith(const std::vector<Word>& queryWords, bool lastIsPrefix, const std::vector<Word>& words) {
+    auto base = std::find_if(words.begin(), words.end(), [](const Word& word) { return word.inBaseName; });
+    for (size_t i = 0; i < queryWords.size(); ++i, ++base) {
+        if (base == words.end()) {
+            return false;
+        }
+        bool last = i + 1 == queryWords.size();
+        if (!(base->text == queryWords[i].text ||
+              (last && lastIsPrefix && startsWith(base->text, queryWords[i].text)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t durationMillis(const SongFormat& format) {
+    return static_cast<uint32_t>(std::lround(format.getDurationInSeconds() * 1000.0));
+}
+
+} // namespace
+
+CatalogSearch::CatalogSearch(const SongCatalog& catalog, const std::atomic<bool>* cancel) {
+    // First pass: give each distinct word an id and note the words of every
+    // song. Second: lay the terms out sorted, each with its songs back to
+    // back, filling the postings from the noted ids.
+    std::deque<std::string> distinct;
+    std::unordered_map<std::string_view, uint32_t> termIds;
+    std::vector<uint32_t> songCounts;           // Per id
+    std::vector<uint32_t> songWords;            // Each song's distinct word ids
+    std::vector<uint32_t> songStarts(catalog.size() + 1);
+    std::string lowered;
+    std::vector<Word> words;
+    termIds.reserve(catalog.size());
+    for (size_t song = 0; song < catalog.size(); ++song) {
+        if (cancel && song % 4096 == 0 && cancel->load(std::memory_order_relaxed)) {
+            return;
+        }
+        songStarts[song] = static_cast<uint32_t>(songWords.size());
+        splitWords(catalog.getName(song), true, lowered, words);
+        for (const Word& word : words) {
+            auto found = termIds.find(word.text);
+            uint32_t id;
+            if (found == termIds.end()) {
+                id = static_cast<uint32_t>(distinct.size());
+                distinct.emplace_back(word.text);
+                termIds.emplace(distinct.back(), id);
+                songCounts.push_back(0);
+            } else {
+                id = found->second;
+                if (std::find(songWords.begin() + songStarts[song], songWords.end(), id) != songWords.end()) {
+                    continue;
+                }
+            }
+            songWords.push_back(id);
+            ++songCounts[id];
+        }
+    }
+    songStarts[catalog.size()] = static_cast<uint32_t>(songWords.size());
+    termIds.clear();
+
+    // Sort views with their ids, which keeps the comparisons off the deque
+    std::vector<std::pair<std::string_view, uint32_t>> order;
+    order.reserve(distinct.size());
+    size_t textSize = 0;
+    for (const std::string& term : distinct) {
+        order.emplace_back(term, static_cast<uint32_t>(order.size()));
+        textSize += term.size();
+    }
+    std::sort(order.begin(), order.end());
+
+    termText.reserve(textSize);
+    terms.reserve(order.size());
+    std::vector<uint32_t> cursors(distinct.size());
+    uint32_t postingCount = 0;
+    for (const auto& [text, id] : order) {
+        terms.push_back(Term{static_cast<uint32_t>(termText.size()), static_cast<uint32_t>(text.size()),
+                             postingCount, songCounts[id]});
+        termText += text;
+        cursors[id] = postingCount;
+        postingCount += songCounts[id];
+    }
+
+    postings.resize(postingCount);
+    for (size_t song = 0; song < catalog.size(); ++song) {
+        for (uint32_t i = songStarts[song]; i < songStarts[song + 1]; ++i) {
+            postings[cursors[songWords[i]]++] = static_cast<uint32_t>(song);
+        }
+    }
+}
+
+std::string_view CatalogSearch::getTerm(size_t index) const {
+    return std::string_view(termText).substr(terms[index].textOffset, terms[index].textLength);
+}
+
+std::pair<size_t, size_t> CatalogSearch::prefixRange(std::string_view prefix) const {
+    auto less = [this](const Term& term, std::string_view text) {
+        return std::string_view(termText).substr(term.textOffset, term.textLength) < text;
+    };
+    size_t first = std::lower_bound(terms.begin(), terms.end(), prefix, less) - terms.begin();
+    size_t last = first;
+    // Terms with the prefix follow one another; find the end by galloping
+    // so short ranges cost a few comparisons
+    size_t step = 1;
+    while (last + step <= terms.size() && startsWith(getTerm(last + step - 1), prefix)) {
+        last += step;
+        step *= 2;
+    }
+    while (step > 1) {
+        step /= 2;
+        if (last + step <= terms.size() && startsWith(getTerm(last + step - 1), prefix)) {
+            last += step;
+        }
+    }
+    return {first, last};
+}
+
+size_t CatalogSearch::getTermCount() const {
+    return terms.size();
+}
+
+std::vector<char> CatalogSearch::search(const SongCatalog& catalog, std::string_view query, uint32_t offset,
+                                        uint16_t limit) const {
+    limit = std::min(limit, MAX_QUERY_PAGE);
+    std::vector<char> payload;
+    beginQueryPage(payload, catalog.getVersion(), offset);
+
+    std::string lowered;
+    std::vector<Word> queryWords;
+    splitWords(query, false, lowered, queryWords);
+    if (queryWords.empty()) {
+        finishQueryPage(payload, 0, 0);
+        return payload;
+    }
+    // The last word matches as a prefix, so results follow typing, unless
+    // the query ends after it ("rock " asks for the whole word)
+    bool lastIsPrefix = isWordByte(static_cast<unsigned char>(query.back()));
+
+    // Each word's songs, as a span of the postings: one term's for a whole
+    // word, a range of terms' for the prefix. A span's size is known
+    // without walking it.
+    struct Span {
+        size_t begin;
+        size_t end;
+        bool sorted;    // One term: songs ascending, so membership is a binary search
+    };
+    std::vector<Span> spans;
+    size_t driver = 0;
+    for (size_t i = 0; i < queryWords.size(); ++i) {
+        std::string_view text = queryWords[i].text;
+        auto [low, high] = prefixRange(text);
+        bool prefix = lastIsPrefix && i + 1 == queryWords.size();
+        if (!prefix) {
+            high = (low < high && getTerm(low) == text) ? low + 1 : low;
+        }
+        if (low == high) {
+            finishQueryPage(payload, 0, 0);
+            return payload;
+        }
+        spans.push_back(Span{terms[low].postingsOffset, terms[high - 1].postingsOffset + terms[high - 1].postingsCount,
+                             high - low == 1});
+        if (spans.back().end - spans.back().begin < spans[driver].end - spans[driver].begin) {
+            driver = i;
+        }
+    }
+
+    struct Match {
+        uint32_t song;
+        uint32_t score;
+        uint32_t nameLength;
+    };
+    std::vector<Match> matches;
+    std::string nameLowered;
+    std::vector<Word> words;
+    bool truncated = false;
+    size_t scanned = 0;
+    // Drive the search from the word with the fewest songs. Candidates
+    // missing another whole word are dropped by binary search before the
+    // more costly check of their name.
+    for (size_t p = spans[driver].begin; p < spans[driver].end; ++p) {
+        if (scanned == MAX_SCANNED || matches.size() == MAX_RANKED) {
+            truncated = true;
+            break;
+        }
+        ++scanned;
+        uint32_t song = postings[p];
+        bool candidate = true;
+        for (size_t i = 0; i < spans.size() && candidate; ++i) {
+            if (i != driver && spans[i].sorted) {
+                candidate = std::binary_search(postings.begin() + spans[i].begin, postings.begin() + spans[i].end, song);
+            }
+        }
+        if (!candidate) {
+            continue;
+        }
+        std::string_view name = catalog.getName(song);
+        splitWords(name, true, nameLowered, words);
+        uint32_t score = 0;
+        for (size_t i = 0; i < queryWords.size(); ++i) {
+            bool prefix = lastIsPrefix && i + 1 == queryWords.size();
+            int wordScore = scoreWord(queryWords[i].text, prefix, words);
+            if (wordScore == 0) {
+                score = 0;
+                break;
+            }
+            score += static_cast<uint32_t>(wordScore);
+        }
+        if (score == 0) {
+            continue;
+        }
+        if (baseNameStartsWith(queryWords, lastIsPrefix, words)) {
+            score += 4;
+        }
+        matches.push_back(Match{song, score, static_cast<uint32_t>(name.size())});
+    }
+
+    // A prefix driver spans several terms, so a song can come up more than once
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) { return a.song < b.song; });
+    matches.erase(std::unique(matches.begin(), matches.end(),
+                              [](const Match& a, const Match& b) { return a.song == b.song; }),
+                  matches.end());
+    // Best first; among equals, shorter paths, then catalog order
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        if (a.nameLength != b.nameLength) {
+            return a.nameLength < b.nameLength;
+        }
+        return a.song < b.song;
+    });
+
+    uint16_t count = 0;
+    for (size_t i = offset; i < matches.size() && count < limit; ++i, ++count) {
+        uint32_t song = matches[i].song;
+        appendQueryEntry(payload, QueryEntryKind::SONG, durationMillis(catalog.getFormat(song)),
+                         catalog.getName(song));
+    }
+    uint8_t flags = 0;
+    if (static_cast<size_t>(offset) + count < matches.size()) {
+        flags |= QUERY_MORE;
+    }
+    if (truncated) {
+        flags |= QUERY_TRUNCATED;
+    }
+    finishQueryPage(payload, count, flags);
+    return payload;
+}
+
+std::vector<char> CatalogSearch::browse(const SongCatalog& catalog, std::string_view directory, uint32_t offset,
+                                        uint16_t limit) {
+    limit = std::min(limit, MAX_QUERY_PAGE);
+    std::vector<char> payload;
+    beginQueryPage(payload, catalog.getVersion(), offset);
+
+    while (!directory.empty() && directory.front() == '/') {
+        directory.remove_prefix(1);
+    }
+    while (!directory.empty() && directory.back() == '/') {
+        directory.remove_suffix(1);
+    }
+    std::string prefix(directory);
+    size_t begin = 0;
+    size_t end = catalog.size();
+    if (!prefix.empty()) {
+        // Everything below "dir/" sorts before "dir0" ('0' follows '/')
+        end = catalog.lowerBound(prefix + '0');
+        prefix += '/';
+        begin = catalog.lowerBound(prefix);
+    }
+
+    // Walk the directory's range; a subdirectory is one entry, skipped
+    // with a binary search however many songs it holds
+    uint16_t count = 0;
+    uint8_t flags = 0;
+    uint32_t position = 0;
+    std::string childEnd;
+    size_t i = begin;
+    while (i < end) {
+        std::string_view rest = catalog.getName(i).substr(prefix.size());
+        size_t slash = rest.find('/');
+        size_t next = i + 1;
+        if (slash != std::string_view::npos) {
+            rest = rest.substr(0, slash);
+            childEnd.assign(prefix).append(rest).push_back('0');
+            next = catalog.lowerBound(childEnd);
+        }
+        if (position >= offset) {
+            if (count == limit) {
+                flags |= QUERY_MORE;
+                break;
+            }
+            if (slash != std::string_view::npos) {
+                appendQueryEntry(payload, QueryEntryKind::DIRECTORY, static_cast<uint32_t>(next - i), rest);
+            } else {
+                appendQueryEntry(payload, QueryEntryKind::SONG, durationMillis(catalog.getFormat(i)), rest);
+            }
+            ++count;
+        }
+        ++position;
+        i = next;
+    }
+    finishQueryPage(payload, count, flags);
+    return payload;
+}
+
+SearchIndexer::SearchIndexer() : stopping(false) {
+    thread = std::thread(&SearchIndexer::run, this);
+}
+
+SearchIndexer::~SearchIndexer() {
+    stop();
+}
+
+void SearchIndexer::update(std::shared_ptr<const SongCatalog> catalog) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(catalog);
+    }
+    wake.notify_one();
+}
+
+std::shared_ptr<const IndexedCatalog> SearchIndexer::current() const {
+    return std::atomic_load(&indexed);
+}
+
+void SearchIndexer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void SearchIndexer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || pending; });
+        if (stopping) {
+            return;
+        }
+        auto catalog = std::move(pending);
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        auto next = std::make_shared<IndexedCatalog>();
+        next->search = std::make_unique<const CatalogSearch>(*catalog, &stopping);
+        next->catalog = std::move(catalog);
+        if (!stopping) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Indexed " << next->catalog->size() << " songs (" << next->search->getTermCount()
+                      << " words) for search in " << ms << " ms" << std::endl;
+
+            auto previous = std::atomic_load(&indexed);
+            std::atomic_store(&indexed, std::shared_ptr<const IndexedCatalog>(std::move(next)));
+            // As with catalogs, the last reference to an old index is
+            // dropped here rather than on a reactor thread
+            if (previous) {
+                retired.push_back(std::move(previous));
+            }
+            retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                         [](const std::shared_ptr<const IndexedCatalog>& old) {
+                                             return old.use_count() == 1;
+                                         }),
+                          retired.end());
+        }
+
+        lock.lock();
+    }
+}
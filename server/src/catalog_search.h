@@ -0,0 +1,117 @@
+#ifndef CATALOG_SEARCH_H
+#define CATALOG_SEARCH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "song_catalog.h"
+
+// Search and paged browsing over one catalog, answering SEARCH_REQUEST and
+// BROWSE_REQUEST (see catalog_query.h).
+//
+// Search uses an inverted index from words to the songs whose path holds
+// them. Words are the lowercased runs of letters and digits in the path
+// (the .wav extension aside), and the sorted term dictionary doubles as a
+// prefix trie: the terms starting with a prefix are one binary-searched
+// range. A query is driven by its rarest whole word, or by the terms its
+// last word is a prefix of, and every candidate is checked against the
+// whole query and scored. Candidates examined and matches ranked are
+// capped, so a query costs the same on any library size; one that hits a
+// cap returns the best of what it saw and says so.
+//
+// Browsing needs no index: a directory's songs are one range of the
+// sorted catalog, and each subdirectory is skipped in one binary search.
+//
+// The index is built once per published catalog by a SearchIndexer.
+class CatalogSearch {
+public:
+    // Driver postings examined, and verified matches ranked, per search
+    static constexpr size_t MAX_SCANNED = 50000;
+    static constexpr size_t MAX_RANKED = 5000;
+
+    // Index 'catalog'. If 'cancel' is set while building, the build stops
+    // early and the index is incomplete.
+    explicit CatalogSearch(const SongCatalog& catalog, const std::atomic<bool>* cancel = nullptr);
+
+    CatalogSearch(const CatalogSearch&) = delete;
+    CatalogSearch& operator=(const CatalogSearch&) = delete;
+
+    // A SEARCH_RESPONSE payload: songs of 'catalog' (the one the index was
+    // built from) matching 'query', best first
+    std::vector<char> search(const SongCatalog& catalog, std::string_view query, uint32_t offset,
+                             uint16_t limit) const;
+
+    // A BROWSE_RESPONSE payload: the subdirectories and songs directly in
+    // 'directory' ("" for the top level), in name order
+    static std::vector<char> browse(const SongCatalog& catalog, std::string_view directory, uint32_t offset,
+                                    uint16_t limit);
+
+    // Distinct words indexed
+    size_t getTermCount() const;
+
+private:
+    struct Term {
+        uint32_t textOffset;
+        uint32_t textLength;
+        uint32_t postingsOffset;
+        uint32_t postingsCount;
+    };
+
+    std::string termText;            // Every term, back to back
+    std::vector<Term> terms;         // Sorted by text
+    std::vector<uint32_t> postings;  // Song positions per term, ascending
+
+    std::string_view getTerm(size_t index) const;
+
+    // Terms starting with 'prefix', as [first, last)
+    std::pair<size_t, size_t> prefixRange(std::string_view prefix) const;
+};
+
+// A catalog and its search index
+struct IndexedCatalog {
+    std::shared_ptr<const SongCatalog> catalog;
+    std::unique_ptr<const CatalogSearch> search;
+};
+
+// Builds search indexes on its own thread. Indexing a large catalog takes
+// seconds, so publishing a catalog (and starting from a saved one) does not
+// wait for it: searches use the newest catalog indexed so far, and each
+// page names the version it was taken from. Catalogs published while a
+// build runs are coalesced; only the latest is indexed next.
+class SearchIndexer {
+public:
+    SearchIndexer();
+    ~SearchIndexer();
+
+    SearchIndexer(const SearchIndexer&) = delete;
+    SearchIndexer& operator=(const SearchIndexer&) = delete;
+
+    // Index 'catalog' next, in place of any catalog still waiting
+    void update(std::shared_ptr<const SongCatalog> catalog);
+
+    // Newest indexed catalog; nullptr until the first build finishes
+    std::shared_ptr<const IndexedCatalog> current() const;
+
+    // Stop the thread, abandoning a build in progress
+    void stop();
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::shared_ptr<const SongCatalog> pending;     // Next to index
+    std::atomic<bool> stopping;
+    std::shared_ptr<const IndexedCatalog> indexed;  // Atomic access only
+    std::vector<std::shared_ptr<const IndexedCatalog>> retired;  // Replaced, maybe still in use
+
+    void run();
+};
+
+#endif // CATALOG_SEARCH_H
@@ -1,188 +1,719 @@
 #include "client_handler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
-#include "../../common/include/protocol.h"
+#include "../../common/include/catalog_query.h"
+#include "../../common/include/catalog_sync.h"
+#include "../../common/include/crc32c.h"
 
-// Size of audio chunks to send at once (256KB)
-const size_t CHUNK_SIZE = 256 * 1024;
+// Smallest audio chunk a client's limits can negotiate down to
+const size_t MIN_CHUNK_SIZE = 4 * 1024;
 
-ClientHandler::ClientHandler(std::unique_ptr<Socket> socket, std::shared_ptr<MusicLibrary> musicLibrary)
-    : clientSocket(std::move(socket)), 
+// Largest request payload a client may send (requests are small control messages)
+const uint32_t MAX_REQUEST_SIZE = 64 * 1024;
+
+// Audio kept requested from disk ahead of the sender, in chunks
+const size_t READAHEAD_CHUNKS = 4;
+
+// Bytes read from the socket per receive call
+const size_t READ_SIZE = 16 * 1024;
+
+// Unparsed input kept before the handler stops reading from the socket
+const size_t MAX_INPUT_BUFFER = 2 * (MAX_REQUEST_SIZE + MESSAGE_HEADER_SIZE);
+
+// Sample frame 'seconds' into a song, clamped to the song; truncated, as
+// the client computes the frame it waits for
+static uint64_t frameAt(const WavFile& song, double seconds) {
+    const WavHeader& header = song.getHeader();
+    uint64_t totalFrames = song.getAudioSize() / std::max<size_t>(header.blockAlign, 1);
+    seconds = std::min(std::max(0.0, seconds), song.getDurationInSeconds());
+    return std::min(static_cast<uint64_t>(seconds * header.sampleRate), totalFrames);
+}
+
+ClientHandler::ClientHandler(std::unique_ptr<Socket> socket, std::shared_ptr<MusicLibrary> musicLibrary,
+                             const StreamConfig& streamConfig, ReactorStats* reactorStats,
+                             SongDelivery songDelivery, SessionRegistry* sessionRegistry,
+                             EncodedBlockCache* encodedBlockCache)
+    : clientSocket(std::move(socket)),
       library(musicLibrary),
-      isRunning(false) {
+      config(streamConfig),
+      deliverSong(std::move(songDelivery)),
+      sessions(sessionRegistry),
+      encodedBlocks(encodedBlockCache),
+      codec(Codec::PCM),
+      helloAllowed(true),
+      sessionToken(NO_SESSION),
+      outputQueue(streamConfig.queueLowWatermark, streamConfig.queueHighWatermark, reactorStats),
+      nextStream(0) {
+    if (sessions) {
+        // The token goes out first, so a client knows it before any audio
+        sessionToken = sessions->issueToken();
+        wire::U64::write(tokenPayload.data(), sessionToken);
+        outputQueue.pushFrame(MessageType::SESSION_TOKEN, tokenPayload.data(), tokenPayload.size());
+    }
 }
 
 ClientHandler::~ClientHandler() {
     stop();
 }
 
-void ClientHandler::start() {
-    isRunning.store(true);
-    clientThread = std::thread(&ClientHandler::handleClient, this);
+void ClientHandler::stop() {
+    if (sessions && !streams.empty()) {
+        std::vector<SessionRegistry::ParkedStream> parked;
+        for (const Stream& stream : streams) {
+            SessionRegistry::ParkedStream entry;
+            entry.id = stream.id;
+            entry.track = stream.track;
+            entry.song = stream.song;
+            entry.endFrame = stream.frameCount == 0 ? 0 : stream.firstFrame + stream.frameCount;
+            entry.paused = stream.paused;
+            parked.push_back(std::move(entry));
+        }
+        sessions->park(sessionToken, std::move(parked));
+    }
+    streams.clear();
+    outputQueue.clear();
+    clientSocket->close();
 }
 
-void ClientHandler::stop() {
-    if (isRunning.load()) {
-        isRunning.store(false);
-        
-        if (clientThread.joinable()) {
-            clientThread.join();
+int ClientHandler::getSocketFd() const {
+    return clientSocket->getSocketFd();
+}
+
+bool ClientHandler::wantsWrite() const {
+    return !outputQueue.empty() || hasReadyStream();
+}
+
+bool ClientHandler::hasReadyStream() const {
+    for (const Stream& stream : streams) {
+        if (stream.song && !stream.paced && !stream.paused) {
+            return true;
         }
-        
-        clientSocket->close();
     }
+    return false;
 }
 
-bool ClientHandler::isActive() const {
-    return isRunning.load();
+bool ClientHandler::wantsRead() const {
+    // Song data stops at the high watermark, so only a flood of requests
+    // can push the backlog past twice that
+    return outputQueue.size() < 2 * config.queueHighWatermark &&
+           inputBuffer.size() < MAX_INPUT_BUFFER;
 }
 
-void ClientHandler::handleClient() {
-    while (isRunning.load() && clientSocket->connected()) {
-        // Receive message header
-        std::vector<char> headerData = clientSocket->receive(sizeof(MessageHeader));
-        
-        if (headerData.empty()) {
-            if (clientSocket->connected()) {
-                // Just no data yet, continue
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                continue;
-            } else {
-                // Connection closed
-                std::cout << "Client disconnected" << std::endl;
-                break;
-            }
+bool ClientHandler::checkBacklog(StreamPacer::Clock::time_point now) const {
+    double age = std::chrono::duration<double>(outputQueue.oldestFrameAge(now)).count();
+    if (config.evictAfterSeconds > 0 && age > config.evictAfterSeconds) {
+        std::cerr << "Evicting slow client: " << outputQueue.size() << " bytes queued, oldest frame "
+                  << age << " seconds old" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+StreamPacer::Clock::time_point ClientHandler::nextWakeup() const {
+    auto wakeup = StreamPacer::Clock::time_point::max();
+    for (const Stream& stream : streams) {
+        if (stream.song && stream.paced && !stream.paused) {
+            wakeup = std::min(wakeup, stream.wakeupTime);
         }
-        
-        if (headerData.size() < sizeof(MessageHeader)) {
-            std::cerr << "Received incomplete header, closing connection" << std::endl;
-            break;
-        }
-        
-        // Parse the header
-        MessageHeader header;
-        memcpy(&header, headerData.data(), sizeof(MessageHeader));
-        
-        // Receive the message payload if there is one
-        std::vector<char> payload;
-        if (header.size > 0) {
-            payload = clientSocket->receive(header.size);
-            
-            if (payload.size() < header.size) {
-                std::cerr << "Received incomplete payload, closing connection" << std::endl;
-                break;
+    }
+    return wakeup;
+}
+
+bool ClientHandler::onTimer() {
+    auto now = StreamPacer::Clock::now();
+    bool resumed = false;
+    for (Stream& stream : streams) {
+        if (stream.song && stream.paced && now >= stream.wakeupTime) {
+            stream.paced = false;
+            resumed = true;
+        }
+    }
+    return resumed ? onWritable() : true;
+}
+
+bool ClientHandler::onReadable() {
+    // Drain what the kernel has buffered for us, up to the input limit
+    char readBuffer[READ_SIZE];
+    while (inputBuffer.size() < MAX_INPUT_BUFFER) {
+        ssize_t bytesRead = clientSocket->receiveSome(readBuffer, sizeof(readBuffer));
+        if (bytesRead < 0) {
+            return false;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        inputBuffer.insert(inputBuffer.end(), readBuffer, readBuffer + bytesRead);
+    }
+
+    if (!processInput()) {
+        return false;
+    }
+
+    // Try to send responses right away instead of waiting for the next poll
+    return onWritable();
+}
+
+bool ClientHandler::onSongLoaded(TrackId trackId, std::shared_ptr<WavFile> song) {
+    // Streams cancelled while the song loaded are gone; the load is ignored
+    for (size_t i = 0; i < streams.size();) {
+        Stream& stream = streams[i];
+        if (!stream.song && stream.track == trackId && !startStream(stream, song)) {
+            streams.erase(streams.begin() + i);
+            continue;
+        }
+        ++i;
+    }
+    return onWritable();
+}
+
+bool ClientHandler::hasBufferedRequest() const {
+    if (inputBuffer.size() < MESSAGE_HEADER_SIZE) {
+        return false;
+    }
+    // An oversized header counts, so processInput() gets to reject it
+    MessageHeader header = decodeMessageHeader(inputBuffer.data());
+    return header.size > MAX_REQUEST_SIZE || inputBuffer.size() - MESSAGE_HEADER_SIZE >= header.size;
+}
+
+bool ClientHandler::processInput() {
+    // Process complete messages while the response backlog has room
+    size_t offset = 0;
+    while (inputBuffer.size() - offset >= MESSAGE_HEADER_SIZE &&
+           outputQueue.size() < 2 * config.queueHighWatermark) {
+        MessageHeader header = decodeMessageHeader(inputBuffer.data() + offset);
+
+        if (header.size > MAX_REQUEST_SIZE) {
+            std::cerr << "Received oversized message (" << header.size
+                      << " bytes), closing connection" << std::endl;
+            return false;
+        }
+
+        if (inputBuffer.size() - offset < MESSAGE_HEADER_SIZE + header.size) {
+            // Wait for the rest of the payload
+            break;
+        }
+
+        // Handled in place; the buffer is only compacted after the loop
+        std::string_view payload(inputBuffer.data() + offset + MESSAGE_HEADER_SIZE, header.size);
+        offset += MESSAGE_HEADER_SIZE + header.size;
+
+        handleMessage(header.type, payload);
+    }
+
+    inputBuffer.erase(inputBuffer.begin(), inputBuffer.begin() + offset);
+    return true;
+}
+
+bool ClientHandler::onWritable() {
+    while (true) {
+        // Top up from the streams while the backlog is under the watermark
+        while (outputQueue.canProduce() && produceSongData()) {
+        }
+
+        if (!outputQueue.flush(*clientSocket)) {
+            std::cerr << "Error sending data to client, closing connection" << std::endl;
+            return false;
+        }
+
+        // Requests held back while the backlog was over the limit get
+        // their turn once it drains; no new input may arrive to wake them
+        if (hasBufferedRequest() && outputQueue.size() < 2 * config.queueHighWatermark) {
+            if (!processInput()) {
+                return false;
             }
+            continue;
+        }
+
+        if (!outputQueue.empty()) {
+            // Socket buffer is full, wait for the next writable event
+            return true;
         }
-        
-        // Handle the message based on its type
-        switch (header.type) {
-            case MessageType::LIST_REQUEST:
+
+        if (!hasReadyStream()) {
+            return true;
+        }
+    }
+}
+
+void ClientHandler::handleMessage(MessageType type, std::string_view payload) {
+    switch (type) {
+        case MessageType::HELLO:
+            negotiate(payload);
+            break;
+
+        case MessageType::LIST_REQUEST:
+            uint64_t version;
+            if (ListSyncRequestMessage::decode(payload, version)) {
+                syncSongList(version);
+            } else {
                 sendSongList();
-                break;
-                
-            case MessageType::SONG_REQUEST:
-                {
-                    // Extract song name from payload
-                    std::string songName(payload.begin(), payload.end());
-                    std::cout << "Client requested song: " << songName << std::endl;
-                    sendSong(songName);
+            }
+            break;
+
+        case MessageType::SONG_REQUEST:
+            {
+                // Older clients name the song; resolve it to its track once
+                StreamId streamId;
+                std::string_view songName;
+                if (!SongRequestMessage::decode(payload, streamId, songName)) {
+                    break;
                 }
-                break;
-                
-            case MessageType::PLAY_CONTROL:
-                // Client-side controls don't require server action in this implementation
-                break;
-                
-            default:
-                std::cerr << "Received unknown message type: " << static_cast<int>(header.type) << std::endl;
-                break;
-        }
+                TrackId trackId = library->findTrack(songName);
+                if (trackId == NO_TRACK) {
+                    sendError("Song not found: " + std::string(songName));
+                } else {
+                    sendSong(streamId, trackId);
+                }
+            }
+            break;
+
+        case MessageType::TRACK_REQUEST:
+            {
+                StreamId streamId;
+                TrackId trackId;
+                uint64_t firstFrame;
+                uint64_t frameCount;
+                if (TrackRequestMessage::decode(payload, streamId, trackId, firstFrame, frameCount)) {
+                    sendSong(streamId, trackId, firstFrame, frameCount);
+                }
+            }
+            break;
+
+        case MessageType::STREAM_CANCEL:
+            {
+                StreamId streamId;
+                if (StreamCancelMessage::decode(payload, streamId)) {
+                    cancelStream(streamId);
+                }
+            }
+            break;
+
+        case MessageType::SEARCH_REQUEST:
+        case MessageType::BROWSE_REQUEST:
+            sendQueryPage(type, payload);
+            break;
+
+        case MessageType::PLAY_CONTROL:
+            {
+                StreamId streamId;
+                PlayControl command;
+                double position;
+                if (!PlayControlMessage::decode(payload, streamId, command, position)) {
+                    break;
+                }
+                if (!std::isfinite(position)) {
+                    sendError("Invalid play position");
+                    break;
+                }
+                controlStream(streamId, command, position);
+            }
+            break;
+
+        case MessageType::SESSION_RESUME:
+            {
+                SessionToken token;
+                StreamId streamId;
+                TrackId trackId;
+                uint64_t firstFrame;
+                if (SessionResumeMessage::decode(payload, token, streamId, trackId, firstFrame)) {
+                    resumeStream(token, streamId, trackId, firstFrame);
+                }
+            }
+            break;
+
+        default:
+            std::cerr << "Received unknown message type: " << static_cast<int>(type) << std::endl;
+            break;
     }
-    
-    // Clean up
-    isRunning.store(false);
-    clientSocket->close();
-    std::cout << "Client handler thread terminated" << std::endl;
+}
+
+bool ClientHandler::negotiate(std::string_view payload) {
+    // SONG_DATA does not name its codec, and the HELLO_ACK payload may still
+    // be queued, so the settings cannot change once they are in use
+    if (!helloAllowed) {
+        return sendError("HELLO must come once, before any stream");
+    }
+    helloAllowed = false;
+
+    uint32_t version;
+    uint32_t maxChunk;
+    CodecSet codecs;
+    double windowSeconds;
+    uint32_t receiveBuffer;
+    if (!HelloMessage::decode(payload, version, maxChunk, codecs, windowSeconds, receiveBuffer)) {
+        return sendError("Malformed HELLO");
+    }
+
+    // The most compact codec the client decodes and the server offers:
+    // ADPCM only goes to clients that ask for the low-bitrate mode
+    codec = Codec::PCM;
+    if (config.adpcm && encodedBlocks && (codecs & codecBit(Codec::ADPCM)) != 0) {
+        codec = Codec::ADPCM;
+    } else if (config.compression && encodedBlocks && (codecs & codecBit(Codec::LOSSLESS)) != 0) {
+        codec = Codec::LOSSLESS;
+    } else if ((codecs & codecBit(Codec::PCM)) == 0) {
+        std::cerr << "Client decodes no codec this server sends, using PCM" << std::endl;
+    }
+
+    // Chunks fit the client's frame limit and its socket buffer, so a whole
+    // chunk can land before the client reads it. 'config' still holds the
+    // server's settings here, as HELLO is only handled once.
+    size_t chunkSize = config.chunkSize;
+    size_t chunkOverhead = SONG_DATA_PREFIX_SIZE - MESSAGE_HEADER_SIZE;
+    chunkSize = std::min<size_t>(chunkSize, maxChunk > chunkOverhead ? maxChunk - chunkOverhead : 0);
+    if (receiveBuffer > 0) {
+        chunkSize = std::min<size_t>(chunkSize, receiveBuffer);
+    }
+    if (codec != Codec::PCM) {
+        // Room for the block headers of audio that does not compress
+        size_t blockOverhead =
+            EncodedBlockCache::blockOverhead(codec) * (chunkSize / EncodedBlockCache::blockFrames(codec) + 1);
+        chunkSize = chunkSize > blockOverhead ? chunkSize - blockOverhead : 0;
+    }
+    config.chunkSize = std::max(chunkSize, MIN_CHUNK_SIZE);
+    config.firstChunkSize = std::min(config.firstChunkSize, config.chunkSize);
+    if (windowSeconds > 0) {
+        config.leadSeconds = std::min(config.leadSeconds, windowSeconds);
+    }
+
+    // Playback can start once the first chunks add up to a full one
+    HelloAckMessage::encodePayload(helloAckPayload.data(), std::min(version, PROTOCOL_VERSION),
+                                   static_cast<uint32_t>(config.chunkSize),
+                                   static_cast<uint32_t>(config.firstChunkSize), codec,
+                                   config.leadSeconds, static_cast<uint32_t>(config.chunkSize));
+    outputQueue.pushFrame(MessageType::HELLO_ACK, helloAckPayload.data(), helloAckPayload.size());
+    return true;
 }
 
 bool ClientHandler::sendSongList() {
-    const auto& songs = library->getSongList();
-    
-    // Serialize and send the song list
-    std::vector<char> message = serializeMessage(MessageType::LIST_RESPONSE, songs);
-    bool result = clientSocket->send(message);
-    
-    if (result) {
-        std::cout << "Sent song list with " << songs.size() << " songs to client" << std::endl;
-    } else {
-        std::cerr << "Failed to send song list to client" << std::endl;
+    // The catalog keeps the list serialized; the frame references it and
+    // holds the catalog until it is sent
+    auto catalog = library->getCatalog();
+    std::string_view songList = catalog->getListPayload();
+    outputQueue.pushFrame(MessageType::LIST_RESPONSE, songList.data(), songList.size(), catalog);
+    return true;
+}
+
+bool ClientHandler::syncSongList(uint64_t knownVersion) {
+    // Replies are prebuilt per catalog; the frame holds the catalog until sent
+    ListReply reply = library->getListUpdate(knownVersion);
+    outputQueue.pushFrame(reply.type, reply.payload.data(), reply.payload.size(), reply.owner);
+    return true;
+}
+
+bool ClientHandler::sendQueryPage(MessageType type, std::string_view payload) {
+    // Both request types have the same layout
+    uint32_t offset;
+    uint16_t limit;
+    std::string_view text;
+    if (!SearchRequestMessage::decode(payload, offset, limit, text)) {
+        return sendError("Malformed query");
     }
-    
-    return result;
+
+    auto page = std::make_shared<const std::vector<char>>(
+        type == MessageType::SEARCH_REQUEST ? library->search(text, offset, limit)
+                                            : library->browse(text, offset, limit));
+    MessageType responseType =
+        type == MessageType::SEARCH_REQUEST ? MessageType::SEARCH_RESPONSE : MessageType::BROWSE_RESPONSE;
+    outputQueue.pushFrame(responseType, page->data(), page->size(), page);
+    return true;
 }
 
-bool ClientHandler::sendSong(const std::string& songName) {
-    // Check if the song exists
-    if (!library->hasSong(songName)) {
-        return sendError("Song not found: " + songName);
+bool ClientHandler::sendSong(StreamId streamId, TrackId trackId, uint64_t firstFrame, uint64_t frameCount) {
+    if (streamId == NO_STREAM) {
+        return sendError("Invalid stream ID");
     }
-    
-    // Load the song
-    auto song = library->getSong(songName);
-    if (!song || !song->isLoaded()) {
-        return sendError("Failed to load song: " + songName);
+    // A request on a stream still sending replaces its song
+    cancelStream(streamId);
+
+    if (streams.size() >= MAX_STREAMS) {
+        return sendError("Too many streams");
     }
-    
-    // Send the WAV header
-    std::vector<char> headerMessage = serializeMessage(MessageType::SONG_INFO, song->getHeader());
-    if (!clientSocket->send(headerMessage)) {
-        std::cerr << "Failed to send song header" << std::endl;
+
+    // Check if the song exists (an integer probe of the catalog)
+    if (!library->hasTrack(trackId)) {
+        return sendError("Song not found: track " + std::to_string(trackId));
+    }
+
+    helloAllowed = false;
+    Stream stream;
+    stream.id = streamId;
+    stream.track = trackId;
+    stream.firstFrame = firstFrame;
+    stream.frameCount = frameCount;
+    streams.push_back(std::move(stream));
+
+    std::shared_ptr<WavFile> song;
+    if (deliverSong) {
+        // Cached songs start right away; otherwise the disk engine loads the
+        // song and the reactor hands it back through onSongLoaded(), while
+        // this client's other requests go on being answered
+        SongDelivery deliver = deliverSong;
+        song = library->requestSong(trackId, [deliver, trackId](std::shared_ptr<WavFile> loaded) {
+            deliver(trackId, loaded);
+        });
+        if (!song) {
+            return true;
+        }
+    } else {
+        song = library->getSong(trackId);
+    }
+
+    if (!startStream(streams.back(), song)) {
+        streams.pop_back();
+    }
+    return true;
+}
+
+bool ClientHandler::startStream(Stream& stream, std::shared_ptr<WavFile> song) {
+    // The name is only needed for error messages, once per song
+    std::string songName = library->getTrackName(stream.track);
+    if (!song || !song->isLoaded()) {
+        sendError("Failed to load song: " + songName);
         return false;
     }
-    
-    // Send the audio data in chunks
-    const auto& audioData = song->getAudioData();
-    size_t offset = 0;
-    
-    while (offset < audioData.size()) {
-        // Serialize and send a chunk of audio data
-        std::vector<char> dataMessage = serializeAudioData(audioData, offset, CHUNK_SIZE);
-        
-        if (!clientSocket->send(dataMessage)) {
-            std::cerr << "Failed to send audio data chunk" << std::endl;
+    stream.song = song;
+    stream.name = songName;
+    if (stream.seekTo >= 0) {
+        stream.firstFrame = frameAt(*song, stream.seekTo);
+        stream.frameCount = 0;
+    }
+    positionStream(stream);
+    return true;
+}
+
+void ClientHandler::positionStream(Stream& stream) {
+    // Clamp the requested frames to the song; the range may start anywhere,
+    // since chunks are read from the song (or its file) at any offset
+    const WavHeader& header = stream.song->getHeader();
+    size_t audioSize = stream.song->getAudioSize();
+    size_t frameSize = std::max<size_t>(header.blockAlign, 1);
+    uint64_t totalFrames = audioSize / frameSize;
+    uint64_t firstFrame = std::min<uint64_t>(stream.firstFrame, totalFrames);
+    uint64_t lastFrame = stream.frameCount == 0 ? totalFrames
+                                                : firstFrame + std::min(stream.frameCount, totalFrames - firstFrame);
+    stream.start = firstFrame * frameSize;
+    stream.end = lastFrame == totalFrames ? audioSize : lastFrame * frameSize;
+
+    // Queue the start frame and WAV header ahead of other streams' audio;
+    // this stream's chunks follow as the socket drains
+    auto info = std::make_shared<std::array<char, wire::U64::MIN_SIZE + sizeof(WavHeader)>>();
+    memcpy(wire::U64::write(info->data(), firstFrame), &header, sizeof(WavHeader));
+    outputQueue.pushStreamFrame(stream.id, OutboundQueue::Lane::CONTROL, MessageType::SONG_INFO,
+                                info->data(), info->size(), info);
+    stream.offset = stream.start;
+    stream.prefetchedUntil = stream.start;
+    stream.chunkLimit = std::max<size_t>(std::min(config.firstChunkSize, config.chunkSize), 1);
+    stream.paced = false;
+
+    // Pacing counts from the start of the range, so a seek gets a fresh lead
+    auto now = StreamPacer::Clock::now();
+    if (config.pacing) {
+        stream.pacer.start(header.byteRate, header.blockAlign, config.leadSeconds, config.paceRate, now);
+        if (stream.paused) {
+            stream.pacer.pause(now);
+        }
+    } else {
+        stream.pacer.disable();
+    }
+}
+
+void ClientHandler::controlStream(StreamId streamId, PlayControl command, double position) {
+    auto found = std::find_if(streams.begin(), streams.end(),
+                              [streamId](const Stream& stream) { return stream.id == streamId; });
+    if (found == streams.end()) {
+        // Sent in full or cancelled already
+        return;
+    }
+    Stream& stream = *found;
+    auto now = StreamPacer::Clock::now();
+
+    switch (command) {
+        case PlayControl::PAUSE:
+            stream.paused = true;
+            stream.pacer.pause(now);
+            break;
+
+        case PlayControl::PLAY:
+            stream.paused = false;
+            stream.pacer.resume(now);
+            break;
+
+        case PlayControl::STOP:
+            cancelStream(streamId);
+            break;
+
+        case PlayControl::SEEK:
+            if (!stream.song) {
+                // Still loading: start from there instead
+                stream.seekTo = std::max(0.0, position);
+                break;
+            }
+            // Audio of the old position not sent yet is dropped; what is
+            // already on the way arrives ahead of the new SONG_INFO
+            outputQueue.cancelStream(streamId);
+            stream.firstFrame = frameAt(*stream.song, position);
+            stream.frameCount = 0;
+            positionStream(stream);
+            break;
+    }
+}
+
+bool ClientHandler::resumeStream(SessionToken token, StreamId streamId, TrackId trackId, uint64_t firstFrame) {
+    // Only this stream is taken; the session's others wait for their own resume
+    SessionRegistry::ParkedStream parked;
+    if (!sessions || token == NO_SESSION || !sessions->resume(token, streamId, parked) ||
+        parked.track != trackId) {
+        // Expired, or the old connection was not seen to drop yet
+        return sendSong(streamId, trackId, firstFrame);
+    }
+
+    // The parked song keeps it cached, so the stream starts right away
+    uint64_t frameCount = 0;
+    if (parked.endFrame != 0) {
+        // A range received in full is sent from its last frame, which the
+        // client already has, so that it still gets the end marker
+        firstFrame = std::min(firstFrame, parked.endFrame - 1);
+        frameCount = parked.endFrame - firstFrame;
+    }
+    sendSong(streamId, trackId, firstFrame, frameCount);
+    if (parked.paused) {
+        controlStream(streamId, PlayControl::PAUSE, 0);
+    }
+    return true;
+}
+
+void ClientHandler::cancelStream(StreamId streamId) {
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (streams[i].id == streamId) {
+            streams.erase(streams.begin() + i);
+            if (nextStream > i) {
+                nextStream--;
+            }
+            break;
+        }
+    }
+    outputQueue.cancelStream(streamId);
+}
+
+bool ClientHandler::produceSongData() {
+    for (size_t tried = 0; tried < streams.size(); ++tried) {
+        size_t index = (nextStream + tried) % streams.size();
+        Stream& stream = streams[index];
+        if (!stream.song || stream.paced || stream.paused) {
+            continue;
+        }
+
+        bool queued = produceChunk(stream);
+        if (!stream.song) {
+            // Sent in full: the stream after it takes its place
+            streams.erase(streams.begin() + index);
+            nextStream = index;
+        } else {
+            nextStream = index + 1;
+        }
+        if (queued) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ClientHandler::produceChunk(Stream& stream) {
+    AudioSpan audio = stream.song->getAudioData();
+
+    if (stream.offset < stream.end) {
+        size_t sent = stream.offset - stream.start;
+        size_t remaining = stream.end - stream.offset;
+        auto now = StreamPacer::Clock::now();
+        size_t chunkSize = stream.pacer.nextChunk(sent, remaining, stream.chunkLimit, now);
+
+        if (chunkSize == 0) {
+            // Ahead of the playhead: sleep until the next top-up is due
+            stream.paced = true;
+            stream.wakeupTime = stream.pacer.nextSendTime(sent, remaining);
             return false;
         }
-        
-        // Update offset
-        size_t chunkSize = std::min(CHUNK_SIZE, audioData.size() - offset);
-        offset += chunkSize;
-        
-        // Small sleep to prevent overwhelming the network
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        // End the chunk on a block grid where it crosses it: the codec's, so
+        // the chunks after a seek are whole blocks the cache can share, or
+        // the song's checksum grid, so its CRC comes from the block CRCs
+        size_t blockBytes = stream.song->getChecksumBlockSize();
+        if (codec != Codec::PCM) {
+            blockBytes =
+                EncodedBlockCache::blockFrames(codec) * std::max<size_t>(stream.song->getHeader().blockAlign, 1);
+        }
+        size_t gridEnd = (stream.offset + chunkSize) / blockBytes * blockBytes;
+        if (gridEnd > stream.offset && stream.offset + chunkSize < stream.end) {
+            chunkSize = gridEnd - stream.offset;
+        }
+
+        if (!audio.empty() && codec != Codec::PCM) {
+            pushEncodedChunk(stream, audio.data + stream.offset, chunkSize);
+        } else if (!audio.empty()) {
+            // Blocks are read for the CRC only the first time the song is
+            // sent; after that only the bytes before the first block
+            // boundary (after a seek) are, so the file can still send the chunk
+            uint32_t crc = stream.song->checksum(stream.offset, chunkSize);
+            if (config.zeroCopy && stream.song->getFileDescriptor() != -1) {
+                outputQueue.pushFileChunk(stream.id, stream.song, stream.offset, chunkSize, crc);
+            } else {
+                // Reference the chunk in the loaded song; writev sends it behind the header
+                outputQueue.pushSongData(stream.id, stream.offset, crc, audio.data + stream.offset, chunkSize,
+                                         stream.song);
+            }
+        } else {
+            // Song is not held in memory: read just this segment from the
+            // file, which is then checksummed and sent from memory
+            auto segment = stream.song->readSegment(stream.offset, chunkSize);
+            if (!segment) {
+                stream.song.reset();
+                return sendError("Failed to read song: " + stream.name);
+            }
+            if (codec != Codec::PCM) {
+                pushEncodedChunk(stream, segment->data(), segment->size());
+            } else {
+                uint32_t crc = crc32c::compute(segment->data(), segment->size());
+                outputQueue.pushSongData(stream.id, stream.offset, crc, segment->data(), segment->size(), segment);
+            }
+        }
+
+        stream.offset += chunkSize;
+
+        // Small chunks get the first audio out quickly; larger ones then
+        // cut the per-frame overhead
+        stream.chunkLimit = std::min(stream.chunkLimit * 2, config.chunkSize);
+
+        // Keep the kernel reading a few chunks ahead so later segments come
+        // from the page cache instead of waiting on the disk
+        if (stream.prefetchedUntil < std::min(stream.offset + config.chunkSize, stream.end)) {
+            size_t start = std::max(stream.prefetchedUntil, stream.offset);
+            stream.prefetchedUntil = std::min(stream.offset + READAHEAD_CHUNKS * config.chunkSize, stream.end);
+            stream.song->prefetch(start, stream.prefetchedUntil - start);
+        }
+        return true;
     }
-    
+
     // Send end marker
-    std::vector<char> endMessage = serializeMessage(MessageType::SONG_DATA_END, std::string());
-    bool result = clientSocket->send(endMessage);
-    
-    if (result) {
-        std::cout << "Sent complete song: " << songName << " (" 
-                  << audioData.size() << " bytes)" << std::endl;
-    } else {
-        std::cerr << "Failed to send song end marker" << std::endl;
+    outputQueue.pushStreamFrame(stream.id, OutboundQueue::Lane::DATA, MessageType::SONG_DATA_END, nullptr, 0);
+    stream.song.reset();
+    return true;
+}
+
+void ClientHandler::pushEncodedChunk(Stream& stream, const char* pcm, size_t size) {
+    // A frame per block, queued straight from the cache with the block's
+    // own CRC; each frame's offset still counts PCM bytes
+    size_t offset = stream.offset;
+    for (const EncodedBlockCache::Block& block : encodedBlocks->encode(stream.song, codec, offset, pcm, size)) {
+        outputQueue.pushSongData(stream.id, offset, block->crc, block->data.data(), block->data.size(), block);
+        offset += block->pcmBytes;
     }
-    
-    return result;
 }
 
 bool ClientHandler::sendError(const std::string& errorMessage) {
-    std::vector<char> message = serializeMessage(MessageType::ERROR, errorMessage);
-    bool result = clientSocket->send(message);
-    
-    if (result) {
-        std::cout << "Sent error to client: " << errorMessage << std::endl;
-    } else {
-        std::cerr << "Failed to send error message to client" << std::endl;
-    }
-    
-    return result;
-}
\ No newline at end of file
+    auto message = std::make_shared<const std::string>(errorMessage);
+    outputQueue.pushFrame(MessageType::ERROR, message->data(), message->size(), message);
+    return true;
+}
@@ -1,44 +1,199 @@
 #ifndef CLIENT_HANDLER_H
 #define CLIENT_HANDLER_H
 
-#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
-#include <thread>
+#include <string_view>
+#include <vector>
+#include "../../common/include/protocol.h"
 #include "../../common/include/socket.h"
+#include "encoded_block_cache.h"
 #include "music_library.h"
+#include "outbound_queue.h"
+#include "server_stats.h"
+#include "session_registry.h"
+#include "stream_pacer.h"
 
+// Streaming settings shared by every connection of a server
+struct StreamConfig {
+    bool zeroCopy = true;      // Send audio bodies with sendfile instead of copying them
+    bool pacing = true;        // Limit each stream to its playback rate after the lead window
+    double leadSeconds = 10.0; // Audio sent ahead of the playhead when a stream starts
+    double paceRate = 1.0;     // Top-up speed as a multiple of the song's byte rate
+    size_t chunkSize = 256 * 1024;      // Largest audio chunk per SONG_DATA frame
+    size_t firstChunkSize = 16 * 1024;  // Chunk a stream starts with, doubling up to chunkSize
+    size_t queueLowWatermark = 256 * 1024;    // Song data resumes once the backlog drains to this
+    size_t queueHighWatermark = 1024 * 1024;  // Song data pauses once the backlog reaches this
+    double evictAfterSeconds = 30.0;          // Drop clients whose oldest queued frame is older
+    double resumeSeconds = 60.0;              // Keep a dropped connection's streams for resuming
+    bool compression = true;                  // Offer the lossless codec to clients that decode it
+    bool adpcm = true;                        // Offer ADPCM to clients that ask for the low-bitrate mode
+    size_t encodedCacheBytes = 256 * 1024 * 1024;  // Memory budget for encoded blocks, 0 = none kept
+};
+
+// Hands a song loaded on a disk engine thread back to the connection's
+// event loop, which then calls ClientHandler::onSongLoaded()
+using SongDelivery = std::function<void(TrackId trackId, std::shared_ptr<WavFile> song)>;
+
+// Per-connection protocol state. A handler never blocks: the owning Reactor
+// calls onReadable()/onWritable() when the socket is ready, and the handler
+// parses whatever complete frames have arrived and writes as much of its
+// pending output as the socket accepts. See protocol.h for the messages.
 class ClientHandler {
 private:
+    // Most streams one connection may have in flight
+    static constexpr size_t MAX_STREAMS = 8;
+
+    // One song being sent
+    struct Stream {
+        StreamId id = NO_STREAM;
+        TrackId track = NO_TRACK;
+        std::shared_ptr<WavFile> song;  // Null while it loads
+        std::string name;               // For logs and errors
+        uint64_t firstFrame = 0;        // Requested range of sample frames,
+        uint64_t frameCount = 0;        // 0 frames meaning the rest of the song
+        size_t start = 0;               // Audio bytes of the range, once loaded
+        size_t end = 0;
+        size_t offset = 0;              // Next audio byte to send
+        size_t prefetchedUntil = 0;     // End of the audio already requested from the kernel
+        size_t chunkLimit = 0;          // Largest chunk to send next; grows to the chunk size
+        double seekTo = -1;             // Seconds to start from once loaded, if seeked while loading
+        bool paused = false;            // The listener paused: nothing is sent until it plays
+
+        // Playback-rate limiter; when it holds the stream back, the reactor
+        // calls onTimer() at wakeupTime
+        StreamPacer pacer;
+        bool paced = false;
+        StreamPacer::Clock::time_point wakeupTime;
+    };
+
     std::unique_ptr<Socket> clientSocket;
     std::shared_ptr<MusicLibrary> library;
-    std::atomic<bool> isRunning;
-    std::thread clientThread;
-    
-    // Handle client request
-    void handleClient();
-    
+    StreamConfig config;       // The server's settings, fitted to the client by HELLO
+    SongDelivery deliverSong;  // Null: load songs synchronously
+    SessionRegistry* sessions; // Null: connections cannot be resumed
+    EncodedBlockCache* encodedBlocks;  // Null: audio is sent as PCM
+    Codec codec;               // Encoding of the audio in SONG_DATA
+    bool helloAllowed;         // No HELLO or stream yet, so one may still set up the connection
+    SessionToken sessionToken;
+    std::array<char, wire::U64::MIN_SIZE> tokenPayload;
+    std::array<char, HelloAckMessage::MIN_SIZE> helloAckPayload;
+
+    // Bytes received but not yet parsed into a complete message
+    std::vector<char> inputBuffer;
+
+    // Frames waiting to be written, in wire order
+    OutboundQueue outputQueue;
+
+    // Streams in flight, oldest first, and the one to queue a chunk from next
+    std::vector<Stream> streams;
+    size_t nextStream;
+
+    // Parse and handle the complete messages in the input buffer
+    bool processInput();
+
+    // Check if a complete message is waiting in the input buffer
+    bool hasBufferedRequest() const;
+
+    // Handle one complete message from the client
+    void handleMessage(MessageType type, std::string_view payload);
+
+    // Queue the next chunk of one stream, taking the streams in turn;
+    // returns false if none can send (all loading or held back by pacing)
+    bool produceSongData();
+
+    // Queue the next chunk of 'stream'; returns false if pacing holds it
+    // back. Clears the stream's song once the song has been sent.
+    bool produceChunk(Stream& stream);
+
+    // Queue the audio at 'pcm', 'size' bytes from the offset of 'stream' on,
+    // compressed with the connection's codec, one frame per codec block
+    void pushEncodedChunk(Stream& stream, const char* pcm, size_t size);
+
+    // Check if a stream has data it may send now
+    bool hasReadyStream() const;
+
+    // Pick the connection's chunk sizes, pacing window and codec from the
+    // client's HELLO and answer with HELLO_ACK. HELLO is accepted once,
+    // before any stream has started; otherwise it gets an ERROR.
+    bool negotiate(std::string_view payload);
+
     // Send the list of available songs to the client
     bool sendSongList();
-    
-    // Send a song to the client
-    bool sendSong(const std::string& songName);
-    
+
+    // Bring a client's saved copy of the list at 'knownVersion' up to date
+    bool syncSongList(uint64_t knownVersion);
+
+    // Answer a SEARCH_REQUEST or BROWSE_REQUEST with one page of results
+    bool sendQueryPage(MessageType type, std::string_view payload);
+
+    // Look up a requested song and start streaming frames
+    // [firstFrame, firstFrame + frameCount) of it on 'streamId' (the rest of
+    // the song if 'frameCount' is 0), or wait for its load
+    bool sendSong(StreamId streamId, TrackId trackId, uint64_t firstFrame = 0, uint64_t frameCount = 0);
+
+    // Queue SONG_INFO and start streaming the requested range of a loaded
+    // song; returns false (and reports the error) if it failed to load
+    bool startStream(Stream& stream, std::shared_ptr<WavFile> song);
+
+    // Queue SONG_INFO and send 'stream' from the first frame of its
+    // requested range on, with pacing counted from there
+    void positionStream(Stream& stream);
+
+    // Apply the listener's PLAY, PAUSE, STOP or SEEK to one of its streams
+    void controlStream(StreamId streamId, PlayControl command, double position);
+
+    // Take 'streamId' of the dropped session 'token' back up from
+    // 'firstFrame' on, or send the track from there if nothing is parked
+    bool resumeStream(SessionToken token, StreamId streamId, TrackId trackId, uint64_t firstFrame);
+
+    // Stop a stream and drop its unsent frames
+    void cancelStream(StreamId streamId);
+
     // Send an error message to the client
     bool sendError(const std::string& errorMessage);
 
 public:
-    ClientHandler(std::unique_ptr<Socket> socket, std::shared_ptr<MusicLibrary> musicLibrary);
+    ClientHandler(std::unique_ptr<Socket> socket, std::shared_ptr<MusicLibrary> musicLibrary,
+                  const StreamConfig& streamConfig = StreamConfig(),
+                  ReactorStats* reactorStats = nullptr,
+                  SongDelivery songDelivery = nullptr,
+                  SessionRegistry* sessionRegistry = nullptr,
+                  EncodedBlockCache* encodedBlockCache = nullptr);
     ~ClientHandler();
-    
-    // Start handling the client
-    void start();
-    
-    // Stop handling the client
+
+    // Read and process pending input; returns false if the connection should close
+    bool onReadable();
+
+    // Write pending output; returns false if the connection should close
+    bool onWritable();
+
+    // Resume a paced stream once its wakeup time has passed
+    bool onTimer();
+
+    // Start the streams waiting for a song; returns false if the
+    // connection should close
+    bool onSongLoaded(TrackId trackId, std::shared_ptr<WavFile> song);
+
+    // Check if the handler has output waiting for the socket to become writable
+    bool wantsWrite() const;
+
+    // Check if the handler accepts more requests; false while its response
+    // backlog is over the limit, which pushes back on the client through TCP
+    bool wantsRead() const;
+
+    // Check whether the client keeps up; returns false if it should be evicted
+    bool checkBacklog(StreamPacer::Clock::time_point now) const;
+
+    // Time the handler wants onTimer() called (time_point::max() if none)
+    StreamPacer::Clock::time_point nextWakeup() const;
+
+    // Close the client connection, parking its streams for a resume
     void stop();
-    
-    // Check if the handler is running
-    bool isActive() const;
+
+    // Get the underlying socket descriptor
+    int getSocketFd() const;
 };
 
-#endif // CLIENT_HANDLER_H
\ No newline at end of file
+#endif // CLIENT_HANDLER_H
@@ -0,0 +1,503 @@
+#include "disk_engine.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace {
+
+// One queued read and how much of it is done
+struct ReadRequest {
+    int fd;
+    char* buffer;
+    size_t length;
+    size_t offset;
+    size_t completed;
+    DiskEngine::Completion done;
+    bool started = false;  // Counted in the in-flight depth
+#ifdef HAVE_IO_URING
+    struct iovec iov{};
+#endif
+};
+
+// Record a newly submitted read in the depth counters
+void trackSubmit(DiskStats& stats) {
+    size_t depth = stats.inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (depth > stats.peakInFlight.load(std::memory_order_relaxed)) {
+        stats.peakInFlight.store(depth, std::memory_order_relaxed);
+    }
+}
+
+// Fallback engine: a fixed pool of threads doing blocking preads. The pool
+// size is the in-flight cap.
+class ThreadPoolEngine : public DiskEngine {
+public:
+    explicit ThreadPoolEngine(size_t threadCount) : stopping(false) {
+        for (size_t i = 0; i < threadCount; ++i) {
+            workers.emplace_back(&ThreadPoolEngine::run, this);
+        }
+    }
+
+    ~ThreadPoolEngine() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        // Reads still queued never start; their callers hear it now
+        for (ReadRequest& request : pending) {
+            stats.queued.fetch_sub(1, std::memory_order_relaxed);
+            request.done(-ECANCELED);
+        }
+    }
+
+    void read(int fd, char* buffer, size_t length, size_t offset, Completion done) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(ReadRequest{fd, buffer, length, offset, 0, std::move(done)});
+            stats.queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        wakeup.notify_one();
+    }
+
+    const char* name() const override {
+        return "threads";
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<ReadRequest> pending;
+    std::vector<std::thread> workers;
+    bool stopping;
+
+    void run() {
+        while (true) {
+            ReadRequest request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this]() { return stopping || !pending.empty(); });
+                if (stopping) {
+                    return;
+                }
+                request = std::move(pending.front());
+                pending.pop_front();
+                stats.queued.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            trackSubmit(stats);
+            ssize_t result = 0;
+            while (request.completed < request.length) {
+                ssize_t bytesRead = pread(request.fd, request.buffer + request.completed,
+                                          request.length - request.completed,
+                                          static_cast<off_t>(request.offset + request.completed));
+                if (bytesRead < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (bytesRead < 0) {
+                    result = -errno;
+                    break;
+                }
+                if (bytesRead == 0) {
+                    break;
+                }
+                request.completed += bytesRead;
+            }
+            if (result == 0) {
+                result = static_cast<ssize_t>(request.completed);
+            }
+            stats.inFlight.fetch_sub(1, std::memory_order_relaxed);
+            stats.reads.fetch_add(1, std::memory_order_relaxed);
+            stats.bytesRead.fetch_add(request.completed, std::memory_order_relaxed);
+
+            request.done(result);
+        }
+    }
+};
+
+#ifdef HAVE_IO_URING
+
+// io_uring engine driven through the raw system calls (no liburing).
+// A single thread owns the ring: callers queue requests and poke an
+// eventfd the ring is reading, and the thread then moves every queued
+// request it has room for into the submission queue with one
+// io_uring_enter that also waits for the next completion.
+class IoUringEngine : public DiskEngine {
+public:
+    explicit IoUringEngine(size_t maxInFlight)
+        : cap(maxInFlight),
+          ringFd(-1),
+          wakeFd(-1),
+          sqRing(nullptr),
+          cqRing(nullptr),
+          sqes(nullptr),
+          sqRingSize(0),
+          cqRingSize(0),
+          sqesSize(0),
+          wakeValue(0),
+          stopping(false) {
+    }
+
+    ~IoUringEngine() override {
+        if (loopThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            poke();
+            loopThread.join();
+        }
+
+        // The ring thread has drained every read it started, so the kernel
+        // no longer writes into any caller's buffer
+        if (sqes) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+        if (wakeFd >= 0) {
+            close(wakeFd);
+        }
+        for (ReadRequest* request : pending) {
+            stats.queued.fetch_sub(1, std::memory_order_relaxed);
+            finish(request, -ECANCELED);
+        }
+    }
+
+    // Create the ring and start the completion thread
+    bool start() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        // One extra entry for the eventfd read that wakes the thread
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(cap + 1), &params));
+        if (ringFd < 0) {
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            sqRing = nullptr;
+            return false;
+        }
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqeMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               ringFd, IORING_OFF_SQES);
+        if (sqeMemory == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(sqeMemory);
+
+        char* sq = static_cast<char*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (wakeFd < 0) {
+            return false;
+        }
+
+        loopThread = std::thread(&IoUringEngine::run, this);
+        return true;
+    }
+
+    void read(int fd, char* buffer, size_t length, size_t offset, Completion done) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(new ReadRequest{fd, buffer, length, offset, 0, std::move(done)});
+            stats.queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        poke();
+    }
+
+    const char* name() const override {
+        return "io_uring";
+    }
+
+private:
+    size_t cap;
+    int ringFd;
+    int wakeFd;
+    void* sqRing;
+    void* cqRing;
+    struct io_uring_sqe* sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    uint64_t wakeValue;             // Target of the eventfd read
+    struct iovec wakeIov;
+
+    std::mutex mutex;               // Guards pending and stopping
+    std::deque<ReadRequest*> pending;
+    std::unordered_set<ReadRequest*> active;  // Owned by the ring thread
+    bool wakeArmed = false;         // The eventfd read is in the ring
+    bool stopping;
+    std::thread loopThread;
+
+    // Wake the ring thread so it picks up queued requests
+    void poke() {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            std::cerr << "Error waking disk engine: " << strerror(errno) << std::endl;
+        }
+    }
+
+    // Fill the next submission queue entry with a vectored read
+    void prepareRead(int fd, struct iovec* iov, size_t offset, uint64_t userData) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(iov);
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    void armWakeup() {
+        wakeIov.iov_base = &wakeValue;
+        wakeIov.iov_len = sizeof(wakeValue);
+        prepareRead(wakeFd, &wakeIov, 0, 0);
+        wakeArmed = true;
+    }
+
+    // Ask the kernel to abandon an in-flight read; its completion still arrives
+    void prepareCancel(ReadRequest* request) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<uint64_t>(request);
+        sqe->user_data = CANCEL_TAG;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Report a request's result to its caller and free it
+    void finish(ReadRequest* request, ssize_t result) {
+        if (request->started) {
+            stats.inFlight.fetch_sub(1, std::memory_order_relaxed);
+            stats.reads.fetch_add(1, std::memory_order_relaxed);
+            stats.bytesRead.fetch_add(request->completed, std::memory_order_relaxed);
+        }
+        request->done(result);
+        delete request;
+    }
+
+    void prepareRequest(ReadRequest* request) {
+        request->iov.iov_base = request->buffer + request->completed;
+        request->iov.iov_len = request->length - request->completed;
+        prepareRead(request->fd, &request->iov, request->offset + request->completed,
+                    reinterpret_cast<uint64_t>(request));
+    }
+
+    // user_data of cancel requests, whose completions are ignored (0 is the wakeup read)
+    static const uint64_t CANCEL_TAG = 1;
+
+    void run() {
+        armWakeup();
+        unsigned toSubmit = 1;
+        bool draining = false;
+        std::vector<std::pair<ReadRequest*, ssize_t>> finished;
+
+        while (true) {
+            std::deque<ReadRequest*> cancelled;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping && !draining) {
+                    // Shutting down: fail the queued reads and cancel the
+                    // started ones, then wait for the ring to go quiet
+                    // before the engine and the callers' buffers go away
+                    draining = true;
+                    cancelled.swap(pending);
+                    // The stop signal may have been consumed by a wakeup
+                    // read that was re-armed since; complete that one too
+                    poke();
+                    for (ReadRequest* request : active) {
+                        if (toSubmit < sqEntries) {
+                            prepareCancel(request);
+                            ++toSubmit;
+                        }
+                    }
+                }
+                // Move as much of the backlog as the cap allows into this batch
+                while (!draining && !pending.empty() && active.size() < cap && toSubmit < sqEntries) {
+                    ReadRequest* request = pending.front();
+                    pending.pop_front();
+                    stats.queued.fetch_sub(1, std::memory_order_relaxed);
+                    if (!request->started) {
+                        request->started = true;
+                        trackSubmit(stats);
+                    }
+                    active.insert(request);
+                    prepareRequest(request);
+                    ++toSubmit;
+                }
+            }
+
+            for (ReadRequest* request : cancelled) {
+                stats.queued.fetch_sub(1, std::memory_order_relaxed);
+                finish(request, -ECANCELED);
+            }
+            if (draining && active.empty() && !wakeArmed && toSubmit == 0) {
+                return;
+            }
+
+            int submitted = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, 1,
+                                                     IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (submitted < 0) {
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    std::cerr << "Error submitting disk reads: " << strerror(errno) << std::endl;
+                }
+                submitted = 0;
+            }
+            toSubmit -= static_cast<unsigned>(submitted);
+
+            // Reap every available completion
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                struct io_uring_cqe* cqe = &cqes[head & cqMask];
+                if (cqe->user_data == 0) {
+                    wakeArmed = false;
+                    if (!draining) {
+                        armWakeup();
+                        ++toSubmit;
+                    }
+                    continue;
+                }
+                if (cqe->user_data == CANCEL_TAG) {
+                    continue;
+                }
+
+                ReadRequest* request = reinterpret_cast<ReadRequest*>(cqe->user_data);
+                int result = cqe->res;
+                if (draining && (result == -EAGAIN || result == -EINTR || (result > 0 &&
+                    request->completed + result < request->length))) {
+                    // Not resumed once shutdown has begun
+                    result = -ECANCELED;
+                }
+                if (result == -EAGAIN || result == -EINTR || (result > 0 &&
+                    request->completed + result < request->length)) {
+                    // Short read: continue from where it stopped, ahead of newer requests
+                    if (result > 0) {
+                        request->completed += result;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    active.erase(request);
+                    pending.push_front(request);
+                    stats.queued.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                if (result > 0) {
+                    request->completed += result;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    active.erase(request);
+                }
+                finished.emplace_back(request, result < 0 ? result : static_cast<ssize_t>(request->completed));
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            for (auto& entry : finished) {
+                finish(entry.first, entry.second);
+            }
+            finished.clear();
+        }
+    }
+};
+
+#endif // HAVE_IO_URING
+
+} // namespace
+
+std::unique_ptr<DiskEngine> DiskEngine::create(Kind kind, size_t maxInFlight) {
+    if (maxInFlight == 0) {
+        maxInFlight = 1;
+    }
+
+#ifdef HAVE_IO_URING
+    if (kind != Kind::THREADS) {
+        auto engine = std::make_unique<IoUringEngine>(maxInFlight);
+        if (engine->start()) {
+            return engine;
+        }
+        std::cerr << "io_uring unavailable (" << strerror(errno) << "), using reader threads" << std::endl;
+    }
+#else
+    if (kind == Kind::IO_URING) {
+        std::cerr << "io_uring is not supported on this platform, using reader threads" << std::endl;
+    }
+#endif
+
+    return std::make_unique<ThreadPoolEngine>(maxInFlight);
+}
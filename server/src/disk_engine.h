@@ -0,0 +1,45 @@
+#ifndef DISK_ENGINE_H
+#define DISK_ENGINE_H
+
+#include <functional>
+#include <memory>
+#include <sys/types.h>
+#include "server_stats.h"
+
+// Asynchronous file reads for loading songs off the reactor threads.
+// Reads beyond the in-flight cap wait in a FIFO queue, so a burst of cold
+// loads keeps the disk queue depth bounded instead of flooding it. The
+// io_uring engine submits everything queued since its last wakeup with one
+// system call; where io_uring is unavailable a pool of reader threads is used.
+class DiskEngine {
+public:
+    // Receives the bytes read (the full length unless the file ends first)
+    // or a negative errno. Runs on an engine thread and must not block.
+    using Completion = std::function<void(ssize_t result)>;
+
+    enum class Kind {
+        AUTO,      // io_uring when the kernel supports it, else threads
+        IO_URING,
+        THREADS
+    };
+
+    virtual ~DiskEngine() = default;
+
+    // Queue a read of 'length' bytes at 'offset' into 'buffer'; short reads
+    // are continued internally. The buffer must stay valid until 'done' runs.
+    virtual void read(int fd, char* buffer, size_t length, size_t offset, Completion done) = 0;
+
+    // Engine name for logs ("io_uring" or "threads")
+    virtual const char* name() const = 0;
+
+    const DiskStats& getStats() const { return stats; }
+
+    // Create an engine allowing at most maxInFlight concurrent reads.
+    // Requests for io_uring fall back to threads if it cannot be set up.
+    static std::unique_ptr<DiskEngine> create(Kind kind, size_t maxInFlight);
+
+protected:
+    DiskStats stats;
+};
+
+#endif // DISK_ENGINE_H
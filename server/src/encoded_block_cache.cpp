@@ -0,0 +1,126 @@
+#include "encoded_block_cache.h"
+#include <algorithm>
+#include "../../common/include/adpcm_codec.h"
+#include "../../common/include/crc32c.h"
+#include "../../common/include/lossless_codec.h"
+
+// Encode 'size' bytes of the song's audio in 'codec' as one checksummed block
+static EncodedBlockCache::Block encodeBlock(Codec codec, const WavHeader& header, const char* pcm, size_t size) {
+    auto block = std::make_shared<EncodedBlockCache::EncodedBlock>();
+    if (codec == Codec::ADPCM) {
+        adpcm::encodeBlock(pcm, size, header.numChannels, header.bitsPerSample, block->data);
+    } else {
+        lossless::encodeBlock(pcm, size, header.numChannels, header.bitsPerSample, block->data);
+    }
+    block->crc = crc32c::compute(block->data.data(), block->data.size());
+    block->pcmBytes = size;
+    return block;
+}
+
+EncodedBlockCache::EncodedBlockCache(size_t capacityBytes)
+    : shardCapacity(capacityBytes / SHARD_COUNT) {
+}
+
+size_t EncodedBlockCache::KeyHash::operator()(const Key& key) const {
+    // Songs are heap objects and blocks consecutive numbers; mix both so
+    // neighbouring blocks land on different shards
+    uint64_t hash = reinterpret_cast<uintptr_t>(key.song) ^ (key.index * 0x9E3779B97F4A7C15ULL) ^
+                    static_cast<uint64_t>(key.codec);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return static_cast<size_t>(hash);
+}
+
+size_t EncodedBlockCache::blockFrames(Codec codec) {
+    return codec == Codec::ADPCM ? adpcm::BLOCK_FRAMES : lossless::BLOCK_FRAMES;
+}
+
+size_t EncodedBlockCache::blockOverhead(Codec codec) {
+    return codec == Codec::ADPCM ? adpcm::MAX_BLOCK_OVERHEAD : lossless::MAX_BLOCK_OVERHEAD;
+}
+
+std::vector<EncodedBlockCache::Block> EncodedBlockCache::encode(const std::shared_ptr<WavFile>& song, Codec codec,
+                                                                size_t start, const char* pcm, size_t size) {
+    const WavHeader& header = song->getHeader();
+    size_t blockBytes = blockFrames(codec) * std::max<size_t>(header.blockAlign, 1);
+    size_t audioSize = song->getAudioSize();
+
+    std::vector<Block> blocks;
+    size_t encodedBytes = 0;
+    size_t position = start;
+    size_t end = start + size;
+    while (position < end) {
+        size_t pieceEnd = std::min((position / blockBytes + 1) * blockBytes, end);
+        const char* piece = pcm + (position - start);
+        size_t pieceSize = pieceEnd - position;
+
+        // A whole block, or the song's last one, is the same for every
+        // stream and worth keeping
+        bool onGrid = position % blockBytes == 0 && (pieceSize == blockBytes || pieceEnd == audioSize);
+        if (onGrid && shardCapacity > 0) {
+            blocks.push_back(lookup(song, codec, position / blockBytes, piece, pieceSize));
+        } else {
+            blocks.push_back(encodeBlock(codec, header, piece, pieceSize));
+        }
+        encodedBytes += blocks.back()->data.size();
+        position = pieceEnd;
+    }
+
+    stats.pcmBytes.fetch_add(size, std::memory_order_relaxed);
+    stats.encodedBytes.fetch_add(encodedBytes, std::memory_order_relaxed);
+    return blocks;
+}
+
+EncodedBlockCache::Block EncodedBlockCache::lookup(const std::shared_ptr<WavFile>& song, Codec codec, size_t index,
+                                                   const char* pcm, size_t size) {
+    Key key{song.get(), codec, index};
+    Shard& shard = shards[KeyHash()(key) % SHARD_COUNT];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.blocks.find(key);
+        // A block of an unloaded song whose address was reused does not match
+        if (it != shard.blocks.end() && it->second.song.lock() == song) {
+            shard.order.splice(shard.order.begin(), shard.order, it->second.position);
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second.block;
+        }
+    }
+
+    // Encode outside the lock so other blocks of the shard are served meanwhile
+    stats.misses.fetch_add(1, std::memory_order_relaxed);
+    Block block = encodeBlock(codec, song->getHeader(), pcm, size);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.blocks.find(key);
+    if (it != shard.blocks.end()) {
+        shard.bytes -= it->second.block->data.size();
+        stats.residentBytes.fetch_sub(it->second.block->data.size(), std::memory_order_relaxed);
+        shard.order.erase(it->second.position);
+        shard.blocks.erase(it);
+    } else {
+        stats.residentBlocks.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.order.push_front(key);
+    shard.blocks.emplace(key, Entry{song, block, shard.order.begin()});
+    shard.bytes += block->data.size();
+    stats.residentBytes.fetch_add(block->data.size(), std::memory_order_relaxed);
+    trim(shard);
+    return block;
+}
+
+void EncodedBlockCache::trim(Shard& shard) {
+    while (shard.bytes > shardCapacity && !shard.order.empty()) {
+        auto it = shard.blocks.find(shard.order.back());
+        shard.bytes -= it->second.block->data.size();
+        stats.residentBytes.fetch_sub(it->second.block->data.size(), std::memory_order_relaxed);
+        stats.residentBlocks.fetch_sub(1, std::memory_order_relaxed);
+        stats.evictions.fetch_add(1, std::memory_order_relaxed);
+        shard.order.pop_back();
+        shard.blocks.erase(it);
+    }
+}
+
+const EncodedCacheStats& EncodedBlockCache::getStats() const {
+    return stats;
+}
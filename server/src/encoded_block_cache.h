@@ -0,0 +1,104 @@
+#ifndef ENCODED_BLOCK_CACHE_H
+#define ENCODED_BLOCK_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../../common/include/protocol.h"
+#include "server_stats.h"
+#include "wav_file.h"
+
+// Songs' audio compressed with the lossless (lossless_codec.h) or ADPCM
+// (adpcm_codec.h) codec, shared by all reactor threads so each block of a
+// song is encoded once per codec and then served to every client streaming
+// it. Blocks sit on a fixed grid of the codec's block size from the start
+// of the song, which is where streams send them from; a piece off the grid
+// (a stream starting mid-block after a seek) is encoded for that stream
+// alone.
+//
+// Blocks belong to the loaded song they were encoded from: once that
+// WavFile is gone (evicted from the song cache, or reloaded because the
+// file changed) they stop matching and age out. Within the byte budget the
+// least recently used blocks are dropped first. Two threads missing the
+// same block at once both encode it; the second copy replaces the first.
+class EncodedBlockCache {
+public:
+    // One encoded block, checksummed when it is encoded so every frame
+    // sending it reuses the CRC
+    struct EncodedBlock {
+        std::vector<char> data;
+        uint32_t crc = 0;      // CRC32C of 'data'
+        size_t pcmBytes = 0;   // Audio bytes it decodes to
+    };
+
+    using Block = std::shared_ptr<const EncodedBlock>;
+
+    // Keep up to 'capacityBytes' of encoded blocks; 0 encodes every chunk
+    // afresh
+    explicit EncodedBlockCache(size_t capacityBytes);
+
+    EncodedBlockCache(const EncodedBlockCache&) = delete;
+    EncodedBlockCache& operator=(const EncodedBlockCache&) = delete;
+
+    // Encode bytes [start, start + size) of the audio of 'song', held at
+    // 'pcm', as consecutive blocks of 'codec' (not PCM): the cached block
+    // itself for every whole block on the grid, the others encoded afresh
+    std::vector<Block> encode(const std::shared_ptr<WavFile>& song, Codec codec, size_t start, const char* pcm,
+                              size_t size);
+
+    // Sample frames per block of 'codec', the grid its blocks are cached on
+    static size_t blockFrames(Codec codec);
+
+    // Most bytes a block of 'codec' adds to the audio it holds
+    static size_t blockOverhead(Codec codec);
+
+    // Hit, miss, eviction, residency and compression counters
+    const EncodedCacheStats& getStats() const;
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    struct Key {
+        const WavFile* song;
+        Codec codec;
+        size_t index;  // Block number on the song's grid
+
+        bool operator==(const Key& other) const {
+            return song == other.song && codec == other.codec && index == other.index;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry {
+        std::weak_ptr<WavFile> song;  // Expired once the song is unloaded
+        Block block;
+        std::list<Key>::iterator position;  // In the shard's LRU order
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> blocks;
+        std::list<Key> order;  // Most recently used first
+        size_t bytes = 0;
+    };
+
+    size_t shardCapacity;
+    Shard shards[SHARD_COUNT];
+    EncodedCacheStats stats;
+
+    // Block 'index' of 'song' in 'codec', from the cache or encoded from
+    // 'pcm' and kept
+    Block lookup(const std::shared_ptr<WavFile>& song, Codec codec, size_t index, const char* pcm, size_t size);
+
+    // Drop least recently used blocks until the shard fits its budget
+    // (mutex held)
+    void trim(Shard& shard);
+};
+
+#endif // ENCODED_BLOCK_CACHE_H
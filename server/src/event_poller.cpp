@@ -0,0 +1,159 @@
+#include "event_poller.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+// Maximum number of events harvested per wait() call
+static const int MAX_EVENTS = 256;
+
+#if defined(__linux__)
+
+EventPoller::EventPoller() : pollFd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (pollFd < 0) {
+        std::cerr << "Error creating epoll instance: " << strerror(errno) << std::endl;
+    }
+}
+
+bool EventPoller::add(int fd, bool wantWrite, bool exclusive) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    if (wantWrite) {
+        ev.events |= EPOLLOUT;
+    }
+#ifdef EPOLLEXCLUSIVE
+    if (exclusive) {
+        ev.events |= EPOLLEXCLUSIVE;
+    }
+#else
+    (void)exclusive;
+#endif
+    ev.data.fd = fd;
+    return epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EventPoller::setInterest(int fd, bool wantRead, bool wantWrite) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = 0;
+    if (wantRead) {
+        ev.events |= EPOLLIN;
+    }
+    if (wantWrite) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = fd;
+    return epoll_ctl(pollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventPoller::remove(int fd) {
+    epoll_ctl(pollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int EventPoller::wait(std::vector<Event>& events, int timeoutMs) {
+    struct epoll_event raw[MAX_EVENTS];
+    events.clear();
+
+    int count = epoll_wait(pollFd, raw, MAX_EVENTS, timeoutMs);
+    if (count < 0) {
+        if (errno != EINTR) {
+            std::cerr << "Error waiting for events: " << strerror(errno) << std::endl;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        Event ev;
+        ev.fd = raw[i].data.fd;
+        ev.readable = (raw[i].events & EPOLLIN) != 0;
+        ev.writable = (raw[i].events & EPOLLOUT) != 0;
+        ev.hangup = (raw[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+        events.push_back(ev);
+    }
+
+    return count;
+}
+
+#else // kqueue
+
+EventPoller::EventPoller() : pollFd(kqueue()) {
+    if (pollFd < 0) {
+        std::cerr << "Error creating kqueue instance: " << strerror(errno) << std::endl;
+    }
+}
+
+bool EventPoller::add(int fd, bool wantWrite, bool exclusive) {
+    // kqueue has no exclusive wakeup; losers of an accept race just see EAGAIN
+    (void)exclusive;
+
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | (wantWrite ? EV_ENABLE : EV_DISABLE), 0, 0, nullptr);
+    return kevent(pollFd, changes, 2, nullptr, 0, nullptr) == 0;
+}
+
+bool EventPoller::setInterest(int fd, bool wantRead, bool wantWrite) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, wantRead ? EV_ENABLE : EV_DISABLE, 0, 0, nullptr);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, wantWrite ? EV_ENABLE : EV_DISABLE, 0, 0, nullptr);
+    return kevent(pollFd, changes, 2, nullptr, 0, nullptr) == 0;
+}
+
+void EventPoller::remove(int fd) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    kevent(pollFd, changes, 2, nullptr, 0, nullptr);
+}
+
+int EventPoller::wait(std::vector<Event>& events, int timeoutMs) {
+    struct kevent raw[MAX_EVENTS];
+    struct timespec timeout;
+    struct timespec* timeoutPtr = nullptr;
+    events.clear();
+
+    if (timeoutMs >= 0) {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long>(timeoutMs % 1000) * 1000000L;
+        timeoutPtr = &timeout;
+    }
+
+    int count = kevent(pollFd, nullptr, 0, raw, MAX_EVENTS, timeoutPtr);
+    if (count < 0) {
+        if (errno != EINTR) {
+            std::cerr << "Error waiting for events: " << strerror(errno) << std::endl;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        Event ev;
+        ev.fd = static_cast<int>(raw[i].ident);
+        ev.readable = raw[i].filter == EVFILT_READ;
+        ev.writable = raw[i].filter == EVFILT_WRITE;
+        ev.hangup = (raw[i].flags & EV_ERROR) != 0;
+        events.push_back(ev);
+    }
+
+    return count;
+}
+
+#endif
+
+EventPoller::~EventPoller() {
+    if (pollFd >= 0) {
+        close(pollFd);
+    }
+}
+
+bool EventPoller::valid() const {
+    return pollFd >= 0;
+}
@@ -0,0 +1,45 @@
+#ifndef EVENT_POLLER_H
+#define EVENT_POLLER_H
+
+#include <vector>
+
+// Thin readiness-notification wrapper: epoll on Linux, kqueue on macOS/BSD.
+// Notifications are level-triggered. Write interest is toggled on demand so
+// idle connections cost nothing; read interest is dropped while a connection
+// is applying backpressure to its peer.
+class EventPoller {
+public:
+    struct Event {
+        int fd;
+        bool readable;
+        bool writable;
+        bool hangup;  // Error or peer hangup reported by the kernel
+    };
+
+    EventPoller();
+    ~EventPoller();
+
+    EventPoller(const EventPoller&) = delete;
+    EventPoller& operator=(const EventPoller&) = delete;
+
+    // Check if the underlying poll descriptor was created successfully
+    bool valid() const;
+
+    // Register a descriptor. Exclusive registration lets several pollers
+    // share one listening socket without waking all of them per connection.
+    bool add(int fd, bool wantWrite, bool exclusive = false);
+
+    // Change read/write interest for an already registered descriptor
+    bool setInterest(int fd, bool wantRead, bool wantWrite);
+
+    // Unregister a descriptor (must be called before closing it)
+    void remove(int fd);
+
+    // Wait up to timeoutMs (-1 = forever) and fill events; returns the count
+    int wait(std::vector<Event>& events, int timeoutMs);
+
+private:
+    int pollFd;
+};
+
+#endif // EVENT_POLLER_H
@@ -0,0 +1,253 @@
+#include "library_scanner.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include "wav_file.h"
+
+// Files probed per task; large directories are split so idle workers can
+// steal part of them
+const size_t PROBE_BATCH_SIZE = 64;
+
+std::string LibraryScanner::joinPath(const std::string& directory, const std::string& name) {
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+bool LibraryScanner::isSongName(const std::string& name) {
+    return name.size() > 4 && name[0] != '.' && name.compare(name.size() - 4, 4, ".wav") == 0;
+}
+
+LibraryScanner::EntryKind LibraryScanner::classifyEntry(DIR* dir, const struct dirent* entry) {
+    if (entry->d_name[0] == '\0' || entry->d_name[0] == '.') {
+        // Skips "." and "..", and hidden files and directories
+        return EntryKind::SKIP;
+    }
+
+    bool isDirectory = entry->d_type == DT_DIR;
+    bool isFile = entry->d_type == DT_REG;
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+        // Some network filesystems don't report entry types; links are
+        // resolved to what they point at
+        struct stat info;
+        if (fstatat(dirfd(dir), entry->d_name, &info, 0) == 0) {
+            isFile = S_ISREG(info.st_mode);
+            isDirectory = entry->d_type == DT_UNKNOWN && S_ISDIR(info.st_mode);
+        }
+    }
+    return isDirectory ? EntryKind::DIRECTORY : isFile ? EntryKind::FILE : EntryKind::SKIP;
+}
+
+bool LibraryScanner::statSong(const std::string& path, FileStamp& stamp) {
+    struct stat info;
+    if (stat(path.c_str(), &info) < 0) {
+        return false;
+    }
+    stamp.size = static_cast<uint64_t>(info.st_size);
+#if defined(__APPLE__)
+    stamp.modifiedNanos = info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#else
+    stamp.modifiedNanos = info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+bool LibraryScanner::probeSong(const std::string& path, SongFormat& format) {
+    WavFile song(path, WavFile::Backend::STREAM);
+    if (!song.probe()) {
+        return false;
+    }
+
+    const WavHeader& header = song.getHeader();
+    format.audioFormat = header.audioFormat;
+    format.channels = header.numChannels;
+    format.sampleRate = header.sampleRate;
+    format.bitsPerSample = header.bitsPerSample;
+    format.dataSize = header.dataSize;
+    return true;
+}
+
+LibraryScanner::LibraryScanner(const std::string& rootDirectory, size_t threadCount,
+                               std::shared_ptr<const SongCatalog> knownSongs)
+    : root(rootDirectory),
+      known(std::move(knownSongs)),
+      pendingTasks(0),
+      stopRequested(false),
+      directoryCount(0),
+      skippedCount(0),
+      reusedCount(0) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+std::vector<SongInfo> LibraryScanner::scan() {
+    directoryCount.store(0);
+    skippedCount.store(0);
+    reusedCount.store(0);
+    for (auto& worker : workers) {
+        worker->songs.clear();
+        worker->tasks.clear();
+    }
+    pendingTasks.store(0);
+
+    pushTask(0, Task{"", {}});
+
+    // The calling thread works as worker 0
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); ++i) {
+        threads.emplace_back(&LibraryScanner::run, this, i);
+    }
+    run(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<SongInfo> songs;
+    for (auto& worker : workers) {
+        std::move(worker->songs.begin(), worker->songs.end(), std::back_inserter(songs));
+        worker->songs.clear();
+    }
+    return songs;
+}
+
+void LibraryScanner::run(size_t self) {
+    Task task;
+    while (!stopRequested.load(std::memory_order_relaxed)) {
+        if (takeTask(self, task)) {
+            if (task.files.empty()) {
+                listDirectory(self, task.directory);
+            } else {
+                probeFiles(self, task);
+            }
+            // Children were queued before this, so the count only reaches
+            // zero once the whole tree is done
+            pendingTasks.fetch_sub(1);
+            continue;
+        }
+
+        if (pendingTasks.load() == 0) {
+            return;
+        }
+        // Others are still listing directories that may yield more work
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+bool LibraryScanner::takeTask(size_t self, Task& task) {
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker& victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void LibraryScanner::pushTask(size_t self, Task task) {
+    pendingTasks.fetch_add(1);
+    Worker& own = *workers[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.tasks.push_back(std::move(task));
+}
+
+void LibraryScanner::listDirectory(size_t self, const std::string& directory) {
+    std::string path = joinPath(root, directory);
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Could not open directory: " << path << std::endl;
+        return;
+    }
+    directoryCount.fetch_add(1);
+
+    Task batch{directory, {}};
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        EntryKind kind = classifyEntry(dir, ent);
+        std::string name = ent->d_name;
+        if (kind == EntryKind::DIRECTORY) {
+            pushTask(self, Task{joinPath(directory, name), {}});
+        } else if (kind == EntryKind::FILE && isSongName(name)) {
+            batch.files.push_back(name);
+            if (batch.files.size() == PROBE_BATCH_SIZE) {
+                pushTask(self, std::move(batch));
+                batch = Task{directory, {}};
+            }
+        }
+    }
+    closedir(dir);
+
+    if (!batch.files.empty()) {
+        pushTask(self, std::move(batch));
+    }
+}
+
+void LibraryScanner::probeFiles(size_t self, const Task& task) {
+    // Only this thread appends to its worker's list; scan() reads it after join
+    std::vector<SongInfo>& found = workers[self]->songs;
+    for (const auto& file : task.files) {
+        SongInfo info;
+        info.name = joinPath(task.directory, file);
+        std::string path = joinPath(root, info.name);
+        if (!statSong(path, info.stamp)) {
+            continue;
+        }
+
+        // Unchanged since the known catalog was built: keep its format
+        size_t index = known ? known->find(info.name) : SongCatalog::NOT_FOUND;
+        if (index != SongCatalog::NOT_FOUND && known->getStamp(index) == info.stamp) {
+            info.format = known->getFormat(index);
+            found.push_back(std::move(info));
+            reusedCount.fetch_add(1);
+            continue;
+        }
+
+        if (!probeSong(path, info.format)) {
+            std::cerr << "Skipping " << info.name << ": not a readable WAV file" << std::endl;
+            skippedCount.fetch_add(1);
+            continue;
+        }
+        found.push_back(std::move(info));
+    }
+}
+
+size_t LibraryScanner::getDirectoryCount() const {
+    return directoryCount.load();
+}
+
+size_t LibraryScanner::getSkippedCount() const {
+    return skippedCount.load();
+}
+
+void LibraryScanner::cancel() {
+    stopRequested.store(true);
+}
+
+bool LibraryScanner::cancelled() const {
+    return stopRequested.load();
+}
+
+size_t LibraryScanner::getReusedCount() const {
+    return reusedCount.load();
+}
+
+size_t LibraryScanner::getThreadCount() const {
+    return workers.size();
+}
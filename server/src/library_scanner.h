@@ -0,0 +1,101 @@
+#ifndef LIBRARY_SCANNER_H
+#define LIBRARY_SCANNER_H
+
+#include <dirent.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "song_catalog.h"
+
+// Parallel scan of a music directory tree. Worker threads walk the
+// subdirectories and probe each .wav file's RIFF/fmt header, so startup
+// scales with threads instead of one readdir and open after another. Work
+// is split into tasks (list one directory, or probe a batch of its files)
+// kept on per-worker deques: a worker takes its newest task and steals the
+// oldest from another worker when its own deque runs dry.
+//
+// Given the catalog from an earlier scan, files whose size and modification
+// time are unchanged keep their recorded format and are not opened again.
+class LibraryScanner {
+public:
+    // threadCount = 0 uses one thread per core
+    LibraryScanner(const std::string& rootDirectory, size_t threadCount = 0,
+                   std::shared_ptr<const SongCatalog> knownSongs = nullptr);
+
+    LibraryScanner(const LibraryScanner&) = delete;
+    LibraryScanner& operator=(const LibraryScanner&) = delete;
+
+    // Walk the tree and return every playable song, named by its path
+    // relative to the root (in no particular order)
+    std::vector<SongInfo> scan();
+
+    // Abandon a running scan from another thread; scan() then returns
+    // early with partial results
+    void cancel();
+    bool cancelled() const;
+
+    // Totals from the last scan
+    size_t getDirectoryCount() const;
+    size_t getSkippedCount() const;   // .wav files that failed the probe
+    size_t getReusedCount() const;    // Unchanged files taken from knownSongs
+    size_t getThreadCount() const;
+
+    // Check if a directory entry is a song the scan would pick up (a
+    // visible .wav file)
+    static bool isSongName(const std::string& name);
+
+    // How the walk treats an entry of a directory being listed
+    enum class EntryKind { SKIP, DIRECTORY, FILE };
+
+    // Classify an entry read from 'dir'. Hidden entries are skipped, linked
+    // files are followed, and linked directories are not, so a link cycle
+    // cannot make the walk endless.
+    static EntryKind classifyEntry(DIR* dir, const struct dirent* entry);
+
+    // Join a path relative to the root with one of its entries
+    static std::string joinPath(const std::string& directory, const std::string& name);
+
+    // Size and modification time of a file; false if it cannot be stat'ed
+    static bool statSong(const std::string& path, FileStamp& stamp);
+
+    // Read the format from a song's header; false if it is not a readable
+    // WAV file
+    static bool probeSong(const std::string& path, SongFormat& format);
+
+private:
+    // List one directory (files empty), or probe a batch of files in it
+    struct Task {
+        std::string directory;            // Relative to the root, "" for the root itself
+        std::vector<std::string> files;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::vector<SongInfo> songs;      // Found by this worker
+    };
+
+    std::string root;
+    std::shared_ptr<const SongCatalog> known;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> pendingTasks;     // Queued or running
+    std::atomic<bool> stopRequested;
+    std::atomic<size_t> directoryCount;
+    std::atomic<size_t> skippedCount;
+    std::atomic<size_t> reusedCount;
+
+    // Worker loop: run tasks until every queue is empty and none is running
+    void run(size_t self);
+
+    // Pop this worker's newest task, or steal another worker's oldest
+    bool takeTask(size_t self, Task& task);
+    void pushTask(size_t self, Task task);
+
+    void listDirectory(size_t self, const std::string& directory);
+    void probeFiles(size_t self, const Task& task);
+};
+
+#endif // LIBRARY_SCANNER_H
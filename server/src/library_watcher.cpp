@@ -0,0 +1,413 @@
+#include "library_watcher.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+// A batch of changes is applied once events stop arriving for this long,
+// or after BATCH_LIMIT while they keep coming
+const std::chrono::milliseconds BATCH_QUIET(200);
+const std::chrono::milliseconds BATCH_LIMIT(2000);
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+LibraryWatcher::LibraryWatcher(const std::string& rootDirectory, Mode watchMode, std::chrono::milliseconds pollInterval,
+                               size_t scanThreads, CurrentCatalog current, Publish publish)
+    : root(rootDirectory),
+      mode(watchMode),
+      interval(pollInterval),
+      threadCount(scanThreads),
+      currentCatalog(std::move(current)),
+      publishCatalog(std::move(publish)),
+      stopping(false),
+      method("off"),
+      activeScan(nullptr),
+      inotifyFd(-1),
+      watchesReady(false),
+      rescanNeeded(false),
+      watchLimitReached(false) {
+    if (pipe(wakePipe) < 0) {
+        wakePipe[0] = wakePipe[1] = -1;
+    } else {
+        fcntl(wakePipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(wakePipe[1], F_SETFD, FD_CLOEXEC);
+    }
+}
+
+LibraryWatcher::~LibraryWatcher() {
+    stop();
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+    if (wakePipe[0] >= 0) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+    }
+}
+
+void LibraryWatcher::watch() {
+#if defined(__linux__)
+    if (mode == Mode::AUTO && !watchesReady) {
+        watchesReady = startInotify();
+        if (watchesReady) {
+            method.store("inotify");
+        }
+    }
+#endif
+}
+
+void LibraryWatcher::start(bool revalidate) {
+    if (mode == Mode::OFF && !revalidate) {
+        return;
+    }
+    thread = std::thread(&LibraryWatcher::run, this, revalidate);
+}
+
+void LibraryWatcher::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+
+    stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (activeScan) {
+            activeScan->cancel();
+        }
+    }
+    char byte = 1;
+    if (write(wakePipe[1], &byte, 1) < 0) {
+        // The thread still notices 'stopping' within one poll interval
+    }
+    thread.join();
+}
+
+const char* LibraryWatcher::getMethod() const {
+    return method.load();
+}
+
+void LibraryWatcher::run(bool revalidate) {
+#if defined(__linux__)
+    watch();
+    if (watchesReady) {
+        std::cout << "Watching " << root << " for changes with inotify (" << watchedDirectories.size()
+                  << " directories)" << std::endl;
+        if (revalidate) {
+            rescan(true);
+        }
+        inotifyLoop();
+        if (stopping.load() || !watchLimitReached) {
+            return;
+        }
+
+        // Part of the tree is unwatched from here on, so only rescans can
+        // be trusted to see its changes
+        std::cerr << "inotify watch limit reached (see fs.inotify.max_user_watches); "
+                  << "falling back to polling" << std::endl;
+        close(inotifyFd);
+        inotifyFd = -1;
+        watchesReady = false;
+        watchedDirectories.clear();
+        pendingFiles.clear();
+        removedDirectories.clear();
+        revalidate = false;
+        rescan(false);
+    }
+#endif
+
+    if (revalidate) {
+        rescan(true);
+    }
+    if (mode == Mode::OFF) {
+        return;
+    }
+
+    method.store("polling");
+    std::cout << "Polling " << root << " for changes every "
+              << std::chrono::duration<double>(interval).count() << " s" << std::endl;
+    pollLoop();
+}
+
+void LibraryWatcher::rescan(bool startup) {
+    auto known = currentCatalog();
+    LibraryScanner scanner(root, threadCount, known);
+    {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (stopping.load()) {
+            return;
+        }
+        activeScan = &scanner;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SongInfo> songs = scanner.scan();
+    {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        activeScan = nullptr;
+    }
+    if (scanner.cancelled()) {
+        return;
+    }
+
+    auto scanned = std::make_shared<const SongCatalog>(std::move(songs));
+    double ms = millisecondsSince(start);
+    if (scanned->sameSongs(*known)) {
+        if (startup) {
+            std::cout << "Catalog index is up to date (" << scanned->size() << " songs checked in "
+                      << ms << " ms)" << std::endl;
+        }
+        return;
+    }
+
+    std::cout << (startup ? "Library changed since the catalog index was written: " : "Library changed: ")
+              << known->size() << " songs before, " << scanned->size() << " now ("
+              << scanner.getReusedCount() << " unchanged, checked in " << ms << " ms)" << std::endl;
+    publishCatalog(scanned);
+}
+
+bool LibraryWatcher::waitForStop(std::chrono::milliseconds timeout) {
+    struct pollfd wake = {wakePipe[0], POLLIN, 0};
+    poll(&wake, 1, static_cast<int>(timeout.count()));
+    return stopping.load();
+}
+
+void LibraryWatcher::pollLoop() {
+    while (!waitForStop(interval)) {
+        rescan(false);
+    }
+}
+
+void LibraryWatcher::applyPendingChanges() {
+    if (rescanNeeded) {
+        // The kernel dropped events, so the pending set is incomplete
+        rescanNeeded = false;
+        pendingFiles.clear();
+        removedDirectories.clear();
+        rescan(false);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SongInfo> added;
+    std::vector<std::string> removed;
+    for (const auto& [name, change] : pendingFiles) {
+        SongInfo info;
+        info.name = name;
+        std::string path = LibraryScanner::joinPath(root, name);
+        if (change == Change::ADDED && LibraryScanner::statSong(path, info.stamp)) {
+            if (LibraryScanner::probeSong(path, info.format)) {
+                added.push_back(std::move(info));
+                continue;
+            }
+            std::cerr << "Skipping " << name << ": not a readable WAV file" << std::endl;
+        }
+        // Gone again, or replaced by something unplayable
+        removed.push_back(name);
+    }
+
+    size_t changeCount = pendingFiles.size() + removedDirectories.size();
+    auto base = currentCatalog();
+    auto updated = SongCatalog::withChanges(*base, std::move(added), removed, removedDirectories);
+    pendingFiles.clear();
+    removedDirectories.clear();
+    if (updated->sameSongs(*base)) {
+        return;
+    }
+
+    std::cout << "Library changed: " << base->size() << " songs before, " << updated->size() << " now ("
+              << changeCount << " changes applied in " << millisecondsSince(start) << " ms)" << std::endl;
+    publishCatalog(updated);
+}
+
+#if defined(__linux__)
+
+// Directory events worth a catalog change; file creation is seen through
+// IN_CLOSE_WRITE, once the file is complete
+const uint32_t WATCH_MASK = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR;
+
+bool LibraryWatcher::startInotify() {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        std::cerr << "inotify unavailable (" << strerror(errno) << "); falling back to polling" << std::endl;
+        return false;
+    }
+
+    if (!watchTree("", false)) {
+        std::cerr << "inotify watch limit reached (see fs.inotify.max_user_watches); "
+                  << "falling back to polling" << std::endl;
+        close(inotifyFd);
+        inotifyFd = -1;
+        watchedDirectories.clear();
+        return false;
+    }
+    return true;
+}
+
+bool LibraryWatcher::watchTree(const std::string& directory, bool addSongs) {
+    std::vector<std::string> stack = {directory};
+    while (!stack.empty()) {
+        std::string current = std::move(stack.back());
+        stack.pop_back();
+        std::string path = LibraryScanner::joinPath(root, current);
+
+        // Watch before listing, so entries created in between raise events
+        int wd = inotify_add_watch(inotifyFd, path.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (errno == ENOSPC || errno == ENOMEM) {
+                return false;
+            }
+            continue;  // Vanished or unreadable; its parent reports the rest
+        }
+        watchedDirectories[wd] = current;
+
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            continue;
+        }
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != nullptr) {
+            // Same rules as the scanner, so both see the same tree
+            LibraryScanner::EntryKind kind = LibraryScanner::classifyEntry(dir, ent);
+            std::string name = ent->d_name;
+            if (kind == LibraryScanner::EntryKind::DIRECTORY) {
+                stack.push_back(LibraryScanner::joinPath(current, name));
+            } else if (addSongs && kind == LibraryScanner::EntryKind::FILE && LibraryScanner::isSongName(name)) {
+                pendingFiles[LibraryScanner::joinPath(current, name)] = Change::ADDED;
+            }
+        }
+        closedir(dir);
+    }
+    return true;
+}
+
+void LibraryWatcher::inotifyLoop() {
+    struct pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+    auto batchStart = std::chrono::steady_clock::now();
+    auto lastEvent = batchStart;
+
+    while (!stopping.load()) {
+        bool pending = !pendingFiles.empty() || !removedDirectories.empty() || rescanNeeded;
+        int timeout = -1;
+        if (pending) {
+            auto deadline = std::min(lastEvent + BATCH_QUIET, batchStart + BATCH_LIMIT);
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                applyPendingChanges();
+                continue;
+            }
+            timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+        }
+
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            std::cerr << "Library watcher poll failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        if ((fds[0].revents & POLLIN) == 0) {
+            continue;
+        }
+
+        readEvents();
+        if (watchLimitReached) {
+            return;
+        }
+        lastEvent = std::chrono::steady_clock::now();
+        if (!pending) {
+            batchStart = lastEvent;
+        }
+    }
+}
+
+void LibraryWatcher::readEvents() {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+        return;
+    }
+
+    for (char* position = buffer; position < buffer + length;) {
+        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(position);
+        position += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            rescanNeeded = true;
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            watchedDirectories.erase(event->wd);
+            continue;
+        }
+
+        auto watched = watchedDirectories.find(event->wd);
+        if (watched == watchedDirectories.end() || event->len == 0 || event->name[0] == '.') {
+            continue;
+        }
+        std::string name = event->name;
+        std::string path = LibraryScanner::joinPath(watched->second, name);
+
+        if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                // Anything already inside arrived before the watch did
+                if (!watchTree(path, true)) {
+                    watchLimitReached = true;
+                    return;
+                }
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if (event->mask & IN_MOVED_FROM) {
+                    unwatchTree(path);
+                }
+                dropPendingUnder(path);
+                removedDirectories.push_back(path);
+            }
+            continue;
+        }
+
+        if (!LibraryScanner::isSongName(name)) {
+            continue;
+        }
+        // A rename arrives as IN_MOVED_FROM for the old name and IN_MOVED_TO
+        // for the new one: the old entry is removed and the new one probed
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            pendingFiles[path] = Change::ADDED;
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            pendingFiles[path] = Change::REMOVED;
+        } else if (event->mask & IN_CREATE) {
+            // Links are complete when created and never closed after writing
+            struct stat info;
+            if (lstat(LibraryScanner::joinPath(root, path).c_str(), &info) == 0 && S_ISLNK(info.st_mode)) {
+                pendingFiles[path] = Change::ADDED;
+            }
+        }
+    }
+}
+
+void LibraryWatcher::unwatchTree(const std::string& directory) {
+    std::string prefix = directory + "/";
+    for (auto it = watchedDirectories.begin(); it != watchedDirectories.end();) {
+        if (it->second == directory || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(inotifyFd, it->first);
+            it = watchedDirectories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void LibraryWatcher::dropPendingUnder(const std::string& directory) {
+    std::string prefix = directory + "/";
+    auto it = pendingFiles.lower_bound(prefix);
+    while (it != pendingFiles.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+        it = pendingFiles.erase(it);
+    }
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef LIBRARY_WATCHER_H
+#define LIBRARY_WATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "library_scanner.h"
+#include "song_catalog.h"
+
+// Keeps the song catalog in step with the music directory while the server
+// runs. On Linux every directory in the tree is watched with inotify, and
+// adds, removals and renames are applied to the catalog incrementally: only
+// the files named by events are probed, and the new catalog is merged from
+// the current one in a single pass. Events are batched for a short quiet
+// period, so copying an album publishes one catalog rather than one per
+// track. Where inotify is unavailable, or its watch limit is reached, the
+// tree is rescanned periodically instead, reusing the formats of unchanged
+// files.
+//
+// All of this runs on the watcher's own thread. A finished catalog is handed
+// to the publish callback as a new immutable snapshot; nothing that serves
+// clients waits for it.
+class LibraryWatcher {
+public:
+    enum class Mode {
+        AUTO,    // inotify where available, else polling
+        POLL,    // Periodic rescans only
+        OFF      // No watching; only the startup revalidation, if asked for
+    };
+
+    // The catalog changes are applied to, and where new catalogs go
+    using CurrentCatalog = std::function<std::shared_ptr<const SongCatalog>()>;
+    using Publish = std::function<void(std::shared_ptr<const SongCatalog>)>;
+
+    LibraryWatcher(const std::string& rootDirectory, Mode mode, std::chrono::milliseconds pollInterval,
+                   size_t scanThreads, CurrentCatalog current, Publish publish);
+    ~LibraryWatcher();
+
+    LibraryWatcher(const LibraryWatcher&) = delete;
+    LibraryWatcher& operator=(const LibraryWatcher&) = delete;
+
+    // Set up the inotify watches now rather than on the watcher thread.
+    // Call it before the scan that builds the initial catalog: changes made
+    // from here on queue up in the kernel and are applied once start() runs.
+    void watch();
+
+    // Start watching on a background thread. With 'revalidate', the whole
+    // tree is rescanned first (for a catalog loaded from a saved index);
+    // watches are set up before that scan, so nothing changed during it
+    // is missed.
+    void start(bool revalidate);
+
+    // Stop the thread, abandoning any scan in progress
+    void stop();
+
+    // How changes are being picked up: "inotify", "polling" or "off"
+    const char* getMethod() const;
+
+private:
+    enum class Change {
+        ADDED,      // Created, rewritten or moved in: probe it
+        REMOVED     // Deleted or moved away
+    };
+
+    std::string root;
+    Mode mode;
+    std::chrono::milliseconds interval;
+    size_t threadCount;
+    CurrentCatalog currentCatalog;
+    Publish publishCatalog;
+
+    std::thread thread;
+    std::atomic<bool> stopping;
+    std::atomic<const char*> method;
+    int wakePipe[2];                    // Wakes the thread for stop()
+
+    std::mutex scanMutex;
+    LibraryScanner* activeScan;         // Full rescan in progress, for stop()
+
+    // inotify state, only touched by the watcher thread
+    int inotifyFd;
+    bool watchesReady;                  // Every directory is watched
+    std::unordered_map<int, std::string> watchedDirectories;  // Watch descriptor -> path relative to root
+
+    // Changes seen since the last publish
+    std::map<std::string, Change> pendingFiles;
+    std::vector<std::string> removedDirectories;
+    bool rescanNeeded;          // Events were lost; only a full rescan is safe
+    bool watchLimitReached;     // A new directory could not be watched
+
+    void run(bool revalidate);
+
+    // Rescan the whole tree against the current catalog and publish the
+    // result if it differs ('startup' for a catalog loaded from the index)
+    void rescan(bool startup);
+
+    // Wait up to 'timeout' for stop(); true if stopping
+    bool waitForStop(std::chrono::milliseconds timeout);
+
+    // Periodic rescans until stopped
+    void pollLoop();
+
+#if defined(__linux__)
+    // Set up inotify and watch every directory; false to fall back to polling
+    bool startInotify();
+
+    // Watch a directory and everything below it. With 'addSongs', songs
+    // found are queued as added (for a directory that appeared while running).
+    bool watchTree(const std::string& directory, bool addSongs);
+
+    // Read events until stopped, publishing a catalog after each quiet period
+    void inotifyLoop();
+
+    // Apply one read() worth of events to the pending changes
+    void readEvents();
+
+    // Stop watching a directory that moved away and everything below it
+    void unwatchTree(const std::string& directory);
+
+    // Forget pending changes below a directory that went away
+    void dropPendingUnder(const std::string& directory);
+#endif
+
+    // Probe pending additions and publish the merged catalog
+    void applyPendingChanges();
+};
+
+#endif // LIBRARY_WATCHER_H
@@ -17,34 +17,215 @@ void signalHandler(int signum) {
     exit(signum);
 }
 
+// Print command line usage
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [port] [music_directory] [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --threads=N        Event loop threads (default: one per core)" << std::endl;
+    std::cerr << "  --zero-copy=0|1    Stream audio with sendfile (default: 1)" << std::endl;
+    std::cerr << "  --pacing=0|1       Send songs at playback rate after a lead window (default: 1)" << std::endl;
+    std::cerr << "  --lead-seconds=S   Audio sent ahead of the playhead (default: 10)" << std::endl;
+    std::cerr << "  --pace-rate=X      Top-up speed as a multiple of playback rate (default: 1.0)" << std::endl;
+    std::cerr << "  --chunk-size=BYTES Largest audio chunk per frame (default: 262144)" << std::endl;
+    std::cerr << "  --first-chunk=BYTES Chunk a song starts with, doubling up to the chunk size (default: 16384)" << std::endl;
+    std::cerr << "  --queue-low=BYTES  Backlog at which song data resumes (default: 262144)" << std::endl;
+    std::cerr << "  --queue-high=BYTES Backlog at which song data pauses (default: 1048576)" << std::endl;
+    std::cerr << "  --evict-after=S    Drop clients whose oldest queued frame is older (default: 30)" << std::endl;
+    std::cerr << "  --resume-seconds=S Keep a dropped client's streams for resuming, 0 = never (default: 60)" << std::endl;
+    std::cerr << "  --compression=0|1  Send lossless-compressed audio to clients that decode it (default: 1)" << std::endl;
+    std::cerr << "  --adpcm=0|1        Send 4:1 ADPCM audio to clients that ask for low bitrate (default: 1)" << std::endl;
+    std::cerr << "  --encoded-cache-bytes=N Memory budget for compressed audio blocks, 0 = none kept (default: 268435456)" << std::endl;
+    std::cerr << "  --cache-bytes=N    Memory budget for loaded songs, 0 = unlimited (default: 0)" << std::endl;
+    std::cerr << "  --cache-songs=N    Loaded songs kept, each holding its file open, 0 = unlimited (default: 512)" << std::endl;
+    std::cerr << "  --song-storage=M   heap, mmap or stream (read on demand) (default: mmap)" << std::endl;
+    std::cerr << "  --io-engine=E      Song loads via auto, io_uring or threads (default: auto)" << std::endl;
+    std::cerr << "  --io-depth=N       Maximum concurrent disk reads for song loads (default: 16)" << std::endl;
+    std::cerr << "  --scan-threads=N   Threads scanning the music directory, 0 = one per core (default: 0)" << std::endl;
+    std::cerr << "  --catalog-index=P  Catalog index file, or off (default: in ~/.local/state/music_server)" << std::endl;
+    std::cerr << "  --watch=M          Pick up library changes via auto (inotify, else polling), poll or off (default: auto)" << std::endl;
+    std::cerr << "  --poll-seconds=S   Rescan period when polling for library changes (default: 30)" << std::endl;
+}
+
+// Parse a --name=value option into the server configuration
+bool parseOption(const std::string& arg, ServerConfig& config) {
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+    
+    try {
+        if (name == "--threads") {
+            config.reactorThreads = std::stoul(value);
+            return true;
+        }
+        if (name == "--zero-copy") {
+            config.stream.zeroCopy = std::stoi(value) != 0;
+            return true;
+        }
+        if (name == "--pacing") {
+            config.stream.pacing = std::stoi(value) != 0;
+            return true;
+        }
+        if (name == "--lead-seconds") {
+            config.stream.leadSeconds = std::stod(value);
+            return true;
+        }
+        if (name == "--pace-rate") {
+            config.stream.paceRate = std::stod(value);
+            return true;
+        }
+        if (name == "--queue-low") {
+            config.stream.queueLowWatermark = std::stoul(value);
+            return true;
+        }
+        if (name == "--queue-high") {
+            config.stream.queueHighWatermark = std::stoul(value);
+            return true;
+        }
+        if (name == "--chunk-size") {
+            config.stream.chunkSize = std::max<size_t>(std::stoull(value), 1);
+            return true;
+        }
+        if (name == "--first-chunk") {
+            config.stream.firstChunkSize = std::stoull(value);
+            return true;
+        }
+        if (name == "--evict-after") {
+            config.stream.evictAfterSeconds = std::stod(value);
+            return true;
+        }
+        if (name == "--resume-seconds") {
+            config.stream.resumeSeconds = std::stod(value);
+            return true;
+        }
+        if (name == "--compression") {
+            config.stream.compression = std::stoi(value) != 0;
+            return true;
+        }
+        if (name == "--adpcm") {
+            config.stream.adpcm = std::stoi(value) != 0;
+            return true;
+        }
+        if (name == "--encoded-cache-bytes") {
+            config.stream.encodedCacheBytes = std::stoull(value);
+            return true;
+        }
+        if (name == "--cache-bytes") {
+            config.library.cacheBytes = std::stoull(value);
+            return true;
+        }
+        if (name == "--cache-songs") {
+            config.library.cacheSongs = std::stoull(value);
+            return true;
+        }
+        if (name == "--song-storage") {
+            if (value == "heap") {
+                config.library.storage = WavFile::Backend::HEAP;
+            } else if (value == "mmap") {
+                config.library.storage = WavFile::Backend::MMAP;
+            } else if (value == "stream") {
+                config.library.storage = WavFile::Backend::STREAM;
+            } else {
+                std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+                return false;
+            }
+            return true;
+        }
+        if (name == "--io-engine") {
+            if (value == "auto") {
+                config.library.diskEngine = DiskEngine::Kind::AUTO;
+            } else if (value == "io_uring") {
+                config.library.diskEngine = DiskEngine::Kind::IO_URING;
+            } else if (value == "threads") {
+                config.library.diskEngine = DiskEngine::Kind::THREADS;
+            } else {
+                std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+                return false;
+            }
+            return true;
+        }
+        if (name == "--io-depth") {
+            config.library.diskDepth = std::stoul(value);
+            return true;
+        }
+        if (name == "--scan-threads") {
+            config.library.scanThreads = std::stoul(value);
+            return true;
+        }
+        if (name == "--catalog-index") {
+            config.library.persistCatalog = value != "off";
+            config.library.indexPath = value == "off" ? "" : value;
+            return true;
+        }
+        if (name == "--watch") {
+            if (value == "auto") {
+                config.library.watch = LibraryWatcher::Mode::AUTO;
+            } else if (value == "poll") {
+                config.library.watch = LibraryWatcher::Mode::POLL;
+            } else if (value == "off") {
+                config.library.watch = LibraryWatcher::Mode::OFF;
+            } else {
+                std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+                return false;
+            }
+            return true;
+        }
+        if (name == "--poll-seconds") {
+            config.library.pollInterval = std::chrono::milliseconds(static_cast<long long>(std::stod(value) * 1000));
+            return true;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+    }
+    
+    return false;
+}
+
 int main(int argc, char* argv[]) {
-    int port = 8080;
-    std::string musicDir = "./music";
+    ServerConfig config;
+    int positional = 0;
     
     // Parse command line arguments
-    if (argc >= 2) {
-        try {
-            port = std::stoi(argv[1]);
-        } catch (const std::exception& e) {
-            std::cerr << "Invalid port number: " << argv[1] << std::endl;
-            std::cerr << "Usage: " << argv[0] << " [port] [music_directory]" << std::endl;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        
+        if (arg.rfind("--", 0) == 0) {
+            if (!parseOption(arg, config)) {
+                std::cerr << "Invalid option: " << arg << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (positional == 0) {
+            try {
+                config.port = std::stoi(arg);
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid port number: " << arg << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+            positional++;
+        } else if (positional == 1) {
+            config.musicDir = arg;
+            positional++;
+        } else {
+            printUsage(argv[0]);
             return 1;
         }
     }
     
-    if (argc >= 3) {
-        musicDir = argv[2];
-    }
-    
     // Register signal handlers
     signal(SIGINT, signalHandler);  // Ctrl+C
     signal(SIGTERM, signalHandler); // Termination signal
+    signal(SIGPIPE, SIG_IGN);       // Dropped clients are detected via send errors
     
     std::cout << "Music Player Server" << std::endl;
-    std::cout << "Starting server on port " << port << " with music directory: " << musicDir << std::endl;
+    std::cout << "Starting server on port " << config.port << " with music directory: " << config.musicDir << std::endl;
     
     // Create and start the server
-    MusicServer server(port, musicDir);
+    MusicServer server(config);
     g_server = &server;
     
     if (!server.start()) {
@@ -62,6 +243,31 @@ int main(int argc, char* argv[]) {
         
         if (command == "clients") {
             std::cout << "Connected clients: " << server.getClientCount() << std::endl;
+        } else if (command == "stats") {
+            ServerStats stats = server.getStats();
+            std::cout << "Connected clients: " << stats.connectedClients << std::endl;
+            std::cout << "Queued bytes:      " << stats.queuedBytes << std::endl;
+            std::cout << "Peak queue bytes:  " << stats.peakQueueBytes << std::endl;
+            std::cout << "Stalls:            " << stats.stallEvents << " ("
+                      << stats.stallMicros / 1000 << " ms total)" << std::endl;
+            std::cout << "Evictions:         " << stats.evictions << std::endl;
+            std::cout << "Accept pauses:     " << stats.acceptPauses << std::endl;
+            std::cout << "Cache hits:        " << stats.cacheHits << std::endl;
+            std::cout << "Cache misses:      " << stats.cacheMisses << std::endl;
+            std::cout << "Cache evictions:   " << stats.cacheEvictions << " ("
+                      << stats.cacheRejections << " loads not admitted)" << std::endl;
+            std::cout << "Cache resident:    " << stats.cacheResidentBytes << " bytes in "
+                      << stats.cacheResidentSongs << " songs" << std::endl;
+            std::cout << "Disk reads:        " << stats.diskReads << " (" << stats.diskBytesRead
+                      << " bytes)" << std::endl;
+            std::cout << "Disk queue:        " << stats.diskInFlight << " in flight, " << stats.diskQueued
+                      << " waiting, peak " << stats.diskPeakInFlight << std::endl;
+            std::cout << "Encoded blocks:    " << stats.encodedHits << " hits, " << stats.encodedMisses
+                      << " misses, " << stats.encodedEvictions << " evictions" << std::endl;
+            std::cout << "Encoded resident:  " << stats.encodedResidentBytes << " bytes in "
+                      << stats.encodedResidentBlocks << " blocks" << std::endl;
+            std::cout << "Compressed audio:  " << stats.encodedPcmBytes << " -> " << stats.encodedBytes
+                      << " bytes" << std::endl;
         } else if (command == "stop" || command == "exit" || command == "quit") {
             std::cout << "Stopping server..." << std::endl;
             server.stop();
@@ -69,6 +275,7 @@ int main(int argc, char* argv[]) {
         } else if (command == "help") {
             std::cout << "Commands:" << std::endl;
             std::cout << "  clients    - Show number of connected clients" << std::endl;
+            std::cout << "  stats      - Show send queue, eviction, cache, disk and compression counters" << std::endl;
             std::cout << "  stop/exit  - Stop the server" << std::endl;
             std::cout << "  help       - Show this help" << std::endl;
         } else if (!command.empty()) {
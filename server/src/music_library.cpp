@@ -1,70 +1,311 @@
 #include "music_library.h"
-#include <dirent.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <filesystem>
+#include "catalog_index.h"
+#include "../../common/include/catalog_query.h"
+#include "../../common/include/catalog_sync.h"
 
-MusicLibrary::MusicLibrary(const std::string& directory) : musicDir(directory) {
-    scanMusicDirectory();
+// Song data is read in segments of this size so the engine's in-flight cap
+// bounds the disk queue even when one long song is loading
+const size_t LOAD_SEGMENT_SIZE = 1024 * 1024;
+
+// Source of release serials, shared by all libraries
+static std::atomic<uint64_t> nextReleaseSerial(0);
+
+MusicLibrary::MusicLibrary(const std::string& directory, const LibraryConfig& libraryConfig)
+    : musicDir(directory),
+      config(libraryConfig),
+      releaseSerial(0),
+      loadedSongs([this](TrackId trackId, SongCache::Callback done) {
+                      loadSong(trackId, std::move(done));
+                  },
+                  libraryConfig.cacheBytes, libraryConfig.cacheSongs),
+      diskEngine(DiskEngine::create(libraryConfig.diskEngine, libraryConfig.diskDepth)) {
+    std::cout << "Loading songs with " << diskEngine->name() << " (up to "
+              << libraryConfig.diskDepth << " disk reads in flight)" << std::endl;
+    
+    // Start from the saved index when there is one; scanning a large
+    // library before accepting clients can take minutes
+    bool fromIndex = loadCatalogIndex();
+    watcher = std::make_unique<LibraryWatcher>(
+        musicDir, config.watch, config.pollInterval, config.scanThreads,
+        [this]() { return getCatalog(); },
+        [this](std::shared_ptr<const SongCatalog> updated) { publishCatalog(std::move(updated)); });
+    if (!fromIndex) {
+        // Watch first so files added while the scan runs are not missed
+        watcher->watch();
+        scanMusicDirectory();
+    }
+    
+    // From here on only the watcher publishes; an indexed catalog is
+    // revalidated on its thread
+    watcher->start(fromIndex);
 }
 
 MusicLibrary::~MusicLibrary() {
+    watcher->stop();
+    searchIndexer.stop();
 }
 
 void MusicLibrary::scanMusicDirectory() {
-    DIR* dir;
-    struct dirent* ent;
-    
-    if ((dir = opendir(musicDir.c_str())) != nullptr) {
-        songNames.clear();
-        
-        while ((ent = readdir(dir)) != nullptr) {
-            std::string filename = ent->d_name;
-            
-            // Check if this is a .wav file
-            if (filename.size() > 4 && 
-                filename.substr(filename.size() - 4) == ".wav") {
-                
-                // Add the song to our list (without the .wav extension)
-                songNames.push_back(filename);
-            }
-        }
-        
-        closedir(dir);
-        
-        // Sort the songs alphabetically
-        std::sort(songNames.begin(), songNames.end());
-        
-        std::cout << "Found " << songNames.size() << " songs in " << musicDir << std::endl;
-    } else {
-        std::cerr << "Could not open directory: " << musicDir << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    
+    // Walk subdirectories too; songs are named by their relative path
+    LibraryScanner scanner(musicDir, config.scanThreads);
+    std::vector<SongInfo> songs = scanner.scan();
+    
+    // The catalog sorts, interns and indexes the names and serializes the
+    // list once; every LIST_REQUEST shares that buffer
+    auto scanned = std::make_shared<const SongCatalog>(std::move(songs));
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Found " << scanned->size() << " songs in " << musicDir << " ("
+              << scanner.getDirectoryCount() << " directories, " << scanner.getSkippedCount()
+              << " unreadable files skipped) in " << ms << " ms with "
+              << scanner.getThreadCount() << " scan threads" << std::endl;
+    
+    publishCatalog(scanned);
+}
+
+bool MusicLibrary::loadCatalogIndex() {
+    if (!config.persistCatalog) {
+        return false;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    auto indexed = CatalogIndex::load(getIndexPath(), musicDir);
+    if (!indexed) {
+        return false;
     }
+    installCatalog(indexed);
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << indexed->size() << " songs from catalog index " << getIndexPath()
+              << " in " << ms << " ms; revalidating in the background" << std::endl;
+    return true;
 }
 
-const std::vector<std::string>& MusicLibrary::getSongList() const {
-    return songNames;
+void MusicLibrary::publishCatalog(std::shared_ptr<const SongCatalog> updated) {
+    installCatalog(updated);
+    
+    if (config.persistCatalog) {
+        CatalogIndex::save(getIndexPath(), musicDir, *updated);
+    }
 }
 
-std::shared_ptr<WavFile> MusicLibrary::getSong(const std::string& songName) {
-    // Check if the song is already loaded
-    auto it = loadedSongs.find(songName);
-    if (it != loadedSongs.end()) {
-        return it->second;
+void MusicLibrary::installCatalog(std::shared_ptr<const SongCatalog> updated) {
+    auto next = std::make_shared<CatalogRelease>();
+    next->catalog = updated;
+    
+    // Deltas are encoded once here, off the reactor threads
+    auto previous = std::atomic_load(&release);
+    if (previous) {
+        next->history = CatalogHistory::advance(previous->history.get(), *previous->catalog, *updated);
     }
+    searchIndexer.update(updated);
     
-    // Load the song
+    std::atomic_store(&release, std::shared_ptr<const CatalogRelease>(std::move(next)));
+    releaseSerial.store(nextReleaseSerial.fetch_add(1) + 1, std::memory_order_release);
+    
+    // A rewritten file keeps its track ID (the hash of its path), so the
+    // cache would go on serving the old audio; removed songs would stay
+    // resident for good. Drop both so the next request reads the disk.
+    if (previous) {
+        loadedSongs.invalidate(previous->catalog->changedTracks(*updated));
+    }
+    
+    // Readers drop old snapshots on their own threads. Holding a reference
+    // here means the last one is always released by the publisher, so
+    // freeing a large catalog never stalls a reactor thread.
+    if (previous) {
+        retiredReleases.push_back(std::move(previous));
+    }
+    retiredReleases.erase(std::remove_if(retiredReleases.begin(), retiredReleases.end(),
+                                         [](const std::shared_ptr<const CatalogRelease>& retired) {
+                                             return retired.use_count() == 1;
+                                         }),
+                          retiredReleases.end());
+}
+
+std::string MusicLibrary::getIndexPath() const {
+    return config.indexPath.empty() ? CatalogIndex::defaultPath(musicDir) : config.indexPath;
+}
+
+const std::shared_ptr<const MusicLibrary::CatalogRelease>& MusicLibrary::currentRelease() const {
+    // Each thread keeps the last snapshot it saw and compares serials (one
+    // atomic load) to decide whether to fetch the published pointer again,
+    // so reading the catalog takes no lock while it is unchanged. Serials
+    // are unique across libraries, so a snapshot cached for one library is
+    // never mistaken for another's.
+    struct CachedRelease {
+        uint64_t serial = 0;
+        std::shared_ptr<const CatalogRelease> release;
+    };
+    thread_local CachedRelease cached;
+    
+    uint64_t serial = releaseSerial.load(std::memory_order_acquire);
+    if (cached.serial != serial) {
+        cached.release = std::atomic_load(&release);
+        cached.serial = serial;
+    }
+    return cached.release;
+}
+
+std::shared_ptr<const SongCatalog> MusicLibrary::getCatalog() const {
+    // Shares the release's count, so the publisher still frees it
+    const auto& current = currentRelease();
+    return std::shared_ptr<const SongCatalog>(current, current->catalog.get());
+}
+
+ListReply MusicLibrary::getListUpdate(uint64_t knownVersion) const {
+    const auto& current = currentRelease();
+    const SongCatalog& catalog = *current->catalog;
+    std::string_view snapshot = catalog.getSnapshotPayload();
+    
+    if (knownVersion == catalog.getVersion()) {
+        // The snapshot starts with the version
+        return ListReply{MessageType::LIST_NOT_MODIFIED, snapshot.substr(0, ListNotModifiedMessage::MIN_SIZE), current};
+    }
+    if (knownVersion != NO_LIST_VERSION && current->history) {
+        std::string_view delta = current->history->findDelta(knownVersion);
+        if (!delta.empty()) {
+            return ListReply{MessageType::LIST_DELTA, delta, current};
+        }
+    }
+    return ListReply{MessageType::LIST_SNAPSHOT, snapshot, current};
+}
+
+std::vector<char> MusicLibrary::search(std::string_view query, uint32_t offset, uint16_t limit) const {
+    auto indexed = searchIndexer.current();
+    if (!indexed) {
+        std::vector<char> payload;
+        beginQueryPage(payload, currentRelease()->catalog->getVersion(), offset);
+        finishQueryPage(payload, 0, QUERY_TRUNCATED);
+        return payload;
+    }
+    return indexed->search->search(*indexed->catalog, query, offset, limit);
+}
+
+std::vector<char> MusicLibrary::browse(std::string_view directory, uint32_t offset, uint16_t limit) const {
+    return CatalogSearch::browse(*currentRelease()->catalog, directory, offset, limit);
+}
+
+
+std::shared_ptr<WavFile> MusicLibrary::getSong(TrackId trackId) {
+    return loadedSongs.get(trackId);
+}
+
+std::shared_ptr<WavFile> MusicLibrary::requestSong(TrackId trackId, SongCache::Callback done) {
+    return loadedSongs.lookup(trackId, std::move(done));
+}
+
+void MusicLibrary::loadSong(TrackId trackId, SongCache::Callback done) {
+    // Only a miss needs the name, to open the file
+    std::string songName = getTrackName(trackId);
+    if (songName.empty()) {
+        done(nullptr);
+        return;
+    }
     std::string filepath = musicDir + "/" + songName;
-    auto song = std::make_shared<WavFile>(filepath);
+    auto song = std::make_shared<WavFile>(filepath, config.storage);
     
-    if (song->load()) {
-        // Add to cache
-        loadedSongs[songName] = song;
-        return song;
+    if (!song->openFile()) {
+        done(nullptr);
+        return;
     }
     
-    return nullptr;
+    // Read the start of the file to locate the data chunk
+    auto prefix = std::make_shared<std::vector<char>>(std::min(WavFile::HEADER_PROBE_SIZE, song->getFileSize()));
+    diskEngine->read(song->getFileDescriptor(), prefix->data(), prefix->size(), 0,
+                     [this, song, prefix, done](ssize_t result) {
+        if (result != static_cast<ssize_t>(prefix->size())) {
+            std::cerr << "Error: Cannot read WAV header" << std::endl;
+            done(nullptr);
+            return;
+        }
+        if (!song->parseHeader(prefix->data(), prefix->size())) {
+            done(nullptr);
+            return;
+        }
+        readSamples(song, done);
+    });
 }
 
-bool MusicLibrary::hasSong(const std::string& songName) const {
-    return std::find(songNames.begin(), songNames.end(), songName) != songNames.end();
+void MusicLibrary::readSamples(std::shared_ptr<WavFile> song, SongCache::Callback done) {
+    // Only heap-backed songs copy their samples at load time
+    char* buffer = song->getLoadBuffer();
+    size_t audioSize = song->getAudioSize();
+    if (!buffer || audioSize == 0) {
+        song->completeLoad();
+        done(song);
+        return;
+    }
+    
+    size_t segments = (audioSize + LOAD_SEGMENT_SIZE - 1) / LOAD_SEGMENT_SIZE;
+    auto remaining = std::make_shared<std::atomic<size_t>>(segments);
+    auto failed = std::make_shared<std::atomic<bool>>(false);
+    
+    for (size_t i = 0; i < segments; ++i) {
+        size_t offset = i * LOAD_SEGMENT_SIZE;
+        size_t length = std::min(LOAD_SEGMENT_SIZE, audioSize - offset);
+        diskEngine->read(song->getFileDescriptor(), buffer + offset, length, song->getDataOffset() + offset,
+                         [song, done, remaining, failed, length](ssize_t result) {
+            if (result != static_cast<ssize_t>(length)) {
+                failed->store(true);
+            }
+            // The last segment to finish completes the load
+            if (remaining->fetch_sub(1) != 1) {
+                return;
+            }
+            if (failed->load()) {
+                std::cerr << "Error: Could not read the entire audio data" << std::endl;
+                done(nullptr);
+                return;
+            }
+            song->completeLoad();
+            done(song);
+        });
+    }
+}
+
+const DiskStats& MusicLibrary::getDiskStats() const {
+    return diskEngine->getStats();
+}
+
+const CacheStats& MusicLibrary::getCacheStats() const {
+    return loadedSongs.getStats();
+}
+
+bool MusicLibrary::hasSong(std::string_view songName) const {
+    return currentRelease()->catalog->contains(songName);
+}
+
+bool MusicLibrary::hasTrack(TrackId trackId) const {
+    return currentRelease()->catalog->findTrack(trackId) != SongCatalog::NOT_FOUND;
+}
+
+TrackId MusicLibrary::findTrack(std::string_view songName) const {
+    const SongCatalog& current = *currentRelease()->catalog;
+    size_t index = current.find(songName);
+    return index == SongCatalog::NOT_FOUND ? NO_TRACK : current.getTrackId(index);
+}
+
+std::string MusicLibrary::getTrackName(TrackId trackId) const {
+    // Hold the catalog while copying the name out of it
+    auto catalog = getCatalog();
+    size_t index = catalog->findTrack(trackId);
+    return index == SongCatalog::NOT_FOUND ? std::string() : std::string(catalog->getName(index));
+}
+
+bool MusicLibrary::getSongFormat(std::string_view songName, SongFormat& format) const {
+    const SongCatalog& current = *currentRelease()->catalog;
+    size_t index = current.find(songName);
+    if (index == SongCatalog::NOT_FOUND) {
+        return false;
+    }
+    format = current.getFormat(index);
+    return true;
 }
\ No newline at end of file
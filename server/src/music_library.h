@@ -1,33 +1,133 @@
 #ifndef MUSIC_LIBRARY_H
 #define MUSIC_LIBRARY_H
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
+#include "../../common/include/protocol.h"
+#include "catalog_history.h"
+#include "catalog_search.h"
+#include "disk_engine.h"
+#include "library_scanner.h"
+#include "library_watcher.h"
+#include "song_cache.h"
+#include "song_catalog.h"
 #include "wav_file.h"
 
+// Song loading and caching settings
+struct LibraryConfig {
+    size_t cacheBytes = 0;                                // Memory budget for loaded songs; 0 = unlimited
+    size_t cacheSongs = 512;                              // Loaded songs kept, each with its file open; 0 = unlimited
+    WavFile::Backend storage = WavFile::Backend::MMAP;    // How loaded songs hold their samples
+    DiskEngine::Kind diskEngine = DiskEngine::Kind::AUTO; // Engine for asynchronous song reads
+    size_t diskDepth = 16;                                // Maximum concurrent disk reads
+    size_t scanThreads = 0;                               // Library scan threads; 0 = one per core
+    bool persistCatalog = true;                           // Keep a catalog index for fast restarts
+    std::string indexPath;                                // Catalog index file; empty = in the state directory
+    LibraryWatcher::Mode watch = LibraryWatcher::Mode::AUTO; // How changes to the directory are picked up
+    std::chrono::milliseconds pollInterval{30000};        // Rescan period when polling
+};
+
+// Reply to a LIST_REQUEST: the payload lives in 'owner'
+struct ListReply {
+    MessageType type;
+    std::string_view payload;
+    std::shared_ptr<const void> owner;
+};
+
 class MusicLibrary {
 private:
+    // A published catalog and the deltas that bring recent versions of the
+    // song list up to it
+    struct CatalogRelease {
+        std::shared_ptr<const SongCatalog> catalog;
+        std::shared_ptr<const CatalogHistory> history;
+    };
+
     std::string musicDir;
-    std::vector<std::string> songNames;
-    std::unordered_map<std::string, std::shared_ptr<WavFile>> loadedSongs;
+    LibraryConfig config;
+    std::shared_ptr<const CatalogRelease> release;  // Current snapshot (atomic access only)
+    std::atomic<uint64_t> releaseSerial;            // Changes on every publish; see currentRelease()
+    std::vector<std::shared_ptr<const CatalogRelease>> retiredReleases;  // Replaced, maybe still in use
+    SearchIndexer searchIndexer;  // Indexes each published catalog for search
+    SongCache loadedSongs;  // Shared by all reactor threads
+    std::unique_ptr<DiskEngine> diskEngine;  // Declared last: stopped before the cache goes away
+    std::unique_ptr<LibraryWatcher> watcher;  // Publishes catalogs as the directory changes
     
-    // Scan the music directory for available songs
+    // Scan the music directory tree for available songs and their formats
     void scanMusicDirectory();
+    
+    // Serve the catalog saved by a previous run; false if there is no
+    // usable index
+    bool loadCatalogIndex();
+    
+    // Make 'updated' the served snapshot, unload the songs whose files it
+    // changed or removed, and persist it. Only one thread publishes at a
+    // time: the constructor, then the watcher.
+    void publishCatalog(std::shared_ptr<const SongCatalog> updated);
+    void installCatalog(std::shared_ptr<const SongCatalog> updated);
+    std::string getIndexPath() const;
+    
+    // This thread's cached snapshot, refreshed if a newer one was published.
+    // The reference is valid until the thread's next call.
+    const std::shared_ptr<const CatalogRelease>& currentRelease() const;
+    
+    // Read a song from disk through the disk engine (called by the cache on a miss)
+    void loadSong(TrackId trackId, SongCache::Callback done);
+    
+    // Read a parsed song's data chunk in segments, then finish the load
+    void readSamples(std::shared_ptr<WavFile> song, SongCache::Callback done);
 
 public:
-    MusicLibrary(const std::string& directory);
+    MusicLibrary(const std::string& directory, const LibraryConfig& libraryConfig = LibraryConfig());
     ~MusicLibrary();
     
-    // Get list of available songs
-    const std::vector<std::string>& getSongList() const;
+    // Current song catalog. Hold the returned pointer while using its names:
+    // the watcher may publish a new catalog at any time. Never blocks.
+    std::shared_ptr<const SongCatalog> getCatalog() const;
+    
+    // What to send a client whose copy of the song list is at 'knownVersion':
+    // LIST_NOT_MODIFIED, a LIST_DELTA from the history, or a LIST_SNAPSHOT.
+    // Every payload is prebuilt, so this only looks it up.
+    ListReply getListUpdate(uint64_t knownVersion) const;
+    
+    // SEARCH_RESPONSE and BROWSE_RESPONSE payloads for a page of results
+    // (see catalog_query.h). Work per call is bounded whatever the library
+    // size. Searches use the newest catalog indexed so far, and find nothing
+    // (flagged as truncated) until the first index is built.
+    std::vector<char> search(std::string_view query, uint32_t offset, uint16_t limit) const;
+    std::vector<char> browse(std::string_view directory, uint32_t offset, uint16_t limit) const;
+    
+    // Load a song by track ID, blocking until it is ready (thread-safe;
+    // concurrent requests share one load)
+    std::shared_ptr<WavFile> getSong(TrackId trackId);
+    
+    // Return the song if it is cached; otherwise start loading it without
+    // blocking, return nullptr and call 'done' from a disk engine thread
+    std::shared_ptr<WavFile> requestSong(TrackId trackId, SongCache::Callback done);
+    
+    // Disk engine read and queue depth counters
+    const DiskStats& getDiskStats() const;
+    
+    // Song cache hit, miss, eviction and residency counters
+    const CacheStats& getCacheStats() const;
+    
+    // Check if a song exists (hash lookup, no allocation)
+    bool hasSong(std::string_view songName) const;
+    bool hasTrack(TrackId trackId) const;
+    
+    // Track ID of a song by name, NO_TRACK if there is none (for clients
+    // that still request songs by name)
+    TrackId findTrack(std::string_view songName) const;
     
-    // Load a song by name
-    std::shared_ptr<WavFile> getSong(const std::string& songName);
+    // Name of a track for display; empty if there is none
+    std::string getTrackName(TrackId trackId) const;
     
-    // Check if a song exists
-    bool hasSong(const std::string& songName) const;
+    // Format read from a song's header by the scan; false if unknown
+    bool getSongFormat(std::string_view songName, SongFormat& format) const;
 };
 
 #endif // MUSIC_LIBRARY_H
\ No newline at end of file
@@ -1,9 +1,24 @@
 #include "music_server.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <thread>
+
+static ServerConfig makeConfig(int port, const std::string& musicDirectory) {
+    ServerConfig config;
+    config.port = port;
+    config.musicDir = musicDirectory;
+    return config;
+}
 
 MusicServer::MusicServer(int serverPort, const std::string& musicDirectory)
-    : port(serverPort), 
-      musicDir(musicDirectory),
+    : MusicServer(makeConfig(serverPort, musicDirectory)) {
+}
+
+MusicServer::MusicServer(const ServerConfig& serverConfig)
+    : config(serverConfig),
       serverSocket(new Socket()),
       isRunning(false) {
 }
@@ -12,22 +27,63 @@ MusicServer::~MusicServer() {
     stop();
 }
 
+// Raise the descriptor limit as far as allowed: every connection and every
+// song kept open needs one, and the usual soft limit of 1024 is far below
+// the connections the event loops can serve
+static void raiseDescriptorLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        return;
+    }
+    rlim_t wanted = limit.rlim_max;
+#ifdef OPEN_MAX
+    // macOS refuses soft limits above OPEN_MAX even when the hard one is unlimited
+    wanted = std::min<rlim_t>(wanted, OPEN_MAX);
+#endif
+    if (wanted > limit.rlim_cur) {
+        limit.rlim_cur = wanted;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            std::cerr << "Could not raise the file descriptor limit: " << strerror(errno) << std::endl;
+        }
+    }
+}
+
 bool MusicServer::start() {
+    raiseDescriptorLimit();
+
     // Create the music library
-    library = std::make_shared<MusicLibrary>(musicDir);
+    library = std::make_shared<MusicLibrary>(config.musicDir, config.library);
+    sessions = std::make_shared<SessionRegistry>(config.stream.resumeSeconds);
+    encodedBlocks = std::make_shared<EncodedBlockCache>(config.stream.encodedCacheBytes);
     
-    // Create and bind the server socket
-    if (!serverSocket->createServer(port)) {
-        std::cerr << "Failed to start server on port " << port << std::endl;
+    // Create and bind the server socket; reactors accept from it without blocking
+    if (!serverSocket->createServer(config.port) || !serverSocket->setNonBlocking()) {
+        std::cerr << "Failed to start server on port " << config.port << std::endl;
         return false;
     }
     
-    std::cout << "Server started on port " << port << std::endl;
-    std::cout << "Music directory: " << musicDir << std::endl;
+    size_t threadCount = config.reactorThreads;
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    // Start the event loops
+    for (size_t i = 0; i < threadCount; ++i) {
+        auto reactor = std::make_unique<Reactor>(*serverSocket, library, config.stream, sessions, encodedBlocks);
+        if (!reactor->start()) {
+            std::cerr << "Failed to start event loop " << i << std::endl;
+            reactors.clear();
+            serverSocket->close();
+            return false;
+        }
+        reactors.push_back(std::move(reactor));
+    }
+    
+    std::cout << "Server started on port " << config.port << " with "
+              << threadCount << " event loop threads" << std::endl;
+    std::cout << "Music directory: " << config.musicDir << std::endl;
     
-    // Start the accept thread
     isRunning.store(true);
-    acceptThread = std::thread(&MusicServer::acceptClients, this);
     
     return true;
 }
@@ -36,15 +92,11 @@ void MusicServer::stop() {
     if (isRunning.load()) {
         isRunning.store(false);
         
-        if (acceptThread.joinable()) {
-            acceptThread.join();
-        }
-        
-        // Stop all client handlers
-        for (auto& client : clients) {
-            client->stop();
+        // Stop all event loops and their connections
+        for (auto& reactor : reactors) {
+            reactor->stop();
         }
-        clients.clear();
+        reactors.clear();
         
         serverSocket->close();
         
@@ -57,47 +109,20 @@ bool MusicServer::running() const {
 }
 
 size_t MusicServer::getClientCount() const {
-    return clients.size();
+    return getStats().connectedClients;
 }
 
-void MusicServer::acceptClients() {
-    while (isRunning.load()) {
-        // Clean up disconnected clients
-        cleanupClients();
-        
-        // Accept a new client
-        std::unique_ptr<Socket> clientSocket(serverSocket->acceptClient());
-        
-        if (clientSocket && clientSocket->connected()) {
-            // Create a new client handler
-            auto handler = std::make_unique<ClientHandler>(std::move(clientSocket), library);
-            
-            // Start handling the client
-            handler->start();
-            
-            // Add to our list of clients
-            clients.push_back(std::move(handler));
-            
-            std::cout << "New client connected. Total clients: " << clients.size() << std::endl;
-        } else if (!isRunning.load()) {
-            // Server is shutting down
-            break;
-        } else {
-            // Accept failed, wait a bit and try again
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        }
+ServerStats MusicServer::getStats() const {
+    ServerStats totals;
+    for (const auto& reactor : reactors) {
+        totals.add(reactor->getStats());
     }
-    
-    std::cout << "Accept thread terminated" << std::endl;
-}
-
-void MusicServer::cleanupClients() {
-    auto it = clients.begin();
-    while (it != clients.end()) {
-        if (!(*it)->isActive()) {
-            it = clients.erase(it);
-        } else {
-            ++it;
-        }
+    if (library) {
+        totals.add(library->getCacheStats());
+        totals.add(library->getDiskStats());
+    }
+    if (encodedBlocks) {
+        totals.add(encodedBlocks->getStats());
     }
-}
\ No newline at end of file
+    return totals;
+}
@@ -4,29 +4,32 @@
 #include <atomic>
 #include <memory>
 #include <string>
-#include <thread>
 #include <vector>
-#include "client_handler.h"
 #include "music_library.h"
+#include "reactor.h"
+
+// Server settings, filled from the command line in main.cpp
+struct ServerConfig {
+    int port = 8080;
+    std::string musicDir = "./music";
+    size_t reactorThreads = 0;  // Event loop threads; 0 = one per hardware thread
+    LibraryConfig library;      // Song loading and caching settings
+    StreamConfig stream;        // Per-connection streaming settings
+};
 
 class MusicServer {
 private:
-    int port;
-    std::string musicDir;
+    ServerConfig config;
     std::unique_ptr<Socket> serverSocket;
     std::shared_ptr<MusicLibrary> library;
+    std::shared_ptr<SessionRegistry> sessions;  // Streams of dropped connections, shared by the event loops
+    std::shared_ptr<EncodedBlockCache> encodedBlocks;  // Compressed audio, shared by the event loops
     std::atomic<bool> isRunning;
-    std::thread acceptThread;
-    std::vector<std::unique_ptr<ClientHandler>> clients;
-    
-    // Thread to accept new clients
-    void acceptClients();
-    
-    // Clean up disconnected clients
-    void cleanupClients();
+    std::vector<std::unique_ptr<Reactor>> reactors;
 
 public:
     MusicServer(int port, const std::string& musicDirectory);
+    MusicServer(const ServerConfig& serverConfig);
     ~MusicServer();
     
     // Start the server
@@ -40,6 +43,10 @@ public:
     
     // Get the number of connected clients
     size_t getClientCount() const;
+    
+    // Get connection, backlog and eviction totals across all event loops,
+    // plus song cache and encoded block cache counters
+    ServerStats getStats() const;
 };
 
-#endif // MUSIC_SERVER_H
\ No newline at end of file
+#endif // MUSIC_SERVER_H
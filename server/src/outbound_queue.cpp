@@ -0,0 +1,258 @@
+#include "outbound_queue.h"
+#include <algorithm>
+
+OutboundQueue::OutboundQueue(size_t low, size_t high, ReactorStats* reactorStats)
+    : queuedBytes(0),
+      lowWatermark(std::min(low, high)),
+      highWatermark(high),
+      throttled(false),
+      stalled(false),
+      stats(reactorStats) {
+}
+
+OutboundQueue::~OutboundQueue() {
+    clear();
+}
+
+void OutboundQueue::pushFrame(MessageType type, const char* payload, size_t size,
+                              std::shared_ptr<const void> owner) {
+    SongDataPrefix prefix;
+    EncodedHeader header = makeMessageHeader(type, size);
+    std::copy(header.begin(), header.end(), prefix.begin());
+    push(Segment{prefix, MESSAGE_HEADER_SIZE, NO_STREAM, Lane::CONTROL, payload, size, std::move(owner),
+                 nullptr, 0, 0, 0, Clock::now()});
+}
+
+void OutboundQueue::pushStreamFrame(StreamId stream, Lane lane, MessageType type, const char* payload,
+                                    size_t size, std::shared_ptr<const void> owner) {
+    SongDataPrefix prefix;
+    StreamPrefix streamPrefix = makeStreamPrefix(type, stream, size);
+    std::copy(streamPrefix.begin(), streamPrefix.end(), prefix.begin());
+    push(Segment{prefix, STREAM_PREFIX_SIZE, stream, lane, payload, size,
+                 std::move(owner), nullptr, 0, 0, 0, Clock::now()});
+}
+
+void OutboundQueue::pushSongData(StreamId stream, size_t offset, uint32_t crc, const char* audio, size_t size,
+                                 std::shared_ptr<const void> owner) {
+    push(Segment{makeSongDataPrefix(stream, offset, crc, size), SONG_DATA_PREFIX_SIZE, stream, Lane::DATA,
+                 audio, size, std::move(owner), nullptr, 0, 0, 0, Clock::now()});
+}
+
+void OutboundQueue::pushFileChunk(StreamId stream, const std::shared_ptr<WavFile>& song, size_t offset,
+                                  size_t length, uint32_t crc) {
+    // Only the frame prefix passes through userspace; the segment keeps the
+    // song alive until its body is written, even if the stream is replaced
+    push(Segment{makeSongDataPrefix(stream, offset, crc, length), SONG_DATA_PREFIX_SIZE, stream,
+                 Lane::DATA, nullptr, 0, nullptr, song, offset, length, 0, Clock::now()});
+}
+
+void OutboundQueue::push(Segment segment) {
+    size_t frameSize = segment.totalSize();
+    queuedBytes += frameSize;
+    (segment.lane == Lane::CONTROL ? control : data).push_back(std::move(segment));
+
+    if (queuedBytes >= highWatermark) {
+        throttled = true;
+    }
+
+    if (stats) {
+        stats->queuedBytes.fetch_add(frameSize, std::memory_order_relaxed);
+        if (queuedBytes > stats->peakQueueBytes.load(std::memory_order_relaxed)) {
+            stats->peakQueueBytes.store(queuedBytes, std::memory_order_relaxed);
+        }
+    }
+}
+
+void OutboundQueue::cancelStream(StreamId stream) {
+    size_t dropped = 0;
+    for (auto* lane : {&control, &data}) {
+        auto unsent = [stream, &dropped](const Segment& segment) {
+            if (segment.stream != stream || segment.sent > 0) {
+                return false;
+            }
+            dropped += segment.totalSize();
+            return true;
+        };
+        lane->erase(std::remove_if(lane->begin(), lane->end(), unsent), lane->end());
+    }
+    if (dropped > 0) {
+        release(dropped);
+    }
+}
+
+OutboundQueue::Segment& OutboundQueue::next() {
+    if (!data.empty() && data.front().sent > 0) {
+        return data.front();
+    }
+    return control.empty() ? data.front() : control.front();
+}
+
+void OutboundQueue::retire(const Segment& segment) {
+    (segment.lane == Lane::CONTROL ? control : data).pop_front();
+}
+
+bool OutboundQueue::flush(Socket& socket) {
+    while (!empty()) {
+        Segment& front = next();
+        ssize_t bytesSent = front.sent < front.memorySize() ? writeMemory(socket)
+                                                            : writeFileBody(socket, front);
+        if (bytesSent < 0) {
+            return false;
+        }
+
+        if (bytesSent == 0) {
+            // Socket buffer is full: remember when the stall started
+            if (!stalled) {
+                stalled = true;
+                stalledSince = Clock::now();
+                if (stats) {
+                    stats->stallEvents.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            return true;
+        }
+
+        if (stalled) {
+            stalled = false;
+            if (stats) {
+                auto stallTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - stalledSince);
+                stats->stallMicros.fetch_add(stallTime.count(), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    return true;
+}
+
+ssize_t OutboundQueue::writeMemory(Socket& socket) {
+    struct iovec iov[Socket::MAX_IOV];
+    Segment* frames[Socket::MAX_IOV];
+    int count = 0;
+    int frameCount = 0;
+    bool fileBodyFollows = false;
+
+    // Prefixes and payloads of consecutive frames go out in one call;
+    // gathering stops at a frame whose body must come from the file
+    auto gather = [&](Segment& segment) {
+        if (count + 2 > Socket::MAX_IOV) {
+            return false;
+        }
+
+        size_t sent = segment.sent;
+        if (sent < segment.prefixSize) {
+            iov[count].iov_base = segment.prefix.data() + sent;
+            iov[count].iov_len = segment.prefixSize - sent;
+            count++;
+            sent = segment.prefixSize;
+        }
+        if (sent < segment.memorySize()) {
+            size_t payloadSent = sent - segment.prefixSize;
+            iov[count].iov_base = const_cast<char*>(segment.payload + payloadSent);
+            iov[count].iov_len = segment.payloadSize - payloadSent;
+            count++;
+        }
+        frames[frameCount++] = &segment;
+
+        if (segment.fileLength > 0) {
+            fileBodyFollows = true;
+            return false;
+        }
+        return true;
+    };
+
+    // Wire order: a partly written data frame, control frames, then data
+    bool more = true;
+    auto firstData = data.begin();
+    if (firstData != data.end() && firstData->sent > 0) {
+        more = gather(*firstData++);
+    }
+    for (auto it = control.begin(); more && it != control.end(); ++it) {
+        more = gather(*it);
+    }
+    for (auto it = firstData; more && it != data.end(); ++it) {
+        more = gather(*it);
+    }
+
+    ssize_t bytesSent = socket.sendvSome(iov, count, fileBodyFollows);
+    if (bytesSent <= 0) {
+        return bytesSent;
+    }
+
+    // Credit the written bytes to frames in order, retiring completed ones
+    size_t remaining = static_cast<size_t>(bytesSent);
+    for (int i = 0; remaining > 0; ++i) {
+        Segment& frame = *frames[i];
+        size_t take = std::min(remaining, frame.memorySize() - frame.sent);
+        frame.sent += take;
+        remaining -= take;
+
+        if (frame.sent == frame.totalSize()) {
+            retire(frame);
+        }
+    }
+
+    release(static_cast<size_t>(bytesSent));
+    return bytesSent;
+}
+
+ssize_t OutboundQueue::writeFileBody(Socket& socket, Segment& segment) {
+    size_t bodySent = segment.sent - segment.memorySize();
+    ssize_t bytesSent = socket.sendFileSome(
+        segment.file->getFileDescriptor(),
+        static_cast<off_t>(segment.file->getDataOffset() + segment.fileOffset + bodySent),
+        segment.fileLength - bodySent);
+
+    if (bytesSent > 0) {
+        segment.sent += bytesSent;
+        if (segment.sent == segment.totalSize()) {
+            retire(segment);
+        }
+        release(static_cast<size_t>(bytesSent));
+    }
+
+    return bytesSent;
+}
+
+void OutboundQueue::release(size_t bytes) {
+    queuedBytes -= bytes;
+    if (queuedBytes <= lowWatermark) {
+        throttled = false;
+    }
+    if (stats) {
+        stats->queuedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+}
+
+void OutboundQueue::clear() {
+    control.clear();
+    data.clear();
+    stalled = false;
+    release(queuedBytes);
+}
+
+bool OutboundQueue::empty() const {
+    return control.empty() && data.empty();
+}
+
+size_t OutboundQueue::size() const {
+    return queuedBytes;
+}
+
+bool OutboundQueue::canProduce() const {
+    return !throttled;
+}
+
+OutboundQueue::Clock::duration OutboundQueue::oldestFrameAge(Clock::time_point now) const {
+    if (empty()) {
+        return Clock::duration::zero();
+    }
+    // Each lane is in queueing order, so its front is its oldest frame
+    Clock::time_point oldest = Clock::time_point::max();
+    for (const auto* lane : {&control, &data}) {
+        if (!lane->empty()) {
+            oldest = std::min(oldest, lane->front().queuedAt);
+        }
+    }
+    return now - oldest;
+}
@@ -0,0 +1,126 @@
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include "../../common/include/protocol.h"
+#include "../../common/include/socket.h"
+#include "server_stats.h"
+#include "wav_file.h"
+
+// Bounded queue of frames waiting to be written to one non-blocking socket.
+// Producers check canProduce(): it turns false once the backlog reaches the
+// high watermark and true again only after it drains to the low watermark,
+// so bulk producers back off without flapping on every write.
+//
+// Frames wait in two lanes. Control frames (replies, and the SONG_INFO that
+// starts a stream) go out ahead of queued song data at the next frame
+// boundary, so a reply never waits behind a backlog of audio.
+class OutboundQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Lane {
+        CONTROL,
+        DATA
+    };
+
+    OutboundQueue(size_t lowWatermark, size_t highWatermark, ReactorStats* reactorStats);
+    ~OutboundQueue();
+
+    OutboundQueue(const OutboundQueue&) = delete;
+    OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+    // Queue a control frame whose payload is referenced, not copied;
+    // 'owner' keeps the payload memory alive until it is written
+    void pushFrame(MessageType type, const char* payload, size_t size,
+                   std::shared_ptr<const void> owner = nullptr);
+
+    // Queue a frame of 'stream' whose payload is the stream ID, then the
+    // referenced bytes
+    void pushStreamFrame(StreamId stream, Lane lane, MessageType type, const char* payload, size_t size,
+                         std::shared_ptr<const void> owner = nullptr);
+
+    // Queue a SONG_DATA frame of 'stream' carrying the referenced audio,
+    // which starts at byte 'offset' of the song's audio and has CRC32C 'crc'
+    void pushSongData(StreamId stream, size_t offset, uint32_t crc, const char* audio, size_t size,
+                      std::shared_ptr<const void> owner);
+
+    // Queue a SONG_DATA frame of 'stream' whose audio is sent from the song's file
+    void pushFileChunk(StreamId stream, const std::shared_ptr<WavFile>& song, size_t offset, size_t length,
+                       uint32_t crc);
+
+    // Drop the frames of 'stream' not yet started; one partly written
+    // still goes out whole, since the framing depends on it
+    void cancelStream(StreamId stream);
+
+    // Write as much as the socket accepts; returns false on a socket error
+    bool flush(Socket& socket);
+
+    // Drop everything still queued
+    void clear();
+
+    bool empty() const;
+
+    // Bytes still to be written
+    size_t size() const;
+
+    // Check if bulk producers may add more (watermark hysteresis)
+    bool canProduce() const;
+
+    // How long the oldest unsent frame has been waiting (zero when empty)
+    Clock::duration oldestFrameAge(Clock::time_point now) const;
+
+private:
+    // One queued frame: its header (and stream ID, and for song data the
+    // offset and checksum), a payload in memory and/or a body sent straight
+    // from the song's file
+    struct Segment {
+        SongDataPrefix prefix;
+        size_t prefixSize;
+        StreamId stream;
+        Lane lane;
+        const char* payload;
+        size_t payloadSize;
+        std::shared_ptr<const void> owner;
+        std::shared_ptr<WavFile> file;
+        size_t fileOffset;
+        size_t fileLength;
+        size_t sent;  // Bytes of this frame already written
+        Clock::time_point queuedAt;
+
+        size_t memorySize() const { return prefixSize + payloadSize; }
+        size_t totalSize() const { return memorySize() + fileLength; }
+    };
+
+    std::deque<Segment> control;
+    std::deque<Segment> data;
+    size_t queuedBytes;
+    size_t lowWatermark;
+    size_t highWatermark;
+    bool throttled;
+    Clock::time_point stalledSince;  // When the socket last filled up (valid if stalled)
+    bool stalled;
+    ReactorStats* stats;
+
+    void push(Segment segment);
+
+    // The frame to write next: one partly written, else the first control
+    // frame, else the first data frame
+    Segment& next();
+
+    // Remove a fully written frame from the front of its lane
+    void retire(const Segment& segment);
+
+    // Gather the in-memory parts of queued frames into one vectored write
+    ssize_t writeMemory(Socket& socket);
+
+    // Send the file body of the front frame
+    ssize_t writeFileBody(Socket& socket, Segment& segment);
+
+    // Account for bytes leaving the queue
+    void release(size_t bytes);
+};
+
+#endif // OUTBOUND_QUEUE_H
@@ -0,0 +1,340 @@
+#include "reactor.h"
+#include <fcntl.h>
+#include <iostream>
+
+// How long accepting stops when the process runs out of descriptors
+static constexpr std::chrono::milliseconds ACCEPT_BACKOFF(100);
+
+Reactor::Reactor(Socket& listenSocket, std::shared_ptr<MusicLibrary> musicLibrary,
+                 const StreamConfig& config, std::shared_ptr<SessionRegistry> sessionRegistry,
+                 std::shared_ptr<EncodedBlockCache> encodedBlockCache)
+    : listenFd(listenSocket.getSocketFd()),
+      listener(listenSocket),
+      library(musicLibrary),
+      streamConfig(config),
+      sessions(std::move(sessionRegistry)),
+      encodedBlocks(std::move(encodedBlockCache)),
+      isRunning(false),
+      inbox(std::make_shared<SongInbox>()),
+      acceptPaused(false),
+      nextConnectionId(0) {
+    wakePipe[0] = -1;
+    wakePipe[1] = -1;
+}
+
+Reactor::~Reactor() {
+    stop();
+
+    // Loads finishing from now on are dropped instead of writing to a closed pipe
+    {
+        std::lock_guard<std::mutex> lock(inbox->mutex);
+        inbox->closed = true;
+        inbox->loads.clear();
+    }
+
+    if (wakePipe[0] != -1) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+    }
+}
+
+bool Reactor::start() {
+    if (!poller.valid()) {
+        return false;
+    }
+
+    if (pipe(wakePipe) < 0) {
+        std::cerr << "Error creating wake pipe: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Neither end may block: the loop drains the pipe until empty, and a
+    // full pipe already guarantees a pending wakeup
+    fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+    inbox->wakeFd = wakePipe[1];
+
+    if (!poller.add(wakePipe[0], false) || !poller.add(listenFd, false, true)) {
+        std::cerr << "Error registering reactor descriptors: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    nextSweep = StreamPacer::Clock::now() + std::chrono::seconds(1);
+    isRunning.store(true);
+    loopThread = std::thread(&Reactor::run, this);
+
+    return true;
+}
+
+void Reactor::stop() {
+    if (isRunning.load()) {
+        isRunning.store(false);
+
+        // Wake the loop so it notices the flag
+        char wake = 1;
+        if (write(wakePipe[1], &wake, 1) < 0) {
+            std::cerr << "Error waking reactor: " << strerror(errno) << std::endl;
+        }
+
+        if (loopThread.joinable()) {
+            loopThread.join();
+        }
+    }
+}
+
+void Reactor::run() {
+    std::vector<EventPoller::Event> events;
+
+    while (isRunning.load()) {
+        poller.wait(events, nextTimeoutMs());
+
+        for (const auto& event : events) {
+            if (event.fd == wakePipe[0]) {
+                deliverSongLoads();
+                continue;
+            }
+            if (event.fd == listenFd) {
+                acceptConnections();
+                continue;
+            }
+            handleEvent(event);
+        }
+
+        runTimers();
+
+        auto now = StreamPacer::Clock::now();
+        if (now >= nextSweep) {
+            sweepBacklogs();
+        }
+        if (acceptPaused && now >= acceptResume) {
+            resumeAccepting();
+        }
+    }
+
+    // Close every connection still owned by this reactor
+    for (auto& entry : connections) {
+        poller.remove(entry.first);
+        entry.second.handler->stop();
+    }
+    stats.connectedClients.fetch_sub(connections.size(), std::memory_order_relaxed);
+    connections.clear();
+}
+
+void Reactor::acceptConnections() {
+    while (true) {
+        int error = 0;
+        std::unique_ptr<Socket> clientSocket(listener.acceptPending(&error));
+        if (!clientSocket) {
+            // The connection stays queued when no descriptor is left for it,
+            // and the level-triggered listener would report it again at once
+            if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                pauseAccepting(error);
+            }
+            return;
+        }
+
+        int fd = clientSocket->getSocketFd();
+        uint64_t id = nextConnectionId++;
+
+        // Songs loaded off-thread come back through the inbox, tagged with
+        // this connection so a recycled descriptor cannot receive them
+        std::shared_ptr<SongInbox> songInbox = inbox;
+        SongDelivery delivery = [songInbox, fd, id](TrackId trackId, std::shared_ptr<WavFile> song) {
+            songInbox->post(SongLoad{fd, id, trackId, std::move(song)});
+        };
+        auto handler = std::make_unique<ClientHandler>(std::move(clientSocket), library,
+                                                       streamConfig, &stats, std::move(delivery),
+                                                       sessions.get(), encodedBlocks.get());
+
+        // A new handler may already have output (its session token)
+        bool writeInterest = handler->wantsWrite();
+        if (!poller.add(fd, writeInterest)) {
+            std::cerr << "Error registering client connection: " << strerror(errno) << std::endl;
+            continue;
+        }
+
+        connections[fd] = Connection{id, std::move(handler), true, writeInterest,
+                                     StreamPacer::Clock::time_point::max()};
+        stats.connectedClients.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Reactor::pauseAccepting(int error) {
+    poller.remove(listenFd);
+    acceptPaused = true;
+    acceptResume = StreamPacer::Clock::now() + ACCEPT_BACKOFF;
+
+    // Logged once per reactor; later pauses only show in the stats
+    if (stats.acceptPauses.fetch_add(1, std::memory_order_relaxed) == 0) {
+        std::cerr << "Out of file descriptors, pausing accepts: " << strerror(error) << std::endl;
+    }
+}
+
+void Reactor::resumeAccepting() {
+    if (!poller.add(listenFd, false, true)) {
+        // Registering may itself need memory; try again after another backoff
+        acceptResume = StreamPacer::Clock::now() + ACCEPT_BACKOFF;
+        return;
+    }
+    acceptPaused = false;
+}
+
+void Reactor::handleEvent(const EventPoller::Event& event) {
+    auto it = connections.find(event.fd);
+    if (it == connections.end()) {
+        // Connection was closed earlier in this batch
+        return;
+    }
+
+    Connection& connection = it->second;
+    ClientHandler* handler = connection.handler.get();
+    bool keepOpen = !event.hangup || event.readable;
+
+    if (keepOpen && event.readable) {
+        keepOpen = handler->onReadable();
+    }
+    if (keepOpen && event.writable) {
+        keepOpen = handler->onWritable();
+    }
+
+    if (!keepOpen) {
+        closeConnection(event.fd);
+        return;
+    }
+
+    updateConnection(event.fd, connection);
+}
+
+void Reactor::SongInbox::post(SongLoad load) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+        return;
+    }
+    loads.push_back(std::move(load));
+
+    char wake = 1;
+    if (write(wakeFd, &wake, 1) < 0 && errno != EAGAIN) {
+        std::cerr << "Error waking reactor: " << strerror(errno) << std::endl;
+    }
+}
+
+void Reactor::deliverSongLoads() {
+    char drain[256];
+    while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    std::vector<SongLoad> loads;
+    {
+        std::lock_guard<std::mutex> lock(inbox->mutex);
+        loads.swap(inbox->loads);
+    }
+
+    for (SongLoad& load : loads) {
+        auto it = connections.find(load.fd);
+        if (it == connections.end() || it->second.id != load.connectionId) {
+            // The client left while its song was loading
+            continue;
+        }
+
+        if (!it->second.handler->onSongLoaded(load.trackId, std::move(load.song))) {
+            closeConnection(load.fd);
+            continue;
+        }
+        updateConnection(load.fd, it->second);
+    }
+}
+
+void Reactor::updateConnection(int fd, Connection& connection) {
+    // Only touch the poller when interest actually changes
+    bool wantRead = connection.handler->wantsRead();
+    bool wantWrite = connection.handler->wantsWrite();
+    if (wantRead != connection.readInterest || wantWrite != connection.writeInterest) {
+        poller.setInterest(fd, wantRead, wantWrite);
+        connection.readInterest = wantRead;
+        connection.writeInterest = wantWrite;
+    }
+
+    auto wakeup = connection.handler->nextWakeup();
+    if (wakeup != connection.wakeup) {
+        connection.wakeup = wakeup;
+        if (wakeup != StreamPacer::Clock::time_point::max()) {
+            timers.push(Timer(wakeup, fd));
+        }
+    }
+}
+
+void Reactor::runTimers() {
+    auto now = StreamPacer::Clock::now();
+
+    while (!timers.empty() && timers.top().first <= now) {
+        Timer timer = timers.top();
+        timers.pop();
+
+        auto it = connections.find(timer.second);
+        if (it == connections.end() || it->second.wakeup != timer.first) {
+            continue;
+        }
+
+        Connection& connection = it->second;
+        connection.wakeup = StreamPacer::Clock::time_point::max();
+        if (!connection.handler->onTimer()) {
+            closeConnection(timer.second);
+            continue;
+        }
+        updateConnection(timer.second, connection);
+    }
+}
+
+void Reactor::sweepBacklogs() {
+    auto now = StreamPacer::Clock::now();
+    nextSweep = now + std::chrono::seconds(1);
+
+    std::vector<int> evicted;
+    for (auto& entry : connections) {
+        if (!entry.second.handler->checkBacklog(now)) {
+            evicted.push_back(entry.first);
+        }
+    }
+
+    for (int fd : evicted) {
+        closeConnection(fd);
+        stats.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int Reactor::nextTimeoutMs() const {
+    if (timers.empty() && connections.empty() && !acceptPaused) {
+        return -1;
+    }
+
+    // Connections need the periodic backlog sweep even when no timer is due
+    auto deadline = connections.empty() ? StreamPacer::Clock::time_point::max() : nextSweep;
+    if (!timers.empty() && timers.top().first < deadline) {
+        deadline = timers.top().first;
+    }
+    if (acceptPaused && acceptResume < deadline) {
+        deadline = acceptResume;
+    }
+
+    auto delay = deadline - StreamPacer::Clock::now();
+    if (delay <= StreamPacer::Clock::duration::zero()) {
+        return 0;
+    }
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(delay).count());
+}
+
+void Reactor::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+
+    poller.remove(fd);
+    it->second.handler->stop();
+    connections.erase(it);
+    stats.connectedClients.fetch_sub(1, std::memory_order_relaxed);
+}
+
+const ReactorStats& Reactor::getStats() const {
+    return stats;
+}
@@ -0,0 +1,131 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "client_handler.h"
+#include "event_poller.h"
+#include "music_library.h"
+#include "server_stats.h"
+
+// One event-loop thread serving many connections. Every reactor polls the
+// shared non-blocking listening socket, accepts the connections it wins and
+// then owns them for their whole lifetime, so handlers need no locking.
+class Reactor {
+private:
+    int listenFd;
+    Socket& listener;
+    std::shared_ptr<MusicLibrary> library;
+    StreamConfig streamConfig;
+    std::shared_ptr<SessionRegistry> sessions;
+    std::shared_ptr<EncodedBlockCache> encodedBlocks;
+    ReactorStats stats;
+    std::atomic<bool> isRunning;
+    std::thread loopThread;
+    EventPoller poller;
+
+    // Self-pipe used to wake the loop on shutdown and song deliveries
+    int wakePipe[2];
+
+    // A song load that finished on a disk engine thread, addressed to one connection
+    struct SongLoad {
+        int fd;
+        uint64_t connectionId;
+        TrackId trackId;
+        std::shared_ptr<WavFile> song;
+    };
+
+    // Mailbox for finished song loads. Disk engine callbacks keep it alive
+    // through a shared_ptr, so a load finishing after the reactor is gone
+    // finds it closed instead of touching freed memory.
+    struct SongInbox {
+        std::mutex mutex;
+        std::vector<SongLoad> loads;
+        int wakeFd = -1;
+        bool closed = false;
+
+        // Queue a finished load and wake the event loop (any thread)
+        void post(SongLoad load);
+    };
+    std::shared_ptr<SongInbox> inbox;
+
+    // A connection, the interest registered for it and its pending wakeup
+    struct Connection {
+        uint64_t id;  // Distinguishes connections that reuse a descriptor
+        std::unique_ptr<ClientHandler> handler;
+        bool readInterest;
+        bool writeInterest;
+        StreamPacer::Clock::time_point wakeup;
+    };
+
+    // Handler wakeups ordered earliest first; entries that no longer match
+    // their connection's wakeup are stale and skipped
+    using Timer = std::pair<StreamPacer::Clock::time_point, int>;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    // Next time every connection's backlog is checked for slow clients
+    StreamPacer::Clock::time_point nextSweep;
+
+    // While descriptors are exhausted the listener is left out of the
+    // poller until this time, so its pending connections cannot spin the loop
+    bool acceptPaused;
+    StreamPacer::Clock::time_point acceptResume;
+
+    // Connections owned by this reactor, keyed by socket descriptor
+    std::unordered_map<int, Connection> connections;
+    uint64_t nextConnectionId;
+
+    // Event loop body
+    void run();
+
+    // Accept every connection currently pending on the listening socket
+    void acceptConnections();
+
+    // Stop polling the listener for a while after 'error', or start again once due
+    void pauseAccepting(int error);
+    void resumeAccepting();
+
+    // Dispatch one readiness event to its connection
+    void handleEvent(const EventPoller::Event& event);
+
+    // Empty the wake pipe and hand finished song loads to their connections
+    void deliverSongLoads();
+
+    // Sync poller write interest and timers with the handler's current needs
+    void updateConnection(int fd, Connection& connection);
+
+    // Fire every wakeup that is due
+    void runTimers();
+
+    // Evict connections whose output backlog has been stuck too long
+    void sweepBacklogs();
+
+    // Poll timeout until the earliest wakeup, sweep or accept resume (-1 if none)
+    int nextTimeoutMs() const;
+
+    // Unregister and destroy a connection
+    void closeConnection(int fd);
+
+public:
+    Reactor(Socket& listenSocket, std::shared_ptr<MusicLibrary> musicLibrary,
+            const StreamConfig& config, std::shared_ptr<SessionRegistry> sessionRegistry = nullptr,
+            std::shared_ptr<EncodedBlockCache> encodedBlockCache = nullptr);
+    ~Reactor();
+
+    // Start the event loop thread
+    bool start();
+
+    // Stop the event loop and close all of its connections
+    void stop();
+
+    // Counters for this reactor's connections
+    const ReactorStats& getStats() const;
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,125 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Counters owned by one reactor. Only the reactor's thread writes them
+// (relaxed atomics), so other threads can read them without locking.
+struct ReactorStats {
+    std::atomic<size_t> connectedClients{0};
+    std::atomic<size_t> queuedBytes{0};      // Outbound bytes waiting in connection queues
+    std::atomic<size_t> peakQueueBytes{0};   // Largest single-connection backlog seen
+    std::atomic<uint64_t> stallEvents{0};    // Times a socket buffer filled with output pending
+    std::atomic<uint64_t> stallMicros{0};    // Total time connections spent stalled
+    std::atomic<uint64_t> evictions{0};      // Connections dropped for falling too far behind
+    std::atomic<uint64_t> acceptPauses{0};   // Times accepting stopped for lack of descriptors
+};
+
+// Song cache counters, updated by whichever thread touches the cache
+struct CacheStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};      // Songs dropped to stay under the budget or song limit
+    std::atomic<uint64_t> rejections{0};     // Loaded songs not kept because colder than the victim
+    std::atomic<size_t> residentBytes{0};
+    std::atomic<size_t> residentSongs{0};
+};
+
+// Disk engine counters, written by the engine's threads
+struct DiskStats {
+    std::atomic<uint64_t> reads{0};          // Completed read requests
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<size_t> inFlight{0};         // Reads submitted to the disk right now
+    std::atomic<size_t> peakInFlight{0};
+    std::atomic<size_t> queued{0};           // Reads waiting for an in-flight slot
+};
+
+// Encoded block cache counters, updated by whichever reactor encodes or
+// serves a block
+struct EncodedCacheStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};      // Blocks dropped to stay under the byte budget
+    std::atomic<size_t> residentBytes{0};
+    std::atomic<size_t> residentBlocks{0};
+    std::atomic<uint64_t> pcmBytes{0};       // Audio sent compressed, before encoding
+    std::atomic<uint64_t> encodedBytes{0};   // The same audio as sent
+};
+
+// Point-in-time totals across all reactors, the song cache, the disk engine
+// and the encoded block cache
+struct ServerStats {
+    size_t connectedClients = 0;
+    size_t queuedBytes = 0;
+    size_t peakQueueBytes = 0;
+    uint64_t stallEvents = 0;
+    uint64_t stallMicros = 0;
+    uint64_t evictions = 0;
+    uint64_t acceptPauses = 0;
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+    uint64_t cacheEvictions = 0;
+    uint64_t cacheRejections = 0;
+    size_t cacheResidentBytes = 0;
+    size_t cacheResidentSongs = 0;
+    uint64_t diskReads = 0;
+    uint64_t diskBytesRead = 0;
+    size_t diskInFlight = 0;
+    size_t diskPeakInFlight = 0;
+    size_t diskQueued = 0;
+    uint64_t encodedHits = 0;
+    uint64_t encodedMisses = 0;
+    uint64_t encodedEvictions = 0;
+    size_t encodedResidentBytes = 0;
+    size_t encodedResidentBlocks = 0;
+    uint64_t encodedPcmBytes = 0;
+    uint64_t encodedBytes = 0;
+
+    // Fold one reactor's counters into the totals
+    void add(const ReactorStats& stats) {
+        connectedClients += stats.connectedClients.load(std::memory_order_relaxed);
+        queuedBytes += stats.queuedBytes.load(std::memory_order_relaxed);
+        size_t peak = stats.peakQueueBytes.load(std::memory_order_relaxed);
+        if (peak > peakQueueBytes) {
+            peakQueueBytes = peak;
+        }
+        stallEvents += stats.stallEvents.load(std::memory_order_relaxed);
+        stallMicros += stats.stallMicros.load(std::memory_order_relaxed);
+        evictions += stats.evictions.load(std::memory_order_relaxed);
+        acceptPauses += stats.acceptPauses.load(std::memory_order_relaxed);
+    }
+
+    // Copy the song cache counters
+    void add(const CacheStats& stats) {
+        cacheHits += stats.hits.load(std::memory_order_relaxed);
+        cacheMisses += stats.misses.load(std::memory_order_relaxed);
+        cacheEvictions += stats.evictions.load(std::memory_order_relaxed);
+        cacheRejections += stats.rejections.load(std::memory_order_relaxed);
+        cacheResidentBytes += stats.residentBytes.load(std::memory_order_relaxed);
+        cacheResidentSongs += stats.residentSongs.load(std::memory_order_relaxed);
+    }
+
+    // Copy the disk engine counters
+    void add(const DiskStats& stats) {
+        diskReads += stats.reads.load(std::memory_order_relaxed);
+        diskBytesRead += stats.bytesRead.load(std::memory_order_relaxed);
+        diskInFlight += stats.inFlight.load(std::memory_order_relaxed);
+        diskPeakInFlight += stats.peakInFlight.load(std::memory_order_relaxed);
+        diskQueued += stats.queued.load(std::memory_order_relaxed);
+    }
+
+    // Copy the encoded block cache counters
+    void add(const EncodedCacheStats& stats) {
+        encodedHits += stats.hits.load(std::memory_order_relaxed);
+        encodedMisses += stats.misses.load(std::memory_order_relaxed);
+        encodedEvictions += stats.evictions.load(std::memory_order_relaxed);
+        encodedResidentBytes += stats.residentBytes.load(std::memory_order_relaxed);
+        encodedResidentBlocks += stats.residentBlocks.load(std::memory_order_relaxed);
+        encodedPcmBytes += stats.pcmBytes.load(std::memory_order_relaxed);
+        encodedBytes += stats.encodedBytes.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // SERVER_STATS_H
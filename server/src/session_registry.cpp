@@ -0,0 +1,65 @@
+#include "session_registry.h"
+
+SessionRegistry::SessionRegistry(double keepSeconds)
+    : keepFor(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(keepSeconds))) {
+}
+
+SessionToken SessionRegistry::issueToken() {
+    std::lock_guard<std::mutex> lock(mutex);
+    SessionToken token;
+    // Straight from the OS entropy source: a seeded generator's later
+    // tokens could be predicted from one a client was given
+    do {
+        token = (static_cast<SessionToken>(random()) << 32) | random();
+    } while (token == NO_SESSION);
+    return token;
+}
+
+void SessionRegistry::park(SessionToken token, std::vector<ParkedStream> streams) {
+    if (token == NO_SESSION || streams.empty() || keepFor <= Clock::duration::zero()) {
+        return;
+    }
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    expire(now);
+    parked[token] = Parked{now + keepFor, std::move(streams)};
+    expiries.emplace_back(now + keepFor, token);
+}
+
+bool SessionRegistry::resume(SessionToken token, StreamId streamId, ParkedStream& stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    expire(Clock::now());
+    auto it = parked.find(token);
+    if (it == parked.end()) {
+        return false;
+    }
+    std::vector<ParkedStream>& streams = it->second.streams;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (streams[i].id == streamId) {
+            stream = std::move(streams[i]);
+            streams.erase(streams.begin() + i);
+            if (streams.empty()) {
+                parked.erase(it);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SessionRegistry::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return parked.size();
+}
+
+void SessionRegistry::expire(Clock::time_point now) {
+    // Every session is kept equally long, so they expire in parking order;
+    // an entry whose session was resumed (or parked again) no longer matches
+    while (!expiries.empty() && expiries.front().first <= now) {
+        auto it = parked.find(expiries.front().second);
+        if (it != parked.end() && it->second.expires == expiries.front().first) {
+            parked.erase(it);
+        }
+        expiries.pop_front();
+    }
+}
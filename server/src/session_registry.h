@@ -0,0 +1,70 @@
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "../../common/include/protocol.h"
+#include "wav_file.h"
+
+// Streams of connections that dropped, kept for a while so a client that
+// reconnects can resume them (SESSION_RESUME) where its verified audio
+// ends. Every connection is given an unguessable token when it opens; when it
+// closes with streams in flight they are parked under the token, holding
+// their songs so a resume starts without loading them again and keeping
+// whether playback was paused. Shared by every event loop.
+class SessionRegistry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A stream as it was when its connection dropped
+    struct ParkedStream {
+        StreamId id = NO_STREAM;
+        TrackId track = NO_TRACK;
+        std::shared_ptr<WavFile> song;  // Null if it was still loading
+        uint64_t endFrame = 0;          // End of the requested range, 0 for the song's end
+        bool paused = false;
+    };
+
+    // Keep parked streams for 'keepSeconds'
+    explicit SessionRegistry(double keepSeconds);
+
+    SessionRegistry(const SessionRegistry&) = delete;
+    SessionRegistry& operator=(const SessionRegistry&) = delete;
+
+    // A new token, never NO_SESSION
+    SessionToken issueToken();
+
+    // Keep the streams of the connection holding 'token'
+    void park(SessionToken token, std::vector<ParkedStream> streams);
+
+    // Take stream 'streamId' parked under 'token' into 'stream'; the
+    // session's other streams stay parked until they are resumed or expire.
+    // Returns false if there is no such stream or it expired.
+    bool resume(SessionToken token, StreamId streamId, ParkedStream& stream);
+
+    // Sessions parked and not yet expired or resumed
+    size_t size() const;
+
+private:
+    struct Parked {
+        Clock::time_point expires;
+        std::vector<ParkedStream> streams;
+    };
+
+    mutable std::mutex mutex;
+    std::random_device random;  // The token is the only credential a resume needs
+    std::unordered_map<SessionToken, Parked> parked;
+    std::deque<std::pair<Clock::time_point, SessionToken>> expiries;  // In parking order
+    Clock::duration keepFor;
+
+    // Drop expired sessions (mutex held)
+    void expire(Clock::time_point now);
+};
+
+#endif // SESSION_REGISTRY_H
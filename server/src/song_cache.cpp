@@ -0,0 +1,260 @@
+#include "song_cache.h"
+#include <future>
+
+SongCache::SongCache(Loader songLoader, size_t capacityBytes, size_t songLimit)
+    : loader(std::move(songLoader)),
+      capacity(capacityBytes),
+      maxSongs(songLimit),
+      accessClock(0) {
+}
+
+SongCache::Shard& SongCache::shardFor(TrackId trackId) {
+    return shards[trackId % SHARD_COUNT];
+}
+
+const SongCache::Shard& SongCache::shardFor(TrackId trackId) const {
+    return shards[trackId % SHARD_COUNT];
+}
+
+std::shared_ptr<WavFile> SongCache::lookup(TrackId trackId, Callback done) {
+    Shard& shard = shardFor(trackId);
+
+    sketch.increment(trackId);
+    uint64_t now = accessClock.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.songs.find(trackId);
+        if (it != shard.songs.end()) {
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
+            it->second.lastAccess = now;
+            if (it->second.bytes > 0) {
+                shard.order.splice(shard.order.begin(), shard.order, it->second.position);
+            }
+            if (!it->second.song) {
+                // In flight: wait for the load another request started
+                it->second.waiters.push_back(std::move(done));
+            }
+            return it->second.song;
+        }
+        shard.songs.emplace(trackId, Entry{nullptr, {std::move(done)}, 0, now, {}, false});
+    }
+
+    // This request starts the load; others for the song queue behind it
+    stats.misses.fetch_add(1, std::memory_order_relaxed);
+    loader(trackId, [this, trackId](std::shared_ptr<WavFile> song) {
+        finishLoad(trackId, std::move(song));
+    });
+    return nullptr;
+}
+
+std::shared_ptr<WavFile> SongCache::get(TrackId trackId) {
+    std::promise<std::shared_ptr<WavFile>> loaded;
+    std::future<std::shared_ptr<WavFile>> result = loaded.get_future();
+
+    auto song = lookup(trackId, [&loaded](std::shared_ptr<WavFile> song) { loaded.set_value(song); });
+    if (song) {
+        return song;
+    }
+    return result.get();
+}
+
+void SongCache::finishLoad(TrackId trackId, std::shared_ptr<WavFile> song) {
+    std::vector<Callback> waiters;
+    bool cache = true;
+    {
+        Shard& shard = shardFor(trackId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.songs.find(trackId);
+        waiters.swap(it->second.waiters);
+        if (song && !it->second.stale) {
+            it->second.song = song;
+        } else {
+            // Failed, or the file changed while it was being read
+            shard.songs.erase(it);
+            cache = false;
+        }
+    }
+
+    if (cache) {
+        admit(trackId, song->getMemoryUsage());
+    }
+
+    for (auto& waiter : waiters) {
+        waiter(song);
+    }
+}
+
+void SongCache::admit(TrackId trackId, size_t bytes) {
+    std::lock_guard<std::mutex> evictionLock(evictionMutex);
+
+    {
+        Shard& shard = shardFor(trackId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.songs.find(trackId);
+        if (it->second.stale) {
+            // Invalidated since the load finished
+            shard.songs.erase(it);
+            return;
+        }
+        Entry& entry = it->second;
+        entry.bytes = bytes;
+        shard.order.push_front(trackId);
+        entry.position = shard.order.begin();
+    }
+    stats.residentBytes.fetch_add(bytes, std::memory_order_relaxed);
+    stats.residentSongs.fetch_add(1, std::memory_order_relaxed);
+
+    // The new song is pinned by its requester, so it is never picked as the
+    // LRU victim; the admission check decides whether it stays instead
+    bool candidateCached = true;
+    while ((capacity > 0 && stats.residentBytes.load(std::memory_order_relaxed) > capacity) ||
+           (maxSongs > 0 && stats.residentSongs.load(std::memory_order_relaxed) > maxSongs)) {
+        TrackId victim = NO_TRACK;
+        if (!findVictim(trackId, victim)) {
+            // Everything left is pinned by active streams
+            break;
+        }
+
+        if (candidateCached && sketch.frequency(trackId) < sketch.frequency(victim)) {
+            remove(trackId);
+            candidateCached = false;
+            stats.rejections.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        remove(victim);
+        stats.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool SongCache::findVictim(TrackId exclude, TrackId& victim) {
+    bool found = false;
+    uint64_t oldest = 0;
+
+    // Each shard's candidate is its least recently used song that may go;
+    // the oldest of those is the victim
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.order.rbegin(); it != shard.order.rend(); ++it) {
+            // Skip the song being admitted and songs referenced by a
+            // stream or a queued frame
+            const Entry& entry = shard.songs.find(*it)->second;
+            if (*it == exclude || entry.song.use_count() > 1) {
+                continue;
+            }
+            if (!found || entry.lastAccess < oldest) {
+                found = true;
+                oldest = entry.lastAccess;
+                victim = *it;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+size_t SongCache::remove(TrackId trackId) {
+    size_t bytes = 0;
+    {
+        Shard& shard = shardFor(trackId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.songs.find(trackId);
+        if (it == shard.songs.end() || it->second.bytes == 0) {
+            return 0;
+        }
+        bytes = it->second.bytes;
+        shard.order.erase(it->second.position);
+        shard.songs.erase(it);
+    }
+
+    stats.residentBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    stats.residentSongs.fetch_sub(1, std::memory_order_relaxed);
+    return bytes;
+}
+
+void SongCache::invalidate(const std::vector<TrackId>& trackIds) {
+    for (TrackId trackId : trackIds) {
+        std::shared_ptr<WavFile> song;
+        {
+            Shard& shard = shardFor(trackId);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.songs.find(trackId);
+            if (it == shard.songs.end()) {
+                continue;
+            }
+            if (it->second.bytes == 0) {
+                // Loading, or loaded but not admitted yet: whoever admits
+                // it drops it instead
+                it->second.stale = true;
+                continue;
+            }
+            song = it->second.song;
+        }
+
+        // Under the eviction lock so admit() never sees the song vanish
+        // halfway through budget enforcement
+        std::lock_guard<std::mutex> evictionLock(evictionMutex);
+        remove(trackId);
+        song->fileChanged();
+    }
+}
+
+bool SongCache::contains(TrackId trackId) const {
+    const Shard& shard = shardFor(trackId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.songs.find(trackId) != shard.songs.end();
+}
+
+const CacheStats& SongCache::getStats() const {
+    return stats;
+}
+
+SongCache::FrequencySketch::FrequencySketch()
+    : counters(new std::atomic<uint8_t>[WIDTH * DEPTH]),
+      additions(0) {
+    for (size_t i = 0; i < WIDTH * DEPTH; ++i) {
+        counters[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t SongCache::FrequencySketch::indexOf(size_t hash, size_t row) const {
+    // Derive an independent hash per row from the song's hash
+    uint64_t h = (static_cast<uint64_t>(hash) + (row + 1) * 0x9E3779B97F4A7C15ULL) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+    return row * WIDTH + static_cast<size_t>(h & (WIDTH - 1));
+}
+
+void SongCache::FrequencySketch::increment(size_t hash) {
+    // Racing increments may be lost; the counts are estimates anyway
+    for (size_t row = 0; row < DEPTH; ++row) {
+        std::atomic<uint8_t>& counter = counters[indexOf(hash, row)];
+        uint8_t count = counter.load(std::memory_order_relaxed);
+        if (count < MAX_COUNT) {
+            counter.store(count + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Halve all counts every 10 * WIDTH requests so popularity decays
+    if (additions.fetch_add(1, std::memory_order_relaxed) + 1 == 10 * WIDTH) {
+        additions.store(0, std::memory_order_relaxed);
+        age();
+    }
+}
+
+unsigned SongCache::FrequencySketch::frequency(size_t hash) const {
+    unsigned minimum = MAX_COUNT;
+    for (size_t row = 0; row < DEPTH; ++row) {
+        unsigned count = counters[indexOf(hash, row)].load(std::memory_order_relaxed);
+        if (count < minimum) {
+            minimum = count;
+        }
+    }
+    return minimum;
+}
+
+void SongCache::FrequencySketch::age() {
+    for (size_t i = 0; i < WIDTH * DEPTH; ++i) {
+        counters[i].store(counters[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+}
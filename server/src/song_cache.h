@@ -0,0 +1,132 @@
+#ifndef SONG_CACHE_H
+#define SONG_CACHE_H
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../../common/include/track_id.h"
+#include "server_stats.h"
+#include "wav_file.h"
+
+// Concurrent cache of loaded songs shared by all reactor threads.
+// Entries are spread over independently locked shards, so lookups for
+// different songs never contend on one lock. Loading is single-flight and
+// asynchronous: the first miss on a song starts the loader, and requests for
+// the same song meanwhile queue a callback on that load instead of reading
+// the file again. Songs are keyed by track ID, which is already a
+// well-mixed hash, so lookups neither hash nor compare strings.
+//
+// With a byte budget or a song limit, inserts evict the least recently
+// used song that no stream holds a reference to (a song is pinned while anyone besides the
+// cache holds it). Each shard keeps its resident songs in LRU order, so
+// finding the victim only compares the shards' oldest unpinned songs. A
+// TinyLFU admission filter keeps scans from flushing the cache: a newly
+// loaded song only displaces a victim it has been requested at least as
+// often as, otherwise the new song is served uncached.
+class SongCache {
+public:
+    // Receives a loaded song, or nullptr if loading failed
+    using Callback = std::function<void(std::shared_ptr<WavFile>)>;
+
+    // Starts loading a track and calls 'done' when it finishes (possibly
+    // before returning)
+    using Loader = std::function<void(TrackId, Callback done)>;
+
+    // capacityBytes = 0 and songLimit = 0 keep every loaded song resident.
+    // Each resident song holds its file open, so the limit bounds descriptors
+    // even when memory is not budgeted.
+    SongCache(Loader songLoader, size_t capacityBytes = 0, size_t songLimit = 0);
+
+    SongCache(const SongCache&) = delete;
+    SongCache& operator=(const SongCache&) = delete;
+
+    // Return the cached song right away. Otherwise start (or join) its load
+    // and return nullptr; 'done' then runs on the loading thread. Failed
+    // loads are not cached, so a later request retries.
+    std::shared_ptr<WavFile> lookup(TrackId trackId, Callback done);
+
+    // Return the cached song, waiting for it to load if necessary
+    std::shared_ptr<WavFile> get(TrackId trackId);
+
+    // Check if a song is loaded or being loaded
+    bool contains(TrackId trackId) const;
+
+    // Forget songs whose files changed or went away, so the next request
+    // loads them again. Streams holding a dropped song keep it. A load
+    // already in flight still answers its waiters but is not cached.
+    void invalidate(const std::vector<TrackId>& trackIds);
+
+    // Hit, miss, eviction and residency counters
+    const CacheStats& getStats() const;
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    struct Entry {
+        std::shared_ptr<WavFile> song;  // Null while loading
+        std::vector<Callback> waiters;  // Requests waiting for the load
+        size_t bytes;                   // Memory held once admitted (0 until then)
+        uint64_t lastAccess;            // Access tick, to compare the shards' LRU songs
+        std::list<TrackId>::iterator position;  // In the shard's LRU order, once admitted
+        bool stale;                     // Invalidated before it was admitted
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<TrackId, Entry> songs;
+        std::list<TrackId> order;  // Resident songs, most recently used first
+    };
+
+    // Approximate per-song request counts (count-min sketch of 4-bit
+    // counters, halved periodically so old popularity fades). Updated with
+    // relaxed atomics, so recording a request never takes a lock.
+    class FrequencySketch {
+    public:
+        FrequencySketch();
+        void increment(size_t hash);
+        unsigned frequency(size_t hash) const;
+
+    private:
+        static const size_t WIDTH = 4096;  // Counters per row (power of two)
+        static const size_t DEPTH = 4;
+        static const unsigned MAX_COUNT = 15;
+
+        std::unique_ptr<std::atomic<uint8_t>[]> counters;
+        std::atomic<size_t> additions;
+
+        size_t indexOf(size_t hash, size_t row) const;
+        void age();
+    };
+
+    Loader loader;
+    size_t capacity;
+    size_t maxSongs;
+    Shard shards[SHARD_COUNT];
+    FrequencySketch sketch;
+    std::atomic<uint64_t> accessClock;
+    std::mutex evictionMutex;  // Serializes budget enforcement, never taken on hits
+    CacheStats stats;
+
+    Shard& shardFor(TrackId trackId);
+    const Shard& shardFor(TrackId trackId) const;
+
+    // Publish a finished load and wake the requests waiting for it
+    void finishLoad(TrackId trackId, std::shared_ptr<WavFile> song);
+
+    // Account for a newly loaded song and evict until back under budget
+    // and the song limit
+    void admit(TrackId trackId, size_t bytes);
+
+    // Find the least recently used unpinned song other than 'exclude'
+    bool findVictim(TrackId exclude, TrackId& victim);
+
+    // Drop a resident song from the cache; returns the bytes released
+    size_t remove(TrackId trackId);
+};
+
+#endif // SONG_CACHE_H
@@ -0,0 +1,379 @@
+#include "song_catalog.h"
+#include "../../common/include/catalog_sync.h"
+#include "../../common/include/wire_codec.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+// Image layout (native byte order, sections 8-byte aligned):
+//   ImageHeader
+//   records   songCount x CatalogRecord, sorted by name
+//   slots     slotCount x uint32_t: position + 1, 0 = empty, hashed by track ID
+//   list      LIST_RESPONSE payload: count, then length-prefixed names
+//   snapshot  LIST_SNAPSHOT payload: version, count, front-coded names
+struct ImageHeader {
+    uint64_t songCount;
+    uint64_t slotCount;
+    uint64_t recordsOffset;
+    uint64_t slotsOffset;
+    uint64_t listOffset;
+    uint64_t listSize;
+    uint64_t version;
+    uint64_t snapshotOffset;
+    uint64_t snapshotSize;
+};
+
+struct CatalogRecord {
+    uint64_t trackId;         // trackIdOf(name)
+    uint64_t nameOffset;      // Into the image (inside the list payload)
+    uint32_t nameLength;
+    uint16_t audioFormat;
+    uint16_t channels;
+    uint64_t fileSize;
+    int64_t modifiedNanos;
+    uint32_t sampleRate;
+    uint32_t dataSize;
+    uint16_t bitsPerSample;
+    uint16_t reserved[3];
+};
+
+static_assert(sizeof(ImageHeader) == 72, "catalog image header layout changed");
+static_assert(sizeof(CatalogRecord) == 56, "catalog record layout changed");
+
+static size_t alignTo8(size_t offset) {
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+double SongFormat::getDurationInSeconds() const {
+    double bytesPerSecond = static_cast<double>(sampleRate) * channels * (bitsPerSample / 8);
+    if (bytesPerSecond == 0) {
+        return 0.0;
+    }
+    return dataSize / bytesPerSecond;
+}
+
+SongCatalog::SongCatalog(std::vector<SongInfo> songs) {
+    auto byName = [](const SongInfo& a, const SongInfo& b) { return a.name < b.name; };
+    auto sameName = [](const SongInfo& a, const SongInfo& b) { return a.name == b.name; };
+    std::sort(songs.begin(), songs.end(), byName);
+    songs.erase(std::unique(songs.begin(), songs.end(), sameName), songs.end());
+
+    std::vector<Entry> entries;
+    entries.reserve(songs.size());
+    for (const auto& song : songs) {
+        entries.push_back(Entry{song.name, song.format, song.stamp});
+    }
+    build(entries);
+}
+
+std::shared_ptr<const SongCatalog> SongCatalog::withChanges(const SongCatalog& base, std::vector<SongInfo> upserts,
+                                                            const std::vector<std::string>& removed,
+                                                            const std::vector<std::string>& removedDirectories) {
+    auto byName = [](const SongInfo& a, const SongInfo& b) { return a.name < b.name; };
+    std::sort(upserts.begin(), upserts.end(), byName);
+    std::unordered_set<std::string_view> removedNames(removed.begin(), removed.end());
+
+    auto isRemoved = [&](std::string_view name) {
+        if (removedNames.count(name) != 0) {
+            return true;
+        }
+        for (const auto& directory : removedDirectories) {
+            if (name.size() > directory.size() && name[directory.size()] == '/' &&
+                name.compare(0, directory.size(), directory) == 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Both inputs are sorted, so one merge pass keeps the result sorted
+    std::vector<Entry> entries;
+    entries.reserve(base.size() + upserts.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < base.size() || j < upserts.size()) {
+        std::string_view baseName = i < base.size() ? base.getName(i) : std::string_view();
+        if (j < upserts.size() && (i >= base.size() || upserts[j].name <= baseName)) {
+            if (i < base.size() && upserts[j].name == baseName) {
+                ++i;  // Replaced
+            }
+            // Later duplicates of a name win
+            if (!entries.empty() && entries.back().name == upserts[j].name) {
+                entries.pop_back();
+            }
+            entries.push_back(Entry{upserts[j].name, upserts[j].format, upserts[j].stamp});
+            ++j;
+            continue;
+        }
+        if (!isRemoved(baseName)) {
+            entries.push_back(Entry{baseName, base.getFormat(i), base.getStamp(i)});
+        }
+        ++i;
+    }
+
+    std::shared_ptr<SongCatalog> catalog(new SongCatalog());
+    catalog->build(entries);
+    return catalog;
+}
+
+void SongCatalog::build(const std::vector<Entry>& entries) {
+    // Power-of-two table at most half full keeps probe runs short
+    size_t slotCount = 16;
+    while (slotCount < 2 * entries.size()) {
+        slotCount *= 2;
+    }
+
+    size_t listSize = 4;
+    std::vector<char> frontCoded;
+    FrontCoder coder(frontCoded);
+    for (const auto& entry : entries) {
+        listSize += 4 + entry.name.size();
+        coder.append(entry.name);
+    }
+
+    ImageHeader header;
+    header.songCount = entries.size();
+    header.slotCount = slotCount;
+    header.recordsOffset = sizeof(ImageHeader);
+    header.slotsOffset = header.recordsOffset + entries.size() * sizeof(CatalogRecord);
+    header.listOffset = alignTo8(header.slotsOffset + slotCount * sizeof(uint32_t));
+    header.listSize = listSize;
+    header.snapshotOffset = alignTo8(header.listOffset + listSize);
+    header.snapshotSize = ListSnapshotMessage::MIN_SIZE + frontCoded.size();
+
+    imageSize = header.snapshotOffset + header.snapshotSize;
+    char* buffer = new char[imageSize]();
+
+    // The list payload holds the names; records point at them
+    char* list = buffer + header.listOffset;
+    char* slotTable = buffer + header.slotsOffset;
+    uint32_t count = static_cast<uint32_t>(entries.size());
+    wire::storeLE(list, count);
+    size_t listPosition = 4;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const Entry& entry = entries[i];
+        uint32_t length = static_cast<uint32_t>(entry.name.size());
+        wire::storeLE(list + listPosition, length);
+        memcpy(list + listPosition + 4, entry.name.data(), entry.name.size());
+
+        CatalogRecord record;
+        memset(&record, 0, sizeof(record));
+        record.trackId = trackIdOf(entry.name);
+        record.nameOffset = header.listOffset + listPosition + 4;
+        record.nameLength = length;
+        record.audioFormat = entry.format.audioFormat;
+        record.channels = entry.format.channels;
+        record.fileSize = entry.stamp.size;
+        record.modifiedNanos = entry.stamp.modifiedNanos;
+        record.sampleRate = entry.format.sampleRate;
+        record.dataSize = entry.format.dataSize;
+        record.bitsPerSample = entry.format.bitsPerSample;
+        memcpy(buffer + header.recordsOffset + i * sizeof(CatalogRecord), &record, sizeof(record));
+        listPosition += 4 + entry.name.size();
+
+        // Track IDs are FNV-1a hashes already, so they index the table as is
+        size_t slot = record.trackId & (slotCount - 1);
+        uint32_t value;
+        memcpy(&value, slotTable + slot * sizeof(uint32_t), sizeof(value));
+        while (value != 0) {
+            CatalogRecord other;
+            memcpy(&other, buffer + header.recordsOffset + (value - 1) * sizeof(CatalogRecord), sizeof(other));
+            if (other.trackId == record.trackId) {
+                std::cerr << "Track ID collision: " << entry.name << " has the ID of "
+                          << entries[value - 1].name << "; rename one to play it" << std::endl;
+            }
+            slot = (slot + 1) & (slotCount - 1);
+            memcpy(&value, slotTable + slot * sizeof(uint32_t), sizeof(value));
+        }
+        value = static_cast<uint32_t>(i + 1);
+        memcpy(slotTable + slot * sizeof(uint32_t), &value, sizeof(value));
+    }
+
+    // The version names the list contents, so it follows the list
+    header.version = listVersion(std::string_view(list, listSize));
+    memcpy(buffer, &header, sizeof(header));
+
+    ListSnapshotMessage::encodePayload(buffer + header.snapshotOffset, header.version, count,
+                                       std::string_view(frontCoded.data(), frontCoded.size()));
+
+    // Entries may view the old image, so the new one is only installed now
+    image.reset(buffer, std::default_delete<char[]>());
+    attach();
+}
+
+std::shared_ptr<const SongCatalog> SongCatalog::fromImage(std::shared_ptr<const char> image, size_t size) {
+    std::shared_ptr<SongCatalog> catalog(new SongCatalog());
+    catalog->image = std::move(image);
+    catalog->imageSize = size;
+    if (!catalog->attach()) {
+        return nullptr;
+    }
+    return catalog;
+}
+
+bool SongCatalog::attach() {
+    if (imageSize < sizeof(ImageHeader)) {
+        return false;
+    }
+    ImageHeader header;
+    memcpy(&header, image.get(), sizeof(header));
+
+    // Every section must lie inside the image; names are checked per access
+    bool valid = header.songCount < UINT32_MAX &&
+                 header.slotCount > 0 && (header.slotCount & (header.slotCount - 1)) == 0 &&
+                 header.recordsOffset <= imageSize &&
+                 header.songCount <= (imageSize - header.recordsOffset) / sizeof(CatalogRecord) &&
+                 header.slotsOffset <= imageSize &&
+                 header.slotCount <= (imageSize - header.slotsOffset) / sizeof(uint32_t) &&
+                 header.listOffset <= imageSize &&
+                 header.listSize <= imageSize - header.listOffset &&
+                 header.snapshotOffset <= imageSize &&
+                 header.snapshotSize <= imageSize - header.snapshotOffset &&
+                 header.snapshotSize >= ListSnapshotMessage::MIN_SIZE;
+    if (!valid) {
+        return false;
+    }
+
+    songCount = header.songCount;
+    slotMask = header.slotCount - 1;
+    records = image.get() + header.recordsOffset;
+    slots = image.get() + header.slotsOffset;
+    listPayload = std::string_view(image.get() + header.listOffset, header.listSize);
+    snapshotPayload = std::string_view(image.get() + header.snapshotOffset, header.snapshotSize);
+    version = header.version;
+    return true;
+}
+
+size_t SongCatalog::size() const {
+    return songCount;
+}
+
+std::string_view SongCatalog::getName(size_t index) const {
+    CatalogRecord record;
+    memcpy(&record, records + index * sizeof(CatalogRecord), sizeof(record));
+    if (record.nameOffset > imageSize || record.nameLength > imageSize - record.nameOffset) {
+        return std::string_view();
+    }
+    return std::string_view(image.get() + record.nameOffset, record.nameLength);
+}
+
+SongFormat SongCatalog::getFormat(size_t index) const {
+    CatalogRecord record;
+    memcpy(&record, records + index * sizeof(CatalogRecord), sizeof(record));
+
+    SongFormat format;
+    format.audioFormat = record.audioFormat;
+    format.channels = record.channels;
+    format.sampleRate = record.sampleRate;
+    format.bitsPerSample = record.bitsPerSample;
+    format.dataSize = record.dataSize;
+    return format;
+}
+
+FileStamp SongCatalog::getStamp(size_t index) const {
+    CatalogRecord record;
+    memcpy(&record, records + index * sizeof(CatalogRecord), sizeof(record));
+
+    FileStamp stamp;
+    stamp.size = record.fileSize;
+    stamp.modifiedNanos = record.modifiedNanos;
+    return stamp;
+}
+
+TrackId SongCatalog::getTrackId(size_t index) const {
+    TrackId trackId;
+    memcpy(&trackId, records + index * sizeof(CatalogRecord) + offsetof(CatalogRecord, trackId), sizeof(trackId));
+    return trackId;
+}
+
+size_t SongCatalog::probe(TrackId trackId, const std::string_view* songName) const {
+    size_t slot = trackId & slotMask;
+    // Bounded by the table size in case a loaded image has no empty slot
+    for (size_t probes = 0; probes <= slotMask; ++probes) {
+        uint32_t value;
+        memcpy(&value, slots + slot * sizeof(uint32_t), sizeof(value));
+        if (value == 0) {
+            break;
+        }
+        size_t index = value - 1;
+        // Compare IDs first; names only on a match, to rule out a collision
+        if (index < songCount && getTrackId(index) == trackId &&
+            (songName == nullptr || getName(index) == *songName)) {
+            return index;
+        }
+        slot = (slot + 1) & slotMask;
+    }
+    return NOT_FOUND;
+}
+
+size_t SongCatalog::find(std::string_view songName) const {
+    return probe(trackIdOf(songName), &songName);
+}
+
+size_t SongCatalog::findTrack(TrackId trackId) const {
+    return probe(trackId, nullptr);
+}
+
+size_t SongCatalog::lowerBound(std::string_view name) const {
+    size_t low = 0;
+    size_t high = songCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (getName(middle) < name) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool SongCatalog::contains(std::string_view songName) const {
+    return find(songName) != NOT_FOUND;
+}
+
+bool SongCatalog::sameSongs(const SongCatalog& other) const {
+    if (songCount != other.songCount) {
+        return false;
+    }
+    for (size_t i = 0; i < songCount; ++i) {
+        if (getName(i) != other.getName(i) || !(getStamp(i) == other.getStamp(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<TrackId> SongCatalog::changedTracks(const SongCatalog& next) const {
+    std::vector<TrackId> changed;
+    size_t j = 0;
+    for (size_t i = 0; i < songCount; ++i) {
+        std::string_view name = getName(i);
+        while (j < next.songCount && next.getName(j) < name) {
+            ++j;  // Added in 'next'
+        }
+        if (j == next.songCount || next.getName(j) != name || !(next.getStamp(j) == getStamp(i))) {
+            changed.push_back(getTrackId(i));
+        }
+    }
+    return changed;
+}
+
+std::string_view SongCatalog::getListPayload() const {
+    return listPayload;
+}
+
+uint64_t SongCatalog::getVersion() const {
+    return version;
+}
+
+std::string_view SongCatalog::getSnapshotPayload() const {
+    return snapshotPayload;
+}
+
+std::string_view SongCatalog::getImage() const {
+    return std::string_view(image.get(), imageSize);
+}
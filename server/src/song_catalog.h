@@ -0,0 +1,152 @@
+#ifndef SONG_CATALOG_H
+#define SONG_CATALOG_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../../common/include/track_id.h"
+
+// Audio format of a song, read from its header when the library is scanned
+struct SongFormat {
+    uint16_t audioFormat = 0;    // 1 = PCM
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitsPerSample = 0;
+    uint32_t dataSize = 0;       // Bytes of audio in the data chunk
+
+    double getDurationInSeconds() const;
+};
+
+// Size and modification time of a song file, used to tell whether a song
+// changed since it was last probed
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t modifiedNanos = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && modifiedNanos == other.modifiedNanos;
+    }
+};
+
+// A song found by a scan: its path relative to the library, its format and
+// the file stamp it was probed at
+struct SongInfo {
+    std::string name;
+    SongFormat format;
+    FileStamp stamp;
+};
+
+// Immutable, sorted set of songs. Everything lives in one contiguous image:
+// a fixed-size record per song (format, file stamp, where its name is), an
+// open-addressing hash table over the names, and the LIST_RESPONSE payload,
+// whose length-prefixed names double as the name storage. Lookups hash the
+// name and probe the table in O(1) without allocating, and list requests
+// send the payload straight out of the image.
+//
+// The image also holds the list front-coded as a LIST_SNAPSHOT payload,
+// stamped with the list's version (see catalog_sync.h).
+//
+// The image has no pointers in it, so it can be written to disk as is and
+// later memory-mapped back (see CatalogIndex) without rebuilding anything.
+class SongCatalog {
+public:
+    // Returned by find() for names not in the catalog
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    // Build from unordered scan results; duplicate names are dropped
+    explicit SongCatalog(std::vector<SongInfo> songs);
+
+    // Adopt an image previously taken from getImage(), for example from a
+    // mapped file. Only the section bounds are checked up front, so this
+    // is O(1); each access is bounds-checked. nullptr if the image is
+    // malformed.
+    static std::shared_ptr<const SongCatalog> fromImage(std::shared_ptr<const char> image, size_t size);
+
+    // A copy of 'base' with songs added or replaced by 'upserts' and with
+    // the songs in 'removed' and under 'removedDirectories' taken out.
+    // Merges in one pass over the sorted base instead of re-sorting it.
+    static std::shared_ptr<const SongCatalog> withChanges(const SongCatalog& base, std::vector<SongInfo> upserts,
+                                                          const std::vector<std::string>& removed,
+                                                          const std::vector<std::string>& removedDirectories);
+
+    SongCatalog(const SongCatalog&) = delete;
+    SongCatalog& operator=(const SongCatalog&) = delete;
+
+    // Number of songs
+    size_t size() const;
+
+    // Name, format and file stamp of the song at a position in sorted order
+    std::string_view getName(size_t index) const;
+    SongFormat getFormat(size_t index) const;
+    FileStamp getStamp(size_t index) const;
+
+    // Track ID of the song at a position (trackIdOf(getName(index)))
+    TrackId getTrackId(size_t index) const;
+
+    // Position of a name in sorted order, or NOT_FOUND
+    size_t find(std::string_view songName) const;
+
+    // Position of a track by ID, or NOT_FOUND. Integer compares only.
+    size_t findTrack(TrackId trackId) const;
+
+    // Position of the first name not less than 'name' (binary search);
+    // the names starting with a prefix form the range between the lower
+    // bounds of the prefix and of its successor
+    size_t lowerBound(std::string_view name) const;
+
+    // Check if a song is in the catalog
+    bool contains(std::string_view songName) const;
+
+    // Check if both catalogs hold the same songs with the same file stamps
+    bool sameSongs(const SongCatalog& other) const;
+
+    // Track IDs of the songs 'next' drops or holds with a different file
+    // stamp (rewritten on disk). One merge pass over both sorted catalogs.
+    std::vector<TrackId> changedTracks(const SongCatalog& next) const;
+
+    // The names serialized as a LIST_RESPONSE payload, inside the image
+    // (valid while the catalog lives)
+    std::string_view getListPayload() const;
+
+    // Version of the song list: equal for catalogs with the same names
+    uint64_t getVersion() const;
+
+    // The names as a LIST_SNAPSHOT payload, inside the image
+    std::string_view getSnapshotPayload() const;
+
+    // The whole image, for persisting
+    std::string_view getImage() const;
+
+private:
+    // A song to write into a new image; the name is not owned
+    struct Entry {
+        std::string_view name;
+        SongFormat format;
+        FileStamp stamp;
+    };
+
+    SongCatalog() = default;
+
+    // Lay out the image for entries already sorted by name and unique
+    void build(const std::vector<Entry>& entries);
+
+    std::shared_ptr<const char> image;
+    size_t imageSize = 0;
+    size_t songCount = 0;
+    size_t slotMask = 0;
+    const char* records = nullptr;
+    const char* slots = nullptr;
+    std::string_view listPayload;
+    std::string_view snapshotPayload;
+    uint64_t version = 0;
+
+    // Locate the sections from the image header; false if out of bounds
+    bool attach();
+
+    // Hash table probe for 'trackId'; with 'songName', the name must match too
+    size_t probe(TrackId trackId, const std::string_view* songName) const;
+};
+
+#endif // SONG_CATALOG_H
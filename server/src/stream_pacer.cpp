@@ -0,0 +1,102 @@
+#include "stream_pacer.h"
+#include <algorithm>
+#include <limits>
+
+// Top-ups are sent in steps of this much playback time
+const double PACE_QUANTUM_SECONDS = 0.25;
+
+StreamPacer::StreamPacer()
+    : active(false), paused(false), bytesPerSecond(0), leadBytes(0), quantum(1), blockAlign(1) {
+}
+
+void StreamPacer::start(uint32_t byteRate, uint16_t frameSize, double leadSeconds,
+                        double rateFactor, Clock::time_point now) {
+    if (byteRate == 0 || leadSeconds < 0 || rateFactor <= 0) {
+        disable();
+        return;
+    }
+
+    active = true;
+    startTime = now;
+    paused = false;
+    bytesPerSecond = byteRate * rateFactor;
+    blockAlign = std::max<size_t>(1, frameSize);
+    leadBytes = static_cast<size_t>(leadSeconds * byteRate);
+    quantum = std::max(blockAlign, static_cast<size_t>(PACE_QUANTUM_SECONDS * byteRate));
+}
+
+void StreamPacer::disable() {
+    active = false;
+}
+
+bool StreamPacer::enabled() const {
+    return active;
+}
+
+void StreamPacer::pause(Clock::time_point now) {
+    if (!paused) {
+        paused = true;
+        pausedAt = now;
+    }
+}
+
+void StreamPacer::resume(Clock::time_point now) {
+    if (paused) {
+        // Shift the start so the paused time does not count
+        startTime += now - pausedAt;
+        paused = false;
+    }
+}
+
+size_t StreamPacer::allowance(Clock::time_point now) const {
+    if (!active) {
+        return std::numeric_limits<size_t>::max();
+    }
+    if (paused) {
+        now = pausedAt;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - startTime).count();
+    return leadBytes + static_cast<size_t>(std::max(0.0, elapsed) * bytesPerSecond);
+}
+
+size_t StreamPacer::nextChunk(size_t sentBytes, size_t remainingBytes, size_t maxChunk,
+                              Clock::time_point now) const {
+    size_t limit = std::min(remainingBytes, maxChunk);
+    if (!active) {
+        return limit;
+    }
+
+    size_t allowed = allowance(now);
+    size_t available = allowed > sentBytes ? allowed - sentBytes : 0;
+
+    // Wait for a full quantum unless this is the tail of the song
+    if (available < std::min(quantum, remainingBytes)) {
+        return 0;
+    }
+
+    size_t chunk = std::min(limit, available);
+    if (chunk < remainingBytes) {
+        chunk -= chunk % blockAlign;
+    }
+    return chunk;
+}
+
+StreamPacer::Clock::time_point StreamPacer::nextSendTime(size_t sentBytes, size_t remainingBytes) const {
+    if (!active) {
+        return Clock::time_point::min();
+    }
+    if (paused) {
+        return Clock::time_point::max();
+    }
+
+    // Solve allowance(t) >= sentBytes + step for t
+    size_t target = sentBytes + std::min(quantum, remainingBytes);
+    if (target <= leadBytes) {
+        return startTime;
+    }
+
+    // One extra byte and rounding up keep float error from waking us early
+    double seconds = (target + 1 - leadBytes) / bytesPerSecond;
+    return startTime + std::chrono::ceil<Clock::duration>(std::chrono::duration<double>(seconds));
+}
@@ -0,0 +1,56 @@
+#ifndef STREAM_PACER_H
+#define STREAM_PACER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Playback-rate pacing for one song stream. The first 'leadSeconds' of audio
+// may be sent immediately so the client can start and ride out jitter; after
+// that the allowance grows at the song's byte rate (times 'rateFactor'), so a
+// listener costs roughly its playback bitrate instead of the link speed.
+// The allowance follows the listener's playhead: it stops growing while
+// playback is paused and picks up where it left off on resume.
+class StreamPacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StreamPacer();
+
+    // Begin pacing a stream; a zero byte rate or lead < 0 disables pacing
+    void start(uint32_t byteRate, uint16_t frameSize, double leadSeconds,
+               double rateFactor, Clock::time_point now);
+
+    // Let the stream send as fast as the socket drains
+    void disable();
+
+    // Check if pacing limits this stream
+    bool enabled() const;
+
+    // Freeze the allowance while the listener is paused, and let it grow
+    // again from where it stopped
+    void pause(Clock::time_point now);
+    void resume(Clock::time_point now);
+
+    // Total bytes the stream may have sent by 'now'
+    size_t allowance(Clock::time_point now) const;
+
+    // Size of the next chunk to send (0 means wait until nextSendTime())
+    size_t nextChunk(size_t sentBytes, size_t remainingBytes, size_t maxChunk,
+                     Clock::time_point now) const;
+
+    // Time at which the next chunk becomes available
+    Clock::time_point nextSendTime(size_t sentBytes, size_t remainingBytes) const;
+
+private:
+    bool active;
+    Clock::time_point startTime;
+    bool paused;
+    Clock::time_point pausedAt;
+    double bytesPerSecond;
+    size_t leadBytes;
+    size_t quantum;     // Smallest top-up worth a send, so timers stay coarse
+    size_t blockAlign;  // Chunks end on sample frame boundaries
+};
+
+#endif // STREAM_PACER_H
@@ -1,121 +1,415 @@
 #include "wav_file.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../common/include/crc32c.h"
 
-WavFile::WavFile(const std::string& path) : filepath(path) {
+// Audio requested ahead of the first send when a song is mapped or streamed
+const size_t INITIAL_PREFETCH = 1024 * 1024;
+
+// Bytes read by probe(); chunks beyond it are located with extra reads
+const size_t SCAN_PROBE_SIZE = 4096;
+
+// Read exactly 'length' bytes at 'offset'; false on error or end of file
+static bool readFully(int fd, char* buffer, size_t length, size_t offset) {
+    while (length > 0) {
+        ssize_t bytesRead = pread(fd, buffer, length, static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        buffer += bytesRead;
+        length -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
 }
 
-WavFile::~WavFile() {
+WavFile::WavFile(const std::string& path, Backend storage)
+    : filepath(path),
+      backend(storage),
+      mapping(nullptr),
+      mappingSize(0),
+      audioSize(0),
+      fileSize(0),
+      dataOffset(0),
+      fileDescriptor(-1),
+      loaded(false),
+      checksumBlock(CHECKSUM_BLOCK_FRAMES),
+      checksumBlockCount(0) {
 }
 
-bool WavFile::load() {
-    return readWavFile();
+WavFile::~WavFile() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+    if (fileDescriptor != -1) {
+        close(fileDescriptor);
+    }
 }
 
-bool WavFile::readWavFile() {
-    FILE* wavFile = fopen(filepath.c_str(), "rb");
-    if (!wavFile) {
-        std::cerr << "Error: Cannot open file " << filepath << std::endl;
+bool WavFile::load() {
+    if (!openFile()) {
         return false;
     }
     
-    // Read the header
-    if (fread(&header, sizeof(WavHeader), 1, wavFile) != 1) {
+    std::vector<char> prefix(std::min(HEADER_PROBE_SIZE, fileSize));
+    if (!readFully(fileDescriptor, prefix.data(), prefix.size(), 0)) {
         std::cerr << "Error: Cannot read WAV header" << std::endl;
-        fclose(wavFile);
+        return false;
+    }
+    if (!parseHeader(prefix.data(), prefix.size())) {
         return false;
     }
     
-    // Validate the header
-    if (strncmp(header.riff, "RIFF", 4) != 0 ||
-        strncmp(header.wave, "WAVE", 4) != 0 ||
-        strncmp(header.fmt, "fmt ", 4) != 0) {
-        std::cerr << "Error: Invalid WAV format" << std::endl;
-        fclose(wavFile);
+    char* buffer = getLoadBuffer();
+    if (buffer && !readFully(fileDescriptor, buffer, audioSize, dataOffset)) {
+        std::cerr << "Error: Could not read the entire audio data" << std::endl;
         return false;
     }
     
-    // Find data chunk (some WAV files have extra chunks)
-    bool dataChunkFound = false;
-    unsigned int dataChunkSize = 0;
+    completeLoad();
+    return true;
+}
+
+bool WavFile::probe() {
+    if (!openFile()) {
+        return false;
+    }
     
-    // If the header doesn't match a standard WAV header, we need to search for
-    // the data chunk
-    if (strncmp(header.data, "data", 4) != 0) {
-        char chunkId[4];
-        unsigned int chunkSize;
-        
-        // Skip past the format chunk
-        fseek(wavFile, 12 + 8 + header.fmtSize, SEEK_SET);
-        
-        // Search for the data chunk
-        while (fread(chunkId, 1, 4, wavFile) == 4) {
-            fread(&chunkSize, 4, 1, wavFile);
-            
-            if (strncmp(chunkId, "data", 4) == 0) {
-                dataChunkSize = chunkSize;
-                dataChunkFound = true;
-                break;
-            }
-            
-            // Skip to the next chunk
-            fseek(wavFile, chunkSize, SEEK_CUR);
-        }
-    } else {
-        dataChunkFound = true;
-        dataChunkSize = header.dataSize;
+    char prefix[SCAN_PROBE_SIZE];
+    size_t length = std::min(sizeof(prefix), fileSize);
+    bool valid = readFully(fileDescriptor, prefix, length, 0) &&
+                 parseChunks(prefix, length) &&
+                 dataOffset + audioSize <= fileSize;
+    
+    // A scan probes every file in the library; don't hold descriptors open
+    close(fileDescriptor);
+    fileDescriptor = -1;
+    return valid;
+}
+
+bool WavFile::openFile() {
+    fileDescriptor = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        std::cerr << "Error: Cannot open file " << filepath << std::endl;
+        return false;
     }
     
-    if (!dataChunkFound) {
-        std::cerr << "Error: Could not find data chunk in WAV file" << std::endl;
-        fclose(wavFile);
+    struct stat fileInfo;
+    if (fstat(fileDescriptor, &fileInfo) < 0) {
+        std::cerr << "Error: Cannot stat " << filepath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    fileSize = static_cast<size_t>(fileInfo.st_size);
+    return true;
+}
+
+size_t WavFile::getFileSize() const {
+    return fileSize;
+}
+
+bool WavFile::parseHeader(const char* prefix, size_t length) {
+    if (!parseChunks(prefix, length)) {
         return false;
     }
     
-    // Read the audio data
-    audioData.resize(dataChunkSize);
-    if (fread(audioData.data(), 1, dataChunkSize, wavFile) != dataChunkSize) {
+    // Reject a data chunk that runs past the end of the file up front:
+    // segment reads would come up short and touching a mapping raises SIGBUS
+    if (dataOffset + audioSize > fileSize) {
         std::cerr << "Error: Could not read the entire audio data" << std::endl;
-        fclose(wavFile);
         return false;
     }
     
-    fclose(wavFile);
+    if (backend == Backend::MMAP) {
+        return mapAudioData();
+    }
+    
+    if (backend == Backend::HEAP) {
+        // Left uninitialized: the caller overwrites all of it
+        audioBuffer.reset(new char[audioSize]);
+    }
+    return true;
+}
+
+char* WavFile::getLoadBuffer() {
+    return audioBuffer.get();
+}
+
+void WavFile::completeLoad() {
+    if (backend == Backend::HEAP) {
+        audio.data = audioBuffer.get();
+        audio.size = audioSize;
+    } else if (backend == Backend::STREAM) {
+        // Samples stay on disk; tell the kernel they will be read front to back
+#if defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(fileDescriptor, static_cast<off_t>(dataOffset), static_cast<off_t>(audioSize),
+                      POSIX_FADV_SEQUENTIAL);
+#endif
+        prefetch(0, INITIAL_PREFETCH);
+    }
+    
+    // Blocks are checksummed as they are first sent: reading them all here
+    // would fault in a whole mapped song on the disk engine's thread
+    checksumBlock = CHECKSUM_BLOCK_FRAMES * std::max<size_t>(header.blockAlign, 1);
+    checksumBlockCount = (audio.size + checksumBlock - 1) / checksumBlock;
+    blockChecksums.reset(new std::atomic<uint64_t>[checksumBlockCount]);
+    for (size_t i = 0; i < checksumBlockCount; ++i) {
+        blockChecksums[i].store(0, std::memory_order_relaxed);
+    }
+    
+    loaded = audioSize > 0;
     
     std::cout << "Loaded WAV file: " << filepath << std::endl;
     std::cout << "Channels: " << header.numChannels << std::endl;
     std::cout << "Sample rate: " << header.sampleRate << " Hz" << std::endl;
     std::cout << "Bits per sample: " << header.bitsPerSample << std::endl;
-    std::cout << "Duration: " 
-              << static_cast<double>(dataChunkSize) / 
-                 (header.sampleRate * header.numChannels * (header.bitsPerSample / 8))
-              << " seconds" << std::endl;
+    std::cout << "Duration: " << getDurationInSeconds() << " seconds" << std::endl;
+}
+
+bool WavFile::readHeaderBytes(const char* prefix, size_t length, char* dest, size_t size, size_t offset) const {
+    if (offset + size <= length) {
+        memcpy(dest, prefix + offset, size);
+        return true;
+    }
+    // Metadata chunks pushed the data chunk past the probed prefix
+    return readFully(fileDescriptor, dest, size, offset);
+}
+
+bool WavFile::parseChunks(const char* prefix, size_t length) {
+    // RIFF header: "RIFF", size, "WAVE"
+    char riffHeader[12];
+    if (!readHeaderBytes(prefix, length, riffHeader, sizeof(riffHeader), 0)) {
+        std::cerr << "Error: Cannot read WAV header" << std::endl;
+        return false;
+    }
     
+    if (strncmp(riffHeader, "RIFF", 4) != 0 || strncmp(riffHeader + 8, "WAVE", 4) != 0) {
+        std::cerr << "Error: Invalid WAV format" << std::endl;
+        return false;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.riff, "RIFF", 4);
+    memcpy(header.wave, "WAVE", 4);
+    
+    // Walk the chunks; "fmt " must come before "data", anything else
+    // (LIST, fact, cue, ...) is skipped
+    bool formatFound = false;
+    size_t offset = sizeof(riffHeader);
+    while (offset + 8 <= fileSize) {
+        char chunkHeader[8];
+        if (!readHeaderBytes(prefix, length, chunkHeader, sizeof(chunkHeader), offset)) {
+            break;
+        }
+        uint32_t chunkSize;
+        memcpy(&chunkSize, chunkHeader + 4, sizeof(chunkSize));
+        offset += sizeof(chunkHeader);
+        
+        if (strncmp(chunkHeader, "fmt ", 4) == 0) {
+            // Only the PCM fields are needed; extensible formats carry more
+            const size_t pcmFormatSize = 16;
+            if (chunkSize < pcmFormatSize ||
+                !readHeaderBytes(prefix, length, reinterpret_cast<char*>(&header.audioFormat),
+                                 pcmFormatSize, offset)) {
+                std::cerr << "Error: Invalid WAV format" << std::endl;
+                return false;
+            }
+            memcpy(header.fmt, "fmt ", 4);
+            header.fmtSize = pcmFormatSize;
+            formatFound = true;
+        } else if (strncmp(chunkHeader, "data", 4) == 0) {
+            if (!formatFound) {
+                std::cerr << "Error: Invalid WAV format" << std::endl;
+                return false;
+            }
+            memcpy(header.data, "data", 4);
+            header.dataSize = chunkSize;
+            header.fileSize = 36 + chunkSize;
+            dataOffset = offset;
+            audioSize = chunkSize;
+            return true;
+        }
+        
+        // Chunks are padded to an even size
+        offset += chunkSize + (chunkSize & 1);
+    }
+    
+    std::cerr << "Error: Could not find data chunk in WAV file" << std::endl;
+    return false;
+}
+
+bool WavFile::mapAudioData() {
+    mappingSize = fileSize;
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: Cannot map " << filepath << ": " << strerror(errno) << std::endl;
+        mapping = nullptr;
+        return false;
+    }
+    
+    // Songs are streamed front to back: read ahead aggressively and let the
+    // kernel drop pages behind the playhead
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+    
+    audio.data = static_cast<const char*>(mapping) + dataOffset;
+    audio.size = audioSize;
+    prefetch(0, INITIAL_PREFETCH);
     return true;
 }
 
+std::shared_ptr<const std::vector<char>> WavFile::readSegment(size_t offset, size_t length) const {
+    if (offset >= audioSize) {
+        return nullptr;
+    }
+    length = std::min(length, audioSize - offset);
+    
+    if (!audio.empty()) {
+        return std::make_shared<const std::vector<char>>(audio.data + offset, audio.data + offset + length);
+    }
+    
+    auto segment = std::make_shared<std::vector<char>>(length);
+    if (!readFully(fileDescriptor, segment->data(), length, dataOffset + offset)) {
+        std::cerr << "Error: Could not read audio data from " << filepath << std::endl;
+        return nullptr;
+    }
+    return segment;
+}
+
+void WavFile::prefetch(size_t offset, size_t length) const {
+    if (backend == Backend::HEAP || offset >= audioSize) {
+        return;
+    }
+    
+    size_t start = dataOffset + offset;
+    size_t end = dataOffset + std::min(audioSize, offset + length);
+    
+    if (mapping) {
+        // madvise needs a page-aligned start
+        size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t alignedStart = start - start % pageSize;
+        madvise(static_cast<char*>(mapping) + alignedStart, end - alignedStart, MADV_WILLNEED);
+        return;
+    }
+    
+    // Start an asynchronous read into the page cache
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fileDescriptor, static_cast<off_t>(start), static_cast<off_t>(end - start),
+                  POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct radvisory advice;
+    advice.ra_offset = static_cast<off_t>(start);
+    advice.ra_count = static_cast<int>(end - start);
+    fcntl(fileDescriptor, F_RDADVISE, &advice);
+#endif
+}
+
+void WavFile::fileChanged() {
+    struct stat fileInfo;
+    if (!mapping || fstat(fileDescriptor, &fileInfo) < 0) {
+        return;
+    }
+    
+    // Pages holding any byte of the file still read fine; only whole pages
+    // past the end fault
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t valid = (static_cast<size_t>(fileInfo.st_size) + pageSize - 1) / pageSize * pageSize;
+    if (valid >= mappingSize) {
+        return;
+    }
+    void* tail = mmap(static_cast<char*>(mapping) + valid, mappingSize - valid, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (tail == MAP_FAILED) {
+        std::cerr << "Error: Cannot unmap the truncated end of " << filepath << ": " << strerror(errno) << std::endl;
+    }
+}
+
 bool WavFile::isLoaded() const {
-    return !audioData.empty();
+    return loaded;
 }
 
 const WavHeader& WavFile::getHeader() const {
     return header;
 }
 
-const std::vector<char>& WavFile::getAudioData() const {
-    return audioData;
+AudioSpan WavFile::getAudioData() const {
+    return audio;
+}
+
+size_t WavFile::getAudioSize() const {
+    return audioSize;
+}
+
+WavFile::Backend WavFile::getBackend() const {
+    return backend;
+}
+
+size_t WavFile::getMemoryUsage() const {
+    return sizeof(WavHeader) + audio.size;
+}
+
+uint32_t WavFile::checksum(size_t offset, size_t length) const {
+    size_t end = offset + length;
+    size_t position = std::min(end, (offset + checksumBlock - 1) / checksumBlock * checksumBlock);
+    uint32_t crc = crc32c::compute(audio.data + offset, position - offset);
+    while (position < end) {
+        size_t block = position / checksumBlock;
+        size_t blockEnd = std::min(position + checksumBlock, audio.size);
+        if (blockEnd > end || block >= checksumBlockCount) {
+            // Ends inside this block
+            return crc32c::extend(crc, audio.data + position, end - position);
+        }
+        crc = crc32c::combine(crc, blockChecksum(block), blockEnd - position);
+        position = blockEnd;
+    }
+    return crc;
+}
+
+uint32_t WavFile::blockChecksum(size_t block) const {
+    // Threads racing on a block compute the same CRC, so the entry needs no
+    // lock and either store wins
+    uint64_t entry = blockChecksums[block].load(std::memory_order_relaxed);
+    if (!(entry & CHECKSUM_KNOWN)) {
+        size_t offset = block * checksumBlock;
+        size_t length = std::min(checksumBlock, audio.size - offset);
+        entry = CHECKSUM_KNOWN | crc32c::compute(audio.data + offset, length);
+        blockChecksums[block].store(entry, std::memory_order_relaxed);
+    }
+    return static_cast<uint32_t>(entry);
+}
+
+size_t WavFile::getChecksumBlockSize() const {
+    return checksumBlock;
 }
 
 const std::string& WavFile::getFilePath() const {
     return filepath;
 }
 
+size_t WavFile::getDataOffset() const {
+    return dataOffset;
+}
+
+int WavFile::getFileDescriptor() const {
+    return fileDescriptor;
+}
+
 double WavFile::getDurationInSeconds() const {
-    if (audioData.empty()) {
+    if (audioSize == 0) {
         return 0.0;
     }
     
     int bytesPerSecond = 
         header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-    return static_cast<double>(audioData.size()) / bytesPerSecond;
-}
\ No newline at end of file
+    if (bytesPerSecond == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(audioSize) / bytesPerSecond;
+}
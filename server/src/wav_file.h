@@ -1,30 +1,132 @@
 #ifndef WAV_FILE_H
 #define WAV_FILE_H
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include "../../common/include/wav_header.h"
 
+// Read-only view of a song's audio samples, valid while the WavFile lives
+struct AudioSpan {
+    const char* data = nullptr;
+    size_t size = 0;
+    
+    bool empty() const { return size == 0; }
+};
+
 class WavFile {
+public:
+    // Where the audio samples live once loaded
+    enum class Backend {
+        HEAP,   // Copied into a private buffer
+        MMAP,   // Mapped read-only from the file, shared through the page cache
+        STREAM  // Left in the file and read segment by segment as it is sent
+    };
+    
 private:
     std::string filepath;
-    WavHeader header;
-    std::vector<char> audioData;
+    Backend backend;
+    WavHeader header;             // Canonical header describing the data chunk
+    std::unique_ptr<char[]> audioBuffer;  // HEAP backend storage
+    void* mapping;                // MMAP backend: the whole file, mapped read-only
+    size_t mappingSize;
+    AudioSpan audio;              // In-memory samples (empty for STREAM)
+    size_t audioSize;             // Bytes in the data chunk
+    size_t fileSize;
+    size_t dataOffset;            // Byte offset of the data chunk within the file
+    int fileDescriptor;           // Read-only descriptor for sendfile and segment reads
+    bool loaded;
+    size_t checksumBlock;         // Audio bytes per entry of blockChecksums
+    size_t checksumBlockCount;
+    // CRC32C of each block of in-memory audio, with CHECKSUM_KNOWN set once
+    // the block has been checksummed (zero until then)
+    std::unique_ptr<std::atomic<uint64_t>[]> blockChecksums;
+    static constexpr uint64_t CHECKSUM_KNOWN = 1ULL << 32;
+    
+    // Walk the RIFF chunks to find the format and data chunks, reading from
+    // the probed prefix of the file where possible
+    bool parseChunks(const char* prefix, size_t length);
+    bool readHeaderBytes(const char* prefix, size_t length, char* dest, size_t size, size_t offset) const;
     
-    bool readWavFile();
+    // Map the file and point the audio span at its data chunk
+    bool mapAudioData();
+    
+    // CRC32C of a whole block of the grid, checksummed on first use
+    uint32_t blockChecksum(size_t block) const;
     
 public:
-    WavFile(const std::string& path);
+    WavFile(const std::string& path, Backend storage = Backend::HEAP);
     ~WavFile();
     
+    WavFile(const WavFile&) = delete;
+    WavFile& operator=(const WavFile&) = delete;
+    
+    // Bytes read from the start of the file to find the data chunk
+    static constexpr size_t HEADER_PROBE_SIZE = 64 * 1024;
+    
+    // Load synchronously on the calling thread
     bool load();
+    
+    // Read only the RIFF chunk headers to learn the song's format and data
+    // size, then close the file again (used by the library scan)
+    bool probe();
     bool isLoaded() const;
     
+    // Load in steps so the reads can be done asynchronously: openFile(),
+    // parseHeader() with the first HEADER_PROBE_SIZE bytes of the file, then
+    // fill getLoadBuffer() with the data chunk if it is non-null (HEAP only)
+    // and call completeLoad()
+    bool openFile();
+    size_t getFileSize() const;
+    bool parseHeader(const char* prefix, size_t length);
+    char* getLoadBuffer();
+    void completeLoad();
+    
     const WavHeader& getHeader() const;
-    const std::vector<char>& getAudioData() const;
+    
+    // Audio samples of the data chunk (heap buffer or file mapping; empty
+    // for the STREAM backend, which reads them with readSegment)
+    AudioSpan getAudioData() const;
+    size_t getAudioSize() const;
+    Backend getBackend() const;
+    
+    // Memory the song keeps resident (samples held in the heap or mapped)
+    size_t getMemoryUsage() const;
+    
+    // Sample frames per block of the checksum grid
+    static constexpr size_t CHECKSUM_BLOCK_FRAMES = 1024;
+    
+    // CRC32C of the in-memory audio in [offset, offset + length). Each
+    // whole block of the grid is checksummed the first time a range covers
+    // it and remembered, so once a song has been sent, a range that ends on
+    // the grid only reads the bytes before its first boundary. Safe to call
+    // from several threads.
+    uint32_t checksum(size_t offset, size_t length) const;
+    
+    // Audio bytes per block of the checksum grid, a whole number of frames
+    size_t getChecksumBlockSize() const;
+    
+    // Read part of the data chunk from the file; returns nullptr on error
+    std::shared_ptr<const std::vector<char>> readSegment(size_t offset, size_t length) const;
+    
+    // Hint that a range of the audio will be read soon, so the kernel can
+    // start reading it ahead of the sender (no-op for the heap backend)
+    void prefetch(size_t offset, size_t length) const;
+    
+    // The file was rewritten after the song was loaded. A mapping is only
+    // valid up to the file's end, so any part of it past the new end is
+    // replaced with zero pages: streams still sending the old song read
+    // silence there instead of faulting (no-op for the other backends).
+    void fileChanged();
+    
     const std::string& getFilePath() const;
     
+    // Location of the audio samples in the file, for sendfile-style streaming
+    size_t getDataOffset() const;
+    int getFileDescriptor() const;
+    
     double getDurationInSeconds() const;
 };
 
-#endif // WAV_FILE_H
\ No newline at end of file
+#endif // WAV_FILE_H
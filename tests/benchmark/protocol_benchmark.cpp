@@ -0,0 +1,148 @@
+// Protocol codec microbenchmark: encodes and decodes the messages of
+// protocol.h in a loop and reports the time and heap allocations per
+// message. Encoding writes into buffers set up before timing starts and
+// decoding reads in place, so every case should allocate nothing; the
+// benchmark fails if one does.
+//
+// Usage: protocol_benchmark [messages]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "../../common/include/protocol.h"
+
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+// Keeps results alive so the work is not optimized away
+static volatile uint64_t sink;
+
+// Run 'body' once per message; returns false if it allocated
+static bool measure(const char* name, size_t messages, const std::function<void(size_t)>& body) {
+    size_t allocationsBefore = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < messages; ++i) {
+        body(i);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t allocated = allocations.load() - allocationsBefore;
+
+    std::cout << name << "  " << (seconds * 1e9) / messages << " ns/message  "
+              << static_cast<double>(allocated) / messages << " allocations/message" << std::endl;
+    return allocated == 0;
+}
+
+int main(int argc, char* argv[]) {
+    size_t messages = argc >= 2 ? std::stoul(argv[1]) : 1000000;
+
+    // A request stream as the server receives it: track and name requests
+    // back to back
+    std::vector<char> requests(64 * 1024);
+    size_t requestBytes = 0;
+    size_t requestCount = 0;
+    while (requestBytes + 64 < requests.size()) {
+        requestBytes += requestCount % 2 == 0
+            ? TrackRequestMessage::encode(requests.data() + requestBytes, requests.size() - requestBytes,
+                                          StreamId(requestCount + 1), trackIdOf(std::to_string(requestCount)),
+                                          uint64_t(requestCount * 4410), uint64_t(0))
+            : SongRequestMessage::encode(requests.data() + requestBytes, requests.size() - requestBytes,
+                                         StreamId(requestCount + 1), std::string_view("Album/Disc 1/03 Track.wav"));
+        requestCount++;
+    }
+
+    // A 100-song list payload
+    std::vector<std::string> names;
+    for (int i = 0; i < 100; ++i) {
+        names.push_back("Artist " + std::to_string(i % 7) + "/Album/" + std::to_string(i) + " Song.wav");
+    }
+    std::vector<char> listPayload = serializeStringList(names);
+    std::vector<char> frame(SongListMessage::frameSize(names));
+
+    std::cout << "Encoding and decoding " << messages << " messages per case" << std::endl;
+    bool ok = true;
+
+    ok &= measure("header encode+decode     ", messages, [](size_t i) {
+        EncodedHeader header = makeMessageHeader(MessageType::SONG_DATA, i);
+        sink = decodeMessageHeader(header.data()).size;
+    });
+
+    ok &= measure("TRACK_REQUEST encode     ", messages, [](size_t i) {
+        char buffer[TrackRequestMessage::FRAME_SIZE];
+        sink = TrackRequestMessage::encode(buffer, sizeof(buffer), StreamId(1), static_cast<TrackId>(i), uint64_t(i),
+                                           uint64_t(0)) + buffer[9];
+    });
+
+    ok &= measure("PLAY_CONTROL round trip  ", messages, [](size_t i) {
+        char buffer[PlayControlMessage::FRAME_SIZE];
+        PlayControlMessage::encode(buffer, sizeof(buffer), StreamId(1), PlayControl::SEEK, i * 0.5);
+        StreamId stream;
+        PlayControl command;
+        double position;
+        PlayControlMessage::decode(std::string_view(buffer + MESSAGE_HEADER_SIZE, sizeof(buffer) - MESSAGE_HEADER_SIZE),
+                                   stream, command, position);
+        sink = static_cast<uint64_t>(position) + static_cast<uint64_t>(command) + stream;
+    });
+
+    // The server's input loop: frame, then decode the request in place
+    size_t position = 0;
+    ok &= measure("request stream decode    ", messages, [&](size_t) {
+        if (position == requestBytes) {
+            position = 0;
+        }
+        MessageHeader header = decodeMessageHeader(requests.data() + position);
+        std::string_view payload(requests.data() + position + MESSAGE_HEADER_SIZE, header.size);
+        position += MESSAGE_HEADER_SIZE + header.size;
+        StreamId stream = NO_STREAM;
+        if (header.type == MessageType::TRACK_REQUEST) {
+            TrackId track = NO_TRACK;
+            uint64_t firstFrame = 0;
+            uint64_t frameCount = 0;
+            TrackRequestMessage::decode(payload, stream, track, firstFrame, frameCount);
+            sink = track + stream + firstFrame;
+        } else {
+            std::string_view name;
+            SongRequestMessage::decode(payload, stream, name);
+            sink = name.size() + stream;
+        }
+    });
+
+    ok &= measure("100-song list encode     ", messages / 100, [&](size_t) {
+        sink = SongListMessage::encode(frame.data(), frame.size(), names);
+    });
+
+    ok &= measure("100-song list decode+walk", messages / 100, [&](size_t) {
+        wire::StringListView songs;
+        SongListMessage::decode(std::string_view(listPayload.data(), listPayload.size()), songs);
+        uint64_t bytes = 0;
+        for (std::string_view name : songs) {
+            bytes += name.size();
+        }
+        sink = bytes;
+    });
+
+    if (!ok) {
+        std::cerr << "Protocol codec allocated on the message path" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Loopback streaming benchmark: sends one song through a real ClientHandler
+// over a TCP loopback connection and reports throughput and sender CPU cost
+// for the writev path (heap-loaded, memory-mapped and streamed songs) and the
+// sendfile path, plus the time each storage backend takes to load the song.
+//
+// Usage: streaming_benchmark [song_megabytes] [iterations] [port]
+
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "client_handler.h"
+#include "event_poller.h"
+#include "music_library.h"
+
+struct RunResult {
+    double seconds;
+    double cpuSeconds;
+    size_t bytes;
+};
+
+static double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write a silent 16-bit stereo 44.1 kHz WAV file with the given data size
+static void createWavFile(const std::string& path, uint32_t dataSize) {
+    WavHeader header;
+    memcpy(header.riff, "RIFF", 4);
+    header.fileSize = 36 + dataSize;
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt, "fmt ", 4);
+    header.fmtSize = 16;
+    header.audioFormat = 1;
+    header.numChannels = 2;
+    header.sampleRate = 44100;
+    header.byteRate = 44100 * 4;
+    header.blockAlign = 4;
+    header.bitsPerSample = 16;
+    memcpy(header.data, "data", 4);
+    header.dataSize = dataSize;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<char> block(1024 * 1024, 0);
+    for (uint32_t written = 0; written < dataSize; written += block.size()) {
+        file.write(block.data(), std::min<size_t>(block.size(), dataSize - written));
+    }
+}
+
+// Receive frames until SONG_DATA_END and return the number of audio bytes
+static size_t drainSong(Socket& socket) {
+    size_t audioBytes = 0;
+    std::vector<char> body;
+
+    while (socket.connected()) {
+        char headerData[MESSAGE_HEADER_SIZE];
+        if (socket.receiveInto(headerData, MESSAGE_HEADER_SIZE) < MESSAGE_HEADER_SIZE) {
+            break;
+        }
+        MessageHeader header = decodeMessageHeader(headerData);
+
+        // Read the payload in place to keep client overhead low
+        body.resize(header.size);
+        if (socket.receiveInto(body.data(), header.size) < header.size) {
+            return audioBytes;
+        }
+
+        if (header.type == MessageType::SONG_DATA) {
+            audioBytes += header.size - (SONG_DATA_PREFIX_SIZE - MESSAGE_HEADER_SIZE);
+        } else if (header.type == MessageType::SONG_DATA_END) {
+            break;
+        }
+    }
+
+    return audioBytes;
+}
+
+static RunResult runOnce(std::shared_ptr<MusicLibrary> library, const std::string& songName,
+                         const StreamConfig& config, int port) {
+    Socket listener;
+    if (!listener.createServer(port)) {
+        exit(1);
+    }
+
+    size_t receivedBytes = 0;
+    std::thread clientThread([&]() {
+        Socket client;
+        if (!client.connectToServer("127.0.0.1", port)) {
+            return;
+        }
+        char request[TrackRequestMessage::FRAME_SIZE];
+        TrackRequestMessage::encode(request, sizeof(request), StreamId(1), trackIdOf(songName), uint64_t(0),
+                                    uint64_t(0));
+        client.send(std::vector<char>(request, request + sizeof(request)));
+        receivedBytes = drainSong(client);
+    });
+
+    std::unique_ptr<Socket> accepted(listener.acceptClient());
+    accepted->setNonBlocking();
+    int fd = accepted->getSocketFd();
+    ClientHandler handler(std::move(accepted), library, config);
+
+    EventPoller poller;
+    poller.add(fd, false);
+    std::vector<EventPoller::Event> events;
+    bool requested = false;
+    bool writeInterest = false;
+
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = threadCpuSeconds();
+
+    // Serve until the request has been handled and all output is written
+    while (!requested || handler.wantsWrite()) {
+        poller.wait(events, 1000);
+        for (const auto& event : events) {
+            bool ok = true;
+            if (event.readable) {
+                ok = handler.onReadable();
+                requested = true;
+            }
+            if (ok && event.writable) {
+                ok = handler.onWritable();
+            }
+            if (!ok) {
+                requested = true;
+                break;
+            }
+        }
+
+        if (handler.wantsWrite() != writeInterest) {
+            writeInterest = !writeInterest;
+            poller.setInterest(fd, true, writeInterest);
+        }
+    }
+
+    double cpuSeconds = threadCpuSeconds() - cpuStart;
+    clientThread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return RunResult{seconds, cpuSeconds, receivedBytes};
+}
+
+int main(int argc, char* argv[]) {
+    size_t songMegabytes = argc >= 2 ? std::stoul(argv[1]) : 128;
+    int iterations = argc >= 3 ? std::stoi(argv[2]) : 5;
+    int port = argc >= 4 ? std::stoi(argv[3]) : 9777;
+
+    std::string dir = (std::filesystem::temp_directory_path() / "streaming_benchmark").string();
+    std::filesystem::create_directories(dir);
+    std::string songName = "bench.wav";
+    createWavFile(dir + "/" + songName, static_cast<uint32_t>(songMegabytes * 1024 * 1024));
+
+    std::cout << "Streaming " << songMegabytes << " MB over loopback, "
+              << iterations << " iterations per mode" << std::endl;
+
+    // Load once per backend so every streaming run starts warm
+    LibraryConfig libraryConfig;
+    libraryConfig.storage = WavFile::Backend::HEAP;
+    auto heapLibrary = std::make_shared<MusicLibrary>(dir, libraryConfig);
+    libraryConfig.storage = WavFile::Backend::MMAP;
+    auto mappedLibrary = std::make_shared<MusicLibrary>(dir, libraryConfig);
+    libraryConfig.storage = WavFile::Backend::STREAM;
+    auto streamedLibrary = std::make_shared<MusicLibrary>(dir, libraryConfig);
+    for (auto library : {heapLibrary, mappedLibrary, streamedLibrary}) {
+        auto start = std::chrono::steady_clock::now();
+        library->getSong(trackIdOf(songName));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        const char* name = library == heapLibrary ? "heap" : (library == mappedLibrary ? "mmap" : "stream");
+        std::cout << name << " load: " << ms << " ms" << std::endl;
+    }
+
+    struct Mode {
+        const char* name;
+        std::shared_ptr<MusicLibrary> library;
+        bool zeroCopy;
+    };
+
+    for (const Mode& mode : {Mode{"writev     ", heapLibrary, false},
+                             Mode{"writev+mmap", mappedLibrary, false},
+                             Mode{"pread      ", streamedLibrary, false},
+                             Mode{"sendfile   ", heapLibrary, true}}) {
+        StreamConfig config;
+        config.zeroCopy = mode.zeroCopy;
+        config.pacing = false;  // Measure raw send cost, not playback-rate pacing
+
+        double totalSeconds = 0;
+        double totalCpu = 0;
+        size_t totalBytes = 0;
+        for (int i = 0; i < iterations; ++i) {
+            RunResult result = runOnce(mode.library, songName, config, port);
+            totalSeconds += result.seconds;
+            totalCpu += result.cpuSeconds;
+            totalBytes += result.bytes;
+        }
+
+        std::cout << mode.name
+                  << "  throughput: " << (totalBytes / totalSeconds) / (1024 * 1024) << " MB/s"
+                  << "  sender CPU: " << (totalCpu * 1e9) / totalBytes << " ns/byte" << std::endl;
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include "adpcm_codec.h"
+#include <cmath>
+#include <vector>
+#include "pcm_codec_test.h"
+
+class AdpcmCodecTest : public PcmCodecTest<adpcm::encodeBlock, adpcm::decode> {
+protected:
+    // Signal-to-noise ratio of 'decoded' against 'pcm', in dB
+    double snr(const std::vector<char>& pcm, const std::vector<char>& decoded) {
+        double signal = 0;
+        double noise = 0;
+        for (size_t i = 0; i + 1 < pcm.size(); i += 2) {
+            double original = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm.data() + i));
+            double error = original - static_cast<int16_t>(wire::loadLE<uint16_t>(decoded.data() + i));
+            signal += original * original;
+            noise += error * error;
+        }
+        return 10 * std::log10(signal / std::max(noise, 1.0));
+    }
+};
+
+TEST_F(AdpcmCodecTest, StereoIsQuarterSizeAndClose) {
+    std::vector<char> pcm = music(44100, 2);
+    size_t encodedSize = 0;
+    std::vector<char> decoded = roundTrip(pcm, 2, 16, &encodedSize);
+    ASSERT_EQ(decoded.size(), pcm.size());
+    EXPECT_LT(encodedSize, pcm.size() / 4 + pcm.size() / 100);
+    EXPECT_GT(snr(pcm, decoded), 25.0);
+}
+
+TEST_F(AdpcmCodecTest, MonoAndShortBlocksKeepTheirLength) {
+    std::vector<char> pcm = music(5000, 1);
+    std::vector<char> decoded = roundTrip(pcm, 1, 16);
+    ASSERT_EQ(decoded.size(), pcm.size());
+    EXPECT_GT(snr(pcm, decoded), 25.0);
+
+    // Every small size, including blocks too short to code and lanes
+    // that end early
+    for (size_t frames = 1; frames < 40; ++frames) {
+        for (uint16_t channels = 1; channels <= 2; ++channels) {
+            std::vector<char> shortPcm = music(frames, channels);
+            ASSERT_EQ(roundTrip(shortPcm, channels, 16).size(), shortPcm.size()) << frames << " frames";
+        }
+    }
+}
+
+TEST_F(AdpcmCodecTest, LaneStartsAreExact) {
+    // Each lane opens with an exact sample: frame 0 of each channel, and
+    // the first frame of each later segment
+    std::vector<char> pcm = music(adpcm::BLOCK_FRAMES, 2);
+    std::vector<char> decoded = roundTrip(pcm, 2, 16);
+    size_t half = adpcm::BLOCK_FRAMES / 2;
+    for (size_t frame : {size_t(0), half}) {
+        for (size_t byte = 0; byte < 4; ++byte) {
+            EXPECT_EQ(decoded[frame * 4 + byte], pcm[frame * 4 + byte]);
+        }
+    }
+}
+
+TEST_F(AdpcmCodecTest, VectorMatchesPortable) {
+    std::vector<char> pcm = music(600, 2);
+    std::vector<int32_t> samples(600 * 2);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = static_cast<int16_t>(wire::loadLE<uint16_t>(pcm.data() + i * 2));
+    }
+    // Full-scale jumps drive the predictor into its clamps
+    samples[400] = 32767;
+    samples[404] = -32768;
+
+    size_t steps = samples.size() / adpcm::LANES - 1;
+    adpcm::detail::Lanes start = {{samples[0], samples[1], samples[2], samples[3]}, {0, 10, 40, 88}};
+    adpcm::detail::Lanes portable = start;
+    adpcm::detail::Lanes vector = start;
+    std::vector<uint8_t> portableCodes(steps * adpcm::LANES);
+    std::vector<uint8_t> vectorCodes(steps * adpcm::LANES);
+    adpcm::detail::encodeLanesPortable(samples.data(), steps, portable, portableCodes.data());
+    adpcm::detail::encodeLanesVector(samples.data(), steps, vector, vectorCodes.data());
+    EXPECT_EQ(vectorCodes, portableCodes);
+
+    std::vector<int32_t> portableOut(samples.size());
+    std::vector<int32_t> vectorOut(samples.size());
+    portable = start;
+    vector = start;
+    adpcm::detail::decodeLanesPortable(portableCodes.data(), steps, portable, portableOut.data());
+    adpcm::detail::decodeLanesVector(portableCodes.data(), steps, vector, vectorOut.data());
+    EXPECT_EQ(vectorOut, portableOut);
+    for (size_t lane = 0; lane < adpcm::LANES; ++lane) {
+        EXPECT_EQ(vector.predictor[lane], portable.predictor[lane]);
+        EXPECT_EQ(vector.index[lane], portable.index[lane]);
+    }
+}
+
+TEST_F(AdpcmCodecTest, OtherFormatsAreStoredVerbatimAndDamageIsRejected) {
+    std::vector<char> eightBit(1000, 7);
+    EXPECT_EQ(roundTrip(eightBit, 1, 8), eightBit);
+
+    std::vector<char> pcm = music(4096, 2);
+    std::vector<char> encoded;
+    adpcm::encodeBlock(pcm.data(), pcm.size(), 2, 16, encoded);
+    std::vector<char> decoded;
+    EXPECT_FALSE(adpcm::decode(encoded.data(), encoded.size() - 1, decoded));
+
+    // A step index past the table
+    std::vector<char> badIndex = encoded;
+    badIndex[10] = static_cast<char>(200);
+    EXPECT_FALSE(adpcm::decode(badIndex.data(), badIndex.size(), decoded));
+
+    // A frame count that does not match the block's size
+    std::vector<char> badFrames = encoded;
+    wire::storeLE(badFrames.data() + 5, static_cast<uint16_t>(1000));
+    EXPECT_FALSE(adpcm::decode(badFrames.data(), badFrames.size(), decoded));
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "catalog_history.h"
+#include "../../common/include/catalog_sync.h"
+
+class CatalogHistoryTest : public ::testing::Test {
+protected:
+    std::shared_ptr<const SongCatalog> catalog(const std::vector<std::string>& names) {
+        std::vector<SongInfo> songs;
+        for (const auto& name : names) {
+            songs.push_back(SongInfo{name, SongFormat(), FileStamp()});
+        }
+        return std::make_shared<const SongCatalog>(std::move(songs));
+    }
+
+    // A list of 'count' padding songs, so small deltas stay under the
+    // snapshot size
+    std::vector<std::string> library(std::vector<std::string> names, int count = 50) {
+        for (int i = 0; i < count; ++i) {
+            names.push_back("library/track" + std::to_string(i) + ".wav");
+        }
+        return names;
+    }
+
+    // Apply the delta from 'from' found in 'history' to 'list'
+    std::vector<std::string> applyDelta(const CatalogHistory& history, const SongCatalog& from,
+                                        const std::vector<std::string>& list, uint64_t& toVersion) {
+        std::string_view payload = history.findDelta(from.getVersion());
+        EXPECT_FALSE(payload.empty());
+        ListDeltaHeader header;
+        std::vector<std::string> removed;
+        std::vector<std::string> added;
+        EXPECT_TRUE(decodeListDelta(payload.data(), payload.size(), header, removed, added));
+        toVersion = header.toVersion;
+        std::vector<std::string> sorted = list;
+        std::sort(sorted.begin(), sorted.end());
+        return applyListDelta(sorted, removed, added);
+    }
+};
+
+TEST_F(CatalogHistoryTest, VersionFollowsNames) {
+    auto first = catalog({"a.wav", "b.wav"});
+    auto same = catalog({"b.wav", "a.wav"});
+    auto other = catalog({"a.wav", "c.wav"});
+
+    EXPECT_EQ(first->getVersion(), same->getVersion());
+    EXPECT_NE(first->getVersion(), other->getVersion());
+    EXPECT_NE(first->getVersion(), NO_LIST_VERSION);
+}
+
+TEST_F(CatalogHistoryTest, ComposesDeltasAcrossVersions) {
+    std::vector<std::string> v1 = library({"a.wav", "b.wav"});
+    std::vector<std::string> v2 = library({"a.wav", "c.wav"});
+    std::vector<std::string> v3 = library({"c.wav", "d.wav", "b.wav"});
+    auto c1 = catalog(v1);
+    auto c2 = catalog(v2);
+    auto c3 = catalog(v3);
+
+    auto h2 = CatalogHistory::advance(nullptr, *c1, *c2);
+    auto h3 = CatalogHistory::advance(h2.get(), *c2, *c3);
+    EXPECT_EQ(h3->size(), 2u);
+
+    // Removed in one step and added back in the next: not in the delta
+    uint64_t toVersion = 0;
+    std::vector<std::string> expected = v3;
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(applyDelta(*h3, *c1, v1, toVersion), expected);
+    EXPECT_EQ(toVersion, c3->getVersion());
+    EXPECT_EQ(applyDelta(*h3, *c2, v2, toVersion), expected);
+    EXPECT_TRUE(h3->findDelta(12345).empty());
+}
+
+TEST_F(CatalogHistoryTest, SnapshotWinsOverLargeDelta) {
+    auto before = catalog({"a.wav"});
+    auto after = catalog({"b.wav", "c.wav", "d.wav"});
+
+    auto history = CatalogHistory::advance(nullptr, *before, *after);
+    EXPECT_TRUE(history->findDelta(before->getVersion()).empty());
+}
+
+TEST_F(CatalogHistoryTest, KeepsHistoryWhenOnlyStampsChange) {
+    auto c1 = catalog(library({"a.wav"}));
+    auto c2 = catalog(library({"b.wav"}));
+    std::vector<SongInfo> restamped = {SongInfo{"b.wav", SongFormat(), FileStamp{1, 2}}};
+    for (const auto& name : library({})) {
+        restamped.push_back(SongInfo{name, SongFormat(), FileStamp()});
+    }
+    auto c3 = std::make_shared<const SongCatalog>(std::move(restamped));
+
+    auto h2 = CatalogHistory::advance(nullptr, *c1, *c2);
+    auto h3 = CatalogHistory::advance(h2.get(), *c2, *c3);
+    EXPECT_EQ(c2->getVersion(), c3->getVersion());
+    EXPECT_FALSE(h3->findDelta(c1->getVersion()).empty());
+}
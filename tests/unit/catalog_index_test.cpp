@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include "catalog_index.h"
+
+class CatalogIndexTest : public ::testing::Test {
+protected:
+    std::string testDir;
+    std::string indexPath;
+
+    void SetUp() override {
+        testDir = "bin/test_data/catalog_index_test";
+        std::filesystem::create_directories(testDir);
+        indexPath = testDir + "/catalog.idx";
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    SongInfo song(const std::string& name, uint32_t sampleRate, uint64_t size) {
+        SongInfo info;
+        info.name = name;
+        info.format.audioFormat = 1;
+        info.format.channels = 2;
+        info.format.sampleRate = sampleRate;
+        info.format.bitsPerSample = 16;
+        info.format.dataSize = static_cast<uint32_t>(size - 44);
+        info.stamp.size = size;
+        info.stamp.modifiedNanos = 1700000000123456789LL;
+        return info;
+    }
+};
+
+TEST_F(CatalogIndexTest, RoundTripsCatalog) {
+    SongCatalog catalog({song("b/two.wav", 48000, 2000), song("a.wav", 44100, 1000)});
+    ASSERT_TRUE(CatalogIndex::save(indexPath, "/music", catalog));
+
+    auto loaded = CatalogIndex::load(indexPath, "/music");
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_TRUE(loaded->sameSongs(catalog));
+    ASSERT_EQ(loaded->size(), 2u);
+    EXPECT_EQ(loaded->getName(0), "a.wav");
+
+    size_t index = loaded->find("b/two.wav");
+    ASSERT_NE(index, SongCatalog::NOT_FOUND);
+    EXPECT_EQ(loaded->getFormat(index).sampleRate, 48000u);
+    EXPECT_EQ(loaded->getFormat(index).dataSize, 1956u);
+    EXPECT_EQ(loaded->getStamp(index).modifiedNanos, 1700000000123456789LL);
+    EXPECT_EQ(loaded->getListPayload(), catalog.getListPayload());
+}
+
+TEST_F(CatalogIndexTest, RejectsMissingForeignOrCorruptIndex) {
+    EXPECT_EQ(CatalogIndex::load(indexPath, "/music"), nullptr);
+
+    SongCatalog catalog({song("a.wav", 44100, 1000)});
+    ASSERT_TRUE(CatalogIndex::save(indexPath, "/music", catalog));
+    EXPECT_EQ(CatalogIndex::load(indexPath, "/other"), nullptr);
+
+    std::filesystem::resize_file(indexPath, std::filesystem::file_size(indexPath) - 1);
+    EXPECT_EQ(CatalogIndex::load(indexPath, "/music"), nullptr);
+
+    std::ofstream(indexPath, std::ios::trunc) << "not an index";
+    EXPECT_EQ(CatalogIndex::load(indexPath, "/music"), nullptr);
+}
+
+TEST_F(CatalogIndexTest, SavesEmptyCatalog) {
+    SongCatalog empty(std::vector<SongInfo>{});
+    ASSERT_TRUE(CatalogIndex::save(indexPath, "/music", empty));
+
+    auto loaded = CatalogIndex::load(indexPath, "/music");
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(loaded->size(), 0u);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "catalog_search.h"
+#include "../../common/include/catalog_query.h"
+
+class CatalogSearchTest : public ::testing::Test {
+protected:
+    std::shared_ptr<const SongCatalog> catalog(const std::vector<std::string>& names) {
+        std::vector<SongInfo> songs;
+        for (const auto& name : names) {
+            SongFormat format;
+            format.audioFormat = 1;
+            format.channels = 2;
+            format.sampleRate = 44100;
+            format.bitsPerSample = 16;
+            format.dataSize = 44100 * 4;    // One second
+            songs.push_back(SongInfo{name, format, FileStamp()});
+        }
+        return std::make_shared<const SongCatalog>(std::move(songs));
+    }
+
+    std::vector<QueryEntry> decode(const std::vector<char>& payload, QueryPageHeader& header) {
+        std::vector<QueryEntry> entries;
+        EXPECT_TRUE(decodeQueryPage(payload.data(), payload.size(), header, entries));
+        return entries;
+    }
+
+    std::vector<std::string> names(const std::vector<QueryEntry>& entries) {
+        std::vector<std::string> result;
+        for (const auto& entry : entries) {
+            result.push_back(entry.name);
+        }
+        return result;
+    }
+};
+
+TEST_F(CatalogSearchTest, MatchesWholeWordsAndLastWordAsPrefix) {
+    auto songs = catalog({"Rock/Highway Star.wav", "Rock/Smoke_on_the_Water.wav", "Jazz/Blue in Green.wav",
+                          "Jazz/So What.wav", "Starlight.wav"});
+    CatalogSearch index(*songs);
+    QueryPageHeader header;
+
+    auto entries = decode(index.search(*songs, "smoke wat", 0, 10), header);
+    ASSERT_EQ(entries.size(), 1u);
+    EXPECT_EQ(entries[0].name, "Rock/Smoke_on_the_Water.wav");
+    EXPECT_EQ(entries[0].kind, QueryEntryKind::SONG);
+    EXPECT_EQ(entries[0].value, 1000u);
+    EXPECT_EQ(header.version, songs->getVersion());
+
+    // Directories match too; only the last word is a prefix
+    EXPECT_EQ(decode(index.search(*songs, "JAZZ", 0, 10), header).size(), 2u);
+    EXPECT_TRUE(decode(index.search(*songs, "smo water", 0, 10), header).empty());
+    // A trailing space asks for the whole word
+    EXPECT_TRUE(decode(index.search(*songs, "wat ", 0, 10), header).empty());
+    EXPECT_TRUE(decode(index.search(*songs, "", 0, 10), header).empty());
+    // The extension is not a word
+    EXPECT_TRUE(decode(index.search(*songs, "wav", 0, 10), header).empty());
+}
+
+TEST_F(CatalogSearchTest, RanksFileNamesAboveDirectories) {
+    auto songs = catalog({"Star/Anthem.wav", "Misc/A Star Is Born.wav", "Starlight.wav", "Misc/Star.wav"});
+    CatalogSearch index(*songs);
+    QueryPageHeader header;
+
+    auto result = names(decode(index.search(*songs, "star", 0, 10), header));
+    // File names starting with the query first, whole words before
+    // prefixes, then file names containing it, then directories
+    std::vector<std::string> expected = {"Misc/Star.wav", "Starlight.wav", "Misc/A Star Is Born.wav",
+                                         "Star/Anthem.wav"};
+    EXPECT_EQ(result, expected);
+}
+
+TEST_F(CatalogSearchTest, PagesResults) {
+    std::vector<std::string> list;
+    for (int i = 0; i < 25; ++i) {
+        list.push_back("mix/track" + std::to_string(100 + i) + ".wav");
+    }
+    auto songs = catalog(list);
+    CatalogSearch index(*songs);
+    QueryPageHeader header;
+
+    auto first = decode(index.search(*songs, "track", 0, 10), header);
+    EXPECT_EQ(first.size(), 10u);
+    EXPECT_EQ(header.flags, QUERY_MORE);
+    auto last = decode(index.search(*songs, "track", 20, 10), header);
+    EXPECT_EQ(last.size(), 5u);
+    EXPECT_EQ(header.flags, 0);
+    EXPECT_EQ(header.offset, 20u);
+    EXPECT_NE(first[0].name, last[0].name);
+
+    // Page size is capped
+    EXPECT_EQ(decode(index.search(*songs, "mix", 0, 1000), header).size(), 25u);
+    std::vector<std::string> many;
+    for (int i = 0; i < 300; ++i) {
+        many.push_back("all/song" + std::to_string(i) + ".wav");
+    }
+    auto large = catalog(many);
+    CatalogSearch largeIndex(*large);
+    EXPECT_EQ(decode(largeIndex.search(*large, "all", 0, 1000), header).size(), MAX_QUERY_PAGE);
+}
+
+TEST_F(CatalogSearchTest, BrowsesOneDirectoryLevel) {
+    auto songs = catalog({"Album/01.wav", "Album/02.wav", "Album/Disc 2/01.wav", "Album-Live/01.wav",
+                          "Other/Deep/Deeper/x.wav", "single.wav"});
+    QueryPageHeader header;
+
+    // Entries come in catalog (byte) order, so "Album-Live" precedes "Album/"
+    auto top = decode(CatalogSearch::browse(*songs, "", 0, 10), header);
+    ASSERT_EQ(top.size(), 4u);
+    EXPECT_EQ(top[0].name, "Album-Live");
+    EXPECT_EQ(top[1].name, "Album");
+    EXPECT_EQ(top[1].kind, QueryEntryKind::DIRECTORY);
+    EXPECT_EQ(top[1].value, 3u);
+    EXPECT_EQ(top[2].name, "Other");
+    EXPECT_EQ(top[3].name, "single.wav");
+    EXPECT_EQ(top[3].kind, QueryEntryKind::SONG);
+
+    auto album = names(decode(CatalogSearch::browse(*songs, "Album/", 0, 10), header));
+    std::vector<std::string> expected = {"01.wav", "02.wav", "Disc 2"};
+    EXPECT_EQ(album, expected);
+
+    auto paged = decode(CatalogSearch::browse(*songs, "Album", 1, 1), header);
+    ASSERT_EQ(paged.size(), 1u);
+    EXPECT_EQ(paged[0].name, "02.wav");
+    EXPECT_EQ(header.flags, QUERY_MORE);
+
+    EXPECT_TRUE(decode(CatalogSearch::browse(*songs, "Missing", 0, 10), header).empty());
+    EXPECT_TRUE(decode(CatalogSearch::browse(*songs, "Alb", 0, 10), header).empty());
+}
@@ -0,0 +1,657 @@
+#include <gtest/gtest.h>
+#include "client_handler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+class ClientHandlerTest : public ::testing::Test {
+protected:
+    const int TEST_PORT = 8998;
+    std::string testDir = "bin/test_data/client_handler_test";
+    std::shared_ptr<MusicLibrary> library;
+    Socket listener;
+    Socket client;
+    std::unique_ptr<Socket> accepted;
+
+    // song.wav: 16-bit stereo at 8 kHz, so a frame is 4 bytes
+    const uint32_t SONG_FRAMES = 8000;
+    const TrackId SONG = trackIdOf("song.wav");
+
+    // long.wav: the same format, long enough to back up in the queue
+    const uint32_t LONG_FRAMES = 400000;
+    const TrackId LONG = trackIdOf("long.wav");
+
+    // A frame as the client received it
+    struct Frame {
+        MessageType type;
+        std::vector<char> payload;
+
+        std::string_view view() const { return std::string_view(payload.data(), payload.size()); }
+    };
+
+    void SetUp() override {
+        std::filesystem::remove_all(testDir);
+        std::filesystem::create_directories(testDir);
+        createWavFile("song.wav", SONG_FRAMES);
+        createWavFile("long.wav", LONG_FRAMES);
+        LibraryConfig config;
+        config.persistCatalog = false;
+        config.watch = LibraryWatcher::Mode::OFF;
+        library = std::make_shared<MusicLibrary>(testDir, config);
+
+        ASSERT_TRUE(listener.createServer(TEST_PORT));
+        connectClient();
+    }
+
+    // Connect 'client' again, leaving the server end in 'accepted'
+    void connectClient() {
+        client.close();
+        ASSERT_TRUE(client.connectToServer("127.0.0.1", TEST_PORT));
+        accepted.reset(listener.acceptClient());
+        ASSERT_NE(accepted, nullptr);
+        ASSERT_TRUE(accepted->setNonBlocking());
+
+        // A reply that never comes fails the test instead of hanging it
+        struct timeval timeout = {2, 0};
+        setsockopt(client.getSocketFd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    void createWavFile(const std::string& name, uint32_t frames) {
+        WavHeader header;
+        memcpy(header.riff, "RIFF", 4);
+        header.fileSize = 36 + frames * 4;
+        memcpy(header.wave, "WAVE", 4);
+        memcpy(header.fmt, "fmt ", 4);
+        header.fmtSize = 16;
+        header.audioFormat = 1;
+        header.numChannels = 2;
+        header.sampleRate = 8000;
+        header.byteRate = 8000 * 4;
+        header.blockAlign = 4;
+        header.bitsPerSample = 16;
+        memcpy(header.data, "data", 4);
+        header.dataSize = frames * 4;
+
+        std::ofstream file(testDir + "/" + name, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> samples(header.dataSize);
+        for (size_t i = 0; i < samples.size(); ++i) {
+            samples[i] = static_cast<char>(i * 7);
+        }
+        file.write(samples.data(), samples.size());
+    }
+
+    // Send encoded frames and let the handler read them
+    void request(ClientHandler& handler, const std::vector<char>& frames) {
+        ASSERT_TRUE(client.send(frames));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT_TRUE(handler.onReadable());
+    }
+
+    // Append a fixed-size message to 'frames'
+    template<typename Message, typename... Args>
+    static void append(std::vector<char>& frames, const Args&... values) {
+        size_t start = frames.size();
+        frames.resize(start + Message::FRAME_SIZE);
+        ASSERT_EQ(Message::encode(frames.data() + start, Message::FRAME_SIZE, values...), Message::FRAME_SIZE);
+    }
+
+    // Read one whole frame from the client side; false on timeout
+    bool receiveFrame(Frame& frame) {
+        std::vector<char> header = client.receive(MESSAGE_HEADER_SIZE);
+        if (header.size() != MESSAGE_HEADER_SIZE) {
+            return false;
+        }
+        MessageHeader decoded = decodeMessageHeader(header.data());
+        frame.type = decoded.type;
+        frame.payload = decoded.size > 0 ? client.receive(decoded.size) : std::vector<char>();
+        return frame.payload.size() == decoded.size;
+    }
+
+    // The parameters of a HELLO_ACK
+    struct HelloAck {
+        uint32_t version = 0;
+        uint32_t chunkSize = 0;
+        uint32_t firstChunkSize = 0;
+        Codec codec = Codec::PCM;
+        double windowSeconds = 0;
+        uint32_t bufferBytes = 0;
+    };
+
+    // Send a HELLO to a new handler on 'accepted' and decode the reply,
+    // then connect again for the next handler
+    bool hello(const StreamConfig& config, EncodedBlockCache* blocks, CodecSet codecs, uint32_t maxChunk,
+               uint32_t receiveBuffer, HelloAck& ack) {
+        bool decoded = false;
+        {
+            ClientHandler handler(std::move(accepted), library, config, nullptr, nullptr, nullptr, blocks);
+            std::vector<char> frames;
+            append<HelloMessage>(frames, PROTOCOL_VERSION, maxChunk, codecs, 4.0, receiveBuffer);
+            request(handler, frames);
+            Frame frame;
+            decoded = receiveFrame(frame) && frame.type == MessageType::HELLO_ACK &&
+                      HelloAckMessage::decode(frame.view(), ack.version, ack.chunkSize, ack.firstChunkSize,
+                                              ack.codec, ack.windowSeconds, ack.bufferBytes);
+        }
+        connectClient();
+        return decoded;
+    }
+
+    // Read frames until 'count' have arrived
+    std::vector<MessageType> receiveFrames(size_t count) {
+        std::vector<MessageType> types;
+        Frame frame;
+        while (types.size() < count && receiveFrame(frame)) {
+            types.push_back(frame.type);
+        }
+        return types;
+    }
+
+    // Read frames up to and including the first of type 'last', while
+    // another thread keeps the handler writing as the socket drains
+    std::vector<Frame> receiveUntil(ClientHandler& handler, MessageType last) {
+        std::atomic<bool> done(false);
+        std::thread pump([&handler, &done]() {
+            while (!done.load()) {
+                handler.onTimer();
+                handler.onWritable();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        std::vector<Frame> frames;
+        Frame frame;
+        while (receiveFrame(frame)) {
+            frames.push_back(frame);
+            if (frame.type == last) {
+                break;
+            }
+        }
+        done.store(true);
+        pump.join();
+        return frames;
+    }
+
+    // Read frames until 'count' streams have sent SONG_DATA_END
+    std::vector<Frame> receiveEnds(ClientHandler& handler, size_t count) {
+        std::vector<Frame> frames;
+        while (countType(frames, MessageType::SONG_DATA_END) < count) {
+            std::vector<Frame> more = receiveUntil(handler, MessageType::SONG_DATA_END);
+            if (more.empty()) {
+                break;
+            }
+            frames.insert(frames.end(), more.begin(), more.end());
+        }
+        return frames;
+    }
+
+    // SONG_INFO's start frame and the audio bytes of stream 'streamId'
+    // among 'frames'
+    static uint64_t startFrame(const std::vector<Frame>& frames, StreamId streamId) {
+        for (const Frame& frame : frames) {
+            StreamId stream;
+            uint64_t first;
+            std::string_view header;
+            if (frame.type == MessageType::SONG_INFO && SongInfoMessage::decode(frame.view(), stream, first, header) &&
+                stream == streamId) {
+                return first;
+            }
+        }
+        return UINT64_MAX;
+    }
+
+    static size_t audioBytes(const std::vector<Frame>& frames, StreamId streamId) {
+        size_t bytes = 0;
+        for (const Frame& frame : frames) {
+            StreamId stream;
+            uint64_t offset;
+            uint32_t crc;
+            std::string_view audio;
+            if (frame.type == MessageType::SONG_DATA && SongDataMessage::decode(frame.view(), stream, offset, crc, audio) &&
+                stream == streamId) {
+                bytes += audio.size();
+            }
+        }
+        return bytes;
+    }
+
+    static StreamId streamOf(const Frame& frame) {
+        StreamId stream = NO_STREAM;
+        uint64_t offset;
+        uint32_t crc;
+        std::string_view audio;
+        if (frame.type == MessageType::SONG_DATA) {
+            SongDataMessage::decode(frame.view(), stream, offset, crc, audio);
+        }
+        return stream;
+    }
+
+    static size_t countType(const std::vector<Frame>& frames, MessageType type) {
+        return std::count_if(frames.begin(), frames.end(), [type](const Frame& frame) { return frame.type == type; });
+    }
+};
+
+TEST_F(ClientHandlerTest, PipelinedRequestsPastTheBacklogLimitAreAnswered) {
+    // A limit below one frame: each request must wait for the previous
+    // reply to be written before it is handled
+    StreamConfig config;
+    config.queueLowWatermark = 2;
+    config.queueHighWatermark = 4;
+    SessionRegistry sessions(60.0);
+    ClientHandler handler(std::move(accepted), library, config, nullptr, nullptr, &sessions);
+
+    const size_t requests = 5;
+    std::vector<char> pipelined;
+    for (size_t i = 0; i < requests; ++i) {
+        EncodedHeader header = makeMessageHeader(MessageType::LIST_REQUEST, 0);
+        pipelined.insert(pipelined.end(), header.begin(), header.end());
+    }
+    ASSERT_TRUE(client.send(pipelined));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // The session token fills the backlog, so reading parks every request
+    // until the token is written
+    ASSERT_TRUE(handler.onReadable());
+    EXPECT_TRUE(handler.wantsRead());
+
+    std::vector<MessageType> frames = receiveFrames(1 + requests);
+    ASSERT_EQ(frames.size(), 1 + requests);
+    EXPECT_EQ(frames[0], MessageType::SESSION_TOKEN);
+    for (size_t i = 1; i < frames.size(); ++i) {
+        EXPECT_NE(frames[i], MessageType::ERROR);
+    }
+}
+
+TEST_F(ClientHandlerTest, SeekRejectsNonFinitePositionsAndClampsToTheEnd) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::SEEK, std::numeric_limits<double>::infinity());
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::SEEK, std::numeric_limits<double>::quiet_NaN());
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::SEEK, 1e30);
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    ASSERT_FALSE(received.empty());
+    EXPECT_EQ(received.back().type, MessageType::SONG_DATA_END);
+    EXPECT_EQ(countType(received, MessageType::ERROR), 2u);
+
+    // Far past the end is the end: nothing is left to send
+    EXPECT_EQ(startFrame(received, 1), SONG_FRAMES);
+    EXPECT_EQ(audioBytes(received, 1), 0u);
+}
+
+TEST_F(ClientHandlerTest, HelloIsAcceptedOnceBeforeAnyStream) {
+    ClientHandler handler(std::move(accepted), library);
+
+    std::vector<char> frames;
+    append<HelloMessage>(frames, PROTOCOL_VERSION, uint32_t(64 * 1024), codecBit(Codec::PCM), 10.0, uint32_t(0));
+    append<HelloMessage>(frames, PROTOCOL_VERSION, uint32_t(8 * 1024), codecBit(Codec::PCM), 1.0, uint32_t(0));
+    request(handler, frames);
+    std::vector<MessageType> replies = receiveFrames(2);
+    EXPECT_EQ(replies, (std::vector<MessageType>{MessageType::HELLO_ACK, MessageType::ERROR}));
+}
+
+TEST_F(ClientHandlerTest, HelloAfterAStreamStartedIsRejected) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<HelloMessage>(frames, PROTOCOL_VERSION, uint32_t(8 * 1024), codecBit(Codec::PCM), 1.0, uint32_t(0));
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(countType(received, MessageType::HELLO_ACK), 0u);
+    EXPECT_EQ(countType(received, MessageType::ERROR), 1u);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES * 4);
+}
+
+TEST_F(ClientHandlerTest, ConcurrentStreamsTakeTurns) {
+    StreamConfig config;
+    config.pacing = false;
+    config.chunkSize = 4096;
+    config.firstChunkSize = 4096;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<TrackRequestMessage>(frames, StreamId(2), SONG, uint64_t(0), uint64_t(0));
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveEnds(handler, 2);
+    ASSERT_EQ(countType(received, MessageType::SONG_DATA_END), 2u);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES * 4);
+    EXPECT_EQ(audioBytes(received, 2), SONG_FRAMES * 4);
+
+    // Chunks alternate, so the second song does not wait for the first
+    std::vector<StreamId> order;
+    for (const Frame& frame : received) {
+        if (frame.type == MessageType::SONG_DATA) {
+            order.push_back(streamOf(frame));
+        }
+    }
+    ASSERT_GE(order.size(), 4u);
+    for (size_t i = 1; i < 4; ++i) {
+        EXPECT_NE(order[i], order[i - 1]);
+    }
+}
+
+TEST_F(ClientHandlerTest, ControlFramesOvertakeQueuedAudio) {
+    StreamConfig config;
+    config.pacing = false;
+    ReactorStats stats;
+
+    // Small socket buffers, so most of the song waits in the handler's queue
+    int bufferSize = 64 * 1024;
+    setsockopt(accepted->getSocketFd(), SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(client.getSocketFd(), SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    ClientHandler handler(std::move(accepted), library, config, &stats);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), LONG, uint64_t(0), uint64_t(0));
+    request(handler, frames);
+    ASSERT_TRUE(handler.onWritable());
+    ASSERT_GT(stats.queuedBytes.load(), 0u);
+
+    // Paused, the stream queues no more audio: any that arrives after the
+    // list was queued before it
+    frames.clear();
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::PAUSE, 0.0);
+    EncodedHeader listRequest = makeMessageHeader(MessageType::LIST_REQUEST, 0);
+    frames.insert(frames.end(), listRequest.begin(), listRequest.end());
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveUntil(handler, MessageType::LIST_RESPONSE);
+    ASSERT_FALSE(received.empty());
+    EXPECT_EQ(received.back().type, MessageType::LIST_RESPONSE);
+
+    struct timeval timeout = {0, 300 * 1000};
+    setsockopt(client.getSocketFd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::vector<Frame> after = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_GT(audioBytes(after, 1), 0u);
+    EXPECT_EQ(countType(after, MessageType::SONG_DATA_END), 0u);
+}
+
+TEST_F(ClientHandlerTest, TrackRequestsSendTheirRangeClampedToTheSong) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(1000), uint64_t(500));
+    append<TrackRequestMessage>(frames, StreamId(2), SONG, uint64_t(7900), uint64_t(500));
+    append<TrackRequestMessage>(frames, StreamId(3), SONG, uint64_t(9000), uint64_t(0));
+    append<TrackRequestMessage>(frames, StreamId(4), SONG, uint64_t(6000), uint64_t(0));
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveEnds(handler, 4);
+    ASSERT_EQ(countType(received, MessageType::SONG_DATA_END), 4u);
+
+    EXPECT_EQ(startFrame(received, 1), 1000u);
+    EXPECT_EQ(audioBytes(received, 1), 500u * 4);
+
+    // Ranges past the end stop there; a count of 0 runs to the end
+    EXPECT_EQ(startFrame(received, 2), 7900u);
+    EXPECT_EQ(audioBytes(received, 2), 100u * 4);
+    EXPECT_EQ(startFrame(received, 3), SONG_FRAMES);
+    EXPECT_EQ(audioBytes(received, 3), 0u);
+    EXPECT_EQ(startFrame(received, 4), 6000u);
+    EXPECT_EQ(audioBytes(received, 4), (SONG_FRAMES - 6000) * 4);
+
+    // Audio is addressed by its byte in the song
+    for (const Frame& frame : received) {
+        StreamId stream;
+        uint64_t offset;
+        uint32_t crc;
+        std::string_view audio;
+        if (frame.type == MessageType::SONG_DATA && SongDataMessage::decode(frame.view(), stream, offset, crc, audio) &&
+            stream == 1) {
+            EXPECT_EQ(offset, 1000u * 4);
+            break;
+        }
+    }
+}
+
+TEST_F(ClientHandlerTest, PausedStreamsSendNothingUntilPlay) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::PAUSE, 0.0);
+    request(handler, frames);
+    ASSERT_TRUE(handler.onWritable());
+    EXPECT_FALSE(handler.wantsWrite());
+    EXPECT_EQ(receiveFrames(1), std::vector<MessageType>{MessageType::SONG_INFO});
+
+    frames.clear();
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::PLAY, 0.0);
+    request(handler, frames);
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES * 4);
+}
+
+TEST_F(ClientHandlerTest, StoppedStreamsSendNothingMore) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    // The SONG_INFO was not started, so it is dropped with the stream
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::STOP, 0.0);
+    EncodedHeader listRequest = makeMessageHeader(MessageType::LIST_REQUEST, 0);
+    frames.insert(frames.end(), listRequest.begin(), listRequest.end());
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveUntil(handler, MessageType::LIST_RESPONSE);
+    ASSERT_EQ(received.size(), 1u);
+    EXPECT_EQ(received[0].type, MessageType::LIST_RESPONSE);
+    EXPECT_FALSE(handler.wantsWrite());
+}
+
+TEST_F(ClientHandlerTest, SeekRestartsTheStreamAtThePosition) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::SEEK, 0.5);
+    request(handler, frames);
+
+    // The unsent SONG_INFO of the old position is replaced
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(countType(received, MessageType::SONG_INFO), 1u);
+    EXPECT_EQ(startFrame(received, 1), SONG_FRAMES / 2);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES / 2 * 4);
+}
+
+TEST_F(ClientHandlerTest, SeekWhilePausedStaysPaused) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::PAUSE, 0.0);
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::SEEK, 0.25);
+    request(handler, frames);
+    ASSERT_TRUE(handler.onWritable());
+    EXPECT_FALSE(handler.wantsWrite());
+
+    frames.clear();
+    append<PlayControlMessage>(frames, StreamId(1), PlayControl::PLAY, 0.25);
+    request(handler, frames);
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(startFrame(received, 1), SONG_FRAMES / 4);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES * 3 / 4 * 4);
+}
+
+TEST_F(ClientHandlerTest, ResumedStreamsContinueFromTheFrameAskedForStillPaused) {
+    StreamConfig config;
+    config.pacing = false;
+    SessionRegistry sessions(60.0);
+    SessionToken token = NO_SESSION;
+    {
+        ClientHandler dropped(std::move(accepted), library, config, nullptr, nullptr, &sessions);
+        ASSERT_TRUE(dropped.onWritable());
+        Frame frame;
+        ASSERT_TRUE(receiveFrame(frame));
+        ASSERT_EQ(frame.type, MessageType::SESSION_TOKEN);
+        ASSERT_TRUE(SessionTokenMessage::decode(frame.view(), token));
+
+        std::vector<char> frames;
+        append<TrackRequestMessage>(frames, StreamId(3), SONG, uint64_t(0), uint64_t(0));
+        append<PlayControlMessage>(frames, StreamId(3), PlayControl::PAUSE, 0.0);
+        request(dropped, frames);
+        dropped.stop();
+    }
+
+    connectClient();
+    ClientHandler handler(std::move(accepted), library, config, nullptr, nullptr, &sessions);
+    std::vector<char> frames;
+    append<SessionResumeMessage>(frames, token, StreamId(3), SONG, uint64_t(2000));
+    request(handler, frames);
+    ASSERT_TRUE(handler.onWritable());
+    EXPECT_FALSE(handler.wantsWrite());
+
+    // The new session's token, then the stream from where the client was
+    std::vector<Frame> received(2);
+    ASSERT_TRUE(receiveFrame(received[0]));
+    ASSERT_TRUE(receiveFrame(received[1]));
+    EXPECT_EQ(received[0].type, MessageType::SESSION_TOKEN);
+    EXPECT_EQ(startFrame(received, 3), 2000u);
+
+    frames.clear();
+    append<PlayControlMessage>(frames, StreamId(3), PlayControl::PLAY, 0.0);
+    request(handler, frames);
+    received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(audioBytes(received, 3), (SONG_FRAMES - 2000) * 4);
+}
+
+TEST_F(ClientHandlerTest, ResumingARangeReceivedInFullResendsItsLastFrame) {
+    StreamConfig config;
+    config.pacing = false;
+    SessionRegistry sessions(60.0);
+    SessionToken token = NO_SESSION;
+    {
+        ClientHandler dropped(std::move(accepted), library, config, nullptr, nullptr, &sessions);
+        ASSERT_TRUE(dropped.onWritable());
+        Frame frame;
+        ASSERT_TRUE(receiveFrame(frame));
+        ASSERT_TRUE(SessionTokenMessage::decode(frame.view(), token));
+
+        std::vector<char> frames;
+        append<TrackRequestMessage>(frames, StreamId(5), SONG, uint64_t(0), uint64_t(1000));
+        append<PlayControlMessage>(frames, StreamId(5), PlayControl::PAUSE, 0.0);
+        request(dropped, frames);
+        dropped.stop();
+    }
+
+    // The client has every frame of the range but not its end marker
+    connectClient();
+    ClientHandler handler(std::move(accepted), library, config, nullptr, nullptr, &sessions);
+    std::vector<char> frames;
+    append<SessionResumeMessage>(frames, token, StreamId(5), SONG, uint64_t(1000));
+    append<PlayControlMessage>(frames, StreamId(5), PlayControl::PLAY, 0.0);
+    request(handler, frames);
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(startFrame(received, 5), 999u);
+    EXPECT_EQ(audioBytes(received, 5), 4u);
+    EXPECT_EQ(countType(received, MessageType::SONG_DATA_END), 1u);
+}
+
+TEST_F(ClientHandlerTest, ResumingWithAnUnknownSessionStartsAFreshStream) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<SessionResumeMessage>(frames, SessionToken(12345), StreamId(1), SONG, uint64_t(2000));
+    request(handler, frames);
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    EXPECT_EQ(startFrame(received, 1), 2000u);
+    EXPECT_EQ(audioBytes(received, 1), (SONG_FRAMES - 2000) * 4);
+}
+
+TEST_F(ClientHandlerTest, HelloAckFitsChunksToTheClient) {
+    StreamConfig config;
+    HelloAck ack;
+
+    // The socket buffer is the tighter limit, and the shorter window wins
+    ASSERT_TRUE(hello(config, nullptr, codecBit(Codec::PCM), 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.version, PROTOCOL_VERSION);
+    EXPECT_EQ(ack.codec, Codec::PCM);
+    EXPECT_EQ(ack.chunkSize, 20000u);
+    EXPECT_EQ(ack.firstChunkSize, config.firstChunkSize);
+    EXPECT_EQ(ack.windowSeconds, 4.0);
+
+    // The frame limit covers the SONG_DATA fields ahead of the audio
+    ASSERT_TRUE(hello(config, nullptr, codecBit(Codec::PCM), 10000, 0, ack));
+    EXPECT_EQ(ack.chunkSize, 10000 - (SONG_DATA_PREFIX_SIZE - MESSAGE_HEADER_SIZE));
+    EXPECT_EQ(ack.firstChunkSize, ack.chunkSize);
+
+    // Limits below the smallest chunk are raised to it
+    ASSERT_TRUE(hello(config, nullptr, codecBit(Codec::PCM), 100, 100, ack));
+    EXPECT_EQ(ack.chunkSize, 4096u);
+}
+
+TEST_F(ClientHandlerTest, HelloPicksTheMostCompactCodecOffered) {
+    StreamConfig config;
+    EncodedBlockCache blocks(1024 * 1024);
+    CodecSet all = codecBit(Codec::PCM) | codecBit(Codec::LOSSLESS) | codecBit(Codec::ADPCM);
+    HelloAck ack;
+
+    ASSERT_TRUE(hello(config, &blocks, all, 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.codec, Codec::ADPCM);
+    ASSERT_TRUE(hello(config, &blocks, codecBit(Codec::PCM) | codecBit(Codec::LOSSLESS), 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.codec, Codec::LOSSLESS);
+
+    // Room is left for the block headers of audio that does not compress
+    EXPECT_LT(ack.chunkSize, 20000u);
+
+    // Encoded audio needs the block cache, and each codec can be turned off
+    ASSERT_TRUE(hello(config, nullptr, all, 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.codec, Codec::PCM);
+    config.adpcm = false;
+    ASSERT_TRUE(hello(config, &blocks, all, 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.codec, Codec::LOSSLESS);
+    config.compression = false;
+    ASSERT_TRUE(hello(config, &blocks, all, 64 * 1024, 20000, ack));
+    EXPECT_EQ(ack.codec, Codec::PCM);
+}
+
+TEST_F(ClientHandlerTest, ChunksStayWithinTheNegotiatedSize) {
+    StreamConfig config;
+    config.pacing = false;
+    ClientHandler handler(std::move(accepted), library, config);
+
+    std::vector<char> frames;
+    append<HelloMessage>(frames, PROTOCOL_VERSION, uint32_t(64 * 1024), codecBit(Codec::PCM), 10.0, uint32_t(5000));
+    append<TrackRequestMessage>(frames, StreamId(1), SONG, uint64_t(0), uint64_t(0));
+    request(handler, frames);
+
+    std::vector<Frame> received = receiveUntil(handler, MessageType::SONG_DATA_END);
+    ASSERT_FALSE(received.empty());
+    EXPECT_EQ(received[0].type, MessageType::HELLO_ACK);
+    EXPECT_EQ(audioBytes(received, 1), SONG_FRAMES * 4);
+    for (const Frame& frame : received) {
+        if (frame.type == MessageType::SONG_DATA) {
+            EXPECT_LE(frame.payload.size() - (SONG_DATA_PREFIX_SIZE - MESSAGE_HEADER_SIZE), 5000u);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "crc32c.h"
+#include <string>
+#include <vector>
+
+class Crc32cTest : public ::testing::Test {
+protected:
+    std::vector<char> pattern(size_t size) {
+        std::vector<char> data(size);
+        uint32_t state = 12345;
+        for (char& c : data) {
+            state = state * 1103515245 + 12345;
+            c = static_cast<char>(state >> 16);
+        }
+        return data;
+    }
+};
+
+TEST_F(Crc32cTest, KnownValues) {
+    // Check values from RFC 3720 (iSCSI) and the usual "123456789" vector
+    std::string digits = "123456789";
+    EXPECT_EQ(crc32c::compute(digits.data(), digits.size()), 0xE3069283u);
+
+    std::vector<char> zeros(32, 0);
+    EXPECT_EQ(crc32c::compute(zeros.data(), zeros.size()), 0x8A9136AAu);
+
+    std::vector<char> ones(32, static_cast<char>(0xFF));
+    EXPECT_EQ(crc32c::compute(ones.data(), ones.size()), 0x62A8AB43u);
+
+    EXPECT_EQ(crc32c::compute(nullptr, 0), 0u);
+}
+
+TEST_F(Crc32cTest, HardwareMatchesTable) {
+    // Every length and alignment around the 8-byte steps
+    std::vector<char> data = pattern(300);
+    for (size_t start = 0; start < 8; ++start) {
+        for (size_t size = 0; size + start <= data.size(); size += 7) {
+            uint32_t table = ~crc32c::detail::updateTable(~0u, data.data() + start, size);
+            uint32_t hardware = ~crc32c::detail::updateHardware(~0u, data.data() + start, size);
+            ASSERT_EQ(hardware, table) << "start " << start << " size " << size;
+        }
+    }
+}
+
+TEST_F(Crc32cTest, ExtendEqualsWhole) {
+    std::vector<char> data = pattern(100000);
+    uint32_t whole = crc32c::compute(data.data(), data.size());
+    uint32_t pieces = crc32c::extend(0, data.data(), 33333);
+    pieces = crc32c::extend(pieces, data.data() + 33333, data.size() - 33333);
+    EXPECT_EQ(pieces, whole);
+}
+
+TEST_F(Crc32cTest, CombineEqualsWhole) {
+    std::vector<char> data = pattern(100000);
+    uint32_t whole = crc32c::compute(data.data(), data.size());
+    for (size_t split : {size_t(0), size_t(1), size_t(4096), size_t(33333), data.size()}) {
+        uint32_t first = crc32c::compute(data.data(), split);
+        uint32_t second = crc32c::compute(data.data() + split, data.size() - split);
+        EXPECT_EQ(crc32c::combine(first, second, data.size() - split), whole) << "split " << split;
+    }
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "encoded_block_cache.h"
+#include "../../common/include/adpcm_codec.h"
+#include "../../common/include/crc32c.h"
+#include "../../common/include/lossless_codec.h"
+
+class EncodedBlockCacheTest : public ::testing::Test {
+protected:
+    std::string testDir;
+    std::shared_ptr<WavFile> song;
+
+    // 16-bit stereo: a block is 4096 frames of 4 bytes
+    const size_t BLOCK_BYTES = lossless::BLOCK_FRAMES * 4;
+    const size_t SONG_FRAMES = 3 * lossless::BLOCK_FRAMES + 1000;
+
+    void SetUp() override {
+        testDir = "bin/test_data/encoded_block_cache_test";
+        std::filesystem::create_directories(testDir);
+        createWavFile(testDir + "/tone.wav");
+        song = std::make_shared<WavFile>(testDir + "/tone.wav");
+        ASSERT_TRUE(song->load());
+    }
+
+    void TearDown() override {
+        song.reset();
+        std::filesystem::remove_all(testDir);
+    }
+
+    void createWavFile(const std::string& path) {
+        uint32_t dataSize = static_cast<uint32_t>(SONG_FRAMES * 4);
+        WavHeader header;
+        memcpy(header.riff, "RIFF", 4);
+        header.fileSize = 36 + dataSize;
+        memcpy(header.wave, "WAVE", 4);
+        memcpy(header.fmt, "fmt ", 4);
+        header.fmtSize = 16;
+        header.audioFormat = 1;
+        header.numChannels = 2;
+        header.sampleRate = 44100;
+        header.byteRate = 44100 * 4;
+        header.blockAlign = 4;
+        header.bitsPerSample = 16;
+        memcpy(header.data, "data", 4);
+        header.dataSize = dataSize;
+
+        std::vector<int16_t> samples(SONG_FRAMES * 2);
+        for (size_t i = 0; i < SONG_FRAMES; ++i) {
+            samples[2 * i] = static_cast<int16_t>(8000 * std::sin(i * 0.031));
+            samples[2 * i + 1] = static_cast<int16_t>(6000 * std::sin(i * 0.047));
+        }
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(samples.data()), dataSize);
+    }
+
+    // Encode [start, start + size) of the song, check each block's CRC and
+    // that together they decode to the same audio, and return their bytes
+    std::vector<char> encodeChecked(EncodedBlockCache& cache, size_t start, size_t size) {
+        const char* pcm = song->getAudioData().data + start;
+        std::vector<char> encoded;
+        size_t pcmBytes = 0;
+        for (const EncodedBlockCache::Block& block : cache.encode(song, Codec::LOSSLESS, start, pcm, size)) {
+            EXPECT_EQ(block->crc, crc32c::compute(block->data.data(), block->data.size()));
+            encoded.insert(encoded.end(), block->data.begin(), block->data.end());
+            pcmBytes += block->pcmBytes;
+        }
+        EXPECT_EQ(pcmBytes, size);
+        std::vector<char> decoded;
+        EXPECT_TRUE(lossless::decode(encoded.data(), encoded.size(), decoded));
+        EXPECT_EQ(decoded, std::vector<char>(pcm, pcm + size));
+        return encoded;
+    }
+};
+
+TEST_F(EncodedBlockCacheTest, WholeBlocksAreEncodedOnce) {
+    EncodedBlockCache cache(1024 * 1024);
+
+    std::vector<char> first = encodeChecked(cache, 0, 2 * BLOCK_BYTES);
+    std::vector<char> second = encodeChecked(cache, 0, 2 * BLOCK_BYTES);
+    EXPECT_EQ(first, second);
+    EXPECT_LT(first.size(), BLOCK_BYTES);
+
+    const EncodedCacheStats& stats = cache.getStats();
+    EXPECT_EQ(stats.misses.load(), 2u);
+    EXPECT_EQ(stats.hits.load(), 2u);
+    EXPECT_EQ(stats.residentBlocks.load(), 2u);
+    EXPECT_EQ(stats.pcmBytes.load(), 4 * BLOCK_BYTES);
+    EXPECT_EQ(stats.encodedBytes.load(), first.size() + second.size());
+}
+
+TEST_F(EncodedBlockCacheTest, PiecesOffTheGridAreNotKept) {
+    EncodedBlockCache cache(1024 * 1024);
+
+    // From mid-block (a seek) to past the next boundary: only the whole
+    // block after it is cached
+    encodeChecked(cache, 400, 2 * BLOCK_BYTES - 400);
+    EXPECT_EQ(cache.getStats().misses.load(), 1u);
+    EXPECT_EQ(cache.getStats().residentBlocks.load(), 1u);
+
+    // The song's short last block is the same for everyone, so it is kept
+    size_t lastBlock = 3 * BLOCK_BYTES;
+    encodeChecked(cache, lastBlock, song->getAudioSize() - lastBlock);
+    encodeChecked(cache, lastBlock, song->getAudioSize() - lastBlock);
+    EXPECT_EQ(cache.getStats().hits.load(), 1u);
+    EXPECT_EQ(cache.getStats().residentBlocks.load(), 2u);
+}
+
+TEST_F(EncodedBlockCacheTest, StaysWithinBudget) {
+    // Room for about one block per shard: every block still encodes
+    // correctly, and the cache drops old ones to fit
+    EncodedBlockCache cache(16 * 2048);
+    for (int pass = 0; pass < 2; ++pass) {
+        encodeChecked(cache, 0, song->getAudioSize());
+    }
+    const EncodedCacheStats& stats = cache.getStats();
+    EXPECT_LE(stats.residentBytes.load(), 16u * 2048);
+    EXPECT_EQ(stats.hits.load() + stats.misses.load(), 8u);
+
+    // Without a budget nothing is kept
+    EncodedBlockCache uncached(0);
+    encodeChecked(uncached, 0, song->getAudioSize());
+    EXPECT_EQ(uncached.getStats().residentBlocks.load(), 0u);
+    EXPECT_EQ(uncached.getStats().misses.load(), 0u);
+}
+
+TEST_F(EncodedBlockCacheTest, ReloadedSongIsEncodedAgain) {
+    EncodedBlockCache cache(1024 * 1024);
+    encodeChecked(cache, 0, BLOCK_BYTES);
+
+    // A new load of the song does not match the old one's blocks
+    song = std::make_shared<WavFile>(testDir + "/tone.wav");
+    ASSERT_TRUE(song->load());
+    encodeChecked(cache, 0, BLOCK_BYTES);
+    EXPECT_EQ(cache.getStats().hits.load(), 0u);
+    EXPECT_EQ(cache.getStats().misses.load(), 2u);
+}
+
+TEST_F(EncodedBlockCacheTest, CodecsAreCachedApart) {
+    EncodedBlockCache cache(1024 * 1024);
+    encodeChecked(cache, 0, BLOCK_BYTES);
+
+    // The same block in ADPCM is encoded separately, at about a quarter of the PCM
+    const char* pcm = song->getAudioData().data;
+    std::vector<EncodedBlockCache::Block> adpcmBlocks = cache.encode(song, Codec::ADPCM, 0, pcm, BLOCK_BYTES);
+    std::vector<EncodedBlockCache::Block> again = cache.encode(song, Codec::ADPCM, 0, pcm, BLOCK_BYTES);
+    ASSERT_EQ(adpcmBlocks.size(), 1u);
+    ASSERT_EQ(again.size(), 1u);
+    // The cached block itself is handed out, not a copy
+    EXPECT_EQ(adpcmBlocks[0], again[0]);
+    const std::vector<char>& adpcmBlock = adpcmBlocks[0]->data;
+    EXPECT_LT(adpcmBlock.size(), BLOCK_BYTES / 4 + 64);
+    std::vector<char> decoded;
+    ASSERT_TRUE(adpcm::decode(adpcmBlock.data(), adpcmBlock.size(), decoded));
+    EXPECT_EQ(decoded.size(), BLOCK_BYTES);
+
+    EXPECT_EQ(cache.getStats().misses.load(), 2u);
+    EXPECT_EQ(cache.getStats().hits.load(), 1u);
+    EXPECT_EQ(cache.getStats().residentBlocks.load(), 2u);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "library_scanner.h"
+#include "../../common/include/wav_header.h"
+
+class LibraryScannerTest : public ::testing::Test {
+protected:
+    std::string testDir;
+
+    void SetUp() override {
+        testDir = "bin/test_data/library_scanner_test";
+        std::filesystem::remove_all(testDir);
+        std::filesystem::create_directories(testDir + "/album/disc2");
+        std::filesystem::create_directories(testDir + "/.hidden");
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    void createWavFile(const std::string& path, uint16_t channels, uint32_t sampleRate, uint32_t dataSize) {
+        WavHeader header;
+        memcpy(header.riff, "RIFF", 4);
+        header.fileSize = 36 + dataSize;
+        memcpy(header.wave, "WAVE", 4);
+        memcpy(header.fmt, "fmt ", 4);
+        header.fmtSize = 16;
+        header.audioFormat = 1;
+        header.numChannels = channels;
+        header.sampleRate = sampleRate;
+        header.byteRate = sampleRate * channels * 2;
+        header.blockAlign = channels * 2;
+        header.bitsPerSample = 16;
+        memcpy(header.data, "data", 4);
+        header.dataSize = dataSize;
+
+        std::ofstream file(testDir + "/" + path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> samples(dataSize, 0);
+        file.write(samples.data(), samples.size());
+    }
+
+    // Scan results sorted by name
+    std::vector<SongInfo> scanSorted(LibraryScanner& scanner) {
+        std::vector<SongInfo> songs = scanner.scan();
+        std::sort(songs.begin(), songs.end(),
+                  [](const SongInfo& a, const SongInfo& b) { return a.name < b.name; });
+        return songs;
+    }
+};
+
+TEST_F(LibraryScannerTest, FindsSongsInSubdirectories) {
+    createWavFile("top.wav", 2, 44100, 4000);
+    createWavFile("album/one.wav", 1, 22050, 2000);
+    createWavFile("album/disc2/two.wav", 2, 48000, 8000);
+    createWavFile(".hidden/secret.wav", 2, 44100, 4000);
+    std::ofstream(testDir + "/notes.txt") << "not a song";
+
+    LibraryScanner scanner(testDir, 4);
+    std::vector<SongInfo> songs = scanSorted(scanner);
+
+    ASSERT_EQ(songs.size(), 3u);
+    EXPECT_EQ(songs[0].name, "album/disc2/two.wav");
+    EXPECT_EQ(songs[1].name, "album/one.wav");
+    EXPECT_EQ(songs[2].name, "top.wav");
+    EXPECT_EQ(scanner.getDirectoryCount(), 3u);
+}
+
+TEST_F(LibraryScannerTest, ReadsFormatFromHeader) {
+    createWavFile("album/one.wav", 1, 22050, 2000);
+
+    LibraryScanner scanner(testDir, 2);
+    std::vector<SongInfo> songs = scanSorted(scanner);
+
+    ASSERT_EQ(songs.size(), 1u);
+    EXPECT_EQ(songs[0].format.channels, 1);
+    EXPECT_EQ(songs[0].format.sampleRate, 22050u);
+    EXPECT_EQ(songs[0].format.bitsPerSample, 16);
+    EXPECT_EQ(songs[0].format.dataSize, 2000u);
+}
+
+TEST_F(LibraryScannerTest, SkipsInvalidFilesAndSplitsLargeDirectories) {
+    for (int i = 0; i < 200; ++i) {
+        createWavFile("album/track" + std::to_string(i) + ".wav", 2, 44100, 400);
+    }
+    std::ofstream(testDir + "/album/broken.wav") << "not a RIFF file";
+
+    LibraryScanner scanner(testDir, 4);
+    EXPECT_EQ(scanner.scan().size(), 200u);
+    EXPECT_EQ(scanner.getSkippedCount(), 1u);
+
+    // Scanning again gives the same result
+    EXPECT_EQ(scanner.scan().size(), 200u);
+}
+
+TEST_F(LibraryScannerTest, ReusesUnchangedSongsFromKnownCatalog) {
+    createWavFile("same.wav", 2, 44100, 4000);
+    createWavFile("changed.wav", 2, 44100, 4000);
+
+    LibraryScanner first(testDir, 2);
+    auto known = std::make_shared<const SongCatalog>(first.scan());
+    EXPECT_EQ(first.getReusedCount(), 0u);
+
+    createWavFile("changed.wav", 1, 8000, 6000);
+    createWavFile("added.wav", 2, 44100, 4000);
+
+    LibraryScanner second(testDir, 2, known);
+    std::vector<SongInfo> songs = scanSorted(second);
+    ASSERT_EQ(songs.size(), 3u);
+    EXPECT_EQ(second.getReusedCount(), 1u);
+    EXPECT_EQ(songs[1].name, "changed.wav");
+    EXPECT_EQ(songs[1].format.sampleRate, 8000u);
+}
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "library_watcher.h"
+#include "music_library.h"
+#include "../../common/include/wav_header.h"
+
+class LibraryWatcherTest : public ::testing::Test {
+protected:
+    std::string testDir;
+    std::mutex catalogMutex;
+    std::shared_ptr<const SongCatalog> catalog;
+    int publishCount = 0;
+
+    void SetUp() override {
+        testDir = "bin/test_data/library_watcher_test";
+        std::filesystem::remove_all(testDir);
+        std::filesystem::create_directories(testDir + "/album");
+        createWavFile("album/one.wav");
+        catalog = std::make_shared<const SongCatalog>(LibraryScanner(testDir, 2).scan());
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    void createWavFile(const std::string& path, uint32_t dataSize = 400, char sample = 0) {
+        WavHeader header;
+        memcpy(header.riff, "RIFF", 4);
+        header.fileSize = 36 + dataSize;
+        memcpy(header.wave, "WAVE", 4);
+        memcpy(header.fmt, "fmt ", 4);
+        header.fmtSize = 16;
+        header.audioFormat = 1;
+        header.numChannels = 2;
+        header.sampleRate = 44100;
+        header.byteRate = 44100 * 4;
+        header.blockAlign = 4;
+        header.bitsPerSample = 16;
+        memcpy(header.data, "data", 4);
+        header.dataSize = dataSize;
+
+        std::ofstream file(testDir + "/" + path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> samples(dataSize, sample);
+        file.write(samples.data(), samples.size());
+    }
+
+    std::unique_ptr<LibraryWatcher> makeWatcher(LibraryWatcher::Mode mode) {
+        return std::make_unique<LibraryWatcher>(
+            testDir, mode, std::chrono::milliseconds(50), 2,
+            [this]() {
+                std::lock_guard<std::mutex> lock(catalogMutex);
+                return catalog;
+            },
+            [this](std::shared_ptr<const SongCatalog> updated) {
+                std::lock_guard<std::mutex> lock(catalogMutex);
+                catalog = std::move(updated);
+                ++publishCount;
+            });
+    }
+
+    // Wait for the published catalog to hold exactly these songs
+    bool waitForSongs(const std::vector<std::string>& names) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(catalogMutex);
+                bool matches = catalog->size() == names.size();
+                for (const auto& name : names) {
+                    matches = matches && catalog->contains(name);
+                }
+                if (matches) {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+};
+
+#if defined(__linux__)
+TEST_F(LibraryWatcherTest, AppliesAddsRemovesAndRenames) {
+    auto watcher = makeWatcher(LibraryWatcher::Mode::AUTO);
+    watcher->watch();
+    watcher->start(false);
+    EXPECT_STREQ(watcher->getMethod(), "inotify");
+
+    createWavFile("two.wav");
+    ASSERT_TRUE(waitForSongs({"album/one.wav", "two.wav"}));
+
+    std::filesystem::rename(testDir + "/two.wav", testDir + "/album/renamed.wav");
+    ASSERT_TRUE(waitForSongs({"album/one.wav", "album/renamed.wav"}));
+
+    std::filesystem::remove(testDir + "/album/one.wav");
+    ASSERT_TRUE(waitForSongs({"album/renamed.wav"}));
+}
+
+TEST_F(LibraryWatcherTest, FollowsDirectoriesAddedAndMovedAway) {
+    auto watcher = makeWatcher(LibraryWatcher::Mode::AUTO);
+    watcher->watch();
+    watcher->start(false);
+
+    std::filesystem::create_directories(testDir + "/new/disc1");
+    createWavFile("new/disc1/a.wav");
+    createWavFile("new/disc1/b.wav");
+    ASSERT_TRUE(waitForSongs({"album/one.wav", "new/disc1/a.wav", "new/disc1/b.wav"}));
+
+    // Moving a directory out of the library removes everything in it
+    std::filesystem::rename(testDir + "/new", testDir + "/.trash");
+    ASSERT_TRUE(waitForSongs({"album/one.wav"}));
+}
+
+TEST_F(LibraryWatcherTest, BatchesBurstsIntoOnePublish) {
+    auto watcher = makeWatcher(LibraryWatcher::Mode::AUTO);
+    watcher->watch();
+    watcher->start(false);
+
+    for (int i = 0; i < 20; ++i) {
+        createWavFile("album/track" + std::to_string(i) + ".wav");
+    }
+    std::vector<std::string> names = {"album/one.wav"};
+    for (int i = 0; i < 20; ++i) {
+        names.push_back("album/track" + std::to_string(i) + ".wav");
+    }
+    ASSERT_TRUE(waitForSongs(names));
+
+    std::lock_guard<std::mutex> lock(catalogMutex);
+    EXPECT_EQ(publishCount, 1);
+}
+#endif
+
+TEST_F(LibraryWatcherTest, PollingPicksUpChanges) {
+    auto watcher = makeWatcher(LibraryWatcher::Mode::POLL);
+    watcher->watch();
+    watcher->start(false);
+
+    createWavFile("album/two.wav");
+    std::filesystem::remove(testDir + "/album/one.wav");
+    ASSERT_TRUE(waitForSongs({"album/two.wav"}));
+
+    watcher->stop();
+    EXPECT_STREQ(watcher->getMethod(), "polling");
+}
+
+TEST_F(LibraryWatcherTest, OffOnlyRevalidates) {
+    createWavFile("album/two.wav");
+    auto watcher = makeWatcher(LibraryWatcher::Mode::OFF);
+    watcher->start(true);
+    ASSERT_TRUE(waitForSongs({"album/one.wav", "album/two.wav"}));
+}
+
+TEST_F(LibraryWatcherTest, RewrittenSongIsReloaded) {
+    LibraryConfig config;
+    config.persistCatalog = false;
+    config.watch = LibraryWatcher::Mode::POLL;
+    config.pollInterval = std::chrono::milliseconds(50);
+    MusicLibrary library(testDir, config);
+    TrackId trackId = trackIdOf("album/one.wav");
+
+    // Streams may still hold the old song while the file is rewritten
+    auto original = library.getSong(trackId);
+    ASSERT_NE(original, nullptr);
+    ASSERT_EQ(original->getAudioSize(), 400u);
+
+    createWavFile("album/one.wav", 800, 0x11);
+
+    // The track ID stays the same; once the change is published the cached
+    // copy must be dropped and the new audio read from disk
+    std::shared_ptr<WavFile> reloaded;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        reloaded = library.getSong(trackId);
+        if (reloaded && reloaded != original) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_NE(reloaded, original);
+    ASSERT_EQ(reloaded->getAudioSize(), 800u);
+    EXPECT_EQ(reloaded->getAudioData().data[0], 0x11);
+    EXPECT_EQ(reloaded->getAudioData().data[799], 0x11);
+}
+
+TEST_F(LibraryWatcherTest, TruncatedSongStaysReadableByHolders) {
+    createWavFile("album/long.wav", 64 * 1024, 0x22);
+    LibraryConfig config;
+    config.persistCatalog = false;
+    config.watch = LibraryWatcher::Mode::POLL;
+    config.pollInterval = std::chrono::milliseconds(50);
+    MusicLibrary library(testDir, config);
+    TrackId trackId = trackIdOf("album/long.wav");
+
+    auto original = library.getSong(trackId);
+    ASSERT_NE(original, nullptr);
+    ASSERT_EQ(original->getBackend(), WavFile::Backend::MMAP);
+
+    createWavFile("album/long.wav", 100, 0x33);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline && library.getSong(trackId) == original) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_NE(library.getSong(trackId), original);
+
+    // Past the file's new end the mapping now reads zeros instead of faulting
+    AudioSpan audio = original->getAudioData();
+    EXPECT_EQ(audio.data[audio.size - 1], 0);
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include "lossless_codec.h"
+#include <cmath>
+#include <vector>
+#include "pcm_codec_test.h"
+
+class LosslessCodecTest : public PcmCodecTest<lossless::encodeBlock, lossless::decode> {
+protected:
+    std::vector<char> noise(size_t size) {
+        std::vector<char> data(size);
+        uint32_t state = 7;
+        for (char& c : data) {
+            state = state * 1103515245 + 12345;
+            c = static_cast<char>(state >> 16);
+        }
+        return data;
+    }
+};
+
+TEST_F(LosslessCodecTest, StereoRoundTripCompresses) {
+    std::vector<char> pcm = music(44100, 2);
+    size_t encodedSize = 0;
+    EXPECT_EQ(roundTrip(pcm, 2, 16, &encodedSize), pcm);
+    EXPECT_LT(encodedSize, pcm.size() * 6 / 10);
+}
+
+TEST_F(LosslessCodecTest, MonoAndShortBlocksRoundTrip) {
+    std::vector<char> pcm = music(5000, 1);
+    EXPECT_EQ(roundTrip(pcm, 1, 16), pcm);
+
+    // Blocks of every small size, including ones too short for LPC
+    for (size_t frames = 1; frames < 40; ++frames) {
+        std::vector<char> shortPcm = music(frames, 2);
+        ASSERT_EQ(roundTrip(shortPcm, 2, 16), shortPcm) << frames << " frames";
+    }
+}
+
+TEST_F(LosslessCodecTest, ExtremesAndSilenceRoundTrip) {
+    // Full-scale square wave: side and mid reach their widest range
+    std::vector<char> pcm(4096 * 4);
+    for (size_t i = 0; i < 4096; ++i) {
+        uint16_t left = (i / 3) % 2 ? 0x7FFF : 0x8000;
+        uint16_t right = (i / 5) % 2 ? 0x8000 : 0x7FFF;
+        wire::storeLE(pcm.data() + i * 4, left);
+        wire::storeLE(pcm.data() + i * 4 + 2, right);
+    }
+    EXPECT_EQ(roundTrip(pcm, 2, 16), pcm);
+
+    std::vector<char> silence(4096 * 4, 0);
+    size_t encodedSize = 0;
+    EXPECT_EQ(roundTrip(silence, 2, 16, &encodedSize), silence);
+    EXPECT_LT(encodedSize, 32u);
+}
+
+TEST_F(LosslessCodecTest, OtherFormatsAndNoiseAreStoredVerbatim) {
+    std::vector<char> random = noise(4096 * 4);
+    size_t encodedSize = 0;
+    EXPECT_EQ(roundTrip(random, 2, 16, &encodedSize), random);
+    EXPECT_LE(encodedSize, random.size() + 5);
+
+    std::vector<char> eightBit = noise(1000);
+    EXPECT_EQ(roundTrip(eightBit, 1, 8), eightBit);
+
+    // A trailing partial frame
+    std::vector<char> partial = music(100, 2);
+    partial.push_back(1);
+    std::vector<char> encoded;
+    lossless::encodeBlock(partial.data(), partial.size(), 2, 16, encoded);
+    std::vector<char> decoded;
+    ASSERT_TRUE(lossless::decode(encoded.data(), encoded.size(), decoded));
+    EXPECT_EQ(decoded, partial);
+}
+
+TEST_F(LosslessCodecTest, RejectsDamagedBlocks) {
+    std::vector<char> pcm = music(4096, 2);
+    std::vector<char> encoded;
+    lossless::encodeBlock(pcm.data(), pcm.size(), 2, 16, encoded);
+    std::vector<char> decoded;
+
+    // Cut short, or claiming more than is there
+    EXPECT_FALSE(lossless::decode(encoded.data(), encoded.size() - 1, decoded));
+    std::vector<char> oversized = encoded;
+    wire::storeLE(oversized.data(), static_cast<uint32_t>(encoded.size()));
+    EXPECT_FALSE(lossless::decode(oversized.data(), oversized.size(), decoded));
+
+    // Garbage in the bitstream never reads past the block
+    for (size_t i = 9; i < encoded.size(); i += 97) {
+        std::vector<char> damaged = encoded;
+        damaged[i] = static_cast<char>(damaged[i] ^ 0x5A);
+        decoded.clear();
+        lossless::decode(damaged.data(), damaged.size(), decoded);
+    }
+}
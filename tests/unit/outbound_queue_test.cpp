@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "outbound_queue.h"
+
+class OutboundQueueTest : public ::testing::Test {
+protected:
+    const size_t LOW_WATERMARK = 1024;
+    const size_t HIGH_WATERMARK = 4096;
+    const int TEST_PORT = 8998;  // Use a port unlikely to be in use
+    std::shared_ptr<std::vector<char>> payload = std::make_shared<std::vector<char>>(1000, 'x');
+
+    // Queue a frame referencing the shared test payload
+    void pushPayload(OutboundQueue& queue) {
+        queue.pushFrame(MessageType::SONG_DATA, payload->data(), payload->size(), payload);
+    }
+};
+
+TEST_F(OutboundQueueTest, TracksQueuedBytes) {
+    ReactorStats stats;
+    OutboundQueue queue(LOW_WATERMARK, HIGH_WATERMARK, &stats);
+    EXPECT_TRUE(queue.empty());
+
+    pushPayload(queue);
+    queue.pushFrame(MessageType::SONG_DATA_END, nullptr, 0);
+    EXPECT_EQ(queue.size(), 2 * MESSAGE_HEADER_SIZE + payload->size());
+    EXPECT_EQ(stats.queuedBytes.load(), queue.size());
+
+    queue.clear();
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(stats.queuedBytes.load(), 0u);
+    EXPECT_EQ(stats.peakQueueBytes.load(), 2 * MESSAGE_HEADER_SIZE + payload->size());
+}
+
+TEST_F(OutboundQueueTest, ProductionResumesAfterDraining) {
+    ReactorStats stats;
+    OutboundQueue queue(LOW_WATERMARK, HIGH_WATERMARK, &stats);
+
+    while (queue.canProduce()) {
+        pushPayload(queue);
+    }
+    EXPECT_GE(queue.size(), HIGH_WATERMARK);
+    EXPECT_FALSE(queue.canProduce());
+
+    Socket server;
+    ASSERT_TRUE(server.createServer(TEST_PORT));
+    size_t queued = queue.size();
+    std::thread clientThread([this, queued]() {
+        Socket client;
+        ASSERT_TRUE(client.connectToServer("127.0.0.1", TEST_PORT));
+        EXPECT_EQ(client.receive(queued).size(), queued);
+    });
+
+    std::unique_ptr<Socket> accepted(server.acceptClient());
+    ASSERT_NE(accepted, nullptr);
+    accepted->setNonBlocking();
+
+    EXPECT_TRUE(queue.flush(*accepted));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_TRUE(queue.canProduce());
+    clientThread.join();
+}
+
+TEST_F(OutboundQueueTest, ReportsAgeOfOldestFrame) {
+    OutboundQueue queue(LOW_WATERMARK, HIGH_WATERMARK, nullptr);
+    auto now = OutboundQueue::Clock::now();
+    EXPECT_EQ(queue.oldestFrameAge(now), OutboundQueue::Clock::duration::zero());
+
+    pushPayload(queue);
+    auto later = OutboundQueue::Clock::now() + std::chrono::seconds(5);
+    EXPECT_GE(queue.oldestFrameAge(later), std::chrono::seconds(5));
+}
+
+TEST_F(OutboundQueueTest, ControlFramesOvertakeStreamData) {
+    OutboundQueue queue(LOW_WATERMARK, HIGH_WATERMARK, nullptr);
+    queue.pushStreamFrame(1, OutboundQueue::Lane::DATA, MessageType::SONG_DATA, payload->data(),
+                          payload->size(), payload);
+    queue.pushStreamFrame(1, OutboundQueue::Lane::DATA, MessageType::SONG_DATA_END, nullptr, 0);
+    queue.pushFrame(MessageType::ERROR, "late", 4);
+    queue.pushStreamFrame(2, OutboundQueue::Lane::CONTROL, MessageType::SONG_INFO, "info", 4);
+
+    Socket server;
+    ASSERT_TRUE(server.createServer(TEST_PORT));
+    size_t queued = queue.size();
+    std::vector<MessageType> order;
+    std::vector<StreamId> streams;
+    std::thread clientThread([&]() {
+        Socket client;
+        ASSERT_TRUE(client.connectToServer("127.0.0.1", TEST_PORT));
+        std::vector<char> received = client.receive(queued);
+        ASSERT_EQ(received.size(), queued);
+        for (size_t offset = 0; offset < received.size();) {
+            MessageHeader header = decodeMessageHeader(received.data() + offset);
+            order.push_back(header.type);
+            StreamId stream = NO_STREAM;
+            if (header.type != MessageType::ERROR) {
+                stream = wire::loadLE<uint32_t>(received.data() + offset + MESSAGE_HEADER_SIZE);
+            }
+            streams.push_back(stream);
+            offset += MESSAGE_HEADER_SIZE + header.size;
+        }
+    });
+
+    std::unique_ptr<Socket> accepted(server.acceptClient());
+    ASSERT_NE(accepted, nullptr);
+    accepted->setNonBlocking();
+    EXPECT_TRUE(queue.flush(*accepted));
+    clientThread.join();
+
+    // Control frames first, in queueing order, then the data of stream 1
+    std::vector<MessageType> expected = {MessageType::ERROR, MessageType::SONG_INFO, MessageType::SONG_DATA,
+                                         MessageType::SONG_DATA_END};
+    EXPECT_EQ(order, expected);
+    EXPECT_EQ(streams, (std::vector<StreamId>{NO_STREAM, 2, 1, 1}));
+}
+
+TEST_F(OutboundQueueTest, CancelDropsUnsentFramesOfOneStream) {
+    ReactorStats stats;
+    OutboundQueue queue(LOW_WATERMARK, HIGH_WATERMARK, &stats);
+    while (queue.canProduce()) {
+        queue.pushStreamFrame(1, OutboundQueue::Lane::DATA, MessageType::SONG_DATA, payload->data(),
+                              payload->size(), payload);
+    }
+    queue.pushStreamFrame(2, OutboundQueue::Lane::CONTROL, MessageType::SONG_INFO, "info", 4);
+    queue.pushFrame(MessageType::ERROR, "error", 5);
+    size_t kept = (STREAM_PREFIX_SIZE + 4) + (MESSAGE_HEADER_SIZE + 5);
+
+    // Only stream 1 goes, and producers may resume
+    queue.cancelStream(1);
+    EXPECT_EQ(queue.size(), kept);
+    EXPECT_EQ(stats.queuedBytes.load(), kept);
+    EXPECT_TRUE(queue.canProduce());
+
+    queue.cancelStream(2);
+    EXPECT_EQ(queue.size(), MESSAGE_HEADER_SIZE + 5);
+    EXPECT_FALSE(queue.empty());
+}
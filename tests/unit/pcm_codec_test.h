@@ -0,0 +1,49 @@
+#ifndef PCM_CODEC_TEST_H
+#define PCM_CODEC_TEST_H
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "codec_block.h"
+
+// Fixture for the block codecs: PCM that sounds like music, and a round
+// trip through a codec's encodeBlock and decode
+template<void (*EncodeBlock)(const char*, size_t, uint16_t, uint16_t, std::vector<char>&),
+         bool (*Decode)(const char*, size_t, std::vector<char>&)>
+class PcmCodecTest : public ::testing::Test {
+protected:
+    // 16-bit PCM of a few sines plus a little noise, like music
+    std::vector<char> music(size_t frames, uint16_t channels) {
+        std::vector<char> pcm(frames * channels * 2);
+        uint32_t state = 1;
+        for (size_t i = 0; i < frames; ++i) {
+            for (uint16_t c = 0; c < channels; ++c) {
+                state = state * 1103515245 + 12345;
+                double t = static_cast<double>(i) / 44100;
+                double value = 9000 * std::sin(2 * M_PI * 220 * t + c) + 4000 * std::sin(2 * M_PI * 1375 * t) +
+                               static_cast<int>((state >> 16) % 64) - 32;
+                wire::storeLE(pcm.data() + (i * channels + c) * 2, static_cast<uint16_t>(static_cast<int16_t>(value)));
+            }
+        }
+        return pcm;
+    }
+
+    // Encode in blocks and decode the whole stream again
+    std::vector<char> roundTrip(const std::vector<char>& pcm, uint16_t channels, uint16_t bits,
+                                size_t* encodedSize = nullptr) {
+        size_t blockBytes = codec_block::BLOCK_FRAMES * channels * (bits / 8);
+        std::vector<char> encoded;
+        for (size_t start = 0; start < pcm.size(); start += blockBytes) {
+            EncodeBlock(pcm.data() + start, std::min(blockBytes, pcm.size() - start), channels, bits, encoded);
+        }
+        if (encodedSize) {
+            *encodedSize = encoded.size();
+        }
+        std::vector<char> decoded;
+        EXPECT_TRUE(Decode(encoded.data(), encoded.size(), decoded));
+        return decoded;
+    }
+};
+
+#endif // PCM_CODEC_TEST_H
@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
 #include "protocol.h"
-#include <vector>
+#include "catalog_sync.h"
+#include "crc32c.h"
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <vector>
 
 class ProtocolTest : public ::testing::Test {
 protected:
@@ -10,169 +14,265 @@ protected:
     }
 };
 
+TEST_F(ProtocolTest, HeaderIsPackedLittleEndian) {
+    EncodedHeader header = makeMessageHeader(MessageType::SONG_DATA, 0x01020304);
+    ASSERT_EQ(header.size(), 5u);
+    EXPECT_EQ(header[0], static_cast<char>(MessageType::SONG_DATA));
+    EXPECT_EQ(header[1], 0x04);
+    EXPECT_EQ(header[2], 0x03);
+    EXPECT_EQ(header[3], 0x02);
+    EXPECT_EQ(header[4], 0x01);
+
+    MessageHeader decoded = decodeMessageHeader(header.data());
+    EXPECT_EQ(decoded.type, MessageType::SONG_DATA);
+    EXPECT_EQ(decoded.size, 0x01020304u);
+}
+
 TEST_F(ProtocolTest, StringSerializationDeserialization) {
-    // Test serializing a string
     std::string testString = "Hello, World!";
-    std::vector<char> serialized = serializeMessage<std::string>(MessageType::SONG_REQUEST, testString);
-    
-    // Verify header
-    ASSERT_GE(serialized.size(), sizeof(MessageHeader));
-    MessageHeader* header = reinterpret_cast<MessageHeader*>(serialized.data());
-    EXPECT_EQ(header->type, MessageType::SONG_REQUEST);
-    EXPECT_EQ(header->size, testString.size());
-    
-    // Verify payload
-    std::string deserializedString(serialized.data() + sizeof(MessageHeader), 
-                                   serialized.data() + sizeof(MessageHeader) + header->size);
-    EXPECT_EQ(deserializedString, testString);
+    char frame[64];
+    size_t size = SongRequestMessage::encode(frame, sizeof(frame), StreamId(3), std::string_view(testString));
+    ASSERT_EQ(size, STREAM_PREFIX_SIZE + testString.size());
+
+    MessageHeader header = decodeMessageHeader(frame);
+    EXPECT_EQ(header.type, MessageType::SONG_REQUEST);
+    EXPECT_EQ(header.size, 4 + testString.size());
+
+    // The decoded name is a view of the frame
+    StreamId stream = NO_STREAM;
+    std::string_view name;
+    ASSERT_TRUE(SongRequestMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, header.size),
+                                           stream, name));
+    EXPECT_EQ(stream, 3u);
+    EXPECT_EQ(name, testString);
+    EXPECT_EQ(name.data(), frame + STREAM_PREFIX_SIZE);
+
+    // Frames that do not fit are not written
+    EXPECT_EQ(SongRequestMessage::encode(frame, 10, StreamId(3), std::string_view(testString)), 0u);
 }
 
 TEST_F(ProtocolTest, StringVectorSerializationDeserialization) {
-    // Test serializing a vector of strings
-    std::vector<std::string> testStrings = {"First song", "Second song", "Third song"};
-    std::vector<char> serialized = serializeMessage<std::vector<std::string>>(
-        MessageType::LIST_RESPONSE, testStrings);
-    
-    // Verify header
-    ASSERT_GE(serialized.size(), sizeof(MessageHeader));
-    MessageHeader* header = reinterpret_cast<MessageHeader*>(serialized.data());
-    EXPECT_EQ(header->type, MessageType::LIST_RESPONSE);
-    
-    // Calculate expected size
-    size_t expectedSize = 0;
+    std::vector<std::string> testStrings = {"First song", "", "Third song"};
+    std::vector<char> frame(SongListMessage::frameSize(testStrings));
+    ASSERT_EQ(SongListMessage::encode(frame.data(), frame.size(), testStrings), frame.size());
+
+    MessageHeader header = decodeMessageHeader(frame.data());
+    EXPECT_EQ(header.type, MessageType::LIST_RESPONSE);
+    size_t expectedSize = 4;
     for (const auto& str : testStrings) {
-        expectedSize += sizeof(uint32_t) + str.size();
-    }
-    EXPECT_EQ(header->size, expectedSize);
-    
-    // Manual deserialization to verify contents
-    const char* data = serialized.data() + sizeof(MessageHeader);
-    std::vector<std::string> deserializedStrings;
-    
-    size_t offset = 0;
-    while (offset < header->size) {
-        uint32_t strSize = *reinterpret_cast<const uint32_t*>(data + offset);
-        offset += sizeof(uint32_t);
-        
-        std::string str(data + offset, data + offset + strSize);
-        deserializedStrings.push_back(str);
-        offset += strSize;
-    }
-    
-    ASSERT_EQ(deserializedStrings.size(), testStrings.size());
-    for (size_t i = 0; i < testStrings.size(); i++) {
-        EXPECT_EQ(deserializedStrings[i], testStrings[i]);
+        expectedSize += 4 + str.size();
     }
+    EXPECT_EQ(header.size, expectedSize);
+
+    std::string_view payload(frame.data() + MESSAGE_HEADER_SIZE, header.size);
+    EXPECT_EQ(payload, std::string_view(serializeStringList(testStrings).data(), expectedSize));
+
+    wire::StringListView songs;
+    ASSERT_TRUE(SongListMessage::decode(payload, songs));
+    ASSERT_EQ(songs.size(), testStrings.size());
+    EXPECT_EQ(std::vector<std::string>(songs.begin(), songs.end()), testStrings);
+
+    // A length running past the payload is rejected
+    EXPECT_FALSE(SongListMessage::decode(payload.substr(0, payload.size() - 1), songs));
+    EXPECT_FALSE(SongListMessage::decode(std::string_view(), songs));
 }
 
 TEST_F(ProtocolTest, ControlMessageSerialization) {
-    // Test play control message
-    ControlMessage playMsg;
-    playMsg.command = PlayControl::PLAY;
-    playMsg.seekPosition = 0;  // Not used for PLAY
-    
-    std::vector<char> serialized = serializeMessage<ControlMessage>(
-        MessageType::PLAY_CONTROL, playMsg);
-    
-    // Verify header
-    ASSERT_GE(serialized.size(), sizeof(MessageHeader));
-    MessageHeader* header = reinterpret_cast<MessageHeader*>(serialized.data());
-    EXPECT_EQ(header->type, MessageType::PLAY_CONTROL);
-    EXPECT_EQ(header->size, sizeof(ControlMessage));
-    
-    // Verify payload
-    ControlMessage* deserializedMsg = reinterpret_cast<ControlMessage*>(
-        serialized.data() + sizeof(MessageHeader));
-    EXPECT_EQ(deserializedMsg->command, PlayControl::PLAY);
-    
-    // Test seek control message
-    ControlMessage seekMsg;
-    seekMsg.command = PlayControl::SEEK;
-    seekMsg.seekPosition = 30.5f;  // Seek to 30.5 seconds
-    
-    serialized = serializeMessage<ControlMessage>(MessageType::PLAY_CONTROL, seekMsg);
-    
-    // Verify header
-    header = reinterpret_cast<MessageHeader*>(serialized.data());
-    EXPECT_EQ(header->type, MessageType::PLAY_CONTROL);
-    EXPECT_EQ(header->size, sizeof(ControlMessage));
-    
-    // Verify payload
-    deserializedMsg = reinterpret_cast<ControlMessage*>(
-        serialized.data() + sizeof(MessageHeader));
-    EXPECT_EQ(deserializedMsg->command, PlayControl::SEEK);
-    EXPECT_FLOAT_EQ(deserializedMsg->seekPosition, 30.5f);
+    char frame[PlayControlMessage::FRAME_SIZE];
+    ASSERT_EQ(PlayControlMessage::encode(frame, sizeof(frame), StreamId(4), PlayControl::SEEK, 30.5), sizeof(frame));
+
+    MessageHeader header = decodeMessageHeader(frame);
+    EXPECT_EQ(header.type, MessageType::PLAY_CONTROL);
+    EXPECT_EQ(header.size, 13u);
+
+    StreamId stream;
+    PlayControl command;
+    double position;
+    ASSERT_TRUE(PlayControlMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, header.size),
+                                           stream, command, position));
+    EXPECT_EQ(stream, 4u);
+    EXPECT_EQ(command, PlayControl::SEEK);
+    EXPECT_DOUBLE_EQ(position, 30.5);
+
+    // Short payloads are rejected; bytes after the last field are ignored
+    EXPECT_FALSE(PlayControlMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, 12), stream, command,
+                                            position));
+    char longer[16] = {};
+    memcpy(longer, frame + MESSAGE_HEADER_SIZE, header.size);
+    EXPECT_TRUE(PlayControlMessage::decode(std::string_view(longer, sizeof(longer)), stream, command, position));
 }
 
-TEST_F(ProtocolTest, WavHeaderSerialization) {
-    // Create a sample WAV header
-    WavHeader wavHeader;
-    wavHeader.riffHeader = 0x46464952;  // "RIFF" in little endian
-    wavHeader.chunkSize = 36 + 1000;    // 1000 bytes of audio data + 36 header bytes
-    wavHeader.waveHeader = 0x45564157;  // "WAVE" in little endian
-    wavHeader.fmtHeader = 0x20746D66;   // "fmt " in little endian
-    wavHeader.subchunk1Size = 16;
-    wavHeader.audioFormat = 1;         // PCM
-    wavHeader.numChannels = 2;         // Stereo
-    wavHeader.sampleRate = 44100;
-    wavHeader.byteRate = 176400;       // 44100 * 2 * 2
-    wavHeader.blockAlign = 4;          // 2 * 2
-    wavHeader.bitsPerSample = 16;
-    wavHeader.dataHeader = 0x61746164; // "data" in little endian
-    wavHeader.subchunk2Size = 1000;    // 1000 bytes of audio data
-    
-    std::vector<char> serialized = serializeMessage<WavHeader>(
-        MessageType::SONG_INFO, wavHeader);
-    
-    // Verify header
-    ASSERT_GE(serialized.size(), sizeof(MessageHeader));
-    MessageHeader* header = reinterpret_cast<MessageHeader*>(serialized.data());
-    EXPECT_EQ(header->type, MessageType::SONG_INFO);
-    EXPECT_EQ(header->size, sizeof(WavHeader));
-    
-    // Verify payload
-    WavHeader* deserializedHeader = reinterpret_cast<WavHeader*>(
-        serialized.data() + sizeof(MessageHeader));
-    
-    EXPECT_EQ(deserializedHeader->riffHeader, wavHeader.riffHeader);
-    EXPECT_EQ(deserializedHeader->chunkSize, wavHeader.chunkSize);
-    EXPECT_EQ(deserializedHeader->waveHeader, wavHeader.waveHeader);
-    EXPECT_EQ(deserializedHeader->fmtHeader, wavHeader.fmtHeader);
-    EXPECT_EQ(deserializedHeader->subchunk1Size, wavHeader.subchunk1Size);
-    EXPECT_EQ(deserializedHeader->audioFormat, wavHeader.audioFormat);
-    EXPECT_EQ(deserializedHeader->numChannels, wavHeader.numChannels);
-    EXPECT_EQ(deserializedHeader->sampleRate, wavHeader.sampleRate);
-    EXPECT_EQ(deserializedHeader->byteRate, wavHeader.byteRate);
-    EXPECT_EQ(deserializedHeader->blockAlign, wavHeader.blockAlign);
-    EXPECT_EQ(deserializedHeader->bitsPerSample, wavHeader.bitsPerSample);
-    EXPECT_EQ(deserializedHeader->dataHeader, wavHeader.dataHeader);
-    EXPECT_EQ(deserializedHeader->subchunk2Size, wavHeader.subchunk2Size);
+TEST_F(ProtocolTest, TrackRequestIsLittleEndian) {
+    char frame[TrackRequestMessage::FRAME_SIZE];
+    ASSERT_EQ(TrackRequestMessage::encode(frame, sizeof(frame), StreamId(7), TrackId(0x0102030405060708ULL),
+                                          uint64_t(44100), uint64_t(0)),
+              33u);
+    EXPECT_EQ(frame[MESSAGE_HEADER_SIZE], 0x07);
+    EXPECT_EQ(frame[STREAM_PREFIX_SIZE], 0x08);
+    EXPECT_EQ(frame[STREAM_PREFIX_SIZE + 7], 0x01);
+    EXPECT_EQ(static_cast<uint8_t>(frame[STREAM_PREFIX_SIZE + 8]), 0x44);
+    EXPECT_EQ(frame[STREAM_PREFIX_SIZE + 9], static_cast<char>(0xAC));
+
+    StreamId stream = NO_STREAM;
+    TrackId track = NO_TRACK;
+    uint64_t firstFrame = 0;
+    uint64_t frameCount = 1;
+    ASSERT_TRUE(TrackRequestMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, 28), stream, track,
+                                            firstFrame, frameCount));
+    EXPECT_EQ(stream, 7u);
+    EXPECT_EQ(track, 0x0102030405060708ULL);
+    EXPECT_EQ(firstFrame, 44100u);
+    EXPECT_EQ(frameCount, 0u);
+
+    // A request without a range is malformed
+    EXPECT_FALSE(TrackRequestMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, 12), stream, track,
+                                             firstFrame, frameCount));
+}
+
+TEST_F(ProtocolTest, SongInfoCarriesStartFrame) {
+    WavHeader header = {};
+    header.sampleRate = 44100;
+    std::string_view headerBytes(reinterpret_cast<const char*>(&header), sizeof(header));
+    char frame[SongInfoMessage::FRAME_SIZE + sizeof(WavHeader)];
+    ASSERT_EQ(SongInfoMessage::encode(frame, sizeof(frame), StreamId(3), uint64_t(88200), headerBytes),
+              sizeof(frame));
+
+    StreamId stream = NO_STREAM;
+    uint64_t firstFrame = 0;
+    std::string_view decoded;
+    std::string_view payload(frame + MESSAGE_HEADER_SIZE, sizeof(frame) - MESSAGE_HEADER_SIZE);
+    ASSERT_TRUE(SongInfoMessage::decode(payload, stream, firstFrame, decoded));
+    EXPECT_EQ(stream, 3u);
+    EXPECT_EQ(firstFrame, 88200u);
+    ASSERT_EQ(decoded.size(), sizeof(WavHeader));
+    EXPECT_EQ(memcmp(decoded.data(), &header, sizeof(WavHeader)), 0);
+}
+
+TEST_F(ProtocolTest, HelloNegotiationRoundTrip) {
+    char hello[HelloMessage::FRAME_SIZE];
+    ASSERT_EQ(HelloMessage::encode(hello, sizeof(hello), PROTOCOL_VERSION, uint32_t(1 << 20),
+                                   codecBit(Codec::PCM), 10.0, uint32_t(131072)),
+              sizeof(hello));
+    uint32_t version = 0;
+    uint32_t maxChunk = 0;
+    CodecSet codecs = 0;
+    double windowSeconds = 0;
+    uint32_t receiveBuffer = 0;
+    ASSERT_TRUE(HelloMessage::decode(std::string_view(hello + MESSAGE_HEADER_SIZE, sizeof(hello) - MESSAGE_HEADER_SIZE),
+                                     version, maxChunk, codecs, windowSeconds, receiveBuffer));
+    EXPECT_EQ(version, PROTOCOL_VERSION);
+    EXPECT_EQ(maxChunk, 1u << 20);
+    EXPECT_EQ(codecs, 1u);
+    EXPECT_EQ(windowSeconds, 10.0);
+    EXPECT_EQ(receiveBuffer, 131072u);
+
+    char ack[HelloAckMessage::FRAME_SIZE];
+    ASSERT_EQ(HelloAckMessage::encode(ack, sizeof(ack), PROTOCOL_VERSION, uint32_t(65536), uint32_t(16384),
+                                      Codec::PCM, 5.0, uint32_t(65536)),
+              sizeof(ack));
+    uint32_t chunkSize = 0;
+    uint32_t firstChunkSize = 0;
+    Codec codec = Codec::PCM;
+    uint32_t startBytes = 0;
+    ASSERT_TRUE(HelloAckMessage::decode(std::string_view(ack + MESSAGE_HEADER_SIZE, sizeof(ack) - MESSAGE_HEADER_SIZE),
+                                        version, chunkSize, firstChunkSize, codec, windowSeconds, startBytes));
+    EXPECT_EQ(chunkSize, 65536u);
+    EXPECT_EQ(firstChunkSize, 16384u);
+    EXPECT_EQ(windowSeconds, 5.0);
+    EXPECT_EQ(startBytes, 65536u);
+}
+
+TEST_F(ProtocolTest, SessionResumeRoundTrip) {
+    char frame[SessionResumeMessage::FRAME_SIZE];
+    ASSERT_EQ(SessionResumeMessage::encode(frame, sizeof(frame), SessionToken(0x1122334455667788),
+                                           StreamId(4), TrackId(99), uint64_t(441000)),
+              sizeof(frame));
+    EXPECT_EQ(static_cast<uint8_t>(frame[MESSAGE_HEADER_SIZE]), 0x88);
+
+    SessionToken token = NO_SESSION;
+    StreamId stream = NO_STREAM;
+    TrackId track = NO_TRACK;
+    uint64_t firstFrame = 0;
+    std::string_view payload(frame + MESSAGE_HEADER_SIZE, sizeof(frame) - MESSAGE_HEADER_SIZE);
+    ASSERT_TRUE(SessionResumeMessage::decode(payload, token, stream, track, firstFrame));
+    EXPECT_EQ(token, 0x1122334455667788u);
+    EXPECT_EQ(stream, 4u);
+    EXPECT_EQ(track, 99u);
+    EXPECT_EQ(firstFrame, 441000u);
 }
 
 TEST_F(ProtocolTest, AudioDataSerialization) {
-    // Create some sample audio data
     const size_t dataSize = 1024;
     std::vector<char> audioData(dataSize);
     for (size_t i = 0; i < dataSize; i++) {
-        audioData[i] = static_cast<char>(i % 256);  // Fill with pattern
+        audioData[i] = static_cast<char>(i % 256);
     }
-    
-    // Test serializing audio data with different chunk sizes
+
+    char frame[SONG_DATA_PREFIX_SIZE + 256];
     for (size_t offset = 0; offset < dataSize; offset += 256) {
-        size_t chunkSize = std::min(256UL, dataSize - offset);
-        std::vector<char> serialized = serializeAudioData(
-            audioData.data() + offset, chunkSize);
-        
-        // Verify header
-        ASSERT_GE(serialized.size(), sizeof(MessageHeader));
-        MessageHeader* header = reinterpret_cast<MessageHeader*>(serialized.data());
-        EXPECT_EQ(header->type, MessageType::SONG_DATA);
-        EXPECT_EQ(header->size, chunkSize);
-        
-        // Verify payload
-        const char* deserializedData = serialized.data() + sizeof(MessageHeader);
-        for (size_t i = 0; i < chunkSize; i++) {
-            EXPECT_EQ(deserializedData[i], audioData[offset + i]);
-        }
+        std::string_view chunk(audioData.data() + offset, 256);
+        uint32_t crc = crc32c::compute(chunk.data(), chunk.size());
+        ASSERT_EQ(SongDataMessage::encode(frame, sizeof(frame), StreamId(2), uint64_t(offset), crc, chunk),
+                  sizeof(frame));
+
+        // A prefix built for a body sent separately matches
+        SongDataPrefix prefix = makeSongDataPrefix(2, offset, crc, chunk.size());
+        EXPECT_EQ(std::string_view(frame, SONG_DATA_PREFIX_SIZE), std::string_view(prefix.data(), prefix.size()));
+
+        MessageHeader header = decodeMessageHeader(frame);
+        EXPECT_EQ(header.type, MessageType::SONG_DATA);
+        StreamId stream = NO_STREAM;
+        uint64_t audioOffset = 0;
+        uint32_t audioCrc = 0;
+        std::string_view audio;
+        ASSERT_TRUE(SongDataMessage::decode(std::string_view(frame + MESSAGE_HEADER_SIZE, header.size),
+                                            stream, audioOffset, audioCrc, audio));
+        EXPECT_EQ(stream, 2u);
+        EXPECT_EQ(audioOffset, offset);
+        EXPECT_EQ(audioCrc, crc32c::compute(audio.data(), audio.size()));
+        EXPECT_EQ(audio, chunk);
     }
-}
\ No newline at end of file
+
+    EXPECT_EQ(SongDataEndMessage::encode(frame, sizeof(frame), StreamId(2)), STREAM_PREFIX_SIZE);
+    EXPECT_EQ(decodeMessageHeader(frame).size, 4u);
+}
+
+TEST_F(ProtocolTest, FrontCodedSnapshotRoundTrip) {
+    std::vector<std::string> names = {"album/disc1/01.wav", "album/disc1/02.wav", "album/disc2/01.wav", "b.wav"};
+    std::vector<char> payload = encodeListSnapshot(42, names);
+
+    // Shared prefixes are stored once
+    size_t rawSize = 0;
+    for (const auto& name : names) {
+        rawSize += name.size();
+    }
+    EXPECT_LT(payload.size(), ListSnapshotMessage::MIN_SIZE + rawSize);
+
+    uint64_t version = 0;
+    std::vector<std::string> decoded;
+    ASSERT_TRUE(decodeListSnapshot(payload.data(), payload.size(), version, decoded));
+    EXPECT_EQ(version, 42u);
+    EXPECT_EQ(decoded, names);
+
+    // Truncated data is rejected
+    EXPECT_FALSE(decodeListSnapshot(payload.data(), payload.size() - 1, version, decoded));
+}
+
+TEST_F(ProtocolTest, ListDeltaRoundTripAndApply) {
+    std::vector<std::string> removed = {"a.wav", "c.wav"};
+    std::vector<std::string> added = {"b.wav", "d/e.wav"};
+    std::vector<char> payload = encodeListDelta(1, 2, removed, added);
+
+    ListDeltaHeader header;
+    std::vector<std::string> decodedRemoved;
+    std::vector<std::string> decodedAdded;
+    ASSERT_TRUE(decodeListDelta(payload.data(), payload.size(), header, decodedRemoved, decodedAdded));
+    EXPECT_EQ(header.fromVersion, 1u);
+    EXPECT_EQ(header.toVersion, 2u);
+    EXPECT_EQ(decodedRemoved, removed);
+    EXPECT_EQ(decodedAdded, added);
+
+    std::vector<std::string> list = {"a.wav", "c.wav", "z.wav"};
+    EXPECT_EQ(applyListDelta(list, decodedRemoved, decodedAdded),
+              (std::vector<std::string>{"b.wav", "d/e.wav", "z.wav"}));
+}
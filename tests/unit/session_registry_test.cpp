@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "session_registry.h"
+#include <thread>
+
+class SessionRegistryTest : public ::testing::Test {
+protected:
+    std::vector<SessionRegistry::ParkedStream> oneStream(StreamId id, TrackId track) {
+        SessionRegistry::ParkedStream stream;
+        stream.id = id;
+        stream.track = track;
+        stream.endFrame = 1000;
+        stream.paused = true;
+        return {stream};
+    }
+};
+
+TEST_F(SessionRegistryTest, TokensAreNeverNoSession) {
+    SessionRegistry registry(60.0);
+    SessionToken first = registry.issueToken();
+    SessionToken second = registry.issueToken();
+    EXPECT_NE(first, NO_SESSION);
+    EXPECT_NE(second, NO_SESSION);
+    EXPECT_NE(first, second);
+}
+
+TEST_F(SessionRegistryTest, ResumeTakesParkedStreamOnce) {
+    SessionRegistry registry(60.0);
+    SessionToken token = registry.issueToken();
+    registry.park(token, oneStream(3, 42));
+    EXPECT_EQ(registry.size(), 1u);
+
+    SessionRegistry::ParkedStream stream;
+    EXPECT_FALSE(registry.resume(registry.issueToken(), 3, stream));
+    ASSERT_TRUE(registry.resume(token, 3, stream));
+    EXPECT_EQ(stream.id, 3u);
+    EXPECT_EQ(stream.track, 42u);
+    EXPECT_EQ(stream.endFrame, 1000u);
+    EXPECT_TRUE(stream.paused);
+
+    // A stream resumes once
+    EXPECT_FALSE(registry.resume(token, 3, stream));
+    EXPECT_EQ(registry.size(), 0u);
+}
+
+TEST_F(SessionRegistryTest, ResumingOneStreamLeavesTheOthersParked) {
+    SessionRegistry registry(60.0);
+    SessionToken token = registry.issueToken();
+    std::vector<SessionRegistry::ParkedStream> streams = oneStream(3, 42);
+    streams.push_back(oneStream(5, 43)[0]);
+    registry.park(token, std::move(streams));
+
+    SessionRegistry::ParkedStream stream;
+    EXPECT_FALSE(registry.resume(token, 4, stream));
+    ASSERT_TRUE(registry.resume(token, 5, stream));
+    EXPECT_EQ(stream.id, 5u);
+    EXPECT_EQ(stream.track, 43u);
+    EXPECT_FALSE(registry.resume(token, 5, stream));
+    EXPECT_EQ(registry.size(), 1u);
+
+    // The other stream is still there; taking it ends the session
+    ASSERT_TRUE(registry.resume(token, 3, stream));
+    EXPECT_EQ(stream.id, 3u);
+    EXPECT_EQ(stream.track, 42u);
+    EXPECT_EQ(registry.size(), 0u);
+}
+
+TEST_F(SessionRegistryTest, ParkedStreamsExpire) {
+    SessionRegistry registry(0.05);
+    SessionToken token = registry.issueToken();
+    registry.park(token, oneStream(1, 7));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    SessionRegistry::ParkedStream stream;
+    EXPECT_FALSE(registry.resume(token, 1, stream));
+    EXPECT_EQ(registry.size(), 0u);
+}
+
+TEST_F(SessionRegistryTest, NothingIsKeptWhenDisabled) {
+    SessionRegistry registry(0);
+    SessionToken token = registry.issueToken();
+    registry.park(token, oneStream(1, 7));
+    EXPECT_EQ(registry.size(), 0u);
+    registry.park(NO_SESSION, oneStream(1, 7));
+    EXPECT_EQ(registry.size(), 0u);
+}
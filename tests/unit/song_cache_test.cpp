@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
+#include "song_cache.h"
+
+class SongCacheTest : public ::testing::Test {
+protected:
+    std::atomic<int> loads{0};
+
+    // Loader that counts calls and takes long enough for requests to overlap
+    SongCache::Loader slowLoader(bool succeed) {
+        return [this, succeed](TrackId trackId, SongCache::Callback done) {
+            loads.fetch_add(1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            done(succeed ? std::make_shared<WavFile>(std::to_string(trackId)) : nullptr);
+        };
+    }
+};
+
+TEST_F(SongCacheTest, ConcurrentMissesLoadOnce) {
+    SongCache cache(slowLoader(true));
+
+    std::vector<std::shared_ptr<WavFile>> results(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); ++i) {
+        threads.emplace_back([&cache, &results, i]() { results[i] = cache.get(trackIdOf("popular.wav")); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(loads.load(), 1);
+    ASSERT_NE(results[0], nullptr);
+    for (const auto& song : results) {
+        EXPECT_EQ(song, results[0]);
+    }
+}
+
+TEST_F(SongCacheTest, HitsReturnCachedSong) {
+    SongCache cache(slowLoader(true));
+    EXPECT_FALSE(cache.contains(trackIdOf("a.wav")));
+
+    auto first = cache.get(trackIdOf("a.wav"));
+    auto second = cache.get(trackIdOf("a.wav"));
+    auto other = cache.get(trackIdOf("b.wav"));
+
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_EQ(first, second);
+    EXPECT_NE(first, other);
+    EXPECT_EQ(loads.load(), 2);
+}
+
+TEST_F(SongCacheTest, FailedLoadIsRetried) {
+    SongCache cache(slowLoader(false));
+
+    EXPECT_EQ(cache.get(trackIdOf("missing.wav")), nullptr);
+    EXPECT_FALSE(cache.contains(trackIdOf("missing.wav")));
+    EXPECT_EQ(cache.get(trackIdOf("missing.wav")), nullptr);
+    EXPECT_EQ(loads.load(), 2);
+}
+
+TEST_F(SongCacheTest, LookupQueuesWaitersUntilLoadCompletes) {
+    // Loader that leaves the load pending until the test completes it
+    SongCache::Callback pending;
+    SongCache cache([&pending](TrackId, SongCache::Callback done) { pending = std::move(done); });
+
+    std::vector<std::shared_ptr<WavFile>> delivered;
+    auto waiter = [&delivered](std::shared_ptr<WavFile> song) { delivered.push_back(song); };
+    EXPECT_EQ(cache.lookup(trackIdOf("slow.wav"), waiter), nullptr);
+    EXPECT_EQ(cache.lookup(trackIdOf("slow.wav"), waiter), nullptr);
+    ASSERT_TRUE(pending);
+    EXPECT_TRUE(delivered.empty());
+
+    auto song = std::make_shared<WavFile>("slow.wav");
+    pending(song);
+    ASSERT_EQ(delivered.size(), 2u);
+    EXPECT_EQ(delivered[0], song);
+    EXPECT_EQ(delivered[1], song);
+
+    // Once loaded, lookups answer directly without queueing the callback
+    EXPECT_EQ(cache.lookup(trackIdOf("slow.wav"), waiter), song);
+    EXPECT_EQ(delivered.size(), 2u);
+}
+
+TEST_F(SongCacheTest, InvalidatedSongsAreLoadedAgain) {
+    SongCache cache(slowLoader(true));
+    auto first = cache.get(trackIdOf("a.wav"));
+
+    cache.invalidate({trackIdOf("a.wav"), trackIdOf("never-loaded.wav")});
+    EXPECT_FALSE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_EQ(cache.getStats().residentSongs.load(), 0u);
+
+    auto second = cache.get(trackIdOf("a.wav"));
+    EXPECT_NE(first, second);
+    EXPECT_EQ(loads.load(), 2);
+    EXPECT_EQ(cache.getStats().residentSongs.load(), 1u);
+}
+
+TEST_F(SongCacheTest, LoadInvalidatedInFlightIsNotCached) {
+    SongCache::Callback pending;
+    SongCache cache([&pending](TrackId, SongCache::Callback done) { pending = std::move(done); });
+
+    std::shared_ptr<WavFile> delivered;
+    EXPECT_EQ(cache.lookup(trackIdOf("slow.wav"), [&delivered](std::shared_ptr<WavFile> song) { delivered = song; }),
+              nullptr);
+    cache.invalidate({trackIdOf("slow.wav")});
+
+    // The waiter still gets the song, but the next request reloads it
+    auto song = std::make_shared<WavFile>("slow.wav");
+    pending(song);
+    EXPECT_EQ(delivered, song);
+    EXPECT_FALSE(cache.contains(trackIdOf("slow.wav")));
+    EXPECT_EQ(cache.getStats().residentSongs.load(), 0u);
+}
+
+class SongCacheBudgetTest : public ::testing::Test {
+protected:
+    std::string testDir;
+
+    std::map<TrackId, std::string> songNames;  // What the catalog would resolve
+
+    void SetUp() override {
+        testDir = "bin/test_data/song_cache_test";
+        std::filesystem::create_directories(testDir);
+        for (const char* name : {"a.wav", "b.wav", "c.wav"}) {
+            createWavFile(testDir + "/" + name, SONG_BYTES);
+            songNames[trackIdOf(name)] = name;
+        }
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    const uint32_t SONG_BYTES = 1000;
+    const size_t ENTRY_BYTES = sizeof(WavHeader) + SONG_BYTES;
+
+    void createWavFile(const std::string& path, uint32_t dataSize) {
+        WavHeader header;
+        memcpy(header.riff, "RIFF", 4);
+        header.fileSize = 36 + dataSize;
+        memcpy(header.wave, "WAVE", 4);
+        memcpy(header.fmt, "fmt ", 4);
+        header.fmtSize = 16;
+        header.audioFormat = 1;
+        header.numChannels = 1;
+        header.sampleRate = 8000;
+        header.byteRate = 8000;
+        header.blockAlign = 1;
+        header.bitsPerSample = 8;
+        memcpy(header.data, "data", 4);
+        header.dataSize = dataSize;
+
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> samples(dataSize, 0);
+        file.write(samples.data(), samples.size());
+    }
+
+    SongCache::Loader fileLoader() {
+        return [this](TrackId trackId, SongCache::Callback done) {
+            auto song = std::make_shared<WavFile>(testDir + "/" + songNames[trackId]);
+            done(song->load() ? song : nullptr);
+        };
+    }
+};
+
+TEST_F(SongCacheBudgetTest, EvictsLeastRecentlyUsed) {
+    SongCache cache(fileLoader(), 2 * ENTRY_BYTES);
+
+    cache.get(trackIdOf("a.wav"));
+    cache.get(trackIdOf("b.wav"));
+    cache.get(trackIdOf("a.wav"));  // b is now least recently used
+    cache.get(trackIdOf("c.wav"));
+
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_FALSE(cache.contains(trackIdOf("b.wav")));
+    EXPECT_TRUE(cache.contains(trackIdOf("c.wav")));
+
+    const CacheStats& stats = cache.getStats();
+    EXPECT_EQ(stats.hits.load(), 1u);
+    EXPECT_EQ(stats.misses.load(), 3u);
+    EXPECT_EQ(stats.evictions.load(), 1u);
+    EXPECT_EQ(stats.residentBytes.load(), 2 * ENTRY_BYTES);
+    EXPECT_EQ(stats.residentSongs.load(), 2u);
+}
+
+TEST_F(SongCacheBudgetTest, PinnedSongsAreNotEvicted) {
+    SongCache cache(fileLoader(), ENTRY_BYTES);
+
+    auto streaming = cache.get(trackIdOf("a.wav"));
+    auto other = cache.get(trackIdOf("b.wav"));
+
+    // Both songs are held, so the cache runs over budget rather than drop one
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_TRUE(cache.contains(trackIdOf("b.wav")));
+    EXPECT_EQ(cache.getStats().residentBytes.load(), 2 * ENTRY_BYTES);
+
+    // Once released, the next load can reclaim the space
+    other.reset();
+    cache.get(trackIdOf("c.wav"));
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_FALSE(cache.contains(trackIdOf("b.wav")));
+    EXPECT_EQ(cache.getStats().residentSongs.load(), 2u);
+}
+
+TEST_F(SongCacheBudgetTest, ColdSongDoesNotDisplacePopularOne) {
+    SongCache cache(fileLoader(), ENTRY_BYTES);
+
+    for (int i = 0; i < 5; ++i) {
+        cache.get(trackIdOf("a.wav"));
+    }
+
+    // A one-off request is served but not kept in place of the popular song
+    auto cold = cache.get(trackIdOf("b.wav"));
+    EXPECT_NE(cold, nullptr);
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_FALSE(cache.contains(trackIdOf("b.wav")));
+    EXPECT_EQ(cache.getStats().rejections.load(), 1u);
+    EXPECT_EQ(cache.getStats().evictions.load(), 0u);
+}
+
+TEST_F(SongCacheBudgetTest, SongLimitEvictsWithoutAByteBudget) {
+    // Every resident song holds its file open, so their number is bounded
+    // even when memory is not
+    SongCache cache(fileLoader(), 0, 2);
+
+    cache.get(trackIdOf("a.wav"));
+    cache.get(trackIdOf("b.wav"));
+    cache.get(trackIdOf("a.wav"));  // b is now least recently used
+    cache.get(trackIdOf("c.wav"));
+
+    EXPECT_TRUE(cache.contains(trackIdOf("a.wav")));
+    EXPECT_FALSE(cache.contains(trackIdOf("b.wav")));
+    EXPECT_TRUE(cache.contains(trackIdOf("c.wav")));
+    EXPECT_EQ(cache.getStats().residentSongs.load(), 2u);
+    EXPECT_EQ(cache.getStats().evictions.load(), 1u);
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include "song_catalog.h"
+#include <cstring>
+
+class SongCatalogTest : public ::testing::Test {
+protected:
+    // Scan results with the given names and no format details
+    std::vector<SongInfo> songs(const std::vector<std::string>& names) {
+        std::vector<SongInfo> result;
+        for (const auto& name : names) {
+            result.push_back(SongInfo{name, SongFormat(), FileStamp()});
+        }
+        return result;
+    }
+
+    // Decode a LIST_RESPONSE payload back into names
+    std::vector<std::string> parseList(std::string_view payload) {
+        std::vector<std::string> result;
+        uint32_t count;
+        memcpy(&count, payload.data(), 4);
+        size_t offset = 4;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t length;
+            memcpy(&length, payload.data() + offset, 4);
+            result.emplace_back(payload.data() + offset + 4, length);
+            offset += 4 + length;
+        }
+        return result;
+    }
+};
+
+TEST_F(SongCatalogTest, SortsAndDropsDuplicates) {
+    SongCatalog catalog(songs({"c.wav", "a.wav", "b.wav", "a.wav"}));
+
+    ASSERT_EQ(catalog.size(), 3u);
+    EXPECT_EQ(catalog.getName(0), "a.wav");
+    EXPECT_EQ(catalog.getName(1), "b.wav");
+    EXPECT_EQ(catalog.getName(2), "c.wav");
+}
+
+TEST_F(SongCatalogTest, FindsTracksById) {
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back("album_" + std::to_string(i % 10) + "/track_" + std::to_string(i) + ".wav");
+    }
+    SongCatalog catalog(songs(names));
+
+    for (size_t i = 0; i < catalog.size(); ++i) {
+        TrackId trackId = catalog.getTrackId(i);
+        // IDs follow from the path alone, so clients can derive them
+        EXPECT_EQ(trackId, trackIdOf(catalog.getName(i)));
+        EXPECT_NE(trackId, NO_TRACK);
+        EXPECT_EQ(catalog.findTrack(trackId), i);
+    }
+    EXPECT_EQ(catalog.findTrack(trackIdOf("missing.wav")), SongCatalog::NOT_FOUND);
+    EXPECT_EQ(catalog.findTrack(NO_TRACK), SongCatalog::NOT_FOUND);
+
+    // The same song keeps its ID in a rebuilt catalog
+    auto changed = SongCatalog::withChanges(catalog, songs({"album_0/new.wav"}), {names[5]}, {});
+    EXPECT_EQ(changed->findTrack(trackIdOf(names[7])), changed->find(names[7]));
+    EXPECT_EQ(changed->findTrack(trackIdOf(names[5])), SongCatalog::NOT_FOUND);
+}
+
+TEST_F(SongCatalogTest, FindsEveryName) {
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back("track_" + std::to_string(i) + ".wav");
+    }
+    SongCatalog catalog(songs(names));
+
+    for (const auto& name : names) {
+        size_t index = catalog.find(name);
+        ASSERT_NE(index, SongCatalog::NOT_FOUND);
+        EXPECT_EQ(catalog.getName(index), name);
+    }
+    EXPECT_FALSE(catalog.contains("track_1000.wav"));
+    EXPECT_FALSE(catalog.contains("track_1.wa"));
+    EXPECT_FALSE(catalog.contains(""));
+}
+
+TEST_F(SongCatalogTest, KeepsFormatWithName) {
+    std::vector<SongInfo> scanned = songs({"b.wav", "a.wav"});
+    scanned[0].format.sampleRate = 48000;
+    scanned[0].format.channels = 2;
+    scanned[0].format.bitsPerSample = 16;
+    scanned[0].format.dataSize = 48000 * 4 * 3;
+    SongCatalog catalog(scanned);
+
+    SongFormat format = catalog.getFormat(catalog.find("b.wav"));
+    EXPECT_EQ(format.sampleRate, 48000u);
+    EXPECT_DOUBLE_EQ(format.getDurationInSeconds(), 3.0);
+    EXPECT_EQ(catalog.getFormat(catalog.find("a.wav")).sampleRate, 0u);
+}
+
+TEST_F(SongCatalogTest, SerializesSortedList) {
+    SongCatalog catalog(songs({"b.wav", "a.wav"}));
+    EXPECT_EQ(parseList(catalog.getListPayload()), (std::vector<std::string>{"a.wav", "b.wav"}));
+
+    SongCatalog empty(songs({}));
+    EXPECT_EQ(empty.size(), 0u);
+    EXPECT_FALSE(empty.contains("a.wav"));
+    EXPECT_TRUE(parseList(empty.getListPayload()).empty());
+}
+
+TEST_F(SongCatalogTest, AdoptsImageWithoutRebuilding) {
+    SongCatalog catalog(songs({"b.wav", "a.wav", "c.wav"}));
+    std::string_view image = catalog.getImage();
+
+    // A copy of the image at another address works the same
+    std::shared_ptr<char> copy(new char[image.size()], std::default_delete<char[]>());
+    memcpy(copy.get(), image.data(), image.size());
+    auto adopted = SongCatalog::fromImage(copy, image.size());
+    ASSERT_NE(adopted, nullptr);
+    EXPECT_TRUE(adopted->sameSongs(catalog));
+    EXPECT_EQ(adopted->find("c.wav"), 2u);
+    EXPECT_EQ(adopted->getListPayload(), catalog.getListPayload());
+
+    // Cut off before the list payload
+    EXPECT_EQ(SongCatalog::fromImage(copy, image.size() / 2), nullptr);
+}
+
+TEST_F(SongCatalogTest, MergesChangesIntoCopy) {
+    SongCatalog base(songs({"a.wav", "album/one.wav", "album/two.wav", "b.wav", "c.wav"}));
+
+    std::vector<SongInfo> upserts = songs({"bb.wav", "a.wav", "album2/one.wav"});
+    upserts[1].format.sampleRate = 8000;
+    auto merged = SongCatalog::withChanges(base, upserts, {"c.wav", "missing.wav"}, {"album"});
+
+    ASSERT_EQ(merged->size(), 4u);
+    EXPECT_EQ(parseList(merged->getListPayload()),
+              (std::vector<std::string>{"a.wav", "album2/one.wav", "b.wav", "bb.wav"}));
+    EXPECT_EQ(merged->getFormat(merged->find("a.wav")).sampleRate, 8000u);
+    EXPECT_TRUE(merged->contains("bb.wav"));
+    EXPECT_FALSE(merged->contains("album/one.wav"));
+
+    // The base is untouched
+    EXPECT_EQ(base.size(), 5u);
+    EXPECT_TRUE(base.contains("c.wav"));
+}
+
+TEST_F(SongCatalogTest, ListsRemovedAndRewrittenTracks) {
+    SongCatalog base(songs({"a.wav", "b.wav", "c.wav", "d.wav"}));
+
+    std::vector<SongInfo> upserts = songs({"b.wav", "c.wav", "e.wav"});
+    upserts[0].stamp.size = 1234;  // Rewritten; c.wav is unchanged
+    auto next = SongCatalog::withChanges(base, upserts, {"d.wav"}, {});
+
+    EXPECT_EQ(base.changedTracks(*next), (std::vector<TrackId>{trackIdOf("b.wav"), trackIdOf("d.wav")}));
+    EXPECT_TRUE(next->changedTracks(*next).empty());
+}
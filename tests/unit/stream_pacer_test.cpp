@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "stream_pacer.h"
+
+class StreamPacerTest : public ::testing::Test {
+protected:
+    // 44.1 kHz, 16-bit stereo
+    const uint32_t BYTE_RATE = 176400;
+    const uint16_t BLOCK_ALIGN = 4;
+    const size_t MAX_CHUNK = 256 * 1024;
+    StreamPacer::Clock::time_point start = StreamPacer::Clock::now();
+};
+
+TEST_F(StreamPacerTest, DisabledPacerSendsFullChunks) {
+    StreamPacer pacer;
+    EXPECT_FALSE(pacer.enabled());
+    EXPECT_EQ(pacer.nextChunk(0, 10 * MAX_CHUNK, MAX_CHUNK, start), MAX_CHUNK);
+    EXPECT_EQ(pacer.nextChunk(0, 100, MAX_CHUNK, start), 100u);
+}
+
+TEST_F(StreamPacerTest, LeadWindowIsAvailableImmediately) {
+    StreamPacer pacer;
+    pacer.start(BYTE_RATE, BLOCK_ALIGN, 2.0, 1.0, start);
+
+    // Two seconds of lead allows 352800 bytes before any time passes
+    EXPECT_EQ(pacer.allowance(start), 2u * BYTE_RATE);
+    EXPECT_EQ(pacer.nextChunk(0, 10 * MAX_CHUNK, MAX_CHUNK, start), MAX_CHUNK);
+
+    size_t rest = pacer.nextChunk(MAX_CHUNK, 10 * MAX_CHUNK, MAX_CHUNK, start);
+    EXPECT_EQ(rest, 2u * BYTE_RATE - MAX_CHUNK);
+    EXPECT_EQ(rest % BLOCK_ALIGN, 0u);
+
+    // Lead exhausted: nothing more until time passes
+    EXPECT_EQ(pacer.nextChunk(2 * BYTE_RATE, 10 * MAX_CHUNK, MAX_CHUNK, start), 0u);
+}
+
+TEST_F(StreamPacerTest, TopsUpAtByteRate) {
+    StreamPacer pacer;
+    pacer.start(BYTE_RATE, BLOCK_ALIGN, 1.0, 1.0, start);
+
+    size_t sent = BYTE_RATE;
+    auto wakeup = pacer.nextSendTime(sent, 10 * MAX_CHUNK);
+    EXPECT_GT(wakeup, start);
+
+    // At the wakeup time a chunk must be available, and not before
+    EXPECT_GT(pacer.nextChunk(sent, 10 * MAX_CHUNK, MAX_CHUNK, wakeup), 0u);
+    EXPECT_EQ(pacer.nextChunk(sent, 10 * MAX_CHUNK, MAX_CHUNK, wakeup - std::chrono::milliseconds(10)), 0u);
+
+    // After one more second, one more second of audio is allowed
+    auto later = start + std::chrono::seconds(1);
+    EXPECT_NEAR(static_cast<double>(pacer.allowance(later)), 2.0 * BYTE_RATE, 1.0);
+}
+
+TEST_F(StreamPacerTest, SongTailIsNotHeldForAFullQuantum) {
+    StreamPacer pacer;
+    pacer.start(BYTE_RATE, BLOCK_ALIGN, 0.0, 1.0, start);
+
+    // Only 10 bytes left: available as soon as 10 bytes of allowance accrue
+    auto wakeup = pacer.nextSendTime(0, 10);
+    EXPECT_EQ(pacer.nextChunk(0, 10, MAX_CHUNK, wakeup), 10u);
+}
+
+TEST_F(StreamPacerTest, ZeroByteRateDisablesPacing) {
+    StreamPacer pacer;
+    pacer.start(0, BLOCK_ALIGN, 1.0, 1.0, start);
+    EXPECT_FALSE(pacer.enabled());
+}
+
+TEST_F(StreamPacerTest, PauseFreezesAllowance) {
+    StreamPacer pacer;
+    pacer.start(BYTE_RATE, BLOCK_ALIGN, 1.0, 1.0, start);
+
+    // Paused one second in, for ten seconds: the allowance stays at two
+    // seconds of audio, and grows from there once playback resumes
+    pacer.pause(start + std::chrono::seconds(1));
+    EXPECT_NEAR(static_cast<double>(pacer.allowance(start + std::chrono::seconds(5))), 2.0 * BYTE_RATE, 1.0);
+    EXPECT_EQ(pacer.nextSendTime(2 * BYTE_RATE, 10 * MAX_CHUNK), StreamPacer::Clock::time_point::max());
+
+    pacer.resume(start + std::chrono::seconds(11));
+    EXPECT_NEAR(static_cast<double>(pacer.allowance(start + std::chrono::seconds(11))), 2.0 * BYTE_RATE, 1.0);
+    EXPECT_NEAR(static_cast<double>(pacer.allowance(start + std::chrono::seconds(12))), 3.0 * BYTE_RATE, 1.0);
+}